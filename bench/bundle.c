@@ -0,0 +1,127 @@
+/*
+* Compare reading a pack as a loose file with reading it from a compressed bundle.
+* The files come from the page cache here, on a device the bundle also reads fewer bytes.
+*
+* make bench && ./bench/bundle
+*/
+#include "bundle.h"
+#include "readfile.h"
+#include "stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PICTURES 20000
+#define ROUNDS 50
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// pictures of one quad each, laid out as the pack section of a .pi
+static int synthesize(const char *filename) {
+	int i, j, size = PICTURES * 53;
+	char *data = (char *)malloc(size);
+	struct stream os;
+	FILE *f;
+	stream_init(&os, data, size);
+	srand(1);
+	for (i = 0; i < PICTURES; i++) {
+		int x = rand() % 2048, y = rand() % 2048;
+		int w = 16 + rand() % 64, h = 16 + rand() % 64;
+		stream_w16(&os, (int16_t)i);
+		stream_w8(&os, 0);
+		stream_w8(&os, 1);
+		stream_w8(&os, 0);
+		stream_w16(&os, (int16_t)x);
+		stream_w16(&os, (int16_t)y);
+		stream_w16(&os, (int16_t)(x + w));
+		stream_w16(&os, (int16_t)y);
+		stream_w16(&os, (int16_t)(x + w));
+		stream_w16(&os, (int16_t)(y + h));
+		stream_w16(&os, (int16_t)x);
+		stream_w16(&os, (int16_t)(y + h));
+		for (j = 0; j < 8; j++) {
+			int v = (j == 0 || j == 3 || j == 6 || j == 7) ? -w * 8 : w * 8;
+			stream_w32(&os, (j & 1) ? ((j == 1 || j == 3) ? -h * 8 : h * 8) : v);
+		}
+	}
+	size = (int)(os.data - data);
+	f = fopen(filename, "wb");
+	if (!f) {
+		free(data);
+		return 0;
+	}
+	fwrite(data, 1, size, f);
+	fclose(f);
+	free(data);
+	return size;
+}
+
+// the parse the loader does over the pack section
+static int parse(char *data, int size) {
+	int i, sum = 0;
+	struct stream is;
+	stream_init(&is, data, size);
+	for (i = 0; i < PICTURES; i++) {
+		int j;
+		sum += stream_r16(&is);
+		stream_r8(&is);
+		stream_r8(&is);
+		stream_r8(&is);
+		for (j = 0; j < 8; j++) {
+			sum += stream_r16(&is);
+		}
+		for (j = 0; j < 8; j++) {
+			sum += stream_r32(&is);
+		}
+	}
+	return sum;
+}
+
+int main(void) {
+	int r, size, bsize, sum = 0, check = 0;
+	double t, tf, tb;
+	const char *name[] = { "pi" };
+	const char *file[] = { "bench_bundle.pi" };
+	char *data;
+	FILE *f;
+
+	size = synthesize(file[0]);
+	if (!size || !bundle_write("bench_bundle.pz", 1, name, file, BUNDLE_BLOCK)) {
+		printf("write failed\n");
+		return 1;
+	}
+	f = fopen("bench_bundle.pz", "rb");
+	fseek(f, 0, SEEK_END);
+	bsize = (int)ftell(f);
+	fclose(f);
+
+	t = now();
+	for (r = 0; r < ROUNDS; r++) {
+		data = readfile(file[0], &size);
+		sum += parse(data, size);
+		free(data);
+	}
+	tf = now() - t;
+
+	t = now();
+	for (r = 0; r < ROUNDS; r++) {
+		struct bundle *b = bundle_open("bench_bundle.pz");
+		data = bundle_load(b, "pi", &size);
+		check += parse(data, size);
+		free(data);
+		bundle_close(b);
+	}
+	tb = now() - t;
+
+	remove("bench_bundle.pi");
+	remove("bench_bundle.pz");
+	printf("loose  : %8d bytes %8.3f ms/load\n", size, tf * 1000 / ROUNDS);
+	printf("bundle : %8d bytes %8.3f ms/load (%.1f%% of the bytes read)\n", bsize, tb * 1000 / ROUNDS, bsize * 100.0 / size);
+	return sum != check;
+}
@@ -0,0 +1,180 @@
+/*
+* Compare hash.c with the MPQ style table it replaced, at the sizes of the pack storage
+* and of export tables, for names found and names missing.
+*
+* make bench && ./bench/hash
+*/
+#include "hash.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOOKUPS 2000000
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the replaced table: three hashes of the upper cased key, fixed size, a miss scans it all
+static unsigned long Crypt[0x500];
+
+struct old_node {
+	long hasha;
+	long hashb;
+	char exist;
+};
+
+struct old_hash {
+	unsigned long size;
+	struct old_node *node;
+};
+
+static void old_init(void) {
+	unsigned long seed = 0x00100001, idx1, idx2, i;
+	for (idx1 = 0; idx1 < 0x100; idx1++) {
+		for (idx2 = idx1, i = 0; i < 5; i++, idx2 += 0x100) {
+			unsigned long tmp1, tmp2;
+			seed = (seed * 125 + 3) % 0x2AAAAB;
+			tmp1 = (seed & 0xFFFF) << 0x10;
+			seed = (seed * 125 + 3) % 0x2AAAAB;
+			tmp2 = (seed & 0xFFFF);
+			Crypt[idx2] = (tmp1 | tmp2);
+		}
+	}
+}
+
+static unsigned long old_string(const char *key, size_t size, unsigned long type) {
+	unsigned long seed1 = 0x7FED7FED, seed2 = 0xEEEEEEEE;
+	size_t i = 0;
+	while (i < size) {
+		int ch = toupper(key[i++]);
+		seed1 = Crypt[(type << 8) + ch] ^ (seed1 + seed2);
+		seed2 = ch + seed1 + seed2 + (seed2 << 5) + 3;
+	}
+	return seed1;
+}
+
+static struct old_hash *old_new(long size) {
+	long i;
+	struct old_hash *h = malloc(sizeof(*h));
+	h->size = size;
+	h->node = malloc(size * sizeof(struct old_node));
+	for (i = 0; i < size; i++) {
+		h->node[i].hasha = -1;
+		h->node[i].hashb = -1;
+		h->node[i].exist = 0;
+	}
+	return h;
+}
+
+static long old_insert(struct old_hash *h, const char *key, size_t size) {
+	unsigned long hash = old_string(key, size, 0);
+	unsigned long hasha = old_string(key, size, 1);
+	unsigned long hashb = old_string(key, size, 2);
+	unsigned long start = hash % h->size, pos = start;
+	while (h->node[pos].exist == 1) {
+		if (h->node[pos].hasha == (long)hasha && h->node[pos].hashb == (long)hashb) {
+			return -1;
+		}
+		pos = (pos + 1) % h->size;
+		if (pos == start) {
+			return -1;
+		}
+	}
+	h->node[pos].exist = 1;
+	h->node[pos].hasha = hasha;
+	h->node[pos].hashb = hashb;
+	return pos;
+}
+
+static long old_exist(struct old_hash *h, const char *key, size_t size) {
+	unsigned long hash = old_string(key, size, 0);
+	unsigned long hasha = old_string(key, size, 1);
+	unsigned long hashb = old_string(key, size, 2);
+	unsigned long start = hash % h->size, pos = start;
+	do {
+		if (h->node[pos].hasha == (long)hasha && h->node[pos].hashb == (long)hashb) {
+			return pos;
+		}
+		pos = (pos + 1) % h->size;
+	} while (pos != start);
+	return -1;
+}
+
+static void old_free(struct old_hash *h) {
+	free(h->node);
+	free(h);
+}
+
+// names like the exports of a pack
+static char (*names(int n, const char *fmt))[32] {
+	int i;
+	char (*name)[32] = malloc(n * sizeof(*name));
+	for (i = 0; i < n; i++) {
+		sprintf(name[i], fmt, i * 7919 % 100003, i);
+	}
+	return name;
+}
+
+static void run(int n) {
+	int i, found = 0, lost = 0;
+	double t, t_old_hit, t_old_miss, t_hit, t_miss;
+	char (*key)[32] = names(n, "ui/button_%d_%d");
+	char (*miss)[32] = names(n, "ui/missing_%d_%d");
+	int *len = malloc(n * sizeof(int));
+	struct old_hash *old = old_new(n);
+	struct hash *h = hash_new(n);
+	for (i = 0; i < n; i++) {
+		len[i] = (int)strlen(key[i]);
+		old_insert(old, key[i], len[i]);
+		hash_insert(h, key[i], len[i], key[i]);
+	}
+
+	t = now();
+	for (i = 0; i < LOOKUPS; i++) {
+		found += old_exist(old, key[i % n], len[i % n]) != -1;
+	}
+	t_old_hit = now() - t;
+	t = now();
+	for (i = 0; i < LOOKUPS / 16; i++) {
+		lost += old_exist(old, miss[i % n], strlen(miss[i % n])) == -1;
+	}
+	t_old_miss = (now() - t) * 16;
+	t = now();
+	for (i = 0; i < LOOKUPS; i++) {
+		found += hash_find(h, key[i % n], len[i % n]) != 0;
+	}
+	t_hit = now() - t;
+	t = now();
+	for (i = 0; i < LOOKUPS; i++) {
+		lost += hash_find(h, miss[i % n], (int)strlen(miss[i % n])) == 0;
+	}
+	t_miss = now() - t;
+
+	printf("%6d keys  hit %7.1f -> %5.1f ns  miss %8.1f -> %5.1f ns\n", n,
+		t_old_hit * 1e9 / LOOKUPS, t_hit * 1e9 / LOOKUPS,
+		t_old_miss * 1e9 / LOOKUPS, t_miss * 1e9 / LOOKUPS);
+	if (found != LOOKUPS * 2 || lost != LOOKUPS + LOOKUPS / 16) {
+		printf("wrong results %d %d\n", found, lost);
+	}
+	old_free(old);
+	hash_free(h);
+	free(len);
+	free(miss);
+	free(key);
+}
+
+int main(void) {
+	old_init();
+	// the storage holds tens of packs, a pack exports tens to thousands of names
+	run(16);
+	run(64);
+	run(500);
+	run(5000);
+	return 0;
+}
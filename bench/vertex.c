@@ -0,0 +1,110 @@
+/*
+* Compare vertex_transform with the scalar per-corner loop it replaced.
+*
+* make bench && ./bench/vertex
+*/
+#include "vertex.h"
+#include "matrix.h"
+#include "renderbuffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define QUADS 4096
+#define ROUNDS 2000
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#if defined(__GNUC__)
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+static float invw = 2.0f / 16 / 1024;
+static float invh = -2.0f / 16 / 768;
+
+// screen_trans lives in another translation unit in the engine
+NOINLINE static void screen_trans(float *x, float *y) {
+	*x *= invw;
+	*y *= invh;
+}
+
+// the loop of sprite_drawquad before vertex_transform
+NOINLINE static void scalar_quad(const int *m, const int32_t *coord, const uint16_t *texcoord, struct vertex *out) {
+	int j;
+	for (j = 0; j < 4; j++) {
+		int xx = coord[j * 2 + 0];
+		int yy = coord[j * 2 + 1];
+		float vx = (xx * m[0] + yy * m[2]) / 1024.0f + m[4];
+		float vy = (xx * m[1] + yy * m[3]) / 1024.0f + m[5];
+		screen_trans(&vx, &vy);
+		out[j].vp.vx = vx;
+		out[j].vp.vy = vy;
+		out[j].vp.tx = texcoord[j * 2 + 0];
+		out[j].vp.ty = texcoord[j * 2 + 1];
+	}
+}
+
+int main(void) {
+	int i, r;
+	double t, ts, tv;
+	float f[6], err = 0;
+	struct matrix mat = { { 1000, 120, -120, 1000, 3200, 4800 } };
+	int32_t *coord = (int32_t *)malloc(QUADS * 8 * sizeof(int32_t));
+	uint16_t *texcoord = (uint16_t *)malloc(QUADS * 8 * sizeof(uint16_t));
+	struct vertex *a = (struct vertex *)malloc(QUADS * 4 * sizeof(struct vertex));
+	struct vertex *b = (struct vertex *)malloc(QUADS * 4 * sizeof(struct vertex));
+
+	srand(1);
+	for (i = 0; i < QUADS * 8; i++) {
+		coord[i] = rand() % 16384 - 8192;
+		texcoord[i] = (uint16_t)rand();
+	}
+
+	t = now();
+	for (r = 0; r < ROUNDS; r++) {
+		mat.m[4] = r;
+		for (i = 0; i < QUADS; i++) {
+			scalar_quad(mat.m, coord + i * 8, texcoord + i * 8, a + i * 4);
+		}
+	}
+	ts = now() - t;
+
+	t = now();
+	for (r = 0; r < ROUNDS; r++) {
+		mat.m[4] = r;
+		vertex_matrix(&mat, invw, invh, f);
+		for (i = 0; i < QUADS; i++) {
+			vertex_transform(f, 4, coord + i * 8, texcoord + i * 8, &b[i * 4].vp, sizeof(struct vertex));
+		}
+	}
+	tv = now() - t;
+
+	for (i = 0; i < QUADS * 4; i++) {
+		float dx = a[i].vp.vx - b[i].vp.vx;
+		float dy = a[i].vp.vy - b[i].vp.vy;
+		if (dx < 0) dx = -dx;
+		if (dy < 0) dy = -dy;
+		if (dx > err) err = dx;
+		if (dy > err) err = dy;
+		if (a[i].vp.tx != b[i].vp.tx || a[i].vp.ty != b[i].vp.ty) {
+			printf("texcoord mismatch at %d\n", i);
+			return 1;
+		}
+	}
+	printf("%d quads x %d rounds\n", QUADS, ROUNDS);
+	printf("scalar : %.3f ms/round\n", ts * 1000 / ROUNDS);
+	printf("vertex : %.3f ms/round (%.2fx)\n", tv * 1000 / ROUNDS, ts / tv);
+	printf("max error : %g\n", err);
+	free(coord);
+	free(texcoord);
+	free(a);
+	free(b);
+	return 0;
+}
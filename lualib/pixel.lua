@@ -28,14 +28,21 @@ pixel.shader = shader.new
 pixel.label = sprite.label
 pixel.panel = sprite.panel
 
+-- a sprite keeps the package it is made from alive, so an unloaded pack lives until its last sprite
+local packageof = setmetatable({}, { __mode = "k" })
+
 function pixel.sprite(packname, name)
-	local p, id = spritepack.query(packname, name)
+	local p, id, package = spritepack.query(packname, name)
 	if not p then
 		error(string.format("'%s' not found", packname))
 	end
-	return sprite.new(p, id)
+	local s = sprite.new(p, id)
+	packageof[s] = package
+	return s
 end
 
+pixel.unload = spritepack.unload
+
 function pixel.start(cb)
 	fw.PIXEL_FRAME = assert(cb.drawframe)
 	fw.PIXEL_ERROR = assert(cb.handle_error)
@@ -9,31 +9,6 @@ local method = c.method
 local get = c.get
 local set = c.set
 
-local method_test = method.test
-function method:test( ... )
-	local s = method_test(self, ...)
-	if s then
-		return debug.setmetatable(s, sprite_meta)
-	end
-end
-
-local method_fetch = method.fetch
-function method:fetch(val)
-	local s = method_fetch(self, val)
-	if s then
-		return debug.setmetatable(s, sprite_meta)
-	end
-end
-
-local get_parent = get.parent
-function get:parent()
-	local p = get_parent(self)
-	if p and not getmetatable(p) then
-		return debug.setmetatable(p, sprite_meta)
-	end
-	return p
-end
-
 local get_material = get.material
 function get:material()
 	local m = get_material(self)
@@ -49,6 +24,39 @@ function get:material()
 	return m
 end
 
+local layer_id = {}
+local layer_n = 0
+
+local method_submit = method.submit
+function method:submit(layer, srt)
+	method_submit(self, layer_id[layer] or layer, srt)
+end
+
+local finish_cb = setmetatable({}, { __mode = "k" })
+
+local method_play = method.play
+function method:play(action, rate, mode, cb)
+	local total = method_play(self, action, rate, mode)
+	finish_cb[self] = total and cb
+	return total
+end
+
+local method_stop = method.stop
+function method:stop()
+	finish_cb[self] = nil
+	method_stop(self)
+end
+
+c.finish(function(list)
+	for _, s in ipairs(list) do
+		local cb = finish_cb[s]
+		if cb then
+			finish_cb[s] = nil
+			cb(s)
+		end
+	end
+end)
+
 local set_text = set.text
 function set:text(text)
 	if not text or text == "" then
@@ -60,30 +68,10 @@ function set:text(text)
 	end
 end
 
-function sprite_meta.__index(spr, key)
-	local m = method[key]
-	if m then
-		return m
-	end
-	local g = get[key]
-	if g then
-		return g(spr)
-	end
-	local c = method.fetch(spr, key)
-	if c then
-		return c
-	end
-	print("unsupport get "..key)
-	return nil
-end
-
-function sprite_meta.__newindex(spr, key, val)
-	local s = set[key]
-	if s then
-		return s(spr, val)
-	end
-	method.mount(spr, key, val)
-end
+-- dispatch in C: method, then get, then child by name; spr:child(name) skips the first two
+sprite_meta.__index = c.index
+sprite_meta.__newindex = c.newindex
+sprite_meta.__gc = c.gc
 
 function sprite.new(pack, id)
 	return debug.setmetatable(c.new(pack, id), sprite_meta)
@@ -112,6 +100,45 @@ function sprite.label(tb)
 	end
 end
 
+-- layers are drawn in the order they are declared when the frame is flushed,
+-- policy "strict" keeps the submit order, "sorted" batches by program and texture.
+-- at most c.layer_max (16) names may be declared
+function sprite.layer(name, policy)
+	local id = layer_id[name]
+	if not id then
+		if layer_n >= c.layer_max then
+			error(string.format("too many layers declaring %s, %d at most", tostring(name), c.layer_max), 2)
+		end
+		id = layer_n
+		layer_n = layer_n + 1
+		layer_id[name] = id
+	end
+	c.layer(id, policy)
+	return id
+end
+
+function sprite.culled()
+	return c.culled()
+end
+
+function sprite.geometry_cache(enable)
+	c.geometry_cache(enable)
+end
+
+-- bytes of render targets used by sprites with spr.bitmap = true
+function sprite.bitmap_budget(bytes)
+	c.bitmap_budget(bytes)
+end
+
+-- srt: x, y, scale, rot per sprite, as a flat number array or a string of packed floats
+function sprite.draw_list(list, srt)
+	c.draw_list(list, srt)
+end
+
+function sprite.draw_parallel(list, srt)
+	c.draw_parallel(list, srt)
+end
+
 function sprite.proxy()
 	local s = c.proxy()
 	return debug.setmetatable(s, sprite_meta)
@@ -5,8 +5,36 @@ local spritepack = {}
 local pattern
 local raw
 local textures = {}
+local free_textures = {}
 local packages = {}
 
+-- texture ids of unloaded packs are reused, textures[id+1] is false while an id is free
+local function texture_id(texfile)
+	local id = table.remove(free_textures)
+	if id then
+		textures[id+1] = texfile
+	else
+		id = #textures
+		table.insert(textures, texfile)
+	end
+	return id
+end
+
+-- a package frees its textures when it is collected, its memory is held by the storage
+-- until spritepack.unload and the last sprite made from it
+local package_meta = {}
+function package_meta.__gc(p)
+	for _, tex in ipairs(p.texture) do
+		texture.unload(tex)
+		textures[tex+1] = false
+		table.insert(free_textures, tex)
+	end
+end
+
+local function package(p)
+	return setmetatable(p, package_meta)
+end
+
 local TYPE_PICTURE = assert(c.TYPE_PICTURE)
 local TYPE_ANIMATION = assert(c.TYPE_ANIMATION)
 local TYPE_POLYGON = assert(c.TYPE_POLYGON)
@@ -264,27 +292,76 @@ local function filepath(filename)
 	return string.gsub(pattern, "([^?]*)?([^?]*)", "%1"..filename.."%2")
 end
 
+local function load_textures(file, n)
+	local tex = {}
+	for i=1, n do
+		local texfile = file.."."..i..".png"
+		tex[i] = texture_id(texfile)
+		texture.load(tex[i], texfile)
+	end
+	return tex
+end
+
+local function load_image(packname, file)
+	local img, texture_n = c.map(file..".pm")
+	if not img then
+		return
+	end
+	local p = { texture = load_textures(file, texture_n) }
+	p.pack, p.export, p.size = c.relocate(img, p.texture, file)
+	if p.pack then
+		p.name = file
+	end
+	p = package(p)
+	if not p.pack then
+		return
+	end
+	packages[packname] = p
+	return p
+end
+
+-- the pack and its textures from one compressed bundle, <file>.pz
+local function load_bundle(packname, file)
+	local b, texture_n = c.open_bundle(file..".pz")
+	if not b then
+		return
+	end
+	local tex = {}
+	for i=1, texture_n do
+		tex[i] = texture_id(file.."."..i..".png")
+	end
+	local p = { texture = tex }
+	p.pack, p.export, p.size = c.load_bundle(b, tex, file)
+	if p.pack then
+		p.name = file
+	end
+	p = package(p)
+	if not p.pack then
+		return
+	end
+	packages[packname] = p
+	return p
+end
+
+-- the sprites of the pack are imported the first time a sprite is made of them
 local function load(packname)
-	local meta
-	local p = {}
+	local data
 	local file = filepath(packname)
+	local bundle = load_bundle(packname, file) or load_image(packname, file)
+	if bundle then
+		return bundle
+	end
 	if raw then
-		local data = io.open(file..".pi", "rb"):read("*a")
-		meta = spritepack.import(data)
+		data = io.open(file..".pi", "rb"):read("*a")
 	else
-		local data = dofile(file..".lua")
-		meta = spritepack.pack(data)
+		data = spritepack.export(spritepack.pack(dofile(file..".lua")))
 	end
-	local tex = {}
-	for i=1, meta.texture do
-		local texfile = file.."."..i..".png"
-		tex[i] = #textures
-		table.insert(textures, texfile)
-		texture.load(tex[i], texfile)
+	local p = package { texture = load_textures(file, (c.import(data, 5, 'w'))) }
+	p.pack, p.export, p.size = c.load(data, p.texture, file)
+	if not p.pack then
+		error("Can't load pack " .. packname)
 	end
-	p.pack = c.new(tex, meta.maxid, meta.size, meta.data, meta.data_size)
-	p.export = meta.export
-	meta.data = nil
+	p.name = file
 	packages[packname] = p
 	return p
 end
@@ -320,6 +397,7 @@ function spritepack.import(data)
 		meta.export[name] = id
 	end
 	meta.data = c.import(data, off, 'p')
+	meta.section_size = math.max(0, #data - (off - 1) - meta.data_size)
 	return meta
 end
 
@@ -332,6 +410,185 @@ function spritepack.load(t)
 	end
 end
 
+-- load packname from data, a string or userdata holding a .pz bundle, or a .pm image or .pi whose
+-- textures are the encoded images in the list images, or the files of packname without it.
+-- with adopt a userdata holding a .pm becomes the memory of the pack instead of being copied
+function spritepack.load_memory(packname, data, images, adopt)
+	if packages[packname] then
+		return packages[packname]
+	end
+	local file = filepath(packname)
+	local n, bundle = c.memory_textures(data)
+	if not n then
+		error("Can't load pack " .. packname)
+	end
+	local tex = {}
+	for i=1, n do
+		local texfile = file.."."..i..".png"
+		tex[i] = texture_id(texfile)
+		if images then
+			texture.load_memory(tex[i], images[i])
+		elseif not bundle then
+			texture.load(tex[i], texfile)
+		end
+	end
+	local p = { texture = tex, memory = adopt and data or nil }
+	p.pack, p.export, p.size = c.load_memory(file, data, tex, adopt)
+	if p.pack then
+		p.name = file
+	end
+	p = package(p)
+	if not p.pack then
+		error("Can't load pack " .. packname)
+	end
+	packages[packname] = p
+	return p
+end
+
+-- the callbacks waiting for each packname loading in the background
+local loading = {}
+
+-- read and decode packname in the background and upload its textures a few per frame,
+-- callback(packname, ok) is called from the update loop when it is loaded. a packname loading
+-- already is not loaded twice, the callback waits for that load
+function spritepack.load_async(packname, callback)
+	local file = filepath(packname)
+	if loading[packname] then
+		table.insert(loading[packname], callback)
+		return
+	end
+	if packages[packname] or not raw then
+		-- loaded already, or a lua source that has to be run here
+		local ok = packages[packname] or load(packname)
+		callback(packname, ok ~= nil)
+		return
+	end
+	local function reserve(n)
+		local tex = {}
+		for i=1, n do
+			tex[i] = texture_id(file.."."..i..".png")
+		end
+		return tex
+	end
+	local waiting = { callback }
+	local posted = c.load_async(file, reserve, function(pack, export, size, tex)
+		loading[packname] = nil
+		if pack then
+			packages[packname] = package { pack = pack, export = export, size = size, texture = tex, name = file }
+		else
+			-- the textures reserved for a pack that failed go with the next collect
+			package { texture = tex }
+		end
+		-- a load of packname done meanwhile, by spritepack.load, is as good
+		local ok = packages[packname] ~= nil
+		for _, cb in ipairs(waiting) do
+			cb(packname, ok)
+		end
+	end)
+	if posted then
+		loading[packname] = waiting
+	else
+		-- the storage has the pack under its file from another package
+		callback(packname, false)
+	end
+end
+
+-- load the packs of packnames with their pictures copied into atlases size pixels wide (2048 by
+-- default) they share, sprites of these packs draw without switching textures. the atlases are
+-- unloaded with the last of the packs, which can not be saved
+function spritepack.load_atlas(packnames, size)
+	if not raw then
+		error "load_atlas needs raw packs"
+	end
+	local names, files = {}, {}
+	for _, packname in ipairs(packnames) do
+		if not packages[packname] then
+			table.insert(names, packname)
+			table.insert(files, filepath(packname))
+		end
+	end
+	if #names == 0 then
+		return
+	end
+	local tex = {}
+	local function reserve(n)
+		for i=1, n do
+			tex[i] = texture_id(files[1]..".atlas."..i)
+		end
+		return tex
+	end
+	local result = c.load_atlas(files, size or 2048, reserve)
+	local atlas = package { texture = tex }
+	for i, packname in ipairs(names) do
+		local r = result[i]
+		if r then
+			packages[packname] = package { pack = r[1], export = r[2], size = r[3], texture = {}, name = files[i], atlas = atlas }
+		end
+	end
+end
+
+-- load the packs of t like spritepack.load, the loose raw packs all at once with their parsing and
+-- texture decoding spread over the worker threads, and the uploads in order. returns the seconds
+-- taken in total and for each packname { parse, decode, upload }, or { load } for the packs of a
+-- bundle, an image or a lua source, which are loaded one by one
+function spritepack.load_batch(t)
+	pattern = t.pattern
+	raw = t.raw
+	local start = c.clock()
+	local report = { packs = {} }
+	local names, files = {}, {}
+	for _, packname in ipairs(t) do
+		local file = filepath(packname)
+		local single = not raw or io.open(file..".pz", "rb") or io.open(file..".pm", "rb")
+		if single then
+			if type(single) ~= "boolean" then
+				single:close()
+			end
+			if not packages[packname] then
+				local s = c.clock()
+				load(packname)
+				report.packs[packname] = { load = c.clock() - s }
+			end
+		elseif not packages[packname] then
+			table.insert(names, packname)
+			table.insert(files, file)
+		end
+	end
+	if #names > 0 then
+		local reserved = {}
+		local function reserve(n, index)
+			local tex = {}
+			for i=1, n do
+				tex[i] = texture_id(files[index].."."..i..".png")
+			end
+			reserved[index] = tex
+			return tex
+		end
+		local _, result = c.load_batch(files, reserve)
+		local failed
+		for i, packname in ipairs(names) do
+			local r = result[i]
+			if r then
+				packages[packname] = package { pack = r[1], export = r[2], size = r[3], texture = r[4], name = files[i] }
+				report.packs[packname] = { parse = r.parse, decode = r.decode, upload = r.upload }
+			else
+				-- the textures reserved for a pack that failed go with the next collect
+				package { texture = reserved[i] or {} }
+				failed = failed or packname
+			end
+		end
+		if failed then
+			error("Can't load pack " .. failed)
+		end
+	end
+	collectgarbage "collect"
+	report.total = c.clock() - start
+	return report
+end
+
+-- milliseconds of texture upload per frame for load_async, returns the previous value
+spritepack.async_budget = c.async_budget
+
 function spritepack.query(packname, name)
 	local p = packages[packname]
 	if not p then
@@ -341,12 +598,37 @@ function spritepack.query(packname, name)
 	if type(name) == "string" then
 		id = p.export[name]
 	end
-	return p.pack, id
+	return p.pack, id, p
+end
+
+-- forget packname, it can be loaded again at once. its textures and memory go with the last
+-- sprite made from it
+function spritepack.unload(packname)
+	local p = packages[packname]
+	packages[packname] = nil
+	if p and p.name then
+		c.unload(p.name)
+		p.name = nil
+	end
+end
+
+-- write a loaded pack as an image, the next load of packname maps it instead of importing
+function spritepack.save(packname, filename)
+	local p = packages[packname]
+	if not p then
+		p = load(packname)
+	end
+	return c.save(filename or filepath(packname)..".pm", p.pack, p.size, p.texture, p.export)
+end
+
+-- pack the files of packname into <file>.pz, save an image first to have it in the bundle
+function spritepack.bundle(packname, filename)
+	local file = filepath(packname)
+	return c.bundle(filename or file..".pz", file)
 end
 
 function spritepack.texture(texfile, reduce)
-	local tex = #textures
-	table.insert(textures, texfile)
+	local tex = texture_id(texfile)
 	texture.load(tex, texfile, reduce)
 	return tex
 end
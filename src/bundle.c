@@ -0,0 +1,276 @@
+#include "bundle.h"
+#include "readfile.h"
+
+#define LZB_IMPLEMENTATION
+#include "lzb.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUNDLE_MAGIC 0x5a505850
+#define BUNDLE_VERSION 1
+#define BUNDLE_NAME 32
+
+/*
+ * header, entries, blocks, then the block data. an entry is split in blocks of
+ * block_size bytes (the last one shorter), each compressed on its own, or stored
+ * when that does not make it smaller (size equals the uncompressed size).
+ */
+struct bundle_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t entry_n;
+	uint32_t block_size;
+	uint32_t block_n;
+};
+
+struct bundle_entry {
+	char name[BUNDLE_NAME];
+	uint32_t size;
+	uint32_t first;
+	uint32_t n;
+};
+
+struct bundle_block {
+	uint32_t offset;
+	uint32_t size;
+};
+
+struct bundle {
+	FILE *f;
+	// a bundle in memory instead of f, own when it is freed with the bundle
+	const char *mem;
+	uint32_t mem_size;
+	char *own;
+	struct bundle_header h;
+	struct bundle_entry *entry;
+	struct bundle_block *block;
+	char *scratch;
+};
+
+struct bundle *bundle_open(const char *filename) {
+	struct bundle *b;
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		return 0;
+	}
+	b = (struct bundle *)malloc(sizeof(*b));
+	memset(b, 0, sizeof(*b));
+	b->f = f;
+	if (fread(&b->h, sizeof(b->h), 1, f) != 1 || b->h.magic != BUNDLE_MAGIC || b->h.version != BUNDLE_VERSION || b->h.block_size == 0) {
+		bundle_close(b);
+		return 0;
+	}
+	b->entry = (struct bundle_entry *)malloc((b->h.entry_n + 1) * sizeof(struct bundle_entry));
+	b->block = (struct bundle_block *)malloc((b->h.block_n + 1) * sizeof(struct bundle_block));
+	if (fread(b->entry, sizeof(struct bundle_entry), b->h.entry_n, f) != b->h.entry_n
+		|| fread(b->block, sizeof(struct bundle_block), b->h.block_n, f) != b->h.block_n) {
+		bundle_close(b);
+		return 0;
+	}
+	return b;
+}
+
+// the size bytes of a bundle in memory at offset
+static int bundle_copy(struct bundle *b, void *dst, uint32_t offset, uint32_t size) {
+	if (offset > b->mem_size || size > b->mem_size - offset) {
+		return 0;
+	}
+	memcpy(dst, b->mem + offset, size);
+	return 1;
+}
+
+struct bundle *bundle_open_memory(char *data, int size, int adopt) {
+	uint32_t off;
+	struct bundle *b = (struct bundle *)malloc(sizeof(*b));
+	memset(b, 0, sizeof(*b));
+	b->mem = data;
+	b->mem_size = size < 0 ? 0 : (uint32_t)size;
+	if (!bundle_copy(b, &b->h, 0, sizeof(b->h)) || b->h.magic != BUNDLE_MAGIC || b->h.version != BUNDLE_VERSION || b->h.block_size == 0
+		|| (uint64_t)b->h.block_n * sizeof(struct bundle_block) > b->mem_size) {
+		free(b);
+		return 0;
+	}
+	b->entry = (struct bundle_entry *)malloc((b->h.entry_n + 1) * sizeof(struct bundle_entry));
+	b->block = (struct bundle_block *)malloc((b->h.block_n + 1) * sizeof(struct bundle_block));
+	off = sizeof(b->h) + b->h.entry_n * sizeof(struct bundle_entry);
+	if (!bundle_copy(b, b->entry, sizeof(b->h), b->h.entry_n * sizeof(struct bundle_entry))
+		|| !bundle_copy(b, b->block, off, b->h.block_n * sizeof(struct bundle_block))) {
+		bundle_close(b);
+		return 0;
+	}
+	if (adopt) {
+		b->own = data;
+	}
+	return b;
+}
+
+void bundle_close(struct bundle *b) {
+	if (b->f) {
+		fclose(b->f);
+	}
+	free(b->own);
+	free(b->entry);
+	free(b->block);
+	free(b->scratch);
+	free(b);
+}
+
+static struct bundle_entry *bundle_find(struct bundle *b, const char *name) {
+	int i;
+	for (i = 0; i < b->h.entry_n; i++) {
+		if (strncmp(b->entry[i].name, name, BUNDLE_NAME) == 0) {
+			return &b->entry[i];
+		}
+	}
+	return 0;
+}
+
+int bundle_size(struct bundle *b, const char *name) {
+	struct bundle_entry *e = bundle_find(b, name);
+	return e ? (int)e->size : -1;
+}
+
+int bundle_read(struct bundle *b, const char *name, char *dst) {
+	uint32_t i, left;
+	struct bundle_entry *e = bundle_find(b, name);
+	if (!e || e->first + e->n > b->h.block_n) {
+		return 0;
+	}
+	if (!b->scratch && !b->mem) {
+		b->scratch = (char *)malloc(lzb_bound(b->h.block_size));
+	}
+	left = e->size;
+	for (i = 0; i < e->n; i++) {
+		struct bundle_block *k = &b->block[e->first + i];
+		uint32_t size = left < b->h.block_size ? left : b->h.block_size;
+		if (k->size > (uint32_t)lzb_bound(b->h.block_size)) {
+			return 0;
+		}
+		if (b->mem) {
+			// a compressed block is decoded straight from the memory of the bundle
+			if (k->offset > b->mem_size || k->size > b->mem_size - k->offset) {
+				return 0;
+			}
+			if (k->size == size) {
+				memcpy(dst, b->mem + k->offset, size);
+			} else if (lzb_decompress(b->mem + k->offset, k->size, dst, size) != (int)size) {
+				return 0;
+			}
+		} else if (fseek(b->f, k->offset, SEEK_SET) != 0) {
+			return 0;
+		} else if (k->size == size) {
+			if (fread(dst, 1, size, b->f) != size) {
+				return 0;
+			}
+		} else if (fread(b->scratch, 1, k->size, b->f) != k->size
+			|| lzb_decompress(b->scratch, k->size, dst, size) != (int)size) {
+			return 0;
+		}
+		dst += size;
+		left -= size;
+	}
+	return left == 0;
+}
+
+char *bundle_load(struct bundle *b, const char *name, int *psize) {
+	char *data;
+	int size = bundle_size(b, name);
+	if (size < 0) {
+		return 0;
+	}
+	data = (char *)malloc(size + 1);
+	if (!bundle_read(b, name, data)) {
+		free(data);
+		return 0;
+	}
+	if (psize) {
+		*psize = size;
+	}
+	return data;
+}
+
+int bundle_write(const char *filename, int n, const char *name[], const char *file[], int block_size) {
+	struct bundle_header h;
+	struct bundle_entry *entry;
+	struct bundle_block *block = 0;
+	char *out = 0;
+	int out_size = 0, out_cap = 0;
+	int block_cap = 0;
+	char *tmp = (char *)malloc(lzb_bound(block_size));
+	int i, ok = 1;
+	uint32_t offset;
+	FILE *f;
+
+	memset(&h, 0, sizeof(h));
+	h.magic = BUNDLE_MAGIC;
+	h.version = BUNDLE_VERSION;
+	h.entry_n = (uint16_t)n;
+	h.block_size = block_size;
+	entry = (struct bundle_entry *)malloc((n + 1) * sizeof(struct bundle_entry));
+	memset(entry, 0, (n + 1) * sizeof(struct bundle_entry));
+	for (i = 0; i < n && ok; i++) {
+		int size, pos;
+		char *data = readfile(file[i], &size);
+		if (!data || strlen(name[i]) >= BUNDLE_NAME) {
+			free(data);
+			ok = 0;
+			break;
+		}
+		strcpy(entry[i].name, name[i]);
+		entry[i].size = size;
+		entry[i].first = h.block_n;
+		for (pos = 0; pos < size || (size == 0 && pos == 0); pos += block_size) {
+			int raw = size - pos < block_size ? size - pos : block_size;
+			int csize = lzb_compress(data + pos, raw, tmp, lzb_bound(block_size));
+			const char *src = tmp;
+			if (csize == 0 || csize >= raw) {
+				csize = raw;
+				src = data + pos;
+			}
+			if (h.block_n >= (uint32_t)block_cap) {
+				block_cap = block_cap ? block_cap * 2 : 64;
+				block = (struct bundle_block *)realloc(block, block_cap * sizeof(struct bundle_block));
+			}
+			if (out_size + csize > out_cap) {
+				while (out_size + csize > out_cap) {
+					out_cap = out_cap ? out_cap * 2 : 64 * 1024;
+				}
+				out = (char *)realloc(out, out_cap);
+			}
+			block[h.block_n].offset = out_size;
+			block[h.block_n].size = csize;
+			memcpy(out + out_size, src, csize);
+			out_size += csize;
+			h.block_n++;
+			entry[i].n++;
+			if (size == 0) {
+				break;
+			}
+		}
+		free(data);
+	}
+	if (ok) {
+		// block offsets are relative to the data until the index size is known
+		offset = sizeof(h) + n * sizeof(struct bundle_entry) + h.block_n * sizeof(struct bundle_block);
+		for (i = 0; i < (int)h.block_n; i++) {
+			block[i].offset += offset;
+		}
+		f = fopen(filename, "wb");
+		ok = f != 0;
+		if (f) {
+			ok = fwrite(&h, sizeof(h), 1, f) == 1
+				&& fwrite(entry, sizeof(struct bundle_entry), n, f) == (size_t)n
+				&& fwrite(block, sizeof(struct bundle_block), h.block_n, f) == h.block_n
+				&& fwrite(out, 1, out_size, f) == (size_t)out_size;
+			ok = fclose(f) == 0 && ok;
+		}
+	}
+	free(tmp);
+	free(out);
+	free(block);
+	free(entry);
+	return ok;
+}
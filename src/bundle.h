@@ -0,0 +1,29 @@
+#ifndef _BUNDLE_H_
+#define _BUNDLE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BUNDLE_BLOCK (64 * 1024)
+
+	struct bundle;
+	//read the header and block index of a bundle, the data is read by bundle_read
+	struct bundle *bundle_open(const char *filename);
+	//a bundle over the size bytes of data, which stay the caller's unless adopt gives bundle_close a malloc block
+	//to free. 0 if data is not a bundle, it is the caller's then
+	struct bundle *bundle_open_memory(char *data, int size, int adopt);
+	void bundle_close(struct bundle *b);
+	//uncompressed size of entry name, -1 if there is none
+	int bundle_size(struct bundle *b, const char *name);
+	//decompress entry name into dst of bundle_size bytes block by block, 0 if it fails
+	int bundle_read(struct bundle *b, const char *name, char *dst);
+	//bundle_read into a malloc block
+	char *bundle_load(struct bundle *b, const char *name, int *psize);
+	//write the n files as entries of the given names, compressed in blocks of block_size bytes
+	int bundle_write(const char *filename, int n, const char *name[], const char *file[], int block_size);
+
+#ifdef __cplusplus
+};
+#endif
+#endif // _BUNDLE_H_
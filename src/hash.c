@@ -1,122 +1,182 @@
-#include <ctype.h>
-#include <stdio.h>
+#include "hash.h"
+
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+/*
+ * open addressing with linear probing over a power of two of slots. a slot keeps the
+ * hash and a copy of its key, a probe compares the hash then the whole key. a removed
+ * key leaves a tombstone so the probes past it go on, tombstones are dropped when the
+ * table is rebuilt, which it is before live keys and tombstones fill 3/4 of it.
+ */
+#define HASH_MIN 8
 
-static unsigned long _crypt_table[0x500];
-static char _ctypt_init = 0;
-static const unsigned long HASH_OFF = 0, HASH_A = 1, HASH_B = 2;
+static char Tombstone[1];
 
-#pragma pack(1)
 struct hash_node {
-	long hasha;
-	long hashb;
-	char exist;
+	// 0 for a free slot, Tombstone for a removed key
+	char *key;
+	int size;
+	uint32_t hash;
+	void *value;
 };
-#pragma pack()
 
 struct hash {
-	unsigned long size;
+	int cap;
+	int count;
+	int used;
 	struct hash_node *node;
 };
 
-static void _crypt_table_init(void) {
-	unsigned long seed = 0x00100001, idx1 = 0, idx2 = 0, i;
-	for (idx1 = 0; idx1 < 0x100; idx1++) {
-		for (idx2 = idx1, i = 0; i < 5; i++, idx2 += 0x100) {
-			unsigned long tmp1, tmp2;
-			seed = (seed * 125 + 3) % 0x2AAAAB;
-			tmp1 = (seed & 0xFFFF) << 0x10;
-			seed = (seed * 125 + 3) % 0x2AAAAB;
-			tmp2 = (seed & 0xFFFF);
-			_crypt_table[idx2] = (tmp1 | tmp2);
-		}
+// FNV-1a
+static uint32_t _hash_string(const char *key, int size) {
+	uint32_t h = 2166136261u;
+	int i;
+	for (i = 0; i < size; i++) {
+		h ^= (uint8_t)key[i];
+		h *= 16777619u;
 	}
+	return h;
 }
 
-static unsigned long _hash_string(const char *key, size_t size, unsigned long type) {
-	unsigned long seed1 = 0x7FED7FED, seed2 = 0xEEEEEEEE;
-	size_t i = 0;
-	while (i < size) {
-		int ch = toupper(*(key + i++));
-		seed1 = _crypt_table[(type << 8) + ch] ^ (seed1 + seed2);
-		seed2 = ch + seed1 + seed2 + (seed2 << 5) + 3;
+static int _hash_cap(int n) {
+	int cap = HASH_MIN;
+	while (cap * 3 < n * 4) {
+		cap *= 2;
 	}
-	return seed1;
+	return cap;
 }
 
-struct hash *hash_new(long size) {
-	struct hash *h;
-	long i;
-	h = malloc(sizeof(struct hash));
-	if (!h) return 0;
-	if (size == 0) {
-		size = 16;
+struct hash *hash_new(int n) {
+	struct hash *h = (struct hash *)malloc(sizeof(struct hash));
+	if (!h) {
+		return 0;
 	}
-	h->size = size;
-	h->node = malloc(size * sizeof(struct hash_node));
+	h->cap = _hash_cap(n);
+	h->count = 0;
+	h->used = 0;
+	h->node = (struct hash_node *)calloc(h->cap, sizeof(struct hash_node));
 	if (!h->node) {
 		free(h);
 		return 0;
 	}
-	for (i = 0; i < size; i++) {
-		h->node[i].hasha = -1;
-		h->node[i].hashb = -1;
-		h->node[i].exist = 0;
-	}
-	if (_ctypt_init == 0) {
-		_crypt_table_init();
-		_ctypt_init = 1;
-	}
 	return h;
 }
 
 void hash_free(struct hash *h) {
+	int i;
+	for (i = 0; i < h->cap; i++) {
+		if (h->node[i].key && h->node[i].key != Tombstone) {
+			free(h->node[i].key);
+		}
+	}
 	free(h->node);
 	free(h);
 }
 
-long hash_insert(struct hash *h, const char *key, size_t size) {
-	unsigned long hash = _hash_string(key, size, HASH_OFF);
-	unsigned long hasha = _hash_string(key, size, HASH_A);
-	unsigned long hashb = _hash_string(key, size, HASH_B);
-	unsigned long hash_start = hash % h->size;
-	unsigned long npos = hash_start;
-	while (h->node[npos].exist == 1) {
-		if (h->node[npos].hasha == hasha && h->node[npos].hashb == hashb) {
+// the slot of key, or -1
+static int _hash_slot(struct hash *h, const char *key, int size, uint32_t hash) {
+	uint32_t mask = h->cap - 1;
+	uint32_t pos = hash & mask;
+	for (;;) {
+		struct hash_node *n = &h->node[pos];
+		if (!n->key) {
 			return -1;
 		}
-		npos = (npos + 1) % h->size;
-		if (npos == hash_start) {
-			return -1;
+		if (n->key != Tombstone && n->hash == hash && n->size == size && memcmp(n->key, key, size) == 0) {
+			return (int)pos;
 		}
+		pos = (pos + 1) & mask;
 	}
-	h->node[npos].exist = 1;
-	h->node[npos].hasha = hasha;
-	h->node[npos].hashb = hashb;
-	return npos;
 }
 
-long hash_exist(struct hash *h, const char *key, size_t size) {
-	unsigned long hash = _hash_string(key, size, HASH_OFF);
-	unsigned long hasha = _hash_string(key, size, HASH_A);
-	unsigned long hashb = _hash_string(key, size, HASH_B);
-	unsigned long hash_start = hash % h->size;
-	unsigned long npos = hash_start;
-	while (1) {
-		if (h->node[npos].hasha == hasha && h->node[npos].hashb == hashb) {
-			return npos;
-		} else {
-			npos = (npos + 1) % h->size;
+static int _hash_rebuild(struct hash *h, int cap) {
+	int i;
+	uint32_t mask = cap - 1;
+	struct hash_node *node = (struct hash_node *)calloc(cap, sizeof(struct hash_node));
+	if (!node) {
+		return 0;
+	}
+	for (i = 0; i < h->cap; i++) {
+		struct hash_node *n = &h->node[i];
+		if (n->key && n->key != Tombstone) {
+			uint32_t pos = n->hash & mask;
+			while (node[pos].key) {
+				pos = (pos + 1) & mask;
+			}
+			node[pos] = *n;
 		}
-		if (npos == hash_start) {
-			break;
+	}
+	free(h->node);
+	h->node = node;
+	h->cap = cap;
+	h->used = h->count;
+	return 1;
+}
+
+int hash_insert(struct hash *h, const char *key, int size, void *value) {
+	uint32_t hash = _hash_string(key, size);
+	uint32_t mask, pos;
+	int tomb = -1;
+	char *copy;
+	if ((h->used + 1) * 4 > h->cap * 3) {
+		// rebuilt at the same size when tombstones are most of the load
+		if (!_hash_rebuild(h, _hash_cap((h->count + 1) * 2))) {
+			return 0;
 		}
 	}
-	return -1;
+	mask = h->cap - 1;
+	for (pos = hash & mask; h->node[pos].key; pos = (pos + 1) & mask) {
+		struct hash_node *n = &h->node[pos];
+		if (n->key == Tombstone) {
+			if (tomb < 0) {
+				tomb = (int)pos;
+			}
+		} else if (n->hash == hash && n->size == size && memcmp(n->key, key, size) == 0) {
+			return 0;
+		}
+	}
+	copy = (char *)malloc(size + 1);
+	if (!copy) {
+		return 0;
+	}
+	memcpy(copy, key, size);
+	copy[size] = 0;
+	if (tomb >= 0) {
+		pos = (uint32_t)tomb;
+	} else {
+		h->used++;
+	}
+	h->node[pos].key = copy;
+	h->node[pos].size = size;
+	h->node[pos].hash = hash;
+	h->node[pos].value = value;
+	h->count++;
+	return 1;
+}
+
+void *hash_find(struct hash *h, const char *key, int size) {
+	int pos = _hash_slot(h, key, size, _hash_string(key, size));
+	return pos < 0 ? 0 : h->node[pos].value;
+}
+
+void *hash_remove(struct hash *h, const char *key, int size) {
+	void *value;
+	struct hash_node *n;
+	int pos = _hash_slot(h, key, size, _hash_string(key, size));
+	if (pos < 0) {
+		return 0;
+	}
+	n = &h->node[pos];
+	value = n->value;
+	free(n->key);
+	n->key = Tombstone;
+	n->value = 0;
+	h->count--;
+	return value;
 }
 
-void hash_remove(struct hash *h, long pos) {
-	h->node[pos].exist = 0;
-	h->node[pos].hasha = -1;
-	h->node[pos].hashb = -1;
+int hash_count(struct hash *h) {
+	return h->count;
 }
@@ -6,11 +6,16 @@ extern "C" {
 #endif
 
 	struct hash;
-	struct hash *hash_new(long size);
+	//a table with room for n keys before it grows
+	struct hash *hash_new(int n);
 	void hash_free(struct hash *h);
-	long hash_insert(struct hash *h, const char *key, int size);
-	long hash_exist(struct hash *h, const char *key, int size);
-	void hash_remove(struct hash *h, long pos);
+	//map the size bytes of key, copied by the table, to value. return 0 if key is there already
+	int hash_insert(struct hash *h, const char *key, int size, void *value);
+	//the value of key, 0 if it is not there
+	void *hash_find(struct hash *h, const char *key, int size);
+	//remove key and return its value, 0 if it is not there
+	void *hash_remove(struct hash *h, const char *key, int size);
+	int hash_count(struct hash *h);
 
 #ifdef __cplusplus
 };
@@ -180,26 +180,27 @@ static const struct font_rect *gen_char(int unicode, const char *utf8, int size,
 }
 
 
-static inline void set_point(struct vertex_pack *v, int *m, int xx, int yy, int tx, int ty) {
-	v->vx = (xx * m[0] + yy * m[2]) / 1024.0f + m[4];
-	v->vy = (xx * m[1] + yy * m[3]) / 1024.0f + m[5];
-	screen_trans(&v->vx, &v->vy);
-
-	v->tx = (uint16_t)(tx * (65535.0f / TEX_WIDTH));
-	v->ty = (uint16_t)(ty * (65535.0f / TEX_HEIGHT));
+static inline void set_point(int32_t *coord, uint16_t *texcoord, int xx, int yy, int tx, int ty) {
+	coord[0] = xx;
+	coord[1] = yy;
+	texcoord[0] = (uint16_t)(tx * (65535.0f / TEX_WIDTH));
+	texcoord[1] = (uint16_t)(ty * (65535.0f / TEX_HEIGHT));
 }
 
 static void draw_rect(const struct font_rect *rect, int size, struct matrix *mat, uint32_t color, uint32_t addi) {
-	struct vertex_pack vb[4];
+	int32_t coord[8];
+	uint16_t texcoord[8];
+	float f[6];
 
 	int w = (rect->w - 1) * size / FONT_SIZE;
 	int h = (rect->h - 1) * size / FONT_SIZE;
 
-	set_point(&vb[0], mat->m, 0, 0, rect->x, rect->y);
-	set_point(&vb[1], mat->m, w*SCREEN_SCALE, 0, rect->x + rect->w - 1, rect->y);
-	set_point(&vb[2], mat->m, w*SCREEN_SCALE, h*SCREEN_SCALE, rect->x + rect->w - 1, rect->y + rect->h - 1);
-	set_point(&vb[3], mat->m, 0, h*SCREEN_SCALE, rect->x, rect->y + rect->h - 1);
-	shader_drawvertex(vb, color, addi);
+	set_point(&coord[0], &texcoord[0], 0, 0, rect->x, rect->y);
+	set_point(&coord[2], &texcoord[2], w*SCREEN_SCALE, 0, rect->x + rect->w - 1, rect->y);
+	set_point(&coord[4], &texcoord[4], w*SCREEN_SCALE, h*SCREEN_SCALE, rect->x + rect->w - 1, rect->y + rect->h - 1);
+	set_point(&coord[6], &texcoord[6], 0, h*SCREEN_SCALE, rect->x, rect->y + rect->h - 1);
+	screen_matrix(mat, f);
+	shader_addquad(f, coord, texcoord, color, addi);
 }
 
 static int draw_size(int unicode, const char *utf8, int size, int edge) {
@@ -0,0 +1,207 @@
+/*
+ * lzb.h - compressor and decompressor of the LZ4 block format, in one header.
+ *
+ * #define LZB_IMPLEMENTATION in one C file before including it.
+ *
+ * A block is a run of sequences: a token (literal length << 4 | match length - 4),
+ * the literal length beyond 15 as 255 bytes and a remainder, the literals, a little
+ * endian 16 bit offset, then the match length beyond 15 the same way. The last
+ * sequence has literals only. Output of lzb_compress is readable by any LZ4 block
+ * decoder and lzb_decompress reads any LZ4 block.
+ */
+#ifndef _LZB_H_
+#define _LZB_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	//the largest compressed size of n bytes
+	int lzb_bound(int n);
+	//compress n bytes of src into dst of cap bytes, return the compressed size or 0 if it does not fit
+	int lzb_compress(const char *src, int n, char *dst, int cap);
+	//decompress the n byte block src into dst of cap bytes, return the size or -1 if the block is broken
+	int lzb_decompress(const char *src, int n, char *dst, int cap);
+
+#ifdef __cplusplus
+};
+#endif
+#endif // _LZB_H_
+
+#ifdef LZB_IMPLEMENTATION
+
+#include <stdint.h>
+#include <string.h>
+
+#define LZB_MINMATCH 4
+#define LZB_LASTLITERALS 5
+#define LZB_MFLIMIT 12
+#define LZB_HASH_LOG 12
+#define LZB_MAX_OFFSET 65535
+
+static uint32_t lzb_read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint32_t lzb_hash(uint32_t seq) {
+	return (seq * 2654435761u) >> (32 - LZB_HASH_LOG);
+}
+
+static uint8_t *lzb_length(uint8_t *op, int len) {
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+int lzb_bound(int n) {
+	return n + n / 255 + 16;
+}
+
+int lzb_compress(const char *src, int n, char *dst, int cap) {
+	int table[1 << LZB_HASH_LOG];
+	const uint8_t *base = (const uint8_t *)src;
+	const uint8_t *ip = base;
+	const uint8_t *anchor = base;
+	const uint8_t *end = base + n;
+	uint8_t *op = (uint8_t *)dst;
+	uint8_t *oend = op + cap;
+	int litlen, i;
+
+	if (n > LZB_MFLIMIT) {
+		const uint8_t *mflimit = end - LZB_MFLIMIT;
+		const uint8_t *matchlimit = end - LZB_LASTLITERALS;
+		for (i = 0; i < (1 << LZB_HASH_LOG); i++) {
+			table[i] = -1;
+		}
+		while (ip < mflimit) {
+			uint8_t *token;
+			const uint8_t *match, *p, *m;
+			int matchlen, offset;
+			uint32_t seq = lzb_read32(ip);
+			uint32_t h = lzb_hash(seq);
+			int ref = table[h];
+			table[h] = (int)(ip - base);
+			if (ref < 0 || ip - (base + ref) > LZB_MAX_OFFSET || lzb_read32(base + ref) != seq) {
+				ip++;
+				continue;
+			}
+			match = base + ref;
+			p = ip + LZB_MINMATCH;
+			m = match + LZB_MINMATCH;
+			while (p < matchlimit && *p == *m) {
+				p++;
+				m++;
+			}
+			matchlen = (int)(p - ip);
+			litlen = (int)(ip - anchor);
+			if (op + 1 + litlen + litlen / 255 + 1 + 2 + matchlen / 255 + 1 > oend) {
+				return 0;
+			}
+			token = op++;
+			if (litlen >= 15) {
+				*token = 15 << 4;
+				op = lzb_length(op, litlen - 15);
+			} else {
+				*token = (uint8_t)(litlen << 4);
+			}
+			memcpy(op, anchor, litlen);
+			op += litlen;
+			offset = (int)(ip - match);
+			*op++ = (uint8_t)(offset & 0xff);
+			*op++ = (uint8_t)(offset >> 8);
+			matchlen -= LZB_MINMATCH;
+			if (matchlen >= 15) {
+				*token |= 15;
+				op = lzb_length(op, matchlen - 15);
+			} else {
+				*token |= (uint8_t)matchlen;
+			}
+			ip = p;
+			anchor = ip;
+		}
+	}
+	litlen = (int)(end - anchor);
+	if (op + 1 + litlen + litlen / 255 + 1 > oend) {
+		return 0;
+	}
+	if (litlen >= 15) {
+		*op++ = 15 << 4;
+		op = lzb_length(op, litlen - 15);
+	} else {
+		*op++ = (uint8_t)(litlen << 4);
+	}
+	memcpy(op, anchor, litlen);
+	op += litlen;
+	return (int)(op - (uint8_t *)dst);
+}
+
+int lzb_decompress(const char *src, int n, char *dst, int cap) {
+	const uint8_t *ip = (const uint8_t *)src;
+	const uint8_t *iend = ip + n;
+	uint8_t *op = (uint8_t *)dst;
+	uint8_t *oend = op + cap;
+	while (ip < iend) {
+		const uint8_t *match;
+		int offset, s;
+		int token = *ip++;
+		int len = token >> 4;
+		if (len == 15) {
+			do {
+				if (ip >= iend) {
+					return -1;
+				}
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+		if (len > iend - ip || len > oend - op) {
+			return -1;
+		}
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+		if (ip >= iend) {
+			break;
+		}
+		if (iend - ip < 2) {
+			return -1;
+		}
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (offset == 0 || offset > op - (uint8_t *)dst) {
+			return -1;
+		}
+		len = token & 15;
+		if (len == 15) {
+			do {
+				if (ip >= iend) {
+					return -1;
+				}
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+		len += LZB_MINMATCH;
+		if (len > oend - op) {
+			return -1;
+		}
+		match = op - offset;
+		if (offset >= len) {
+			memcpy(op, match, len);
+			op += len;
+		} else {
+			// the match overlaps what it writes, a run
+			while (len-- > 0) {
+				*op++ = *match++;
+			}
+		}
+	}
+	return (int)(op - (uint8_t *)dst);
+}
+
+#endif // LZB_IMPLEMENTATION
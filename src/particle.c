@@ -263,17 +263,13 @@ void particle_system_reset(struct particle_system *ps) {
 }
 
 void calc_particle_system_mat(struct particle * p, struct matrix *m, int edge) {
-	struct srt srt;
 	struct matrix tmp;
+	int scale = (int)(p->size * 1024 / edge);
 
-	matrix_identity(m);
-	srt.rot = (int)(p->rotation * 1024 / 360);
-	srt.scalex = (int)(p->size * 1024 / edge);
-	srt.scaley = srt.scalex;
-	srt.offx = (int)((p->pos.x + p->startPos.x) * SCREEN_SCALE);
-	srt.offy = (int)((p->pos.y + p->startPos.y) * SCREEN_SCALE);
-	matrix_srt(m, &srt);
-	memcpy(tmp.m, m, sizeof(int) * 6);
+	// same as matrix_srt on an identity matrix
+	matrix_sr(&tmp, scale, scale, (int)(p->rotation * 1024 / 360));
+	tmp.m[4] = (int)((p->pos.x + p->startPos.x) * SCREEN_SCALE);
+	tmp.m[5] = (int)((p->pos.y + p->startPos.y) * SCREEN_SCALE);
 	matrix_mul(m, &tmp, &p->emitMatrix);
 }
 
@@ -8,6 +8,7 @@
 #include "sprite.h"
 #include "spritepack.h"
 #include "particle.h"
+#include "thread.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -199,14 +200,17 @@ int pixel_init(lua_State *L) {
 	luaL_requiref(L, "pixel.spritepack", pixel_spritepack, 0);
 	luaL_requiref(L, "pixel.particle", pixel_particle, 0);
 	lua_settop(L, 0);
+	spritepack_init("");
 	shader_init();
 	texture_init();
 	label_init(0);
+	thread_init(-1);
 	return 0;
 }
 
 int pixel_unit(lua_State *L) {
 	(void)L;
+	thread_unit();
 	label_unit();
 	texture_unit();
 	shader_unit();
@@ -215,8 +219,10 @@ int pixel_unit(lua_State *L) {
 
 int pixel_flush(lua_State *L) {
 	(void)L;
+	sprite_layer_flush();
 	shader_flush();
 	label_flush();
+	sprite_bitmap_frame();
 	return 0;
 }
 
@@ -300,10 +306,16 @@ void pixel_frame(float t) {
 
 void pixel_update(float t) {
 	if (P.fps <= 0) return;
+	spritepack_async_update();
 	if (P.logic == 0) P.real = 1.0f / P.fps;
 	else P.real += t;
 	while (P.logic < P.real) {
 		lua_State *L = P.L;
+		sprite_animate(1.0f / P.fps);
+		if (sprite_finish(L)) {
+			call(L, 1, 0);
+			lua_settop(L, 3);
+		}
 		lua_pushvalue(L, 2);
 		call(L, 0, 0);
 		lua_settop(L, 3);
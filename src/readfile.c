@@ -3,6 +3,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 int readable(const char *file) {
 	FILE *f;
 	f = fopen(file, "r");
@@ -31,4 +38,46 @@ char *readfile(const char *file, int *psize) {
 		*psize = size;
 	}
 	return data;
-}
\ No newline at end of file
+}
+
+#if defined(_WIN32)
+
+char *mapfile(const char *file, int *psize) {
+	return readfile(file, psize);
+}
+
+void unmapfile(char *data, int size) {
+	(void)size;
+	free(data);
+}
+
+#else
+
+char *mapfile(const char *file, int *psize) {
+	struct stat st;
+	void *data;
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	// private pages, so the loader may patch the image in place
+	data = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return 0;
+	}
+	if (psize) {
+		*psize = (int)st.st_size;
+	}
+	return (char *)data;
+}
+
+void unmapfile(char *data, int size) {
+	munmap(data, size);
+}
+
+#endif
@@ -7,6 +7,9 @@ extern "C" {
 
 	int readable(const char *file);
 	char *readfile(const char *file, int *psize);
+	//map file copy-on-write, a read copy where mapping is not available
+	char *mapfile(const char *file, int *psize);
+	void unmapfile(char *data, int size);
 
 #ifdef __cplusplus
 };
@@ -3,6 +3,7 @@
 #include "render.h"
 #include "shader.h"
 #include "texture.h"
+#include "vertex.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,16 +36,9 @@ void renderbuffer_clear(struct renderbuffer *rb) {
 	rb->object = 0;
 }
 
-int renderbuffer_addvertex(struct renderbuffer *rb, const struct vertex_pack vp[4], uint32_t color, uint32_t addi) {
-	struct quad *q;
+static void quad_color(struct quad *q, uint32_t color, uint32_t addi) {
 	int i;
-
-	if (rb->object >= MAX_COMMBINE) {
-		return 1;
-	}
-	q = &rb->vb[rb->object];
 	for (i = 0; i < 4; i++) {
-		q->p[i].vp = vp[i];
 		q->p[i].rgba[0] = (color >> 16) & 0xff;
 		q->p[i].rgba[1] = (color >> 8) & 0xff;
 		q->p[i].rgba[2] = (color)& 0xff;
@@ -54,6 +48,39 @@ int renderbuffer_addvertex(struct renderbuffer *rb, const struct vertex_pack vp[
 		q->p[i].addi[2] = (addi)& 0xff;
 		q->p[i].addi[3] = (addi >> 24) & 0xff;
 	}
+}
+
+void renderbuffer_quadcolor(struct quad *q, uint32_t color, uint32_t addi) {
+	quad_color(q, color, addi);
+}
+
+int renderbuffer_addvertex(struct renderbuffer *rb, const struct vertex_pack vp[4], uint32_t color, uint32_t addi) {
+	struct quad *q;
+	int i;
+
+	if (rb->object >= MAX_COMMBINE) {
+		return 1;
+	}
+	q = &rb->vb[rb->object];
+	for (i = 0; i < 4; i++) {
+		q->p[i].vp = vp[i];
+	}
+	quad_color(q, color, addi);
+	if (++rb->object >= MAX_COMMBINE) {
+		return 1;
+	}
+	return 0;
+}
+
+int renderbuffer_addquad(struct renderbuffer *rb, const float f[6], const int32_t coord[8], const uint16_t texcoord[8], uint32_t color, uint32_t addi) {
+	struct quad *q;
+
+	if (rb->object >= MAX_COMMBINE) {
+		return 1;
+	}
+	q = &rb->vb[rb->object];
+	vertex_transform(f, 4, coord, texcoord, &q->p[0].vp, sizeof(struct vertex));
+	quad_color(q, color, addi);
 	if (++rb->object >= MAX_COMMBINE) {
 		return 1;
 	}
@@ -38,6 +38,9 @@ extern "C" {
 	void renderbuffer_unit(struct renderbuffer *rb);
 	void renderbuffer_update(struct renderbuffer *rb);
 	int renderbuffer_addvertex(struct renderbuffer *rb, const struct vertex_pack vp[4], uint32_t color, uint32_t addi);
+	//transform a quad by the vertex matrix f straight into the buffer
+	int renderbuffer_addquad(struct renderbuffer *rb, const float f[6], const int32_t coord[8], const uint16_t texcoord[8], uint32_t color, uint32_t addi);
+	void renderbuffer_quadcolor(struct quad *q, uint32_t color, uint32_t addi);
 	void renderbuffer_clear(struct renderbuffer *rb);
 	void renderbuffer_draw(struct renderbuffer *rb, float x, float y, float scale);
 	int renderbuffer_add(struct renderbuffer *rb, struct sprite *s);
@@ -59,4 +59,8 @@ void scissor_pop(void) {
 	}
 	b = &S.b[S.depth - 1];
 	screen_scissor(b->x, b->y, b->w, b->h);
-}
\ No newline at end of file
+}
+
+int scissor_active(void) {
+	return S.depth > 0;
+}
@@ -7,6 +7,7 @@ extern "C" {
 
 	void scissor_push(int x, int y, int w, int h);
 	void scissor_pop(void);
+	int scissor_active(void);
 
 #ifdef __cplusplus
 };
@@ -1,6 +1,7 @@
 #include "screen.h"
 #include "render.h"
 #include "spritepack.h"
+#include "vertex.h"
 
 struct screen {
 	int width;
@@ -11,6 +12,8 @@ struct screen {
 };
 
 static struct screen SCREEN;
+static struct screen SAVED;
+static int TARGET_MODE = 0;
 
 void screen_init(float w, float h, float scale) {
 	SCREEN.width = (int)w;
@@ -56,4 +59,36 @@ void screen_scissor(int x, int y, int w, int h) {
 
 int screen_visible(float x, float y) {
 	return x >= 0.0f && x <= 2.0f && y >= -2.0f && y <= 0.0f;
+}
+
+void screen_matrix(const struct matrix *mat, float f[6]) {
+	vertex_matrix(mat, SCREEN.invw, SCREEN.invh, f);
+}
+
+void screen_target(int w, int h) {
+	if (w > 0 && h > 0) {
+		if (!TARGET_MODE) {
+			SAVED = SCREEN;
+			TARGET_MODE = 1;
+		}
+		SCREEN.width = (int)(w / SCREEN.scale);
+		SCREEN.height = (int)(h / SCREEN.scale);
+		SCREEN.invw = 2.0f * SCREEN.scale / SCREEN_SCALE / w;
+		SCREEN.invh = -2.0f * SCREEN.scale / SCREEN_SCALE / h;
+		render_setviewport(0, 0, w, h);
+	} else if (TARGET_MODE) {
+		SCREEN = SAVED;
+		TARGET_MODE = 0;
+		render_setviewport(0, 0, (int)(SCREEN.width * SCREEN.scale), (int)(SCREEN.height * SCREEN.scale));
+	}
+}
+
+float screen_scale(void) {
+	return SCREEN.scale;
+}
+
+int screen_cull(const int aabb[4]) {
+	return aabb[2] < 0 || aabb[3] < 0
+		|| aabb[0] > SCREEN.width * SCREEN_SCALE
+		|| aabb[1] > SCREEN.height * SCREEN_SCALE;
 }
\ No newline at end of file
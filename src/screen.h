@@ -11,6 +11,13 @@ extern "C" {
 	void screen_trans(float *x, float *y);
 	void screen_scissor(int x, int y, int w, int h);
 	int screen_visible(float x, float y);
+	int screen_cull(const int aabb[4]);
+	struct matrix;
+	//fold mat and the screen transform into a vertex matrix
+	void screen_matrix(const struct matrix *mat, float f[6]);
+	//map the screen onto a render target of w*h pixels, 0 maps it back
+	void screen_target(int w, int h);
+	float screen_scale(void);
 
 #ifdef __cplusplus
 };
@@ -270,6 +270,29 @@ void shader_drawvertex(const struct vertex_pack vp[4], uint32_t color, uint32_t
 	}
 }
 
+void shader_addquad(const float f[6], const int32_t coord[8], const uint16_t texcoord[8], uint32_t color, uint32_t addi) {
+	if (renderbuffer_addquad(&S.rb, f, coord, texcoord, color, addi)) {
+		shader_flush();
+	}
+}
+
+void shader_addquads(const struct quad *q, int n) {
+	struct renderbuffer *rb = &S.rb;
+	while (n > 0) {
+		int cnt = MAX_COMMBINE - rb->object;
+		if (cnt > n) {
+			cnt = n;
+		}
+		memcpy(&rb->vb[rb->object], q, cnt * sizeof(struct quad));
+		rb->object += cnt;
+		q += cnt;
+		n -= cnt;
+		if (rb->object >= MAX_COMMBINE) {
+			shader_flush();
+		}
+	}
+}
+
 static void shader_drawquad(const struct vertex_pack *vp, uint32_t color, uint32_t addi, int idx, int max) {
 	struct vertex_pack _vp[4];
 	int i;
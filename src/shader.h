@@ -38,7 +38,10 @@ extern "C" {
 	int shader_uniform_size(enum UNIFORM_FORMAT t);
 
 	void shader_drawvertex(const struct vertex_pack vp[4], uint32_t color, uint32_t addi);
+	void shader_addquad(const float f[6], const int32_t coord[8], const uint16_t texcoord[8], uint32_t color, uint32_t addi);
 	void shader_drawpolygon(int n, const struct vertex_pack *vp, uint32_t color, uint32_t addi);
+	//append n quads built elsewhere, flushing as the buffer fills
+	void shader_addquads(const struct quad *q, int n);
 	void shader_drawbuffer(struct renderbuffer *rb, float x, float y, float scale);
 	void shader_draw(int tid, const float tcoord[8], const float scoord[8], uint32_t color, uint32_t addi);
 
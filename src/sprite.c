@@ -1,3 +1,4 @@
+#include "pixel.h"
 #include "sprite.h"
 #include "matrix.h"
 #include "spritepack.h"
@@ -8,7 +9,9 @@
 #include "renderbuffer.h"
 #include "shader.h"
 #include "particle.h"
+#include "thread.h"
 #include "label.h"
+#include "vertex.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,6 +19,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <limits.h>
+#include <math.h>
 #include <malloc.h>
 
 struct material;
@@ -26,6 +30,11 @@ struct anchor_data {
 	struct matrix mat;
 };
 
+struct drawlist;
+struct touchindex;
+struct geometry;
+struct bitmap;
+
 struct sprite {
 	struct sprite *parent;
 	uint16_t type;
@@ -40,12 +49,21 @@ struct sprite {
 		struct matrix *mat;
 	} s;
 	struct matrix mat;
+	struct matrix world;
 	int start_frame;
 	int total_frame;
 	int frame;
 	int flag;
 	const char *name;
 	struct material *material;
+	struct drawlist *list;
+	struct touchindex *index;
+	int anim;
+	struct geometry *geo;
+	int geo_gen;
+	struct bitmap *bitmap;
+	// with SPRITE_FLAG_REBOUND, the bound of every frame of s as its children are now
+	int32_t bound[4];
 	union {
 		struct sprite *children[1];
 		struct rich_text *rich_text;
@@ -54,10 +72,63 @@ struct sprite {
 	} data;
 };
 
+static void sprite_dirty(struct sprite *s);
+static void geo_clear(void);
+
+// the precomputed pack bound of s and its ancestors no longer covers their content,
+// their own bounds are computed again the next time they are asked for
+static void sprite_unbound(struct sprite *s) {
+	sprite_dirty(s);
+	for (; s; s = s->parent) {
+		s->flag |= SPRITE_FLAG_REBOUND | SPRITE_FLAG_STALEBOUND;
+	}
+}
+
+// the cached world matrix of s and its subtree must be recomputed
+static void world_dirty(struct sprite *s) {
+	int i;
+	if ((s->flag & SPRITE_FLAG_WORLD) == 0) {
+		// a valid child implies a valid parent, so the subtree is dirty too
+		return;
+	}
+	s->flag &= ~SPRITE_FLAG_WORLD;
+	if (s->type == TYPE_ANIMATION) {
+		for (i = 0; i < s->s.ani->component_n; i++) {
+			if (s->data.children[i]) {
+				world_dirty(s->data.children[i]);
+			}
+		}
+	}
+}
+
+// the parts of s moved, as after a frame change
+static void world_dirty_children(struct sprite *s) {
+	int i;
+	if (s->type != TYPE_ANIMATION || (s->flag & SPRITE_FLAG_WORLD) == 0) {
+		return;
+	}
+	for (i = 0; i < s->s.ani->component_n; i++) {
+		if (s->data.children[i]) {
+			world_dirty(s->data.children[i]);
+		}
+	}
+}
+
+static void mount_child(struct sprite *s, int idx, struct sprite *c);
+static void arena_free(struct sprite *root);
+
 void sprite_free(struct sprite *s) {
 	if (!s) {
 		return;
 	}
+	if (s->flag & SPRITE_FLAG_INARENA) {
+		// released with the root of its tree
+		return;
+	}
+	if (s->flag & SPRITE_FLAG_ARENA) {
+		arena_free(s);
+		return;
+	}
 	if (s->type == TYPE_ANIMATION) {
 		int i;
 		struct pack_animation *ani = s->s.ani;
@@ -72,6 +143,10 @@ void sprite_free(struct sprite *s) {
 			free(s->data.rich_text);
 		}
 	}
+	sprite_drawlist(s, 0);
+	sprite_touchindex(s, 0);
+	sprite_bitmap(s, 0);
+	sprite_stop(s);
 	free(s);
 }
 
@@ -106,36 +181,93 @@ static struct sprite *_anchor_new(struct sprite *s, struct sprite_pack *pack, in
 	s->data.anchor->pic = 0;
 	s->s.mat = &s->data.anchor->mat;
 	s->material = 0;
+	s->list = 0;
+	s->index = 0;
+	s->anim = 0;
+	s->geo = 0;
+	s->bitmap = 0;
 	matrix_identity(s->s.mat);
 	return s;
 }
 
-static struct sprite *_new(struct sprite_pack *pack, int id) {
-	int i;
+#define ARENA_ALIGN(sz) (((sz) + 7) & ~7)
+// slots of the pool table at first, doubled as it fills
+#define ARENA_POOL 64
+#define ARENA_FREE_MAX 16
+
+// header of a block holding a whole sprite tree, the root follows it
+struct sprite_arena {
+	struct sprite_pack *pack;
+	int id;
 	int size;
-	struct sprite *s;
+	struct sprite_arena *next;
+};
+
+// released trees and a freshly built template for one (pack, id)
+struct arena_pool {
+	struct sprite_pack *pack;
+	int id;
+	int n;
+	struct sprite_arena *template;
+	struct sprite_arena *free;
+};
+
+// the pools by (pack, id), open addressed, the slots of a pack go with it
+struct arena_table {
+	struct arena_pool *slot;
+	int n;
+	int cap;
+};
+
+static struct arena_table ARENA;
+
+static int node_size(struct sprite_pack *pack, int id) {
 	if (id == ANCHOR_ID) {
-		size = sizeof(struct sprite) + sizeof(struct anchor_data);
-		s = (struct sprite *)malloc(size);
-		return _anchor_new(s, pack, id);
+		return ARENA_ALIGN(sizeof(struct sprite) + sizeof(struct anchor_data));
 	}
 	if (pack->type[id] == TYPE_ANIMATION) {
 		struct pack_animation *ani = (struct pack_animation *)pack->data[id];
-		size = sizeof(struct sprite) + (ani->component_n - 1)*sizeof(struct sprite *);
-	} else {
-		size = sizeof(struct sprite);
+		return ARENA_ALIGN(sizeof(struct sprite) + (ani->component_n - 1)*sizeof(struct sprite *));
+	}
+	return ARENA_ALIGN(sizeof(struct sprite));
+}
+
+static int tree_size(struct sprite_pack *pack, int id) {
+	int size = node_size(pack, id);
+	if (id != ANCHOR_ID && pack->type[id] == TYPE_ANIMATION) {
+		int i;
+		struct pack_animation *ani = (struct pack_animation *)pack->data[id];
+		for (i = 0; i < ani->component_n; i++) {
+			size += tree_size(pack, ani->component[i].id);
+		}
+	}
+	return size;
+}
+
+static struct sprite *_new(struct sprite_pack *pack, int id, char **arena) {
+	int i;
+	struct sprite *s = (struct sprite *)*arena;
+	*arena += node_size(pack, id);
+	if (id == ANCHOR_ID) {
+		_anchor_new(s, pack, id);
+		s->flag |= SPRITE_FLAG_INARENA;
+		return s;
 	}
-	s = (struct sprite *)malloc(size);
 	s->parent = 0;
 	s->t.mat = 0;
 	s->t.color = 0xffffffff;
 	s->t.addi = 0;
 	s->t.pid = PROGRAM_DEFAULT;
-	s->flag = 0;
+	s->flag = SPRITE_FLAG_INARENA;
 	s->name = 0;
 	s->id = id;
 	s->type = pack->type[id];
 	s->material = 0;
+	s->list = 0;
+	s->index = 0;
+	s->anim = 0;
+	s->geo = 0;
+	s->bitmap = 0;
 	if (pack->type[id] == TYPE_ANIMATION) {
 		s->s.ani = (struct pack_animation *)pack->data[id];
 		s->frame = 0;
@@ -162,16 +294,184 @@ static struct sprite *_new(struct sprite_pack *pack, int id) {
 		if (cid < 0) {
 			break;
 		}
-		cs = _new(pack, cid);
+		cs = _new(pack, cid, arena);
 		if (cs) {
 			cs->name = sprite_childname(s, i);
-			sprite_mount(s, i, cs);
+			mount_child(s, i, cs);
 			update_message(pack, cs, id, i, s->frame);
 		}
 	}
 	return s;
 }
 
+// the slot of (pack, id) in slot, or the empty one it goes to. cap is a power of 2 and never full
+static struct arena_pool *arena_probe(struct arena_pool *slot, int cap, struct sprite_pack *pack, int id) {
+	unsigned int i = ((unsigned int)((uintptr_t)pack >> 4) ^ (unsigned int)id * 2654435761u) & (cap - 1);
+	for (; slot[i].pack; i = (i + 1) & (cap - 1)) {
+		if (slot[i].pack == pack && slot[i].id == id) {
+			break;
+		}
+	}
+	return &slot[i];
+}
+
+// move the pools into a table of cap slots
+static void arena_rehash(int cap) {
+	int i;
+	struct arena_table old = ARENA;
+	ARENA.slot = cap ? (struct arena_pool *)calloc(cap, sizeof(struct arena_pool)) : 0;
+	ARENA.cap = cap;
+	for (i = 0; i < old.cap; i++) {
+		if (old.slot[i].pack) {
+			*arena_probe(ARENA.slot, cap, old.slot[i].pack, old.slot[i].id) = old.slot[i];
+		}
+	}
+	free(old.slot);
+}
+
+// the pool of (pack, id), added when there is none
+static struct arena_pool *arena_pool(struct sprite_pack *pack, int id) {
+	struct arena_pool *ap;
+	if ((ARENA.n + 1) * 4 > ARENA.cap * 3) {
+		arena_rehash(ARENA.cap ? ARENA.cap * 2 : ARENA_POOL);
+	}
+	ap = arena_probe(ARENA.slot, ARENA.cap, pack, id);
+	if (!ap->pack) {
+		ap->pack = pack;
+		ap->id = id;
+		ARENA.n++;
+	}
+	return ap;
+}
+
+// the pool of (pack, id) with the tree it copies, built the first time
+static struct arena_pool *arena_template(struct sprite_pack *pack, int id) {
+	struct arena_pool *ap = arena_pool(pack, id);
+	if (!ap->template) {
+		char *ptr;
+		struct sprite *root;
+		int size = sizeof(struct sprite_arena) + tree_size(pack, id);
+		struct sprite_arena *a = (struct sprite_arena *)malloc(size);
+		a->pack = pack;
+		a->id = id;
+		a->size = size;
+		a->next = 0;
+		ptr = (char *)(a + 1);
+		root = _new(pack, id, &ptr);
+		root->flag = (root->flag & ~SPRITE_FLAG_INARENA) | SPRITE_FLAG_ARENA;
+		ap->template = a;
+	}
+	return ap;
+}
+
+// move the pointers of the tree s into a block delta bytes away
+static void arena_fixup(struct sprite *s, ptrdiff_t delta) {
+	int i;
+	if (s->parent) {
+		s->parent = (struct sprite *)((char *)s->parent + delta);
+	}
+	if (s->type == TYPE_ANCHOR) {
+		s->data.anchor = (struct anchor_data *)((char *)s->data.anchor + delta);
+		s->s.mat = &s->data.anchor->mat;
+	} else if (s->type == TYPE_ANIMATION) {
+		for (i = 0; i < s->s.ani->component_n; i++) {
+			if (s->data.children[i]) {
+				s->data.children[i] = (struct sprite *)((char *)s->data.children[i] + delta);
+				arena_fixup(s->data.children[i], delta);
+			}
+		}
+	}
+}
+
+static struct sprite *arena_new(struct sprite_pack *pack, int id) {
+	int size;
+	struct sprite *root;
+	struct sprite_arena *a;
+	struct arena_pool *ap;
+	spritepack_require(pack, id);
+	ap = arena_template(pack, id);
+	size = ap->template->size;
+	a = ap->free;
+	if (a) {
+		ap->free = a->next;
+		ap->n--;
+	} else {
+		a = (struct sprite_arena *)malloc(size);
+	}
+	memcpy(a, ap->template, size);
+	root = (struct sprite *)(a + 1);
+	arena_fixup(root, (char *)a - (char *)ap->template);
+	spritepack_retain(pack);
+	return root;
+}
+
+// release what the nodes of a tree own, sprites mounted from outside the block are freed
+static void arena_release(struct sprite *s, struct sprite_arena *a) {
+	int i;
+	if (s->type == TYPE_ANIMATION) {
+		for (i = 0; i < s->s.ani->component_n; i++) {
+			struct sprite *c = s->data.children[i];
+			if (!c) {
+				continue;
+			}
+			if ((char *)c > (char *)a && (char *)c < (char *)a + a->size) {
+				arena_release(c, a);
+			} else {
+				sprite_free(c);
+			}
+		}
+	} else if (s->type == TYPE_LABEL) {
+		if (s->data.rich_text) {
+			free(s->data.rich_text);
+			s->data.rich_text = 0;
+		}
+	}
+	sprite_drawlist(s, 0);
+	sprite_touchindex(s, 0);
+	sprite_bitmap(s, 0);
+	sprite_stop(s);
+}
+
+static void arena_free(struct sprite *root) {
+	struct sprite_arena *a = (struct sprite_arena *)root - 1;
+	struct sprite_pack *pack = a->pack;
+	struct arena_pool *ap;
+	arena_release(root, a);
+	ap = arena_pool(a->pack, a->id);
+	if (ap->n < ARENA_FREE_MAX) {
+		a->next = ap->free;
+		ap->free = a;
+		ap->n++;
+	} else {
+		free(a);
+	}
+	// the last reference frees the pack and the pool of its trees
+	spritepack_release(pack);
+}
+
+void sprite_pool_clear(struct sprite_pack *pack) {
+	int i;
+	for (i = 0; i < ARENA.cap; i++) {
+		struct arena_pool *ap = &ARENA.slot[i];
+		if (!ap->pack || (pack && ap->pack != pack)) {
+			continue;
+		}
+		while (ap->free) {
+			struct sprite_arena *a = ap->free;
+			ap->free = a->next;
+			free(a);
+		}
+		free(ap->template);
+		// a pack loaded later at the same address must not find the slots of this one
+		memset(ap, 0, sizeof(*ap));
+		ARENA.n--;
+	}
+	// an emptied slot would end the probe for the slots after it, so the others are put back
+	arena_rehash(ARENA.n > 0 ? ARENA.cap : 0);
+	// cached geometry is keyed by pointers into the pack and holds its texture ids
+	geo_clear();
+}
+
 struct sprite *sprite_new(const char *packname, const char *name) {
 	int id;
 	struct sprite_pack *pack = spritepack_query(packname);
@@ -182,7 +482,7 @@ struct sprite *sprite_new(const char *packname, const char *name) {
 	if (!pack || id == -1) {
 		return 0;
 	}
-	return _new(pack, id);
+	return arena_new(pack, id);
 }
 
 int sprite_action(struct sprite *s, const char *action) {
@@ -191,6 +491,8 @@ int sprite_action(struct sprite *s, const char *action) {
 		return -1;
 	}
 	ani = s->s.ani;
+	sprite_dirty(s);
+	world_dirty_children(s);
 	if (action == 0) {
 		if (ani->action == 0) {
 			return -1;
@@ -200,19 +502,14 @@ int sprite_action(struct sprite *s, const char *action) {
 		s->frame = 0;
 		return s->total_frame;
 	} else {
-		int i;
-		for (i = 0; i < ani->action_n; i++) {
-			const char *name = (const char *)ani->action[i].name;
-			if (name) {
-				if (0 == strcmp(name, action)) {
-					s->start_frame = ani->action[i].start_frame;
-					s->total_frame = ani->action[i].n;
-					s->frame = 0;
-					return s->total_frame;
-				}
-			}
+		int i = spritepack_action(ani, action);
+		if (i < 0) {
+			return -1;
 		}
-		return -1;
+		s->start_frame = ani->action[i].start_frame;
+		s->total_frame = ani->action[i].n;
+		s->frame = 0;
+		return s->total_frame;
 	}
 }
 
@@ -285,9 +582,8 @@ static void switch_program(struct sprite_trans *t, int def, struct material *m)
 
 void sprite_drawquad(struct pack_picture *pic, const struct srt *srt, const struct sprite_trans *arg) {
 	struct matrix tmp;
-	struct vertex_pack vb[4];
-	int i, j;
-	int *m;
+	float f[6];
+	int i;
 	if (!pic) {
 		return;
 	}
@@ -297,28 +593,14 @@ void sprite_drawquad(struct pack_picture *pic, const struct srt *srt, const stru
 		tmp = *arg->mat;
 	}
 	matrix_srt(&tmp, srt);
-	m = tmp.m;
+	screen_matrix(&tmp, f);
 	for (i = 0; i < pic->n; i++) {
 		struct pack_quad *q = &pic->rect[i];
 		int glid = texture_rid(q->texid);
 		if (glid == 0)
 			continue;
 		shader_texture(glid, 0);
-		for (j = 0; j < 4; j++) {
-			int xx = q->screen_coord[j * 2 + 0];
-			int yy = q->screen_coord[j * 2 + 1];
-			float vx = (xx * m[0] + yy * m[2]) / 1024.0f + m[4];
-			float vy = (xx * m[1] + yy * m[3]) / 1024.0f + m[5];
-			uint16_t tx = q->texture_coord[j * 2 + 0];
-			uint16_t ty = q->texture_coord[j * 2 + 1];
-
-			screen_trans(&vx, &vy);
-			vb[j].vx = vx;
-			vb[j].vy = vy;
-			vb[j].tx = tx;
-			vb[j].ty = ty;
-		}
-		shader_drawvertex(vb, arg->color, arg->addi);
+		shader_addquad(f, q->screen_coord, q->texture_coord, arg->color, arg->addi);
 	}
 }
 
@@ -327,15 +609,15 @@ void sprite_drawpolygon(struct pack_polygon *poly, const struct srt *srt, const
 #if defined(_MSC_VER)
 	struct vertex_pack *vb;
 #endif
-	int i, j;
-	int *m;
+	float f[6];
+	int i;
 	if (!arg->mat) {
 		matrix_identity(&tmp);
 	} else {
 		tmp = *arg->mat;
 	}
 	matrix_srt(&tmp, srt);
-	m = tmp.m;
+	screen_matrix(&tmp, f);
 	for (i = 0; i < poly->n; i++) {
 		struct pack_poly *p = &poly->poly[i];
 		int glid = texture_rid(p->texid);
@@ -347,20 +629,7 @@ void sprite_drawpolygon(struct pack_polygon *poly, const struct srt *srt, const
 #else
 		struct vertex_pack vb[p->n];
 #endif
-		for (j = 0; j < p->n; j++) {
-			int xx = p->screen_coord[j * 2 + 0];
-			int yy = p->screen_coord[j * 2 + 1];
-			float vx = (xx * m[0] + yy * m[2]) / 1024.0f + m[4];
-			float vy = (xx * m[1] + yy * m[3]) / 1024.0f + m[5];
-			uint16_t tx = p->texture_coord[j * 2 + 0];
-			uint16_t ty = p->texture_coord[j * 2 + 1];
-
-			screen_trans(&vx, &vy);
-			vb[j].vx = vx;
-			vb[j].vy = vy;
-			vb[j].tx = tx;
-			vb[j].ty = ty;
-		}
+		vertex_transform(f, p->n, p->screen_coord, p->texture_coord, vb, sizeof(struct vertex_pack));
 		shader_drawpolygon(p->n, vb, arg->color, arg->addi);
 	}
 }
@@ -456,88 +725,1574 @@ static void sprite_drawparticle(struct sprite *s, struct particle_system *ps, st
 	s->t.color = old_c;
 }
 
-static void _draw_ani(struct sprite *s, struct srt *srt, struct material *material, struct sprite_trans *t);
+static void poly_aabb(int n, const int32_t *point, struct srt *srt, struct matrix *mat, int aabb[4]) {
+	int *m;
+	int i;
+	struct matrix tmp;
+	if (!mat) {
+		matrix_identity(&tmp);
+	} else {
+		tmp = *mat;
+	}
+	matrix_srt(&tmp, srt);
+	m = tmp.m;
+	for (i = 0; i < n; i++) {
+		int x = point[i * 2];
+		int y = point[i * 2 + 1];
+		int xx = (x*m[0] + y*m[2]) / 1024 + m[4];
+		int yy = (x*m[1] + y*m[3]) / 1024 + m[5];
 
-static int draw_child(struct sprite *s, struct srt *srt, struct sprite_trans *ts, struct material *material) {
-	struct sprite_trans temp;
-	struct matrix temp_mat;
-	struct sprite_trans *t = sprite_trans_mul(&s->t, ts, &temp, &temp_mat);
-	if (s->material) {
-		material = s->material;
+		if (xx < aabb[0]) {
+			aabb[0] = xx;
+		}
+		if (xx > aabb[2]) {
+			aabb[2] = xx;
+		}
+		if (yy < aabb[1]) {
+			aabb[1] = yy;
+		}
+		if (yy > aabb[3]) {
+			aabb[3] = yy;
+		}
 	}
+}
+
+// transform the local box b by mat and srt, and merge it into aabb
+static void bound_aabb(const int32_t b[4], struct srt *srt, struct matrix *mat, int aabb[4]) {
+	int32_t pt[] = {
+		b[0], b[1], b[2], b[1],
+		b[0], b[3], b[2], b[3],
+	};
+	poly_aabb(4, pt, srt, mat, aabb);
+}
+
+static void sprite_rebound(struct sprite *s);
+
+// the bound of every frame of s before its own transform, 0 if it is unbounded
+static const int32_t *frames_bound(struct sprite *s, int32_t tmp[4]);
+
+// the local bound of s before its own transform, 0 if s has no precomputed bound
+static const int32_t *local_bound(struct sprite *s, int32_t tmp[4]) {
+	int frame;
+	const int32_t *aabb;
 	switch (s->type) {
 	case TYPE_PICTURE:
-		switch_program(t, PROGRAM_PICTURE, material);
-		sprite_drawquad(s->s.pic, srt, t);
-		return 0;
+		return s->s.pic->aabb;
 	case TYPE_POLYGON:
-		switch_program(t, PROGRAM_PICTURE, material);
-		sprite_drawpolygon(s->s.poly, srt, t);
-		return 0;
+		return s->s.poly->aabb;
 	case TYPE_LABEL:
-		if (s->data.rich_text) {
-			t->pid = PROGRAM_DEFAULT;
-			switch_program(t, s->s.label->edge ? PROGRAM_TEXT_EDGE : PROGRAM_TEXT, material);
-			label_draw(s->data.rich_text, s->s.label, srt, t);
+		tmp[0] = tmp[1] = 0;
+		tmp[2] = s->s.label->width * SCREEN_SCALE;
+		tmp[3] = s->s.label->height * SCREEN_SCALE;
+		return tmp;
+	case TYPE_PANEL:
+		tmp[0] = tmp[1] = 0;
+		tmp[2] = s->s.panel->width * SCREEN_SCALE;
+		tmp[3] = s->s.panel->height * SCREEN_SCALE;
+		return tmp;
+	case TYPE_ANIMATION:
+		if (s->flag & SPRITE_FLAG_NOBOUND) {
+			return 0;
 		}
-		return 0;
-	case TYPE_ANCHOR:
-		if (s->data.anchor->ps) {
-			switch_program(t, PROGRAM_PICTURE, material);
-			sprite_drawparticle(s, s->data.anchor->ps, s->data.anchor->pic, srt);
+		if (s->flag & SPRITE_FLAG_REBOUND) {
+			// the bound of the frame is not kept, that of every frame covers it
+			return frames_bound(s, tmp);
 		}
-		anchor_update(s, srt, t);
-		return 0;
-	case TYPE_PANEL:
-		if (s->data.scissor) {
-			set_scissor(s->s.panel, srt, t);
-			return 1;
-		} else {
+		frame = get_frame(s);
+		if (frame < 0) {
 			return 0;
 		}
-	case TYPE_ANIMATION:
-		break;
+		aabb = s->s.ani->frame[frame].aabb;
+		return aabb[0] == AABB_INFINITE ? 0 : aabb;
 	default:
 		return 0;
 	}
-	_draw_ani(s, srt, material, t);
-	return 0;
 }
 
-static void _draw_ani(struct sprite *s, struct srt *srt, struct material *material, struct sprite_trans *t) {
-	int i, scissor = 0;
-	struct pack_frame *pf;
-	struct pack_animation *ani = s->s.ani;
-	int frame = get_frame(s);
-	if (frame < 0) {
-		return;
-	}
-	pf = &ani->frame[frame];
-	for (i = 0; i < pf->n; i++) {
-		struct sprite_trans tran;
-		struct matrix mat;
-		struct sprite_trans *ct;
-		struct pack_part *pp = &pf->part[i];
-		int idx = pp->component_id;
-		struct sprite *child = s->data.children[idx];
-		if (!child || (child->flag & SPRITE_FLAG_INVISIBLE)) {
-			continue;
+#define BITMAP_ALIGN 32
+#define BITMAP_MAX 2048
+#define BITMAP_POOL 8
+
+// a subtree rendered into a render target, drawn as one quad while it is valid
+struct bitmap {
+	struct sprite *s;
+	int valid;
+	// the tree holds anchors or multimount sprites, it is always drawn directly
+	int volatile_tree;
+	// the frame of the last change, a tree changing every frame is not worth caching
+	int change;
+	int stamp;
+	int target;
+	int width;
+	int height;
+	int32_t coord[8];
+	uint16_t texcoord[8];
+};
+
+struct bitmap_target {
+	int id;
+	int width;
+	int height;
+};
+
+struct bitmap_cache {
+	int budget;
+	int used;
+	int frame;
+	int building;
+	// the bitmaps holding a target
+	int n;
+	int cap;
+	struct bitmap **live;
+	// released targets kept for reuse
+	int free_n;
+	struct bitmap_target free[BITMAP_POOL];
+};
+
+static struct bitmap_cache B = { 16 * 1024 * 1024 };
+
+#define GEO_SLOT 256
+#define GEO_MAX 1024
+
+// a quad of a cached subtree, in the space of the subtree root
+struct geo_quad {
+	int32_t coord[8];
+	uint16_t texcoord[8];
+	uint16_t texid;
+	int16_t pid;
+	uint32_t color;
+	uint32_t addi;
+};
+
+// the geometry of an animation subtree, shared by every instance with the same key
+struct geometry {
+	struct geometry *next;
+	unsigned int hash;
+	// the data pointer and frame of each node of the subtree, in draw order
+	int key_n;
+	intptr_t *key;
+	int quad_n;
+	int quad_cap;
+	struct geo_quad *quad;
+};
+
+struct geo_cache {
+	int enable;
+	int generation;
+	int n;
+	struct geometry *slot[GEO_SLOT];
+	int key_n;
+	int key_cap;
+	intptr_t *key;
+};
+
+static struct geo_cache G;
+
+// the geometry of a sprite whose subtree can not be cached, till sprite_dirty or the next generation
+static struct geometry GEO_NONE;
+
+static void geo_clear(void) {
+	int i;
+	for (i = 0; i < GEO_SLOT; i++) {
+		struct geometry *g = G.slot[i];
+		while (g) {
+			struct geometry *next = g->next;
+			free(g->key);
+			free(g->quad);
+			free(g);
+			g = next;
 		}
-		ct = sprite_trans_mul(&pp->t, t, &tran, &mat);
-		scissor += draw_child(child, srt, ct, material);
+		G.slot[i] = 0;
 	}
-	for (i = 0; i < scissor; i++) {
-		scissor_pop();
+	G.n = 0;
+	G.generation++;
+}
+
+void sprite_geometry_cache(int enable) {
+	if (!enable) {
+		geo_clear();
 	}
+	G.enable = enable;
 }
 
-void sprite_draw(struct sprite *s, struct srt *srt) {
+static void geo_push(intptr_t k) {
+	if (G.key_n >= G.key_cap) {
+		G.key_cap = G.key_cap ? G.key_cap * 2 : 64;
+		G.key = (intptr_t *)realloc(G.key, G.key_cap * sizeof(intptr_t));
+	}
+	G.key[G.key_n++] = k;
+}
+
+// append the key of the subtree below s, return 0 if a node carries its own state
+static int geo_key(struct sprite *s) {
+	int i, frame;
+	struct pack_frame *pf;
+	frame = get_frame(s);
+	geo_push((intptr_t)s->s.ani);
+	geo_push(frame);
+	if (frame < 0) {
+		return 1;
+	}
+	pf = &s->s.ani->frame[frame];
+	for (i = 0; i < pf->n; i++) {
+		struct sprite *c = s->data.children[pf->part[i].component_id];
+		if (!c || (c->flag & SPRITE_FLAG_INVISIBLE)) {
+			geo_push(0);
+			continue;
+		}
+		if (c->t.mat || c->t.color != 0xffffffff || c->t.addi || c->t.pid != PROGRAM_DEFAULT
+			|| c->material || c->bitmap || (c->flag & SPRITE_FLAG_MULTIMOUNT)) {
+			return 0;
+		}
+		switch (c->type) {
+		case TYPE_PICTURE:
+		case TYPE_POLYGON:
+			geo_push((intptr_t)c->s.pic);
+			break;
+		case TYPE_PANEL:
+			if (c->data.scissor) {
+				return 0;
+			}
+			geo_push(0);
+			break;
+		case TYPE_ANIMATION:
+			if (!geo_key(c)) {
+				return 0;
+			}
+			break;
+		default:
+			// labels and anchors are drawn per instance
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static inline void geo_point(const struct matrix *mat, int32_t x, int32_t y, int32_t *out) {
+	if (!mat) {
+		out[0] = x;
+		out[1] = y;
+	} else {
+		const int *m = mat->m;
+		out[0] = (x * m[0] + y * m[2]) / 1024 + m[4];
+		out[1] = (x * m[1] + y * m[3]) / 1024 + m[5];
+	}
+}
+
+static struct geo_quad *geo_quad(struct geometry *g, int texid, struct sprite_trans *t) {
+	struct geo_quad *q;
+	if (g->quad_n >= g->quad_cap) {
+		g->quad_cap = g->quad_cap ? g->quad_cap * 2 : 16;
+		g->quad = (struct geo_quad *)realloc(g->quad, g->quad_cap * sizeof(struct geo_quad));
+	}
+	q = &g->quad[g->quad_n++];
+	q->texid = texid;
+	q->pid = t->pid;
+	q->color = t->color;
+	q->addi = t->addi;
+	return q;
+}
+
+static void geo_build(struct geometry *g, struct sprite *s, struct sprite_trans *t) {
+	int i, j, k;
+	struct pack_frame *pf;
+	int frame = get_frame(s);
+	if (frame < 0) {
+		return;
+	}
+	pf = &s->s.ani->frame[frame];
+	for (i = 0; i < pf->n; i++) {
+		struct sprite_trans tran;
+		struct matrix mat;
+		struct sprite_trans *ct;
+		struct pack_part *pp = &pf->part[i];
+		struct sprite *c = s->data.children[pp->component_id];
+		if (!c || (c->flag & SPRITE_FLAG_INVISIBLE)) {
+			continue;
+		}
+		ct = sprite_trans_mul(&pp->t, t, &tran, &mat);
+		switch (c->type) {
+		case TYPE_PICTURE:
+			for (j = 0; j < c->s.pic->n; j++) {
+				struct pack_quad *pq = &c->s.pic->rect[j];
+				struct geo_quad *q = geo_quad(g, pq->texid, ct);
+				for (k = 0; k < 4; k++) {
+					geo_point(ct->mat, pq->screen_coord[k * 2], pq->screen_coord[k * 2 + 1], &q->coord[k * 2]);
+				}
+				memcpy(q->texcoord, pq->texture_coord, sizeof(q->texcoord));
+			}
+			break;
+		case TYPE_POLYGON:
+			for (j = 0; j < c->s.poly->n; j++) {
+				struct pack_poly *p = &c->s.poly->poly[j];
+				int max = p->n - 1;
+				int m = 0;
+				// the same fan of quads as shader_drawpolygon
+				do {
+					struct geo_quad *q = geo_quad(g, p->texid, ct);
+					for (k = 0; k < 4; k++) {
+						int v = k == 0 ? 0 : (m + k <= max ? m + k : max);
+						geo_point(ct->mat, p->screen_coord[v * 2], p->screen_coord[v * 2 + 1], &q->coord[k * 2]);
+						q->texcoord[k * 2] = p->texture_coord[v * 2];
+						q->texcoord[k * 2 + 1] = p->texture_coord[v * 2 + 1];
+					}
+					m += 2;
+				} while (m < max - 1);
+			}
+			break;
+		case TYPE_ANIMATION:
+			geo_build(g, c, ct);
+			break;
+		}
+	}
+}
+
+static unsigned int geo_hash(const intptr_t *key, int n) {
+	unsigned int h = 2166136261u;
+	int i;
+	for (i = 0; i < n; i++) {
+		h = (h ^ (unsigned int)key[i] ^ (unsigned int)((uint64_t)key[i] >> 32)) * 16777619u;
+	}
+	return h;
+}
+
+static struct geometry *geo_query(struct sprite *s) {
+	struct geometry *g;
+	struct sprite_trans ident = { 0, 0xffffffff, 0, PROGRAM_DEFAULT };
+	unsigned int h;
+	G.key_n = 0;
+	if (!geo_key(s)) {
+		return 0;
+	}
+	h = geo_hash(G.key, G.key_n);
+	for (g = G.slot[h % GEO_SLOT]; g; g = g->next) {
+		if (g->hash == h && g->key_n == G.key_n && 0 == memcmp(g->key, G.key, G.key_n * sizeof(intptr_t))) {
+			return g;
+		}
+	}
+	if (G.n >= GEO_MAX) {
+		geo_clear();
+	}
+	g = (struct geometry *)malloc(sizeof(struct geometry));
+	g->hash = h;
+	g->key_n = G.key_n;
+	g->key = (intptr_t *)malloc(G.key_n * sizeof(intptr_t));
+	memcpy(g->key, G.key, G.key_n * sizeof(intptr_t));
+	g->quad_n = 0;
+	g->quad_cap = 0;
+	g->quad = 0;
+	geo_build(g, s, &ident);
+	g->next = G.slot[h % GEO_SLOT];
+	G.slot[h % GEO_SLOT] = g;
+	G.n++;
+	return g;
+}
+
+// draw the animation s from the shared cache, return 0 if its subtree can not be cached
+static int geo_draw(struct sprite *s, struct srt *srt, struct sprite_trans *t, struct material *material) {
+	int i, pid = -2;
+	float f[6];
+	struct matrix tmp;
+	struct geometry *g = s->geo;
+	if (!g || s->geo_gen != G.generation) {
+		g = geo_query(s);
+		s->geo = g ? g : &GEO_NONE;
+		s->geo_gen = G.generation;
+	}
+	if (!g || g == &GEO_NONE) {
+		return 0;
+	}
+	if (!t->mat) {
+		matrix_identity(&tmp);
+	} else {
+		tmp = *t->mat;
+	}
+	matrix_srt(&tmp, srt);
+	screen_matrix(&tmp, f);
+	for (i = 0; i < g->quad_n; i++) {
+		struct geo_quad *q = &g->quad[i];
+		uint32_t color = q->color;
+		uint32_t addi = q->addi;
+		int qpid = q->pid != PROGRAM_DEFAULT ? q->pid : t->pid;
+		int glid = texture_rid(q->texid);
+		if (glid == 0)
+			continue;
+		if (qpid == PROGRAM_DEFAULT) {
+			qpid = PROGRAM_PICTURE;
+		}
+		if (qpid != pid) {
+			pid = qpid;
+			shader_program(pid, material);
+		}
+		if (color == 0xffffffff) {
+			color = t->color;
+		} else if (t->color != 0xffffffff) {
+			color = color_mul(color, t->color);
+		}
+		if (addi == 0) {
+			addi = t->addi;
+		} else if (t->addi != 0) {
+			addi = color_add(addi, t->addi);
+		}
+		shader_texture(glid, 0);
+		shader_addquad(f, q->coord, q->texcoord, color, addi);
+	}
+	return 1;
+}
+
+static void _draw_ani(struct sprite *s, struct srt *srt, struct material *material, struct sprite_trans *t);
+
+static int Culled = 0;
+
+// return 1 when s lies outside the viewport, safe to call from any thread
+static int cull_test(struct sprite *s, struct srt *srt, struct sprite_trans *t) {
+	int32_t tmp[4];
+	int aabb[4] = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+	const int32_t *bound = local_bound(s, tmp);
+	if (!bound) {
+		return 0;
+	}
+	bound_aabb(bound, srt, t->mat, aabb);
+	return screen_cull(aabb);
+}
+
+// return 1 when s lies outside the viewport and can be skipped
+static int cull_child(struct sprite *s, struct srt *srt, struct sprite_trans *t) {
+	if (cull_test(s, srt, t)) {
+		++Culled;
+		return 1;
+	}
+	return 0;
+}
+
+int sprite_culled(void) {
+	int n = Culled;
+	Culled = 0;
+	return n;
+}
+
+static int child_aabb(struct sprite *s, struct srt *srt, struct matrix *mat, int aabb[4]);
+
+static void target_destroy(int id) {
+	render_rem(TEXTURE, render_target_texture(id));
+	render_rem(TARGET, id);
+}
+
+static void bitmap_evict(struct bitmap *b) {
+	int i;
+	if (!b->target) {
+		return;
+	}
+	if (B.free_n < BITMAP_POOL) {
+		struct bitmap_target *bt = &B.free[B.free_n++];
+		bt->id = b->target;
+		bt->width = b->width;
+		bt->height = b->height;
+	} else {
+		target_destroy(b->target);
+		B.used -= b->width * b->height * 4;
+	}
+	b->target = 0;
+	b->valid = 0;
+	for (i = 0; i < B.n; i++) {
+		if (B.live[i] == b) {
+			B.live[i] = B.live[--B.n];
+			break;
+		}
+	}
+}
+
+// make room for size bytes, evicting only the bitmaps not drawn in this frame
+static int bitmap_reserve(int size) {
+	while (B.used + size > B.budget) {
+		int i;
+		struct bitmap *lru = 0;
+		if (B.free_n > 0) {
+			struct bitmap_target *bt = &B.free[--B.free_n];
+			target_destroy(bt->id);
+			B.used -= bt->width * bt->height * 4;
+			continue;
+		}
+		for (i = 0; i < B.n; i++) {
+			struct bitmap *b = B.live[i];
+			if (b->stamp != B.frame && (!lru || b->stamp < lru->stamp)) {
+				lru = b;
+			}
+		}
+		if (!lru) {
+			return 0;
+		}
+		bitmap_evict(lru);
+	}
+	return 1;
+}
+
+static int bitmap_target(struct bitmap *b, int pw, int ph) {
+	int i, size, width, height;
+	width = (pw + BITMAP_ALIGN - 1) / BITMAP_ALIGN * BITMAP_ALIGN;
+	height = (ph + BITMAP_ALIGN - 1) / BITMAP_ALIGN * BITMAP_ALIGN;
+	if (b->target) {
+		if (b->width == width && b->height == height) {
+			return 1;
+		}
+		bitmap_evict(b);
+	}
+	for (i = 0; i < B.free_n; i++) {
+		struct bitmap_target *bt = &B.free[i];
+		if (bt->width == width && bt->height == height) {
+			b->target = bt->id;
+			*bt = B.free[--B.free_n];
+			break;
+		}
+	}
+	if (!b->target) {
+		size = width * height * 4;
+		if (!bitmap_reserve(size)) {
+			return 0;
+		}
+		b->target = render_target_create(width, height, TEXTURE_RGBA8);
+		if (!b->target) {
+			return 0;
+		}
+		B.used += size;
+	}
+	b->width = width;
+	b->height = height;
+	if (B.n >= B.cap) {
+		B.cap = B.cap ? B.cap * 2 : 16;
+		B.live = (struct bitmap **)realloc(B.live, B.cap * sizeof(struct bitmap *));
+	}
+	B.live[B.n++] = b;
+	return 1;
+}
+
+static int bitmap_volatile(struct sprite *s) {
+	int i, frame;
+	struct pack_frame *pf;
+	if (s->flag & SPRITE_FLAG_MULTIMOUNT) {
+		return 1;
+	}
+	if (s->type == TYPE_ANCHOR) {
+		return 1;
+	}
+	if (s->type != TYPE_ANIMATION) {
+		return 0;
+	}
+	frame = get_frame(s);
+	if (frame < 0) {
+		return 0;
+	}
+	pf = &s->s.ani->frame[frame];
+	for (i = 0; i < pf->n; i++) {
+		struct sprite *c = s->data.children[pf->part[i].component_id];
+		if (c && (c->flag & SPRITE_FLAG_INVISIBLE) == 0 && bitmap_volatile(c)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// render the subtree of s into its target, in the local space of s
+static int bitmap_build(struct sprite *s, struct bitmap *b) {
+	int i, x0, y0, x1, y1, pw, ph;
+	int32_t tmp[4];
+	int aabb[4] = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+	const int32_t *bound = local_bound(s, tmp);
+	float scale = screen_scale();
+	float u, v;
+	struct matrix mat;
+	struct sprite_trans t = { &mat, 0xffffffff, 0, PROGRAM_DEFAULT };
+	if (bound) {
+		memcpy(aabb, bound, sizeof(aabb));
+	} else {
+		struct pack_frame *pf;
+		int frame = get_frame(s);
+		if (frame < 0) {
+			return 0;
+		}
+		pf = &s->s.ani->frame[frame];
+		for (i = 0; i < pf->n; i++) {
+			struct pack_part *pp = &pf->part[i];
+			struct sprite *c = s->data.children[pp->component_id];
+			if (c && (c->flag & SPRITE_FLAG_INVISIBLE) == 0) {
+				child_aabb(c, 0, pp->t.mat, aabb);
+			}
+		}
+	}
+	if (aabb[0] > aabb[2] || aabb[1] > aabb[3]) {
+		return 0;
+	}
+	// whole pixels with a border of one
+	x0 = (int)floorf((float)aabb[0] / SCREEN_SCALE) - 1;
+	y0 = (int)floorf((float)aabb[1] / SCREEN_SCALE) - 1;
+	x1 = (int)ceilf((float)aabb[2] / SCREEN_SCALE) + 1;
+	y1 = (int)ceilf((float)aabb[3] / SCREEN_SCALE) + 1;
+	pw = (int)ceilf((x1 - x0) * scale);
+	ph = (int)ceilf((y1 - y0) * scale);
+	if (pw > BITMAP_MAX || ph > BITMAP_MAX || !bitmap_target(b, pw, ph)) {
+		return 0;
+	}
+	matrix_identity(&mat);
+	mat.m[4] = -x0 * SCREEN_SCALE;
+	mat.m[5] = -y0 * SCREEN_SCALE;
+	shader_flush();
+	render_set(TARGET, b->target, 0);
+	screen_target(b->width, b->height);
+	shader_clear(0);
+	B.building = 1;
+	_draw_ani(s, 0, 0, &t);
+	B.building = 0;
+	label_flush();
+	shader_flush();
+	render_set(TARGET, 0, 0);
+	screen_target(0, 0);
+
+	// the target is drawn from the bottom row up, its top left is at v = 1
+	u = (x1 - x0) * scale / b->width;
+	v = 1.0f - (y1 - y0) * scale / b->height;
+	x0 *= SCREEN_SCALE;
+	y0 *= SCREEN_SCALE;
+	x1 *= SCREEN_SCALE;
+	y1 *= SCREEN_SCALE;
+	b->coord[0] = x0; b->coord[1] = y0;
+	b->coord[2] = x1; b->coord[3] = y0;
+	b->coord[4] = x1; b->coord[5] = y1;
+	b->coord[6] = x0; b->coord[7] = y1;
+	b->texcoord[0] = 0; b->texcoord[1] = 0xffff;
+	b->texcoord[2] = (uint16_t)(u * 0xffff); b->texcoord[3] = 0xffff;
+	b->texcoord[4] = (uint16_t)(u * 0xffff); b->texcoord[5] = (uint16_t)(v * 0xffff);
+	b->texcoord[6] = 0; b->texcoord[7] = (uint16_t)(v * 0xffff);
+	return 1;
+}
+
+// draw the animation s from its bitmap, return 0 if it must be drawn directly
+static int bitmap_draw(struct sprite *s, struct srt *srt, struct sprite_trans *t, struct material *material) {
+	struct bitmap *b = s->bitmap;
+	struct matrix tmp;
+	float f[6];
+	if (B.building) {
+		return 0;
+	}
+	b->stamp = B.frame;
+	if (!b->valid) {
+		if (b->volatile_tree || b->change == B.frame || scissor_active()) {
+			return 0;
+		}
+		if (bitmap_volatile(s)) {
+			b->volatile_tree = 1;
+			return 0;
+		}
+		if (!bitmap_build(s, b)) {
+			return 0;
+		}
+		b->valid = 1;
+	}
+	if (!t->mat) {
+		matrix_identity(&tmp);
+	} else {
+		tmp = *t->mat;
+	}
+	matrix_srt(&tmp, srt);
+	screen_matrix(&tmp, f);
+	switch_program(t, PROGRAM_PICTURE, material);
+	shader_texture(render_target_texture(b->target), 0);
+	shader_addquad(f, b->coord, b->texcoord, t->color, t->addi);
+	return 1;
+}
+
+int sprite_bitmap(struct sprite *s, int enable) {
+	if (enable) {
+		if (s->type != TYPE_ANIMATION) {
+			return 0;
+		}
+		if (!s->bitmap) {
+			s->bitmap = (struct bitmap *)malloc(sizeof(struct bitmap));
+			memset(s->bitmap, 0, sizeof(struct bitmap));
+			s->bitmap->s = s;
+			s->bitmap->change = B.frame;
+		}
+	} else if (s->bitmap) {
+		bitmap_evict(s->bitmap);
+		free(s->bitmap);
+		s->bitmap = 0;
+	}
+	return 1;
+}
+
+void sprite_bitmap_budget(int bytes) {
+	B.budget = bytes > 0 ? bytes : 0;
+	bitmap_reserve(0);
+}
+
+void sprite_bitmap_frame(void) {
+	B.frame++;
+}
+
+// return the number of scissors pushed, -1 if an off-screen scissor clips the rest of the frame
+static int draw_child(struct sprite *s, struct srt *srt, struct sprite_trans *ts, struct material *material) {
+	struct sprite_trans temp;
+	struct matrix temp_mat;
+	struct sprite_trans *t = sprite_trans_mul(&s->t, ts, &temp, &temp_mat);
+	if (s->material) {
+		material = s->material;
+	}
+	switch (s->type) {
+	case TYPE_PICTURE:
+		if (cull_child(s, srt, t)) {
+			return 0;
+		}
+		switch_program(t, PROGRAM_PICTURE, material);
+		sprite_drawquad(s->s.pic, srt, t);
+		return 0;
+	case TYPE_POLYGON:
+		if (cull_child(s, srt, t)) {
+			return 0;
+		}
+		switch_program(t, PROGRAM_PICTURE, material);
+		sprite_drawpolygon(s->s.poly, srt, t);
+		return 0;
+	case TYPE_LABEL:
+		if (s->data.rich_text && !cull_child(s, srt, t)) {
+			t->pid = PROGRAM_DEFAULT;
+			switch_program(t, s->s.label->edge ? PROGRAM_TEXT_EDGE : PROGRAM_TEXT, material);
+			label_draw(s->data.rich_text, s->s.label, srt, t);
+		}
+		return 0;
+	case TYPE_ANCHOR:
+		if (s->data.anchor->ps) {
+			switch_program(t, PROGRAM_PICTURE, material);
+			sprite_drawparticle(s, s->data.anchor->ps, s->data.anchor->pic, srt);
+		}
+		anchor_update(s, srt, t);
+		return 0;
+	case TYPE_PANEL:
+		if (s->data.scissor) {
+			if (cull_child(s, srt, t)) {
+				return -1;
+			}
+			set_scissor(s->s.panel, srt, t);
+			return 1;
+		} else {
+			return 0;
+		}
+	case TYPE_ANIMATION:
+		if (cull_child(s, srt, t)) {
+			return 0;
+		}
+		if (s->bitmap && bitmap_draw(s, srt, t, material)) {
+			return 0;
+		}
+		if (G.enable && geo_draw(s, srt, t, material)) {
+			return 0;
+		}
+		break;
+	default:
+		return 0;
+	}
+	_draw_ani(s, srt, material, t);
+	return 0;
+}
+
+// s, at t with its own trans, is clipped by an off-screen scissor and not drawn, its anchors
+// still follow the tree
+static void anchor_clipped(struct sprite *s, struct srt *srt, struct sprite_trans *t) {
+	int i, frame;
+	struct pack_frame *pf;
+	if (s->type == TYPE_ANCHOR) {
+		anchor_update(s, srt, t);
+		return;
+	}
+	if (s->type != TYPE_ANIMATION || (frame = get_frame(s)) < 0) {
+		return;
+	}
+	pf = &s->s.ani->frame[frame];
+	for (i = 0; i < pf->n; i++) {
+		struct sprite_trans tran;
+		struct matrix mat;
+		struct pack_part *pp = &pf->part[i];
+		struct sprite *child = s->data.children[pp->component_id];
+		if (child && (child->flag & SPRITE_FLAG_INVISIBLE) == 0) {
+			struct sprite_trans ctran;
+			struct matrix cmat;
+			struct sprite_trans *ct = sprite_trans_mul(&pp->t, t, &tran, &mat);
+			anchor_clipped(child, srt, sprite_trans_mul(&child->t, ct, &ctran, &cmat));
+		}
+	}
+}
+
+static void _draw_ani(struct sprite *s, struct srt *srt, struct material *material, struct sprite_trans *t) {
+	int i, ret, scissor = 0, clipped = 0;
+	struct pack_frame *pf;
+	struct pack_animation *ani = s->s.ani;
+	int frame = get_frame(s);
+	if (frame < 0) {
+		return;
+	}
+	pf = &ani->frame[frame];
+	for (i = 0; i < pf->n; i++) {
+		struct sprite_trans tran;
+		struct matrix mat;
+		struct sprite_trans *ct;
+		struct pack_part *pp = &pf->part[i];
+		int idx = pp->component_id;
+		struct sprite *child = s->data.children[idx];
+		if (!child || (child->flag & SPRITE_FLAG_INVISIBLE)) {
+			continue;
+		}
+		ct = sprite_trans_mul(&pp->t, t, &tran, &mat);
+		if (clipped) {
+			struct sprite_trans ctran;
+			struct matrix cmat;
+			anchor_clipped(child, srt, sprite_trans_mul(&child->t, ct, &ctran, &cmat));
+			continue;
+		}
+		ret = draw_child(child, srt, ct, material);
+		if (ret < 0) {
+			clipped = 1;
+			continue;
+		}
+		scissor += ret;
+	}
+	for (i = 0; i < scissor; i++) {
+		scissor_pop();
+	}
+}
+
+#define RECORD_GROUP 0
+#define RECORD_END 1
+#define RECORD_PICTURE 2
+#define RECORD_POLYGON 3
+#define RECORD_LABEL 4
+#define RECORD_ANCHOR 5
+#define RECORD_SCISSOR 6
+#define RECORD_BITMAP 7
+
+// one node of a flattened sprite tree, t is relative to the root of the list
+struct draw_record {
+	struct sprite *s;
+	struct material *material;
+	struct sprite_trans t;
+	struct matrix mat;
+	int type;
+	// group: the record after its end; scissor: the end of its group
+	int end;
+};
+
+struct drawlist {
+	int dirty;
+	// the tree holds multimount sprites, whose changes can not be tracked
+	int volatile_tree;
+	int n;
+	int cap;
+	int depth;
+	int *scissor;
+	struct draw_record *rec;
+};
+
+#define TOUCH_GRID 16
+
+// a touchable part or an animation of the tree, in the order test_child visits them,
+// placed in the space of the root before its own matrix and the srt
+struct touch_record {
+	struct sprite *s;
+	int group;
+	int parent;
+	// previous sibling in the frame; group: its last child
+	int prev;
+	int last;
+	int scissor;
+	int inverse;
+	int stamp;
+	int aabb[4];
+	struct matrix imat;
+	// group: the bound test_child checks in world space, and the matrix that takes it to the root
+	int bounded;
+	int32_t bound[4];
+	int has_mat;
+	struct matrix mat;
+};
+
+struct touchindex {
+	int dirty;
+	int volatile_tree;
+	int stamp;
+	// the query: the point before touch_point, the srt and the matrix of the root
+	int x;
+	int y;
+	struct srt *srt;
+	struct matrix *mat;
+	int n;
+	int cap;
+	struct touch_record *rec;
+	// grid over bound, cell[i]..cell[i+1] index item
+	int bound[4];
+	int cellw;
+	int cellh;
+	int cell[TOUCH_GRID * TOUCH_GRID + 1];
+	int item_n;
+	int *item;
+};
+
+static void sprite_dirty(struct sprite *s) {
+	for (; s; s = s->parent) {
+		if (s->list) {
+			s->list->dirty = 1;
+		}
+		if (s->index) {
+			s->index->dirty = 1;
+		}
+		if (s->bitmap) {
+			s->bitmap->valid = 0;
+			s->bitmap->volatile_tree = 0;
+			s->bitmap->change = B.frame;
+		}
+		s->geo = 0;
+	}
+}
+
+static int list_push(struct drawlist *dl, int type, struct sprite *s, struct sprite_trans *t, struct material *material) {
+	struct draw_record *rec;
+	if (dl->n >= dl->cap) {
+		dl->cap = dl->cap ? dl->cap * 2 : 16;
+		dl->rec = (struct draw_record *)realloc(dl->rec, dl->cap * sizeof(struct draw_record));
+	}
+	rec = &dl->rec[dl->n];
+	rec->s = s;
+	rec->material = material;
+	rec->t = *t;
+	if (t->mat) {
+		rec->mat = *t->mat;
+	}
+	rec->type = type;
+	rec->end = 0;
+	return dl->n++;
+}
+
+static void list_node(struct drawlist *dl, struct sprite *s, struct sprite_trans *t, struct material *material, int depth) {
+	int i, j, group, end, frame;
+	struct pack_frame *pf;
+	if (s->flag & SPRITE_FLAG_MULTIMOUNT) {
+		dl->volatile_tree = 1;
+	}
+	switch (s->type) {
+	case TYPE_PICTURE:
+		list_push(dl, RECORD_PICTURE, s, t, material);
+		return;
+	case TYPE_POLYGON:
+		list_push(dl, RECORD_POLYGON, s, t, material);
+		return;
+	case TYPE_LABEL:
+		list_push(dl, RECORD_LABEL, s, t, material);
+		return;
+	case TYPE_ANCHOR:
+		list_push(dl, RECORD_ANCHOR, s, t, material);
+		return;
+	case TYPE_PANEL:
+		if (s->data.scissor) {
+			list_push(dl, RECORD_SCISSOR, s, t, material);
+		}
+		return;
+	case TYPE_ANIMATION:
+		if (s->bitmap && depth > 0) {
+			list_push(dl, RECORD_BITMAP, s, t, material);
+			return;
+		}
+		break;
+	default:
+		return;
+	}
+	if (++depth > dl->depth) {
+		dl->depth = depth;
+	}
+	group = list_push(dl, RECORD_GROUP, s, t, material);
+	frame = get_frame(s);
+	if (frame >= 0) {
+		pf = &s->s.ani->frame[frame];
+		for (i = 0; i < pf->n; i++) {
+			struct sprite_trans tran, ctran;
+			struct matrix mat, cmat;
+			struct sprite_trans *ct;
+			struct pack_part *pp = &pf->part[i];
+			struct sprite *child = s->data.children[pp->component_id];
+			if (!child || (child->flag & SPRITE_FLAG_INVISIBLE)) {
+				continue;
+			}
+			ct = sprite_trans_mul(&pp->t, t, &tran, &mat);
+			ct = sprite_trans_mul(&child->t, ct, &ctran, &cmat);
+			list_node(dl, child, ct, child->material ? child->material : material, depth);
+		}
+	}
+	end = list_push(dl, RECORD_END, s, t, material);
+	dl->rec[group].end = end + 1;
+	for (j = group + 1; j < end;) {
+		struct draw_record *rec = &dl->rec[j];
+		if (rec->type == RECORD_GROUP) {
+			j = rec->end;
+		} else {
+			if (rec->type == RECORD_SCISSOR) {
+				rec->end = end;
+			}
+			j++;
+		}
+	}
+}
+
+static void list_build(struct sprite *root) {
+	int i;
+	struct drawlist *dl = root->list;
+	struct sprite_trans ident = { 0, 0xffffffff, 0, PROGRAM_DEFAULT };
+	dl->n = 0;
+	dl->depth = 0;
+	dl->dirty = 0;
+	dl->volatile_tree = 0;
+	list_node(dl, root, &ident, 0, 0);
+	for (i = 0; i < dl->n; i++) {
+		struct draw_record *rec = &dl->rec[i];
+		if (rec->t.mat) {
+			rec->t.mat = &rec->mat;
+		}
+	}
+	dl->scissor = (int *)realloc(dl->scissor, (dl->depth + 1) * sizeof(int));
+}
+
+// the records from..to are clipped by an off-screen scissor, their anchors still follow the tree,
+// those below a bitmap too
+static void list_clipped(struct sprite *root, struct srt *srt, int from, int to) {
+	int i;
+	struct drawlist *dl = root->list;
+	for (i = from; i < to; i++) {
+		struct sprite_trans temp;
+		struct matrix temp_mat;
+		struct draw_record *rec = &dl->rec[i];
+		if (rec->type == RECORD_ANCHOR || rec->type == RECORD_BITMAP) {
+			anchor_clipped(rec->s, srt, sprite_trans_mul(&rec->t, &root->t, &temp, &temp_mat));
+		}
+	}
+}
+
+static void list_draw(struct sprite *root, struct srt *srt) {
+	int i, depth = 0;
+	struct drawlist *dl = root->list;
+	int *scissor = dl->scissor;
+	for (i = 0; i < dl->n;) {
+		struct sprite_trans temp;
+		struct matrix temp_mat;
+		struct draw_record *rec = &dl->rec[i];
+		struct sprite *s = rec->s;
+		struct sprite_trans *t = sprite_trans_mul(&rec->t, &root->t, &temp, &temp_mat);
+		struct material *material = rec->material ? rec->material : root->material;
+		switch (rec->type) {
+		case RECORD_GROUP:
+			if (cull_child(s, srt, t)) {
+				i = rec->end;
+				continue;
+			}
+			scissor[++depth] = 0;
+			break;
+		case RECORD_END:
+			for (; scissor[depth] > 0; scissor[depth]--) {
+				scissor_pop();
+			}
+			depth--;
+			break;
+		case RECORD_PICTURE:
+			if (!cull_child(s, srt, t)) {
+				switch_program(t, PROGRAM_PICTURE, material);
+				sprite_drawquad(s->s.pic, srt, t);
+			}
+			break;
+		case RECORD_POLYGON:
+			if (!cull_child(s, srt, t)) {
+				switch_program(t, PROGRAM_PICTURE, material);
+				sprite_drawpolygon(s->s.poly, srt, t);
+			}
+			break;
+		case RECORD_LABEL:
+			if (s->data.rich_text && !cull_child(s, srt, t)) {
+				t->pid = PROGRAM_DEFAULT;
+				switch_program(t, s->s.label->edge ? PROGRAM_TEXT_EDGE : PROGRAM_TEXT, material);
+				label_draw(s->data.rich_text, s->s.label, srt, t);
+			}
+			break;
+		case RECORD_ANCHOR:
+			if (s->data.anchor->ps) {
+				switch_program(t, PROGRAM_PICTURE, material);
+				sprite_drawparticle(s, s->data.anchor->ps, s->data.anchor->pic, srt);
+			}
+			anchor_update(s, srt, t);
+			break;
+		case RECORD_SCISSOR:
+			if (cull_child(s, srt, t)) {
+				list_clipped(root, srt, i + 1, rec->end);
+				i = rec->end;
+				continue;
+			}
+			set_scissor(s->s.panel, srt, t);
+			scissor[depth]++;
+			break;
+		case RECORD_BITMAP:
+			if (!cull_child(s, srt, t) && !bitmap_draw(s, srt, t, material)) {
+				_draw_ani(s, srt, material, t);
+			}
+			break;
+		}
+		i++;
+	}
+}
+
+void sprite_drawlist(struct sprite *s, int enable) {
+	if (enable) {
+		if (!s->list) {
+			s->list = (struct drawlist *)malloc(sizeof(struct drawlist));
+			memset(s->list, 0, sizeof(struct drawlist));
+			s->list->dirty = 1;
+		}
+	} else if (s->list) {
+		free(s->list->rec);
+		free(s->list->scissor);
+		free(s->list);
+		s->list = 0;
+	}
+}
+
+void sprite_draw(struct sprite *s, struct srt *srt) {
 	if (!s) {
 		return;
 	}
-	if ((s->flag & SPRITE_FLAG_INVISIBLE) == 0) {
-		draw_child(s, srt, 0, 0);
+	if ((s->flag & SPRITE_FLAG_INVISIBLE) == 0) {
+		if (s->list && !s->bitmap) {
+			if (s->list->dirty || s->list->volatile_tree) {
+				list_build(s);
+			}
+			list_draw(s, srt);
+		} else {
+			draw_child(s, srt, 0, 0);
+		}
+	}
+}
+
+// a run of quads built off the main thread, or a sprite the main thread draws itself
+struct draw_op {
+	struct sprite *s;
+	struct srt *srt;
+	struct material *material;
+	int pid;
+	int tid;
+	int start;
+	int n;
+};
+
+// the draw ops of a contiguous range of roots, built by one thread
+struct draw_segment {
+	int op_n;
+	int op_cap;
+	struct draw_op *op;
+	int quad_n;
+	int quad_cap;
+	struct quad *quad;
+	int pid;
+	int tid;
+	struct material *material;
+	int reset;
+	int culled;
+};
+
+struct draw_job {
+	struct sprite **list;
+	int n;
+	struct srt *srt;
+	int seg_n;
+};
+
+static struct draw_segment *Segment = 0;
+static int Segment_n = 0;
+
+static void seg_program(struct draw_segment *seg, struct sprite_trans *t, int def, struct material *m) {
+	int pid = t->pid == PROGRAM_DEFAULT ? def : t->pid;
+	if (pid != seg->pid || m) {
+		seg->pid = pid;
+		seg->material = m;
+		seg->reset = 1;
+	}
+}
+
+static void seg_texture(struct draw_segment *seg, int tid) {
+	if (tid != seg->tid) {
+		seg->tid = tid;
+		seg->reset = 1;
+	}
+}
+
+static struct draw_op *seg_op(struct draw_segment *seg) {
+	struct draw_op *op;
+	if (seg->op_n >= seg->op_cap) {
+		seg->op_cap = seg->op_cap ? seg->op_cap * 2 : 64;
+		seg->op = (struct draw_op *)realloc(seg->op, seg->op_cap * sizeof(struct draw_op));
+	}
+	op = &seg->op[seg->op_n++];
+	op->s = 0;
+	op->srt = 0;
+	op->material = 0;
+	op->pid = seg->pid;
+	op->tid = seg->tid;
+	op->start = seg->quad_n;
+	op->n = 0;
+	return op;
+}
+
+static struct quad *seg_quad(struct draw_segment *seg) {
+	if (seg->reset) {
+		// every op of a program run keeps its material, the texture may split the run
+		struct draw_op *op = seg_op(seg);
+		op->material = seg->material;
+		seg->reset = 0;
+	}
+	if (seg->quad_n >= seg->quad_cap) {
+		seg->quad_cap = seg->quad_cap ? seg->quad_cap * 2 : 256;
+		seg->quad = (struct quad *)realloc(seg->quad, seg->quad_cap * sizeof(struct quad));
+	}
+	seg->op[seg->op_n - 1].n++;
+	return &seg->quad[seg->quad_n++];
+}
+
+static void seg_drawquad(struct draw_segment *seg, struct pack_picture *pic, struct srt *srt, struct sprite_trans *arg) {
+	struct matrix tmp;
+	float f[6];
+	int i;
+	if (!arg->mat) {
+		matrix_identity(&tmp);
+	} else {
+		tmp = *arg->mat;
+	}
+	matrix_srt(&tmp, srt);
+	screen_matrix(&tmp, f);
+	for (i = 0; i < pic->n; i++) {
+		struct quad *q;
+		struct pack_quad *pq = &pic->rect[i];
+		int glid = texture_rid(pq->texid);
+		if (glid == 0)
+			continue;
+		seg_texture(seg, glid);
+		q = seg_quad(seg);
+		vertex_transform(f, 4, pq->screen_coord, pq->texture_coord, &q->p[0].vp, sizeof(struct vertex));
+		renderbuffer_quadcolor(q, arg->color, arg->addi);
+	}
+}
+
+static void seg_drawpolygon(struct draw_segment *seg, struct pack_polygon *poly, struct srt *srt, struct sprite_trans *arg) {
+	struct matrix tmp;
+	float f[6];
+	int i, j, k;
+	if (!arg->mat) {
+		matrix_identity(&tmp);
+	} else {
+		tmp = *arg->mat;
+	}
+	matrix_srt(&tmp, srt);
+	screen_matrix(&tmp, f);
+	for (i = 0; i < poly->n; i++) {
+		struct pack_poly *p = &poly->poly[i];
+		int max = p->n - 1;
+		int glid = texture_rid(p->texid);
+#if defined(_MSC_VER)
+		struct vertex_pack *vb;
+#endif
+		if (glid == 0)
+			continue;
+		seg_texture(seg, glid);
+#if defined(_MSC_VER)
+		vb = _alloca(p->n*sizeof(struct vertex_pack));
+#else
+		struct vertex_pack vb[p->n];
+#endif
+		vertex_transform(f, p->n, p->screen_coord, p->texture_coord, vb, sizeof(struct vertex_pack));
+		// the same fan of quads as shader_drawpolygon
+		j = 0;
+		do {
+			struct quad *q = seg_quad(seg);
+			q->p[0].vp = vb[0];
+			for (k = 1; k < 4; k++) {
+				q->p[k].vp = vb[j + k <= max ? j + k : max];
+			}
+			renderbuffer_quadcolor(q, arg->color, arg->addi);
+			j += 2;
+		} while (j < max - 1);
+	}
+}
+
+// mirror draw_child for the parts that need no GL state, return -1 for any other
+static int seg_child(struct draw_segment *seg, struct sprite *s, struct srt *srt, struct sprite_trans *ts, struct material *material) {
+	int i, frame;
+	struct pack_frame *pf;
+	struct sprite_trans temp;
+	struct matrix temp_mat;
+	struct sprite_trans *t = sprite_trans_mul(&s->t, ts, &temp, &temp_mat);
+	if ((s->flag & SPRITE_FLAG_MULTIMOUNT) || s->bitmap) {
+		return -1;
+	}
+	if (s->material) {
+		material = s->material;
+	}
+	switch (s->type) {
+	case TYPE_PICTURE:
+		if (cull_test(s, srt, t)) {
+			seg->culled++;
+			return 0;
+		}
+		seg_program(seg, t, PROGRAM_PICTURE, material);
+		seg_drawquad(seg, s->s.pic, srt, t);
+		return 0;
+	case TYPE_POLYGON:
+		if (cull_test(s, srt, t)) {
+			seg->culled++;
+			return 0;
+		}
+		seg_program(seg, t, PROGRAM_PICTURE, material);
+		seg_drawpolygon(seg, s->s.poly, srt, t);
+		return 0;
+	case TYPE_ANCHOR:
+		if (s->data.anchor->ps) {
+			return -1;
+		}
+		anchor_update(s, srt, t);
+		return 0;
+	case TYPE_PANEL:
+		return s->data.scissor ? -1 : 0;
+	case TYPE_ANIMATION:
+		if (cull_test(s, srt, t)) {
+			seg->culled++;
+			return 0;
+		}
+		break;
+	default:
+		// labels touch the glyph cache
+		return -1;
+	}
+	frame = get_frame(s);
+	if (frame < 0) {
+		return 0;
+	}
+	pf = &s->s.ani->frame[frame];
+	for (i = 0; i < pf->n; i++) {
+		struct sprite_trans tran;
+		struct matrix mat;
+		struct pack_part *pp = &pf->part[i];
+		struct sprite *child = s->data.children[pp->component_id];
+		if (!child || (child->flag & SPRITE_FLAG_INVISIBLE)) {
+			continue;
+		}
+		if (seg_child(seg, child, srt, sprite_trans_mul(&pp->t, t, &tran, &mat), material) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// append the quads of the root s, or when a part of it needs the main thread, roll them back
+// and append s for the main thread to draw in place
+static void seg_root(struct draw_segment *seg, struct sprite *s, struct srt *srt) {
+	struct draw_op *op;
+	int op_n = seg->op_n;
+	int quad_n = seg->quad_n;
+	int culled = seg->culled;
+	// the quads of s may have gone to the last op before it bailed
+	int last_n = op_n > 0 ? seg->op[op_n - 1].n : 0;
+	if (s->list == 0 && seg_child(seg, s, srt, 0, 0) == 0) {
+		return;
+	}
+	seg->op_n = op_n;
+	seg->quad_n = quad_n;
+	seg->culled = culled;
+	if (op_n > 0) {
+		seg->op[op_n - 1].n = last_n;
+	}
+	seg->material = 0;
+	op = seg_op(seg);
+	op->s = s;
+	op->srt = srt;
+	seg->reset = 1;
+}
+
+static void seg_build(void *ud, int idx) {
+	int i, from, to;
+	struct draw_job *job = (struct draw_job *)ud;
+	struct draw_segment *seg = &Segment[idx];
+	from = job->n * idx / job->seg_n;
+	to = job->n * (idx + 1) / job->seg_n;
+	seg->op_n = 0;
+	seg->quad_n = 0;
+	seg->culled = 0;
+	seg->reset = 1;
+	seg->material = 0;
+	for (i = from; i < to; i++) {
+		struct sprite *s = job->list[i];
+		if (s && !(s->flag & SPRITE_FLAG_INVISIBLE)) {
+			seg_root(seg, s, job->srt);
+		}
+	}
+}
+
+void sprite_draw_roots(struct sprite **list, int n, struct srt *srt) {
+	int i, j;
+	struct draw_job job;
+	int seg_n = thread_count();
+	if (seg_n > n) {
+		seg_n = n;
+	}
+	if (seg_n <= 0) {
+		return;
+	}
+	if (seg_n > Segment_n) {
+		Segment = (struct draw_segment *)realloc(Segment, seg_n * sizeof(struct draw_segment));
+		memset(Segment + Segment_n, 0, (seg_n - Segment_n) * sizeof(struct draw_segment));
+		Segment_n = seg_n;
+	}
+	job.list = list;
+	job.n = n;
+	job.srt = srt;
+	job.seg_n = seg_n;
+	thread_run(seg_build, &job, seg_n);
+	for (i = 0; i < seg_n; i++) {
+		struct draw_segment *seg = &Segment[i];
+		Culled += seg->culled;
+		for (j = 0; j < seg->op_n; j++) {
+			struct draw_op *op = &seg->op[j];
+			if (op->s) {
+				sprite_draw(op->s, op->srt);
+			} else if (op->n > 0) {
+				shader_program(op->pid, op->material);
+				shader_texture(op->tid, 0);
+				shader_addquads(&seg->quad[op->start], op->n);
+			}
+		}
+	}
+}
+
+struct layer_item {
+	struct sprite *s;
+	struct srt srt;
+};
+
+struct layer {
+	int policy;
+	int n;
+	int cap;
+	struct layer_item *item;
+};
+
+static struct layer Layer[SPRITE_LAYER_MAX];
+static struct draw_segment Layer_seg;
+static int *Layer_order = 0;
+static int Layer_order_cap = 0;
+static int Layer_pending = 0;
+
+int sprite_layer(int layer, int policy) {
+	if (layer < 0 || layer >= SPRITE_LAYER_MAX) {
+		return 0;
+	}
+	Layer[layer].policy = policy;
+	return 1;
+}
+
+int sprite_submit(int layer, struct sprite *s, struct srt *srt) {
+	struct layer *l;
+	struct layer_item *item;
+	if (layer < 0 || layer >= SPRITE_LAYER_MAX) {
+		return 0;
+	}
+	l = &Layer[layer];
+	if (l->n >= l->cap) {
+		l->cap = l->cap ? l->cap * 2 : 64;
+		l->item = (struct layer_item *)realloc(l->item, l->cap * sizeof(struct layer_item));
+	}
+	item = &l->item[l->n++];
+	item->s = s;
+	Layer_pending++;
+	if (srt) {
+		item->srt = *srt;
+	} else {
+		item->srt.offx = 0;
+		item->srt.offy = 0;
+		item->srt.scalex = 1024;
+		item->srt.scaley = 1024;
+		item->srt.rot = 0;
+	}
+	return 1;
+}
+
+// quads first, by program, material and texture, then the sprites left to the main thread
+static int layer_order(const void *a, const void *b) {
+	int ia = *(const int *)a;
+	int ib = *(const int *)b;
+	const struct draw_op *x = &Layer_seg.op[ia];
+	const struct draw_op *y = &Layer_seg.op[ib];
+	if ((x->s != 0) != (y->s != 0)) {
+		return x->s ? 1 : -1;
+	}
+	if (x->pid != y->pid) {
+		return x->pid < y->pid ? -1 : 1;
+	}
+	if (x->material != y->material) {
+		return (uintptr_t)x->material < (uintptr_t)y->material ? -1 : 1;
+	}
+	if (x->tid != y->tid) {
+		return x->tid < y->tid ? -1 : 1;
+	}
+	return ia - ib;
+}
+
+static void layer_sorted(struct layer *l) {
+	int i;
+	struct draw_segment *seg = &Layer_seg;
+	seg->op_n = 0;
+	seg->quad_n = 0;
+	seg->culled = 0;
+	seg->reset = 1;
+	seg->material = 0;
+	for (i = 0; i < l->n; i++) {
+		struct layer_item *item = &l->item[i];
+		if (item->s && !(item->s->flag & SPRITE_FLAG_INVISIBLE)) {
+			seg_root(seg, item->s, &item->srt);
+		}
+	}
+	Culled += seg->culled;
+	if (seg->op_n > Layer_order_cap) {
+		Layer_order_cap = seg->op_n;
+		Layer_order = (int *)realloc(Layer_order, Layer_order_cap * sizeof(int));
+	}
+	for (i = 0; i < seg->op_n; i++) {
+		Layer_order[i] = i;
+	}
+	qsort(Layer_order, seg->op_n, sizeof(int), layer_order);
+	for (i = 0; i < seg->op_n; i++) {
+		struct draw_op *op = &seg->op[Layer_order[i]];
+		if (op->s) {
+			sprite_draw(op->s, op->srt);
+		} else if (op->n > 0) {
+			shader_program(op->pid, op->material);
+			shader_texture(op->tid, 0);
+			shader_addquads(&seg->quad[op->start], op->n);
+		}
+	}
+}
+
+void sprite_layer_flush(void) {
+	int i, j;
+	for (i = 0; i < SPRITE_LAYER_MAX; i++) {
+		struct layer *l = &Layer[i];
+		if (l->n == 0) {
+			continue;
+		}
+		if (l->policy == SPRITE_LAYER_SORTED) {
+			layer_sorted(l);
+		} else {
+			for (j = 0; j < l->n; j++) {
+				sprite_draw(l->item[j].s, &l->item[j].srt);
+			}
+		}
+		l->n = 0;
 	}
+	Layer_pending = 0;
 }
 
 void sprite_ps(struct sprite *s, int x, int y, float scale) {
@@ -550,6 +2305,8 @@ void sprite_ps(struct sprite *s, int x, int y, float scale) {
 		matrix_identity(m);
 		s->t.mat = m;
 	}
+	sprite_unbound(s->parent);
+	world_dirty(s);
 	mat = m->m;
 	x *= SCREEN_SCALE;
 	y *= SCREEN_SCALE;
@@ -575,6 +2332,8 @@ void sprite_scale(struct sprite *s, float scale) {
 		matrix_identity(m);
 		s->t.mat = m;
 	}
+	sprite_unbound(s->parent);
+	world_dirty(s);
 	mat = m->m;
 	scale *= 1024;
 	mat[0] = (int)scale;
@@ -593,6 +2352,8 @@ void sprite_sr(struct sprite *s, float sx, float sy, float r) {
 		matrix_identity(mat);
 		s->t.mat = mat;
 	}
+	sprite_unbound(s->parent);
+	world_dirty(s);
 	sx *= 1024;
 	sy *= 1024;
 	r *= (1024.0f / 360.f);
@@ -609,48 +2370,50 @@ void sprite_rot(struct sprite *s, float r) {
 		matrix_identity(mat);
 		s->t.mat = mat;
 	}
+	sprite_unbound(s->parent);
+	world_dirty(s);
 	r *= (1024.0f / 360.f);
 	matrix_sr(mat, 1024, 1024, (int)r);
 }
 
+struct matrix *sprite_world(struct sprite *s) {
+	if ((s->flag & SPRITE_FLAG_WORLD) == 0) {
+		struct matrix pmat;
+		sprite_pmatrix(s, &pmat);
+		if (s->t.mat) {
+			matrix_mul(&s->world, s->t.mat, &pmat);
+		} else {
+			s->world = pmat;
+		}
+		s->flag |= SPRITE_FLAG_WORLD;
+	}
+	return &s->world;
+}
+
 void sprite_pmatrix(struct sprite *s, struct matrix *mat) {
 	struct sprite *p = s->parent;
 	if (p) {
-		struct matrix tmp;
 		struct matrix *pmat, *cmat;
 		struct pack_animation *ani = p->s.ani;
-		struct pack_frame *pf;
 		int frame, i;
 		assert(p->type == TYPE_ANIMATION);
-		sprite_pmatrix(p, mat);
-		pmat = p->t.mat;
+		pmat = sprite_world(p);
 		cmat = 0;
 		frame = get_frame(p);
-		if (frame < 0) {
-			return;
-		}
-		pf = &ani->frame[frame];
-		for (i = 0; i < pf->n; i++) {
-			struct pack_part *pp = &pf->part[i];
-			int idx = pp->component_id;
-			struct sprite *child = p->data.children[idx];
-			if (child == s) {
-				cmat = pp->t.mat;
-				break;
+		if (frame >= 0) {
+			struct pack_frame *pf = &ani->frame[frame];
+			for (i = 0; i < pf->n; i++) {
+				struct pack_part *pp = &pf->part[i];
+				if (p->data.children[pp->component_id] == s) {
+					cmat = pp->t.mat;
+					break;
+				}
 			}
 		}
-		if (!pmat && !cmat) {
-			return;
-		}
-		if (pmat) {
-			matrix_mul(&tmp, pmat, mat);
-		} else {
-			tmp = *mat;
-		}
 		if (cmat) {
-			matrix_mul(mat, cmat, &tmp);
+			matrix_mul(mat, cmat, pmat);
 		} else {
-			*mat = tmp;
+			*mat = *pmat;
 		}
 	} else {
 		matrix_identity(mat);
@@ -664,20 +2427,19 @@ struct matrix *sprite_worldmatrix(struct sprite *s) {
 	return s->s.mat;
 }
 
-struct matrix *sprite_matrix(struct sprite *s, struct matrix *mat) {
-	struct matrix *oldmat;
-
+const struct matrix *sprite_matrix(struct sprite *s, struct matrix *mat) {
 	if (!s->t.mat) {
 		s->t.mat = &s->mat;
 		matrix_identity(&s->mat);
 	}
-	oldmat = s->t.mat;
 	if (!mat) {
-		return oldmat;
+		return s->t.mat;
 	}
 	s->t.mat = &s->mat;
 	s->mat = *mat;
-	return oldmat;
+	sprite_unbound(s->parent);
+	world_dirty(s);
+	return s->t.mat;
 }
 
 static struct matrix *mat_mul(struct matrix *a, struct matrix *b, struct matrix *tmp) {
@@ -691,91 +2453,77 @@ static struct matrix *mat_mul(struct matrix *a, struct matrix *b, struct matrix
 	return tmp;
 }
 
-static void poly_aabb(int n, const int32_t *point, struct srt *srt, struct matrix *mat, int aabb[4]) {
-	int *m;
-	int i;
-	struct matrix tmp;
-	if (!mat) {
-		matrix_identity(&tmp);
-	} else {
-		tmp = *mat;
-	}
-	matrix_srt(&tmp, srt);
-	m = tmp.m;
-	for (i = 0; i < n; i++) {
-		int x = point[i * 2];
-		int y = point[i * 2 + 1];
-		int xx = (x*m[0] + y*m[2]) / 1024 + m[4];
-		int yy = (x*m[1] + y*m[3]) / 1024 + m[5];
-
-		if (xx < aabb[0]) {
-			aabb[0] = xx;
-		}
-		if (xx > aabb[2]) {
-			aabb[2] = xx;
-		}
-		if (yy < aabb[1]) {
-			aabb[1] = yy;
+static const int32_t *frames_bound(struct sprite *s, int32_t tmp[4]) {
+	const int32_t *aabb;
+	switch (s->type) {
+	case TYPE_ANIMATION:
+		if (s->flag & SPRITE_FLAG_NOBOUND) {
+			return 0;
 		}
-		if (yy > aabb[3]) {
-			aabb[3] = yy;
+		if (s->flag & SPRITE_FLAG_STALEBOUND) {
+			sprite_rebound(s);
 		}
+		aabb = (s->flag & SPRITE_FLAG_REBOUND) ? s->bound : s->s.ani->aabb;
+		return aabb[0] == AABB_INFINITE ? 0 : aabb;
+	case TYPE_ANCHOR:
+		return 0;
+	default:
+		return local_bound(s, tmp);
 	}
 }
 
-static inline void quad_aabb(struct pack_picture *pic, struct srt *srt, struct matrix *mat, int aabb[4]) {
-	int i;
-	for (i = 0; i < pic->n; i++) {
-		poly_aabb(4, pic->rect[i].screen_coord, srt, mat, aabb);
+// bound s as the pack does, over every frame with its children as they are now, hidden ones too
+static void sprite_rebound(struct sprite *s) {
+	int i, j, clipped;
+	struct pack_animation *ani = s->s.ani;
+	int aabb[4] = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+	s->flag &= ~SPRITE_FLAG_STALEBOUND;
+	for (i = 0; i < ani->frame_n; i++) {
+		struct pack_frame *pf = &ani->frame[i];
+		clipped = 0;
+		for (j = 0; j < pf->n; j++) {
+			struct matrix tmp;
+			int32_t btmp[4];
+			struct pack_part *pp = &pf->part[j];
+			struct sprite *child = s->data.children[pp->component_id];
+			const int32_t *b;
+			if (!child) {
+				continue;
+			}
+			b = frames_bound(child, btmp);
+			if (!b) {
+				s->bound[0] = s->bound[1] = s->bound[2] = s->bound[3] = AABB_INFINITE;
+				return;
+			}
+			if (!clipped) {
+				bound_aabb(b, 0, mat_mul(child->t.mat, pp->t.mat, &tmp), aabb);
+			}
+			if (child->type == TYPE_PANEL && child->data.scissor) {
+				clipped = 1;
+			}
+		}
 	}
-}
-
-static inline void polygon_aabb(struct pack_polygon *polygon, struct srt *srt, struct matrix *mat, int aabb[4]) {
-	int i;
-	for (i = 0; i < polygon->n; i++) {
-		struct pack_poly *poly = &polygon->poly[i];
-		poly_aabb(poly->n, poly->screen_coord, srt, mat, aabb);
+	if (aabb[0] > aabb[2]) {
+		memset(aabb, 0, sizeof(aabb));
+	}
+	for (i = 0; i < 4; i++) {
+		s->bound[i] = aabb[i];
 	}
-}
-
-static inline void label_aabb(struct pack_label *lab, struct srt *srt, struct matrix *mat, int aabb[4]) {
-	int32_t pt[] = {
-		0,0,lab->width*SCREEN_SCALE,0,
-		0,lab->height*SCREEN_SCALE, lab->width*SCREEN_SCALE, lab->height*SCREEN_SCALE,
-	};
-	poly_aabb(4, pt, srt, mat, aabb);
-}
-
-static inline void panel_aabb(struct pack_panel *pp, struct srt *srt, struct matrix *mat, int aabb[4]) {
-	int32_t pt[] = {
-		0,0,pp->width*SCREEN_SCALE,0,
-		0,pp->height*SCREEN_SCALE,pp->width*SCREEN_SCALE,pp->height*SCREEN_SCALE,
-	};
-	poly_aabb(4, pt, srt, mat, aabb);
 }
 
 static int child_aabb(struct sprite *s, struct srt *srt, struct matrix *mat, int aabb[4]) {
 	struct pack_animation *ani;
 	int frame, i;
 	struct pack_frame *pf;
-	struct matrix tmp;
-	struct matrix *t = mat_mul(s->t.mat, mat, &tmp);
-	switch (s->type) {
-	case TYPE_PICTURE:
-		quad_aabb(s->s.pic, srt, t, aabb);
-		return 0;
-	case TYPE_POLYGON:
-		polygon_aabb(s->s.poly, srt, t, aabb);
-		return 0;
-	case TYPE_LABEL:
-		label_aabb(s->s.label, srt, t, aabb);
-		return 0;
-	case TYPE_PANEL:
-		panel_aabb(s->s.panel, srt, t, aabb);
-		return s->data.scissor;
-	case TYPE_ANIMATION:
-		break;
-	default:
+	struct matrix tmp;
+	int32_t btmp[4];
+	struct matrix *t = mat_mul(s->t.mat, mat, &tmp);
+	const int32_t *bound = local_bound(s, btmp);
+	if (bound) {
+		bound_aabb(bound, srt, t, aabb);
+		return s->type == TYPE_PANEL ? s->data.scissor : 0;
+	}
+	if (s->type != TYPE_ANIMATION) {
 		return 0;
 	}
 	ani = s->s.ani;
@@ -826,8 +2574,15 @@ void sprite_aabb(struct sprite *s, struct srt *srt, int world, int aabb[4]) {
 	}
 }
 
+static inline int test_bound(const int32_t aabb[4], int x, int y) {
+	return x >= aabb[0] && x <= aabb[2] && y >= aabb[1] && y <= aabb[3];
+}
+
 static int test_quad(struct pack_picture *pic, int x, int y) {
 	int p;
+	if (!test_bound(pic->aabb, x, y)) {
+		return 0;
+	}
 	for (p = 0; p < pic->n; p++) {
 		int maxx, maxy, minx, miny, i;
 		struct pack_quad *pq = &pic->rect[p];
@@ -856,6 +2611,9 @@ static int test_quad(struct pack_picture *pic, int x, int y) {
 
 static int test_polygon(struct pack_polygon *poly, int x, int y) {
 	int p;
+	if (!test_bound(poly->aabb, x, y)) {
+		return 0;
+	}
 	for (p = 0; p < poly->n; p++) {
 		struct pack_poly *pp = &poly->poly[p];
 		int i, maxx, maxy, minx, miny;
@@ -864,13 +2622,13 @@ static int test_polygon(struct pack_polygon *poly, int x, int y) {
 		for (i = 1; i < pp->n; i++) {
 			int xx = pp->screen_coord[i * 2 + 0];
 			int yy = pp->screen_coord[i * 2 + 1];
-			if (x<minx)
+			if (xx<minx)
 				minx = xx;
-			else if (x>maxx)
+			else if (xx>maxx)
 				maxx = xx;
-			if (y<miny)
+			if (yy<miny)
 				miny = yy;
-			else if (y>maxy)
+			else if (yy>maxy)
 				maxy = yy;
 		}
 		if (x >= minx && x <= maxx && y >= miny && y <= maxy) {
@@ -969,6 +2727,16 @@ static int test_child(struct sprite *s, struct srt *srt, struct matrix *mat, int
 	struct matrix *t = mat_mul(s->t.mat, mat, &tmp);
 	if (s->type == TYPE_ANIMATION) {
 		struct sprite *spr = 0;
+		int32_t btmp[4];
+		const int32_t *bound = local_bound(s, btmp);
+		if (bound) {
+			int aabb[4] = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+			bound_aabb(bound, srt, t, aabb);
+			if (!test_bound(aabb, x, y)) {
+				*touch = 0;
+				return 0;
+			}
+		}
 		test = test_animation(s, srt, t, x, y, &spr);
 		if (test) {
 			*touch = spr;
@@ -1026,13 +2794,374 @@ static int test_child(struct sprite *s, struct srt *srt, struct matrix *mat, int
 	}
 }
 
+static int touch_push(struct touchindex *ti, struct sprite *s, int parent, int prev) {
+	struct touch_record *rec;
+	if (ti->n >= ti->cap) {
+		ti->cap = ti->cap ? ti->cap * 2 : 16;
+		ti->rec = (struct touch_record *)realloc(ti->rec, ti->cap * sizeof(struct touch_record));
+	}
+	rec = &ti->rec[ti->n];
+	rec->s = s;
+	rec->group = 0;
+	rec->parent = parent;
+	rec->prev = prev;
+	rec->last = -1;
+	rec->scissor = 0;
+	rec->inverse = 0;
+	rec->stamp = 0;
+	rec->bounded = 0;
+	return ti->n++;
+}
+
+static int touch_node(struct touchindex *ti, struct sprite *s, struct matrix *mat, int parent, int prev) {
+	int i, idx, frame;
+	struct matrix tmp, full;
+	struct touch_record *rec;
+	// the matrix of the root goes with the srt into the query point
+	struct matrix *t = parent < 0 ? 0 : mat_mul(s->t.mat, mat, &tmp);
+	int32_t btmp[4];
+	const int32_t *bound;
+	if (s->flag & SPRITE_FLAG_MULTIMOUNT) {
+		ti->volatile_tree = 1;
+	}
+	switch (s->type) {
+	case TYPE_ANIMATION:
+		idx = touch_push(ti, s, parent, prev);
+		rec = &ti->rec[idx];
+		rec->group = 1;
+		bound = local_bound(s, btmp);
+		if (bound) {
+			rec->bounded = 1;
+			memcpy(rec->bound, bound, sizeof(rec->bound));
+		}
+		rec->has_mat = t != 0;
+		if (t) {
+			rec->mat = *t;
+		}
+		frame = get_frame(s);
+		if (frame >= 0) {
+			struct pack_frame *pf = &s->s.ani->frame[frame];
+			int last = -1;
+			for (i = 0; i < pf->n; i++) {
+				struct matrix temp2;
+				struct pack_part *pp = &pf->part[i];
+				struct sprite *child = s->data.children[pp->component_id];
+				int c;
+				if (!child || (child->flag & SPRITE_FLAG_INVISIBLE)) {
+					continue;
+				}
+				c = touch_node(ti, child, mat_mul(pp->t.mat, t, &temp2), idx, last);
+				if (c >= 0) {
+					last = c;
+				}
+			}
+			ti->rec[idx].last = last;
+		}
+		return idx;
+	case TYPE_PICTURE:
+	case TYPE_POLYGON:
+	case TYPE_LABEL:
+	case TYPE_PANEL:
+		break;
+	default:
+		return -1;
+	}
+	idx = touch_push(ti, s, parent, prev);
+	rec = &ti->rec[idx];
+	rec->scissor = s->type == TYPE_PANEL && s->data.scissor;
+	if (!t) {
+		matrix_identity(&full);
+	} else {
+		full = *t;
+	}
+	rec->inverse = matrix_inverse(&full, &rec->imat) == 0;
+	bound = local_bound(s, btmp);
+	rec->aabb[0] = rec->aabb[1] = INT_MAX;
+	rec->aabb[2] = rec->aabb[3] = INT_MIN;
+	bound_aabb(bound, 0, t, rec->aabb);
+	// the exact test rounds through the inverse matrix
+	rec->aabb[0] -= SCREEN_SCALE;
+	rec->aabb[1] -= SCREEN_SCALE;
+	rec->aabb[2] += SCREEN_SCALE;
+	rec->aabb[3] += SCREEN_SCALE;
+	return idx;
+}
+
+static inline void touch_cells(struct touchindex *ti, const int aabb[4], int r[4]) {
+	int i;
+	r[0] = (aabb[0] - ti->bound[0]) / ti->cellw;
+	r[1] = (aabb[1] - ti->bound[1]) / ti->cellh;
+	r[2] = (aabb[2] - ti->bound[0]) / ti->cellw;
+	r[3] = (aabb[3] - ti->bound[1]) / ti->cellh;
+	for (i = 0; i < 4; i++) {
+		if (r[i] < 0) {
+			r[i] = 0;
+		} else if (r[i] >= TOUCH_GRID) {
+			r[i] = TOUCH_GRID - 1;
+		}
+	}
+}
+
+static void touch_build(struct sprite *root) {
+	int i, x, y;
+	struct touchindex *ti = root->index;
+	ti->n = 0;
+	ti->dirty = 0;
+	ti->volatile_tree = 0;
+	touch_node(ti, root, 0, -1, -1);
+
+	ti->bound[0] = ti->bound[1] = INT_MAX;
+	ti->bound[2] = ti->bound[3] = INT_MIN;
+	for (i = 0; i < ti->n; i++) {
+		struct touch_record *rec = &ti->rec[i];
+		if (rec->group) {
+			continue;
+		}
+		if (rec->aabb[0] < ti->bound[0]) ti->bound[0] = rec->aabb[0];
+		if (rec->aabb[1] < ti->bound[1]) ti->bound[1] = rec->aabb[1];
+		if (rec->aabb[2] > ti->bound[2]) ti->bound[2] = rec->aabb[2];
+		if (rec->aabb[3] > ti->bound[3]) ti->bound[3] = rec->aabb[3];
+	}
+	if (ti->bound[0] > ti->bound[2]) {
+		return;
+	}
+	ti->cellw = (ti->bound[2] - ti->bound[0]) / TOUCH_GRID + 1;
+	ti->cellh = (ti->bound[3] - ti->bound[1]) / TOUCH_GRID + 1;
+
+	memset(ti->cell, 0, sizeof(ti->cell));
+	for (i = 0; i < ti->n; i++) {
+		int r[4];
+		if (ti->rec[i].group) {
+			continue;
+		}
+		touch_cells(ti, ti->rec[i].aabb, r);
+		for (y = r[1]; y <= r[3]; y++) {
+			for (x = r[0]; x <= r[2]; x++) {
+				ti->cell[y * TOUCH_GRID + x + 1]++;
+			}
+		}
+	}
+	for (i = 0; i < TOUCH_GRID * TOUCH_GRID; i++) {
+		ti->cell[i + 1] += ti->cell[i];
+	}
+	if (ti->cell[TOUCH_GRID * TOUCH_GRID] > ti->item_n) {
+		ti->item_n = ti->cell[TOUCH_GRID * TOUCH_GRID];
+		ti->item = (int *)realloc(ti->item, ti->item_n * sizeof(int));
+	}
+	for (i = 0; i < ti->n; i++) {
+		int r[4];
+		if (ti->rec[i].group) {
+			continue;
+		}
+		touch_cells(ti, ti->rec[i].aabb, r);
+		for (y = r[1]; y <= r[3]; y++) {
+			for (x = r[0]; x <= r[2]; x++) {
+				ti->item[ti->cell[y * TOUCH_GRID + x]++] = i;
+			}
+		}
+	}
+	// filling moved every offset to the start of the next cell
+	for (i = TOUCH_GRID * TOUCH_GRID; i > 0; i--) {
+		ti->cell[i] = ti->cell[i - 1];
+	}
+	ti->cell[0] = 0;
+}
+
+static int touch_record_test(struct touchindex *ti, int i, int x, int y, struct sprite **touch);
+
+static int touch_check(struct touchindex *ti, int i, int x, int y, struct sprite **touch) {
+	struct sprite *tmp = 0;
+	if (touch_record_test(ti, i, x, y, &tmp)) {
+		*touch = tmp;
+		return 1;
+	}
+	if (tmp) {
+		*touch = tmp;
+	}
+	return 0;
+}
+
+// the same walk as test_animation over the children of group g
+static int touch_group(struct touchindex *ti, int g, int x, int y, struct sprite **touch) {
+	int i, scissor;
+	int start = ti->rec[g].last;
+	while (start >= 0) {
+		for (scissor = start; scissor >= 0 && !ti->rec[scissor].scissor; scissor = ti->rec[scissor].prev)
+			;
+		if (scissor >= 0) {
+			struct sprite *tmp = 0;
+			touch_check(ti, scissor, x, y, &tmp);
+			if (!tmp) {
+				start = ti->rec[scissor].prev;
+				continue;
+			}
+		}
+		for (i = start; i >= 0; i = ti->rec[i].prev) {
+			if (touch_check(ti, i, x, y, touch)) {
+				return 1;
+			}
+			if (i == scissor) {
+				break;
+			}
+		}
+		start = scissor >= 0 ? ti->rec[scissor].prev : -1;
+	}
+	return 0;
+}
+
+// the bound of a group against the point of the query, as test_child tests it
+static int touch_bound(struct touchindex *ti, struct touch_record *rec) {
+	struct matrix tmp;
+	int aabb[4] = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+	bound_aabb(rec->bound, ti->srt, mat_mul(rec->has_mat ? &rec->mat : 0, ti->mat, &tmp), aabb);
+	return test_bound(aabb, ti->x, ti->y);
+}
+
+static int touch_record_test(struct touchindex *ti, int i, int x, int y, struct sprite **touch) {
+	int *m;
+	int xx, yy, test;
+	struct touch_record *rec = &ti->rec[i];
+	struct sprite *s = rec->s;
+	if (rec->stamp != ti->stamp) {
+		*touch = 0;
+		return 0;
+	}
+	if (rec->group) {
+		struct sprite *spr = 0;
+		if (rec->bounded && !touch_bound(ti, rec)) {
+			*touch = 0;
+			return 0;
+		}
+		if (touch_group(ti, i, x, y, &spr)) {
+			*touch = spr;
+			return 1;
+		} else if (spr) {
+			if (s->flag & SPRITE_FLAG_MESSAGE) {
+				*touch = s;
+				return 1;
+			}
+			*touch = spr;
+			return 0;
+		}
+		*touch = 0;
+		return 0;
+	}
+	if (!rec->inverse) {
+		*touch = 0;
+		return 0;
+	}
+	m = rec->imat.m;
+	xx = (x*m[0] + y*m[2]) / 1024 + m[4];
+	yy = (x*m[1] + y*m[3]) / 1024 + m[5];
+	switch (s->type) {
+	case TYPE_PICTURE:
+		test = test_quad(s->s.pic, xx, yy);
+		break;
+	case TYPE_POLYGON:
+		test = test_polygon(s->s.poly, xx, yy);
+		break;
+	case TYPE_LABEL:
+		test = test_label(s->s.label, xx, yy);
+		break;
+	default:
+		test = test_panel(s->s.panel, xx, yy);
+		break;
+	}
+	if (test) {
+		*touch = s;
+		return (s->flag & SPRITE_FLAG_MESSAGE);
+	}
+	*touch = 0;
+	return 0;
+}
+
+// bring the point back through the srt and the matrix of the root, into the space of the index
+static int touch_point(struct sprite *root, struct srt *srt, int *x, int *y) {
+	int *m;
+	int xx, yy;
+	struct matrix tmp, imat;
+	if (!root->t.mat) {
+		if (!srt) {
+			return 1;
+		}
+		matrix_identity(&tmp);
+	} else {
+		tmp = *root->t.mat;
+	}
+	matrix_srt(&tmp, srt);
+	if (matrix_inverse(&tmp, &imat)) {
+		return 0;
+	}
+	m = imat.m;
+	xx = (*x*m[0] + *y*m[2]) / 1024 + m[4];
+	yy = (*x*m[1] + *y*m[3]) / 1024 + m[5];
+	*x = xx;
+	*y = yy;
+	return 1;
+}
+
+// stamp the parts whose box holds the point and their groups, then test only those
+static int touch_test(struct sprite *root, struct srt *srt, int x, int y, struct sprite **touch) {
+	int i, cell, hit = 0;
+	struct touchindex *ti = root->index;
+	if (ti->dirty || ti->volatile_tree) {
+		touch_build(root);
+	}
+	*touch = 0;
+	ti->x = x;
+	ti->y = y;
+	ti->srt = srt;
+	ti->mat = root->t.mat;
+	if (!touch_point(root, srt, &x, &y)) {
+		return 0;
+	}
+	if (ti->n == 0 || x < ti->bound[0] || x > ti->bound[2] || y < ti->bound[1] || y > ti->bound[3]) {
+		return 0;
+	}
+	ti->stamp++;
+	cell = ((y - ti->bound[1]) / ti->cellh) * TOUCH_GRID + (x - ti->bound[0]) / ti->cellw;
+	for (i = ti->cell[cell]; i < ti->cell[cell + 1]; i++) {
+		int p = ti->item[i];
+		if (!test_bound(ti->rec[p].aabb, x, y)) {
+			continue;
+		}
+		hit = 1;
+		for (; p >= 0 && ti->rec[p].stamp != ti->stamp; p = ti->rec[p].parent) {
+			ti->rec[p].stamp = ti->stamp;
+		}
+	}
+	if (!hit) {
+		return 0;
+	}
+	return touch_record_test(ti, 0, x, y, touch);
+}
+
+void sprite_touchindex(struct sprite *s, int enable) {
+	if (enable) {
+		if (!s->index) {
+			s->index = (struct touchindex *)malloc(sizeof(struct touchindex));
+			memset(s->index, 0, sizeof(struct touchindex));
+			s->index->dirty = 1;
+		}
+	} else if (s->index) {
+		free(s->index->rec);
+		free(s->index->item);
+		free(s->index);
+		s->index = 0;
+	}
+}
+
 struct sprite *sprite_test(struct sprite *s, struct srt *srt, int x, int y) {
 	struct sprite *tmp = 0;
 	int test;
 
 	x *= SCREEN_SCALE;
 	y *= SCREEN_SCALE;
-	test = test_child(s, srt, 0, x, y, &tmp);
+	if (s->index) {
+		test = touch_test(s, srt, x, y, &tmp);
+	} else {
+		test = test_child(s, srt, 0, x, y, &tmp);
+	}
 	if (test) {
 		return tmp;
 	}
@@ -1051,6 +3180,8 @@ int sprite_visible(struct sprite *s, int visible) {
 		s->flag &= ~SPRITE_FLAG_INVISIBLE;
 	else
 		s->flag |= SPRITE_FLAG_INVISIBLE;
+	// bounds cover the hidden parts too
+	sprite_dirty(s->parent);
 	return v;
 }
 
@@ -1114,67 +3245,47 @@ int sprite_child_idx1(struct sprite *s, struct sprite *c) {
 }
 
 int sprite_child_idx(struct sprite *s, const char *name) {
-	int i;
-	struct pack_animation *ani;
-
 	assert(name);
 	if (s->type != TYPE_ANIMATION) {
 		return -1;
 	}
-	ani = s->s.ani;
-	for (i = 0; i < ani->component_n; i++) {
-		const char *cname = (const char *)ani->component[i].name;
-		if (cname && 0 == strcmp(name, cname)) {
-			return i;
-		}
-	}
-	return -1;
+	return spritepack_component(s->s.ani, name);
 }
 
 struct sprite *sprite_child(struct sprite *s, const char *name) {
-	int i;
-	struct pack_animation *ani;
-
-	assert(name);
-	if (s->type != TYPE_ANIMATION) {
+	int i = sprite_child_idx(s, name);
+	if (i < 0) {
 		return 0;
 	}
-	ani = s->s.ani;
-	for (i = 0; i < ani->component_n; i++) {
-		const char *cname = (const char *)ani->component[i].name;
-		if (cname && 0 == strcmp(name, cname)) {
-			return s->data.children[i];
-		}
-	}
-	return 0;
+	return s->data.children[i];
 }
 
 int sprite_child_visible(struct sprite *s, const char *name) {
-	int i, frame;
-	struct pack_animation *ani;
+	int i, idx, frame;
 	struct pack_frame *pf;
-	assert(name);
-	if (s->type != TYPE_ANIMATION) {
+	struct sprite *child;
+	idx = sprite_child_idx(s, name);
+	if (idx < 0) {
+		return 0;
+	}
+	child = s->data.children[idx];
+	if (!child || !child->name) {
 		return 0;
 	}
-	ani = s->s.ani;
 	frame = get_frame(s);
 	if (frame < 0) {
 		return 0;
 	}
-	pf = &ani->frame[frame];
+	pf = &s->s.ani->frame[frame];
 	for (i = 0; i < pf->n; i++) {
-		struct pack_part *pp = &pf->part[i];
-		int idx = pp->component_id;
-		struct sprite *child = s->data.children[idx];
-		if (child->name && strcmp(name, child->name) == 0) {
+		if (pf->part[i].component_id == idx) {
 			return 1;
 		}
 	}
 	return 0;
 }
 
-void sprite_mount(struct sprite *s, int idx, struct sprite *c) {
+static void mount_child(struct sprite *s, int idx, struct sprite *c) {
 	struct pack_animation *ani;
 	struct sprite *os;
 
@@ -1186,9 +3297,11 @@ void sprite_mount(struct sprite *s, int idx, struct sprite *c) {
 	if (os) {
 		os->parent = 0;
 		os->name = 0;
+		world_dirty(os);
 	}
 	s->data.children[idx] = c;
 	if (c) {
+		world_dirty(c);
 		assert(c->parent == 0);
 		if ((c->flag & SPRITE_FLAG_MULTIMOUNT) == 0) {
 			c->name = (const char *)ani->component[idx].name;
@@ -1203,6 +3316,11 @@ void sprite_mount(struct sprite *s, int idx, struct sprite *c) {
 	}
 }
 
+void sprite_mount(struct sprite *s, int idx, struct sprite *c) {
+	mount_child(s, idx, c);
+	sprite_unbound(s);
+}
+
 int sprite_frame1(struct sprite *s, int dframe) {
 	if (!s || s->type != TYPE_ANIMATION) {
 		return 0;
@@ -1225,27 +3343,168 @@ static inline int force_frame(struct sprite *s, int i, int force) {
 	return 0;
 }
 
-int sprite_frame(struct sprite *s, int frame, int force) {
-	int i, total;
-	struct pack_animation *ani;
-	if (!s || s->type != TYPE_ANIMATION) {
-		return 0;
-	}
-	if (-1 == frame) {
-		return s->frame;
-	}
-	s->frame = frame;
-	total = s->total_frame;
-	ani = s->s.ani;
-	for (i = 0; i < ani->component_n; i++) {
-		if (force_frame(s, i, force)) {
-			int t = sprite_frame(s->data.children[i], frame, force);
-			if (t > total) {
-				total = t;
+int sprite_frame(struct sprite *s, int frame, int force) {
+	int i, total;
+	struct pack_animation *ani;
+	if (!s || s->type != TYPE_ANIMATION) {
+		return 0;
+	}
+	if (-1 == frame) {
+		return s->frame;
+	}
+	if (s->frame != frame) {
+		s->frame = frame;
+		sprite_dirty(s);
+		world_dirty_children(s);
+	}
+	total = s->total_frame;
+	ani = s->s.ani;
+	for (i = 0; i < ani->component_n; i++) {
+		if (force_frame(s, i, force)) {
+			int t = sprite_frame(s->data.children[i], frame, force);
+			if (t > total) {
+				total = t;
+			}
+		}
+	}
+	return total;
+}
+
+// a sprite advanced by sprite_animate, s->anim is its slot + 1
+struct anim_slot {
+	struct sprite *s;
+	float rate;
+	float time;
+	int mode;
+	int dir;
+};
+
+struct anim_list {
+	int n;
+	int cap;
+	struct anim_slot *slot;
+	int done_n;
+	int done_cap;
+	struct sprite **done;
+};
+
+static struct anim_list A;
+
+int sprite_play(struct sprite *s, const char *action, float rate, int mode) {
+	int total;
+	struct anim_slot *slot;
+	if (!s || s->type != TYPE_ANIMATION) {
+		return -1;
+	}
+	if (action) {
+		total = sprite_action(s, action);
+		if (total < 0) {
+			return -1;
+		}
+	} else {
+		total = s->total_frame;
+		sprite_frame(s, 0, 0);
+	}
+	if (!s->anim) {
+		if (A.n >= A.cap) {
+			A.cap = A.cap ? A.cap * 2 : 64;
+			A.slot = (struct anim_slot *)realloc(A.slot, A.cap * sizeof(struct anim_slot));
+		}
+		A.slot[A.n].s = s;
+		s->anim = ++A.n;
+	}
+	slot = &A.slot[s->anim - 1];
+	slot->rate = rate;
+	slot->time = 0;
+	slot->mode = mode;
+	slot->dir = 1;
+	return total;
+}
+
+void sprite_stop(struct sprite *s) {
+	int idx;
+	if (!s || !s->anim) {
+		return;
+	}
+	idx = s->anim - 1;
+	s->anim = 0;
+	if (idx != --A.n) {
+		A.slot[idx] = A.slot[A.n];
+		A.slot[idx].s->anim = idx + 1;
+	}
+}
+
+// the frame of a slot after n steps, 1 when a once animation reaches its end
+static int anim_step(struct anim_slot *slot, int total, int n, int *frame) {
+	int f = *frame;
+	switch (slot->mode) {
+	case SPRITE_ANIM_ONCE:
+		f += n;
+		if (f >= total - 1) {
+			*frame = total - 1;
+			return 1;
+		}
+		break;
+	case SPRITE_ANIM_PINGPONG:
+		if (total < 2) {
+			f = 0;
+			break;
+		}
+		n %= (total - 1) * 2;
+		while (n-- > 0) {
+			f += slot->dir;
+			if (f >= total - 1) {
+				f = total - 1;
+				slot->dir = -1;
+			} else if (f <= 0) {
+				f = 0;
+				slot->dir = 1;
+			}
+		}
+		break;
+	default:
+		f = (f + n) % total;
+		break;
+	}
+	*frame = f;
+	return 0;
+}
+
+void sprite_animate(float dt) {
+	int i = 0;
+	A.done_n = 0;
+	while (i < A.n) {
+		struct anim_slot *slot = &A.slot[i];
+		struct sprite *s = slot->s;
+		int n, frame, done;
+		int total = s->total_frame;
+		slot->time += dt * slot->rate;
+		n = (int)slot->time;
+		if (n <= 0 || total <= 0) {
+			i++;
+			continue;
+		}
+		slot->time -= n;
+		frame = s->frame;
+		done = anim_step(slot, total, n, &frame);
+		sprite_frame(s, frame, 0);
+		if (done) {
+			if (A.done_n >= A.done_cap) {
+				A.done_cap = A.done_cap ? A.done_cap * 2 : 16;
+				A.done = (struct sprite **)realloc(A.done, A.done_cap * sizeof(struct sprite *));
 			}
+			A.done[A.done_n++] = s;
+			// the last slot moves into i
+			sprite_stop(s);
+		} else {
+			i++;
 		}
 	}
-	return total;
+}
+
+struct sprite **sprite_finished(int *n) {
+	*n = A.done_n;
+	return A.done;
 }
 
 const char *sprite_text(struct sprite *s, const char *text) {
@@ -1259,6 +3518,8 @@ const char *sprite_text(struct sprite *s, const char *text) {
 		}
 		return 0;
 	}
+	// a bitmap above s holds the old text
+	sprite_dirty(s);
 	if (0 == strcmp("", text)) {
 		if (s->data.rich_text) {
 			free(s->data.rich_text);
@@ -1303,6 +3564,7 @@ int sprite_scissor(struct sprite *s, int scissor) {
 	}
 	old_scissor = s->data.scissor;
 	s->data.scissor = scissor;
+	sprite_unbound(s->parent);
 	return old_scissor;
 }
 
@@ -1324,6 +3586,11 @@ static struct sprite *sprite_label_init(struct sprite *s, struct pack_label *pl)
 	s->frame = 0;
 	s->data.rich_text = 0;
 	s->material = 0;
+	s->list = 0;
+	s->index = 0;
+	s->anim = 0;
+	s->geo = 0;
+	s->bitmap = 0;
 	return s;
 }
 
@@ -1345,6 +3612,11 @@ static struct sprite *sprite_panel_init(struct sprite *s, struct pack_panel *pp)
 	s->frame = 0;
 	s->data.rich_text = 0;
 	s->material = 0;
+	s->list = 0;
+	s->index = 0;
+	s->anim = 0;
+	s->geo = 0;
+	s->bitmap = 0;
 	return s;
 }
 
@@ -1414,17 +3686,10 @@ static int rb_update_tex(struct renderbuffer *rb, int id) {
 }
 
 static int rb_drawquad(struct renderbuffer *rb, struct pack_picture *pic, const struct sprite_trans *arg) {
-	int *m;
 	int object;
-	struct matrix tmp;
-	struct vertex_pack vb[4];
-	int i, j;
-	if (arg->mat == NULL) {
-		matrix_identity(&tmp);
-	} else {
-		tmp = *arg->mat;
-	}
-	m = tmp.m;
+	float f[6];
+	int i;
+	vertex_matrix(arg->mat, 1.0f, 1.0f, f);
 	object = rb->object;
 	for (i = 0; i < pic->n; i++) {
 		struct pack_quad *q = &pic->rect[i];
@@ -1432,15 +3697,7 @@ static int rb_drawquad(struct renderbuffer *rb, struct pack_picture *pic, const
 			rb->object = object;
 			return -1;
 		}
-		for (j = 0; j < 4; j++) {
-			int xx = q->screen_coord[j * 2 + 0];
-			int yy = q->screen_coord[j * 2 + 1];
-			vb[j].vx = (xx * m[0] + yy * m[2]) / 1024.0f + m[4];
-			vb[j].vy = (xx * m[1] + yy * m[3]) / 1024.0f + m[5];
-			vb[j].tx = q->texture_coord[j * 2 + 0];
-			vb[j].ty = q->texture_coord[j * 2 + 1];
-		}
-		if (renderbuffer_addvertex(rb, vb, arg->color, arg->addi)) {
+		if (renderbuffer_addquad(rb, f, q->screen_coord, q->texture_coord, arg->color, arg->addi)) {
 			return 1;
 		}
 	}
@@ -1472,16 +3729,10 @@ static int rb_add_polygon(struct renderbuffer *rb, int n, const struct vertex_pa
 }
 
 static int rb_drawpolygon(struct renderbuffer *rb, struct pack_polygon *poly, const struct sprite_trans *arg) {
-	struct matrix tmp;
-	int i, j;
+	float f[6];
+	int i;
 	int object;
-	int *m;
-	if (!arg->mat) {
-		matrix_identity(&tmp);
-	} else {
-		tmp = *arg->mat;
-	}
-	m = tmp.m;
+	vertex_matrix(arg->mat, 1.0f, 1.0f, f);
 	object = rb->object;
 	for (i = 0; i < poly->n; i++) {
 #if defined(_MSC_VER)
@@ -1497,14 +3748,7 @@ static int rb_drawpolygon(struct renderbuffer *rb, struct pack_polygon *poly, co
 #else
 		struct vertex_pack vb[p->n];
 #endif
-		for (j = 0; j < p->n; j++) {
-			int xx = p->screen_coord[j * 2 + 0];
-			int yy = p->screen_coord[j * 2 + 1];
-			vb[j].vx = (xx * m[0] + yy * m[2]) / 1024.0f + m[4];
-			vb[j].vy = (xx * m[1] + yy * m[3]) / 1024.0f + m[5];
-			vb[j].tx = p->texture_coord[j * 2 + 0];
-			vb[j].ty = p->texture_coord[j * 2 + 1];
-		}
+		vertex_transform(f, p->n, p->screen_coord, p->texture_coord, vb, sizeof(struct vertex_pack));
 		if (rb_add_polygon(rb, p->n, vb, arg->color, arg->addi)) {
 			rb->object = object;
 			return 1;
@@ -1639,6 +3883,14 @@ static void lget_reftable(lua_State *L, int idx) {
 	}
 }
 
+static void lset_meta(lua_State *L, int idx) {
+	if (lua_getmetatable(L, idx)) {
+		lua_pop(L, 1);
+	} else if (lua_getmetatable(L, 1)) {
+		lua_setmetatable(L, idx);
+	}
+}
+
 static int lps(lua_State *L) {
 	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
 	struct matrix *mat = &s->mat;
@@ -1648,6 +3900,8 @@ static int lps(lua_State *L) {
 		matrix_identity(mat);
 		s->t.mat = mat;
 	}
+	sprite_unbound(s->parent);
+	world_dirty(s);
 	m = mat->m;
 	n = lua_gettop(L);
 	switch (n) {
@@ -1690,6 +3944,8 @@ static int lsr(lua_State *L) {
 		matrix_identity(mat);
 		s->t.mat = mat;
 	}
+	sprite_unbound(s->parent);
+	world_dirty(s);
 	n = lua_gettop(L);
 	switch (n) {
 	case 4:
@@ -1716,6 +3972,24 @@ static int ldraw(lua_State *L) {
 	return 0;
 }
 
+// the submitted sprites are kept alive until the first submit after the next flush
+static int lsubmit(lua_State *L) {
+	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
+	int layer = (int)luaL_checkinteger(L, 2);
+	struct srt srt;
+	if (!sprite_submit(layer, s, fill_srt(L, &srt, 3))) {
+		return luaL_error(L, "invalid layer %d", layer);
+	}
+	if (Layer_pending == 1) {
+		lua_newtable(L);
+		lua_setfield(L, LUA_REGISTRYINDEX, "PIXEL_SPRITE_LAYER");
+	}
+	lua_getfield(L, LUA_REGISTRYINDEX, "PIXEL_SPRITE_LAYER");
+	lua_pushvalue(L, 1);
+	lua_rawseti(L, -2, Layer_pending);
+	return 0;
+}
+
 static int lfetch(lua_State *L) {
 	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
 	const char *name = luaL_checkstring(L, 2);
@@ -1732,6 +4006,7 @@ static int lfetch(lua_State *L) {
 			lua_pushvalue(L, 1);
 			lua_rawseti(L, -2, 0);
 			lua_pop(L, 1);
+			lset_meta(L, top);
 		}
 	}
 	return 1;
@@ -1870,6 +4145,7 @@ static int ltest(lua_State *L) {
 		}
 		lua_replace(L, -2);
 	}
+	lset_meta(L, lua_gettop(L));
 	return 1;
 }
 
@@ -1980,18 +4256,102 @@ static const char *srt_key[] = {
 	"scale",
 };
 
+#define SPRITE_ANIM "PIXEL_SPRITE_ANIM"
+#define SPRITE_FINISH "PIXEL_SPRITE_FINISH"
+
+// registry table of the playing sprites by address. its values are weak, a sprite dropped while it
+// plays is collected and its __gc stops it
+static void lanim_table(lua_State *L) {
+	if (lua_getfield(L, LUA_REGISTRYINDEX, SPRITE_ANIM) != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_createtable(L, 0, 1);
+		lua_pushliteral(L, "v");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, LUA_REGISTRYINDEX, SPRITE_ANIM);
+	}
+}
+
+static int lplay(lua_State *L) {
+	static const char *modes[] = { "loop", "once", "pingpong", 0 };
+	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
+	const char *action = luaL_optstring(L, 2, 0);
+	float rate = (float)luaL_optnumber(L, 3, 30);
+	int mode = luaL_checkoption(L, 4, "loop", modes);
+	int total = sprite_play(s, action, rate, mode);
+	if (total < 0) {
+		return 0;
+	}
+	lanim_table(L);
+	lua_pushvalue(L, 1);
+	lua_rawsetp(L, -2, s);
+	lua_pushinteger(L, total);
+	return 1;
+}
+
+static int lstop(lua_State *L) {
+	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
+	sprite_stop(s);
+	lanim_table(L);
+	lua_pushnil(L);
+	lua_rawsetp(L, -2, s);
+	return 0;
+}
+
+static int lfinish(lua_State *L) {
+	if (!lua_isnoneornil(L, 1)) {
+		luaL_checktype(L, 1, LUA_TFUNCTION);
+	}
+	lua_settop(L, 1);
+	lua_setfield(L, LUA_REGISTRYINDEX, SPRITE_FINISH);
+	return 0;
+}
+
+int sprite_finish(lua_State *L) {
+	int i, j, n;
+	struct sprite **done = sprite_finished(&n);
+	if (n == 0) {
+		return 0;
+	}
+	lua_getfield(L, LUA_REGISTRYINDEX, SPRITE_FINISH);
+	lanim_table(L);
+	lua_createtable(L, n, 0);
+	for (i = j = 0; i < n; i++) {
+		// a sprite collected already, its __gc has not run yet
+		if (lua_rawgetp(L, -2, done[i]) == LUA_TNIL) {
+			lua_pop(L, 1);
+			continue;
+		}
+		lua_rawseti(L, -2, ++j);
+		lua_pushnil(L);
+		lua_rawsetp(L, -3, done[i]);
+	}
+	lua_remove(L, -2);
+	if (!lua_isfunction(L, -2)) {
+		lua_pop(L, 2);
+		return 0;
+	}
+	return 1;
+}
+
 static void lmethod(lua_State *L) {
 	luaL_Reg l[] = {
 		{"ps", lps},
 		{"sr", lsr},
 		{"draw", ldraw},
+		{"submit", lsubmit},
 		{"fetch", lfetch},
+		{"child", lfetch},
 		{"mount", lmount},
 		{"test", ltest},
 		{"aabb", laabb},
 		{"char_size", lchar_size},
 		{"child_visible", lchild_visible},
 		{"children_name", lchildren_name},
+		{"play", lplay},
+		{"stop", lstop},
 		{"anchor_particle", lanchor_particle},
 		{0, 0},
 	};
@@ -2038,13 +4398,16 @@ static int lget_visible(lua_State *L) {
 	return 1;
 }
 
+// a copy, with the methods of pixel.matrix once it is loaded, set it back for the sprite to move
 static int lget_matrix(lua_State *L) {
 	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
-	if (!s->t.mat) {
-		s->t.mat = &s->mat;
-		matrix_identity(&s->mat);
+	struct matrix *mat = (struct matrix *)lua_newuserdata(L, sizeof(struct matrix));
+	if (s->t.mat) {
+		*mat = *s->t.mat;
+	} else {
+		matrix_identity(mat);
 	}
-	lua_pushlightuserdata(L, s->t.mat);
+	luaL_setmetatable(L, "matrix");
 	return 1;
 }
 
@@ -2054,7 +4417,8 @@ static int lget_world_matrix(lua_State *L) {
 		lua_pushlightuserdata(L, s->s.mat);
 		return 1;
 	}
-	return luaL_error(L, "world matrix need a anchor");
+	lua_pushlightuserdata(L, sprite_world(s));
+	return 1;
 }
 
 static int lget_type(lua_State *L) {
@@ -2092,6 +4456,7 @@ static int lget_parent(lua_State *L) {
 	}
 	lua_getuservalue(L, 1);
 	lua_rawgeti(L, -1, 0);
+	lset_meta(L, lua_gettop(L));
 	return 1;
 }
 
@@ -2129,6 +4494,24 @@ static int lget_message(lua_State *L) {
 	return 1;
 }
 
+static int lget_drawlist(lua_State *L) {
+	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
+	lua_pushboolean(L, s->list != 0);
+	return 1;
+}
+
+static int lget_touchindex(lua_State *L) {
+	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
+	lua_pushboolean(L, s->index != 0);
+	return 1;
+}
+
+static int lget_bitmap(lua_State *L) {
+	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
+	lua_pushboolean(L, s->bitmap != 0);
+	return 1;
+}
+
 static uint32_t ud_key = 0xffff;
 static int lget_ud(lua_State *L) {
 	lget_reftable(L, 1);
@@ -2159,6 +4542,9 @@ static void lgetter(lua_State *L) {
 		{"material", lget_material},
 		{"text", lget_text},
 		{"message", lget_message},
+		{"drawlist", lget_drawlist},
+		{"touchindex", lget_touchindex},
+		{"bitmap", lget_bitmap},
 		{"ud", lget_ud},
 		{0, 0},
 	};
@@ -2194,6 +4580,7 @@ static int lset_visible(lua_State *L) {
 		s->flag &= ~SPRITE_FLAG_INVISIBLE;
 	else
 		s->flag |= SPRITE_FLAG_INVISIBLE;
+	sprite_dirty(s->parent);
 	return 0;
 }
 
@@ -2205,6 +4592,8 @@ static int lset_matrix(lua_State *L) {
 	}
 	s->t.mat = &s->mat;
 	s->mat = *mat;
+	sprite_unbound(s->parent);
+	world_dirty(s);
 	return 0;
 }
 
@@ -2212,6 +4601,7 @@ static int lset_color(lua_State *L) {
 	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
 	uint32_t color = (uint32_t)luaL_checkinteger(L, 2);
 	s->t.color = color;
+	sprite_dirty(s->parent);
 	return 0;
 }
 
@@ -2219,6 +4609,7 @@ static int lset_alpha(lua_State *L) {
 	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
 	uint8_t alpha = (uint8_t)lua_tonumber(L, 2);
 	s->t.color = (s->t.color & 0xffffff) | (alpha << 24);
+	sprite_dirty(s->parent);
 	return 0;
 }
 
@@ -2226,6 +4617,7 @@ static int lset_additive(lua_State *L) {
 	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
 	uint32_t additive = (uint32_t)luaL_checkinteger(L, 2);
 	s->t.addi = additive;
+	sprite_dirty(s->parent);
 	return 0;
 }
 
@@ -2242,6 +4634,7 @@ static int lset_program(lua_State *L) {
 		lua_pushnil(L);
 		lua_setfield(L, -2, "material");
 	}
+	sprite_dirty(s->parent);
 	return 0;
 }
 
@@ -2251,6 +4644,7 @@ static int lset_scissor(lua_State *L) {
 		return luaL_error(L, "scissor need a panel");
 	}
 	s->data.scissor = lua_toboolean(L, 2);
+	sprite_unbound(s->parent);
 	return 0;
 }
 
@@ -2259,6 +4653,7 @@ static int lset_text(lua_State *L) {
 	if (s->type != TYPE_LABEL) {
 		return luaL_error(L, "set text need a label");
 	}
+	sprite_dirty(s);
 	if (lua_isnoneornil(L, 2)) {
 		s->data.rich_text = 0;
 		lget_reftable(L, 1);
@@ -2350,6 +4745,26 @@ static int lset_message(lua_State *L) {
 	return 0;
 }
 
+static int lset_drawlist(lua_State *L) {
+	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
+	sprite_drawlist(s, lua_toboolean(L, 2));
+	return 0;
+}
+
+static int lset_touchindex(lua_State *L) {
+	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
+	sprite_touchindex(s, lua_toboolean(L, 2));
+	return 0;
+}
+
+static int lset_bitmap(lua_State *L) {
+	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
+	if (!sprite_bitmap(s, lua_toboolean(L, 2))) {
+		return luaL_error(L, "only animation can be cached as bitmap");
+	}
+	return 0;
+}
+
 static void lsetter(lua_State *L) {
 	luaL_Reg l[] = {
 		{"frame", lset_frame},
@@ -2364,75 +4779,50 @@ static void lsetter(lua_State *L) {
 		{"scissor", lset_scissor},
 		{"text", lset_text},
 		{"message", lset_message},
+		{"drawlist", lset_drawlist},
+		{"touchindex", lset_touchindex},
+		{"bitmap", lset_bitmap},
 		{0, 0},
 	};
 	luaL_newlib(L, l);
 }
 
-static struct sprite *l_new(lua_State *L, struct sprite_pack *pack, int id) {
-	int i;
-	int size;
-	struct sprite *s;
-	if (id == ANCHOR_ID) {
-		size = sizeof(struct sprite) + sizeof(struct anchor_data);
-		s = (struct sprite *)lua_newuserdata(L, size);
-		return _anchor_new(s, pack, id);
-	}
-	if (pack->type[id] == TYPE_ANIMATION) {
-		struct pack_animation *ani = (struct pack_animation *)pack->data[id];
-		size = sizeof(struct sprite) + (ani->component_n - 1)*sizeof(struct sprite *);
-	} else {
-		size = sizeof(struct sprite);
-	}
-	s = (struct sprite *)lua_newuserdata(L, size);
+// a tree of userdata copied from the tree t of a pool template, the children of a node are in
+// its uservalue
+static struct sprite *l_new(lua_State *L, struct sprite_pack *pack, const struct sprite *t) {
+	int i, n = 0;
+	int size = node_size(pack, t->id);
+	struct sprite *s = (struct sprite *)lua_newuserdata(L, size);
+	memcpy(s, t, size);
+	s->flag &= ~(SPRITE_FLAG_ARENA | SPRITE_FLAG_INARENA);
 	s->parent = 0;
-	s->t.mat = 0;
-	s->t.color = 0xffffffff;
-	s->t.addi = 0;
-	s->t.pid = PROGRAM_DEFAULT;
-	s->flag = 0;
-	s->name = 0;
-	s->id = id;
-	s->type = pack->type[id];
-	s->material = 0;
-	if (pack->type[id] == TYPE_ANIMATION) {
-		s->s.ani = (struct pack_animation *)pack->data[id];
-		s->frame = 0;
-		sprite_action(s, 0);
-		for (i = 0; i < s->s.ani->component_n; i++) {
-			s->data.children[i] = 0;
-		}
-	} else {
-		s->s.pic = (struct pack_picture *)pack->data[id];
-		s->start_frame = 0;
-		s->total_frame = 0;
-		s->frame = 0;
-		memset(&s->data, 0, sizeof(s->data));
-		if (s->type == TYPE_PANEL) {
-			struct pack_panel *pp = (struct pack_panel *)pack->data[id];
-			s->data.scissor = pp->scissor;
-		}
+	if (s->type == TYPE_ANCHOR) {
+		s->data.anchor = (struct anchor_data *)(s + 1);
+		s->s.mat = &s->data.anchor->mat;
+		return s;
 	}
-	for (i = 0; ; i++) {
+	if (s->type != TYPE_ANIMATION) {
+		return s;
+	}
+	for (i = 0; i < s->s.ani->component_n; i++) {
 		struct sprite *cs;
-		int cid = sprite_component(s, i);
-		if (cid < 0) {
-			break;
+		const struct sprite *ct = t->data.children[i];
+		if (!ct) {
+			continue;
 		}
-		if (i == 0) {
+		if (n++ == 0) {
 			lua_newtable(L);
 			lua_pushvalue(L, -1);
 			lua_setuservalue(L, -3);
 		}
-		cs = l_new(L, pack, cid);
-		if (cs) {
-			cs->name = sprite_childname(s, i);
-			sprite_mount(s, i, cs);
-			update_message(pack, cs, id, i, s->frame);
-			lua_rawseti(L, -2, i + 1);
+		cs = l_new(L, pack, ct);
+		if (ct->parent) {
+			cs->parent = s;
 		}
+		s->data.children[i] = cs;
+		lua_rawseti(L, -2, i + 1);
 	}
-	if (i > 0) {
+	if (n > 0) {
 		lua_pop(L, 1);
 	}
 	return s;
@@ -2441,7 +4831,8 @@ static struct sprite *l_new(lua_State *L, struct sprite_pack *pack, int id) {
 static int lnew(lua_State *L) {
 	struct sprite_pack *pack = (struct sprite_pack *)lua_touserdata(L, 1);
 	int id = (int)lua_tointeger(L, 2);
-	l_new(L, pack, id);
+	spritepack_require(pack, id);
+	l_new(L, pack, (struct sprite *)(arena_template(pack, id)->template + 1));
 	return 1;
 }
 
@@ -2456,6 +4847,7 @@ static int lmaterial(lua_State *L) {
 	s->material = (struct material *)lua_newuserdata(L, size);
 	memset(s->material, 0, size);
 	material_init(s->material, s->t.pid);
+	sprite_dirty(s->parent);
 	lua_setfield(L, -2, "__obj");
 	lua_pushvalue(L, -1);
 	lua_setfield(L, -3, "material");
@@ -2525,6 +4917,7 @@ static int lproxy(lua_State *L) {
 	static struct pack_frame frame = {
 		&part,
 		1,	// n
+		{ AABB_INFINITE, AABB_INFINITE, AABB_INFINITE, AABB_INFINITE },	// aabb
 	};
 	static struct pack_action action = {
 		0,	// name
@@ -2537,6 +4930,10 @@ static int lproxy(lua_State *L) {
 		1,	// frame_number
 		1,	// action_number
 		1,	// component_number
+		0,	// component_slot
+		0,	// action_slot
+		{ AABB_INFINITE, AABB_INFINITE, AABB_INFINITE, AABB_INFINITE },	// aabb
+		0,	// hash, searched linearly
 		{{
 			(uint8_t *)"proxy",	// name
 				0,		// id
@@ -2551,7 +4948,7 @@ static int lproxy(lua_State *L) {
 	s->t.color = 0xffffffff;
 	s->t.addi = 0;
 	s->t.pid = PROGRAM_DEFAULT;
-	s->flag = SPRITE_FLAG_MULTIMOUNT;
+	s->flag = SPRITE_FLAG_MULTIMOUNT | SPRITE_FLAG_NOBOUND;
 	s->name = 0;
 	s->id = 0;
 	s->type = TYPE_ANIMATION;
@@ -2559,11 +4956,171 @@ static int lproxy(lua_State *L) {
 	s->total_frame = 0;
 	s->frame = 0;
 	s->material = 0;
+	s->list = 0;
+	s->index = 0;
+	s->anim = 0;
+	s->geo = 0;
+	s->bitmap = 0;
 	s->data.children[0] = 0;
 	sprite_action(s, 0);
 	return 1;
 }
 
+static int lgc(lua_State *L) {
+	struct sprite *s = (struct sprite *)lua_touserdata(L, 1);
+	sprite_drawlist(s, 0);
+	sprite_touchindex(s, 0);
+	sprite_bitmap(s, 0);
+	sprite_stop(s);
+	return 0;
+}
+
+static int ldraw_parallel(lua_State *L) {
+	static struct sprite **list = 0;
+	static int cap = 0;
+	struct srt srt;
+	int i, n;
+	luaL_checktype(L, 1, LUA_TTABLE);
+	n = (int)lua_rawlen(L, 1);
+	if (n > cap) {
+		cap = n;
+		list = (struct sprite **)realloc(list, cap * sizeof(struct sprite *));
+	}
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, 1, i + 1);
+		list[i] = (struct sprite *)lua_touserdata(L, -1);
+		lua_pop(L, 1);
+	}
+	sprite_draw_roots(list, n, fill_srt(L, &srt, 2));
+	return 0;
+}
+
+static void pack_srt(struct srt *srt, double x, double y, double scale, double rot) {
+	srt->offx = (int)(x * SCREEN_SCALE);
+	srt->offy = (int)(y * SCREEN_SCALE);
+	srt->scalex = srt->scaley = (int)(scale * 1024);
+	srt->rot = (int)(rot * (1024.0 / 360.0));
+}
+
+/*
+ * draw_list(sprites, srt)
+ * srt holds x, y, scale, rot for each sprite, either as a flat array of numbers
+ * or as a string of native floats (string.pack("ffff", ...)), nil draws at origin.
+ */
+static int ldraw_list(lua_State *L) {
+	int i, n, t;
+	struct srt srt;
+	size_t sz = 0;
+	const float *packed = 0;
+	luaL_checktype(L, 1, LUA_TTABLE);
+	n = (int)lua_rawlen(L, 1);
+	t = lua_type(L, 2);
+	if (t == LUA_TSTRING) {
+		packed = (const float *)lua_tolstring(L, 2, &sz);
+		if (sz < (size_t)n * 4 * sizeof(float)) {
+			return luaL_error(L, "need %d packed floats", n * 4);
+		}
+	} else if (t == LUA_TTABLE) {
+		if ((int)lua_rawlen(L, 2) < n * 4) {
+			return luaL_error(L, "need %d numbers", n * 4);
+		}
+	} else {
+		fill_srt(L, &srt, 2);
+	}
+	for (i = 0; i < n; i++) {
+		struct sprite *s;
+		if (packed) {
+			const float *v = packed + i * 4;
+			pack_srt(&srt, v[0], v[1], v[2], v[3]);
+		} else if (t == LUA_TTABLE) {
+			int j;
+			double v[4];
+			for (j = 0; j < 4; j++) {
+				lua_rawgeti(L, 2, i * 4 + j + 1);
+				v[j] = lua_tonumber(L, -1);
+				lua_pop(L, 1);
+			}
+			pack_srt(&srt, v[0], v[1], v[2], v[3]);
+		}
+		lua_rawgeti(L, 1, i + 1);
+		s = (struct sprite *)lua_touserdata(L, -1);
+		lua_pop(L, 1);
+		sprite_draw(s, &srt);
+	}
+	return 0;
+}
+
+static int llayer(lua_State *L) {
+	static const char *policy[] = { "strict", "sorted", 0 };
+	int layer = (int)luaL_checkinteger(L, 1);
+	if (!sprite_layer(layer, luaL_checkoption(L, 2, "strict", policy))) {
+		return luaL_error(L, "invalid layer %d", layer);
+	}
+	return 0;
+}
+
+static int lbitmap_budget(lua_State *L) {
+	sprite_bitmap_budget((int)luaL_checkinteger(L, 1));
+	return 0;
+}
+
+static int lgeometry_cache(lua_State *L) {
+	sprite_geometry_cache(lua_toboolean(L, 1));
+	return 0;
+}
+
+static int lculled(lua_State *L) {
+	lua_pushinteger(L, sprite_culled());
+	return 1;
+}
+
+/* upvalues: method, get, set */
+static int lindex(lua_State *L) {
+	lua_CFunction f;
+	lua_settop(L, 2);
+	lua_pushvalue(L, 2);
+	if (lua_rawget(L, lua_upvalueindex(1)) != LUA_TNIL) {
+		return 1;
+	}
+	lua_pushvalue(L, 2);
+	if (lua_rawget(L, lua_upvalueindex(2)) != LUA_TNIL) {
+		f = lua_tocfunction(L, -1);
+		if (f) {
+			lua_settop(L, 1);
+			return f(L);
+		}
+		lua_pushvalue(L, 1);
+		lua_call(L, 1, 1);
+		return 1;
+	}
+	lua_settop(L, 2);
+	if (lua_type(L, 2) == LUA_TSTRING && lfetch(L) && lua_isuserdata(L, -1)) {
+		return 1;
+	}
+	pixel_log("unsupport get %s\n", luaL_tolstring(L, 2, 0));
+	return 0;
+}
+
+static int lnewindex(lua_State *L) {
+	lua_CFunction f;
+	lua_settop(L, 3);
+	lua_pushvalue(L, 2);
+	if (lua_rawget(L, lua_upvalueindex(3)) != LUA_TNIL) {
+		f = lua_tocfunction(L, -1);
+		if (f) {
+			lua_pop(L, 1);
+			lua_remove(L, 2);
+			return f(L);
+		}
+		lua_pushvalue(L, 1);
+		lua_pushvalue(L, 3);
+		lua_call(L, 2, 0);
+		return 0;
+	}
+	lua_pop(L, 1);
+	return lmount(L);
+}
+
 int pixel_sprite(lua_State *L) {
 	luaL_Reg l[] = {
 		{"new", lnew},
@@ -2571,15 +5128,45 @@ int pixel_sprite(lua_State *L) {
 		{"label", llabel},
 		{"panel", lpanel},
 		{"proxy", lproxy},
+		{"culled", lculled},
+		{"geometry_cache", lgeometry_cache},
+		{"bitmap_budget", lbitmap_budget},
+		{"layer", llayer},
+		{"gc", lgc},
+		{"finish", lfinish},
+		{0, 0},
+	};
+	// like the methods, they read an srt table through the key upvalues
+	luaL_Reg srt[] = {
+		{"draw_parallel", ldraw_parallel},
+		{"draw_list", ldraw_list},
 		{0, 0},
 	};
+	int i, n;
 	luaL_newlib(L, l);
+	n = sizeof(srt_key) / sizeof(srt_key[0]);
+	for (i = 0; i < n; i++) {
+		lua_pushstring(L, srt_key[i]);
+	}
+	luaL_setfuncs(L, srt, n);
+	lua_pushinteger(L, SPRITE_LAYER_MAX);
+	lua_setfield(L, -2, "layer_max");
 	lmethod(L);
 	lua_setfield(L, -2, "method");
 	lgetter(L);
 	lua_setfield(L, -2, "get");
 	lsetter(L);
 	lua_setfield(L, -2, "set");
+	lua_getfield(L, -1, "method");
+	lua_getfield(L, -2, "get");
+	lua_getfield(L, -3, "set");
+	lua_pushvalue(L, -3);
+	lua_pushvalue(L, -3);
+	lua_pushvalue(L, -3);
+	lua_pushcclosure(L, lindex, 3);
+	lua_setfield(L, -5, "index");
+	lua_pushcclosure(L, lnewindex, 3);
+	lua_setfield(L, -2, "newindex");
 	return 1;
 }
 
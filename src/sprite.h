@@ -8,15 +8,35 @@
 #define SPRITE_FLAG_MESSAGE 0x02
 #define SPRITE_FLAG_MULTIMOUNT 0x04
 #define SPRITE_FLAG_FORCEFRAME 0x08
+#define SPRITE_FLAG_NOBOUND 0x10
+#define SPRITE_FLAG_ARENA 0x20
+#define SPRITE_FLAG_INARENA 0x40
+#define SPRITE_FLAG_WORLD 0x80
+#define SPRITE_FLAG_REBOUND 0x100
+#define SPRITE_FLAG_STALEBOUND 0x200
+
+#define SPRITE_ANIM_LOOP 0
+#define SPRITE_ANIM_ONCE 1
+#define SPRITE_ANIM_PINGPONG 2
+
+#define SPRITE_LAYER_STRICT 0
+#define SPRITE_LAYER_SORTED 1
+// layers are 0 to SPRITE_LAYER_MAX - 1
+#define SPRITE_LAYER_MAX 16
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 	struct sprite;
+	//the whole tree is allocated in one block, its nodes are released with the root
 	struct sprite *sprite_new(const char *packname, const char *name);
 	void sprite_free(struct sprite *s);
+	//drop the released trees and the cached geometry kept for pack, 0 for all packs
+	void sprite_pool_clear(struct sprite_pack *pack);
 	void sprite_draw(struct sprite *s, struct srt *srt);
+	//draw the roots in order, their vertices are built on the worker threads
+	void sprite_draw_roots(struct sprite **list, int n, struct srt *srt);
 	void sprite_drawquad(struct pack_picture *pic, const struct srt *srt, const struct sprite_trans *arg);
 	void sprite_drawpolygon(struct pack_polygon *poly, const struct srt *srt, const struct sprite_trans *arg);
 	struct sprite *sprite_label(struct pack_label *pl, const char *text);
@@ -30,8 +50,12 @@ extern "C" {
 	int sprite_visible(struct sprite *s, int visible);
 	const char *sprite_name(struct sprite *s);
 	void sprite_pmatrix(struct sprite *s, struct matrix *mat);
+	//the world matrix of s without srt, cached until a matrix, frame or mount above s changes
+	struct matrix *sprite_world(struct sprite *s);
 	struct matrix *sprite_worldmatrix(struct sprite *s);
-	struct matrix *sprite_matrix(struct sprite *s, struct matrix *mat);
+	//set the matrix of s to mat if not null, return the matrix of s, which is changed through mat only
+	//for the cached world matrices and bounds to follow
+	const struct matrix *sprite_matrix(struct sprite *s, struct matrix *mat);
 	int sprite_action(struct sprite *s, const char *action);
 	//return component id
 	int sprite_component(struct sprite *s, int idx);
@@ -50,6 +74,33 @@ extern "C" {
 	//0 return current text, other set text
 	const char *sprite_text(struct sprite *s, const char *text);
 	int sprite_scissor(struct sprite *s, int scissor);
+	//return the number of parts culled since last call
+	int sprite_culled(void);
+	//draw s from a flattened list, rebuilt when the tree changes
+	void sprite_drawlist(struct sprite *s, int enable);
+	//keep a grid of the touchable parts of s for sprite_test, rebuilt when the tree changes
+	void sprite_touchindex(struct sprite *s, int enable);
+	//share the vertices of animations whose subtree has no state of its own, 0 drops the cache
+	void sprite_geometry_cache(int enable);
+	//draw the animation s from a render target holding its subtree, redrawn when the subtree changes
+	int sprite_bitmap(struct sprite *s, int enable);
+	//bytes of render targets all bitmaps may hold, the ones not drawn in this frame are evicted first
+	void sprite_bitmap_budget(int bytes);
+	//end of a frame
+	void sprite_bitmap_frame(void);
+	//strict layers draw in submit order, sorted ones batch their quads by program and texture,
+	//return 0 if layer is out of range
+	int sprite_layer(int layer, int policy);
+	//queue s for the next sprite_layer_flush, which draws the layers in ascending order
+	int sprite_submit(int layer, struct sprite *s, struct srt *srt);
+	void sprite_layer_flush(void);
+	//play action (0 the current one) at rate frames per second, return total frame or -1
+	int sprite_play(struct sprite *s, const char *action, float rate, int mode);
+	void sprite_stop(struct sprite *s);
+	//advance all playing sprites by dt seconds
+	void sprite_animate(float dt);
+	//the sprites whose once animation ended in the last sprite_animate
+	struct sprite **sprite_finished(int *n);
 
 	struct particle_system;
 	void sprite_particle(struct sprite *s, struct particle_system *ps, struct sprite *a);
@@ -58,6 +109,8 @@ extern "C" {
 #ifdef PIXEL_LUA
 #include "lua.h"
 	int pixel_sprite(lua_State *L);
+	//push the finish handler and the finished sprites, return 0 when there is nothing to call
+	int sprite_finish(lua_State *L);
 #endif // PIXEL_LUA
 
 #ifdef __cplusplus
@@ -6,6 +6,10 @@
 #include "stream.h"
 #include "pixel.h"
 #include "readfile.h"
+#include "screen.h"
+#include "thread.h"
+#include "sprite.h"
+#include "bundle.h"
 
 #include <stdint.h>
 #include <stdio.h>
@@ -35,6 +39,19 @@ static void *plloc(void *ud, int size) {
 
 struct spritepack {
 	int *tex;
+	// width and height of each texture when they are not loaded at import
+	const int *texsize;
+	// sections of the .pi while it is imported
+	char *bound;
+	int bound_size;
+	char *atlas;
+	int atlas_n;
+	// names imported so far, each is in the pack memory once
+	const char **names;
+	int names_n;
+	int names_cap;
+	// the sprites not imported yet of a pack loaded by pi_load
+	struct pack_lazy *lazy;
 	int matrix_n;
 	struct matrix *matrix;
 	struct slloc slloc;
@@ -42,18 +59,123 @@ struct spritepack {
 	struct sprite_pack *p;
 	struct hash *h;
 	int *export;
+	// kept to write the pack as an image
+	int size;
+	int *texture;
+	int texture_n;
+	// the texture ids are the caller's, they are not released with the pack
+	int borrowed;
+	char *export_data;
+	int export_size;
+	int export_n;
+	// size and hash of the .pi it is imported from, 0 when unknown, written into its image
+	uint32_t source_size;
+	uint32_t source_hash;
+	struct pack_image *image;
+	// its textures are atlases shared with other packs, it can not be written as an image
+	int shared;
+	// the storage holds one reference until the pack is unloaded, sprites one each
+	char *name;
+	int ref;
+	struct spritepack *next;
+};
+
+/*
+ * a pack loaded lazily keeps its .pi and imports a sprite, with the sprites it draws, the first
+ * time one is made of it. the pack memory is taken in the order sprites are imported, its pages
+ * are touched as they are used.
+ */
+struct pack_lazy {
+	// the sprites then the sections of the .pi
+	char *meta;
+	int size;
+	// by id, where the sprite starts in meta, -1 if the pack has no such sprite
+	int *offset;
+	// by id, the matrix table its parts refer to
+	struct matrix **matrix;
+	// by id, 0 if not bound yet, as _bound_sprite keeps it
+	uint8_t *state;
+	// by id, where its bounds start in the bound section, 0 if the pack has none
+	int *bound;
+	int *tex;
+	int n;
 };
 
 struct spritepack_storage {
+	// the loaded packs by name
 	struct hash *h;
-	struct spritepack *array;
-	int n;
+	// every pack not freed yet, unloaded ones included
+	struct spritepack *live;
+	// the same packs by the address of their sprite_pack
+	struct hash *owner;
 	int tex;
+	int *free_tex;
+	int free_n;
+	int free_cap;
+	// by texture id, the packs holding it, an atlas is held by every pack drawing from it
+	int *tex_ref;
+	int tex_ref_cap;
 	const char *path;
 };
 
 static struct spritepack_storage S = { 0,0,0 };
 
+static const int32_t Unbounded[4] = { AABB_INFINITE, AABB_INFINITE, AABB_INFINITE, AABB_INFINITE };
+
+static void aabb_init(int32_t aabb[4]) {
+	aabb[0] = INT32_MAX;
+	aabb[1] = INT32_MAX;
+	aabb[2] = INT32_MIN;
+	aabb[3] = INT32_MIN;
+}
+
+static void aabb_point(int32_t aabb[4], int32_t x, int32_t y) {
+	if (x < aabb[0]) {
+		aabb[0] = x;
+	}
+	if (x > aabb[2]) {
+		aabb[2] = x;
+	}
+	if (y < aabb[1]) {
+		aabb[1] = y;
+	}
+	if (y > aabb[3]) {
+		aabb[3] = y;
+	}
+}
+
+// an empty sprite bounds to its origin
+static void aabb_close(int32_t aabb[4]) {
+	if (aabb[0] == INT32_MAX) {
+		memset(aabb, 0, 4 * sizeof(int32_t));
+	}
+}
+
+// merge box b transformed by mat into aabb
+static void aabb_merge(int32_t aabb[4], const int32_t b[4], const struct matrix *mat) {
+	int i;
+	int32_t pt[8];
+	if (aabb[0] == AABB_INFINITE) {
+		return;
+	}
+	if (b[0] == AABB_INFINITE) {
+		memcpy(aabb, b, 4 * sizeof(int32_t));
+		return;
+	}
+	pt[0] = b[0]; pt[1] = b[1];
+	pt[2] = b[2]; pt[3] = b[1];
+	pt[4] = b[0]; pt[5] = b[3];
+	pt[6] = b[2]; pt[7] = b[3];
+	for (i = 0; i < 8; i += 2) {
+		if (mat) {
+			const int *m = mat->m;
+			aabb_point(aabb, (pt[i] * m[0] + pt[i + 1] * m[2]) / 1024 + m[4], (pt[i] * m[1] + pt[i + 1] * m[3]) / 1024 + m[5]);
+		} else {
+			aabb_point(aabb, pt[i], pt[i + 1]);
+		}
+	}
+}
+
 static void _import_matrix(struct spritepack *sp) {
 	int n, i;
 
@@ -69,6 +191,20 @@ static void _import_matrix(struct spritepack *sp) {
 	}
 }
 
+static void _import_coord(struct spritepack *sp, int texid, float x, float y, uint16_t *u, uint16_t *v) {
+	if (sp->texsize) {
+		texture_normalize(sp->texsize[texid * 2], sp->texsize[texid * 2 + 1], x, y, u, v);
+	} else if (texture_coord(sp->tex[texid], x, y, u, v) && texid < sp->atlas_n) {
+		// the texture is not loaded, normalize by the size the pack was compiled against
+		struct stream is;
+		int width, height;
+		stream_init(&is, sp->atlas + texid * 4, 4);
+		width = (uint16_t)stream_r16(&is);
+		height = (uint16_t)stream_r16(&is);
+		texture_normalize(width, height, x, y, u, v);
+	}
+}
+
 static void _import_picture(struct spritepack *sp) {
 	int i, n;
 	struct pack_picture *pp;
@@ -76,6 +212,7 @@ static void _import_picture(struct spritepack *sp) {
 	n = stream_r8(&sp->is);
 	pp = (struct pack_picture *)plloc(&sp->slloc, sizeof(struct pack_picture) + (n - 1)*sizeof(struct pack_quad));
 	pp->n = n;
+	aabb_init(pp->aabb);
 	for (i = 0; i < n; i++) {
 		int j;
 		struct pack_quad *q = &pp->rect[i];
@@ -84,12 +221,16 @@ static void _import_picture(struct spritepack *sp) {
 		for (j = 0; j < 8; j += 2) {
 			float x = (float)stream_r16(&sp->is);
 			float y = (float)stream_r16(&sp->is);
-			texture_coord(q->texid, x, y, &q->texture_coord[j], &q->texture_coord[j + 1]);
+			_import_coord(sp, texid, x, y, &q->texture_coord[j], &q->texture_coord[j + 1]);
 		}
 		for (j = 0; j < 8; j++) {
 			q->screen_coord[j] = stream_r32(&sp->is);
 		}
+		for (j = 0; j < 8; j += 2) {
+			aabb_point(pp->aabb, q->screen_coord[j], q->screen_coord[j + 1]);
+		}
 	}
+	aabb_close(pp->aabb);
 }
 
 static void _import_frame(struct spritepack *sp, struct pack_frame *pf, int component_n) {
@@ -140,6 +281,124 @@ static void _import_frame(struct spritepack *sp, struct pack_frame *pf, int comp
 	}
 }
 
+static unsigned int name_hashn(const char *name, int n) {
+	int i;
+	unsigned int h = 2166136261u;
+	for (i = 0; i < n; i++) {
+		h = (h ^ (uint8_t)name[i]) * 16777619u;
+	}
+	return h;
+}
+
+static unsigned int name_hash(const char *name) {
+	return name_hashn(name, (int)strlen(name));
+}
+
+static void names_insert(struct spritepack *sp, const char *name) {
+	unsigned int i, mask;
+	if (sp->names_n * 2 >= sp->names_cap) {
+		int j, cap = sp->names_cap;
+		const char **old = sp->names;
+		sp->names_cap = cap ? cap * 2 : 64;
+		sp->names = (const char **)calloc(sp->names_cap, sizeof(char *));
+		sp->names_n = 0;
+		for (j = 0; j < cap; j++) {
+			if (old[j]) {
+				names_insert(sp, old[j]);
+			}
+		}
+		free(old);
+	}
+	mask = sp->names_cap - 1;
+	for (i = name_hash(name) & mask; sp->names[i]; i = (i + 1) & mask)
+		;
+	sp->names[i] = name;
+	sp->names_n++;
+}
+
+// a component or action name, shared with the animations of the pack read before
+static const uint8_t *_import_name(struct spritepack *sp) {
+	unsigned int i, mask;
+	const char *name;
+	int n;
+	assert(sp->is.size > 0);
+	n = (uint8_t)sp->is.data[0];
+	if (n != 255 && sp->names_cap > 0) {
+		assert(sp->is.size > n);
+		mask = sp->names_cap - 1;
+		for (i = name_hashn(sp->is.data + 1, n) & mask; sp->names[i]; i = (i + 1) & mask) {
+			if (0 == memcmp(sp->names[i], sp->is.data + 1, n) && sp->names[i][n] == 0) {
+				sp->is.data += n + 1;
+				sp->is.size -= n + 1;
+				return (const uint8_t *)sp->names[i];
+			}
+		}
+	}
+	name = stream_rstr(&sp->is, 0, plloc, &sp->slloc);
+	if (name) {
+		names_insert(sp, name);
+	}
+	return (const uint8_t *)name;
+}
+
+
+static void name_insert(uint16_t *hash, int slot, const uint8_t *name, int idx, const void *base, int stride) {
+	unsigned int i;
+	if (!name) {
+		return;
+	}
+	for (i = name_hash((const char *)name) & (slot - 1); hash[i]; i = (i + 1) & (slot - 1)) {
+		const uint8_t *other = *(const uint8_t **)((const char *)base + (hash[i] - 1) * stride);
+		if (0 == strcmp((const char *)name, (const char *)other)) {
+			// the first one wins, as in a linear search
+			return;
+		}
+	}
+	hash[i] = idx + 1;
+}
+
+static int name_find(const uint16_t *hash, int slot, const char *name, const void *base, int stride) {
+	unsigned int i;
+	if (slot == 0) {
+		return -1;
+	}
+	for (i = name_hash(name) & (slot - 1); hash[i]; i = (i + 1) & (slot - 1)) {
+		const uint8_t *other = *(const uint8_t **)((const char *)base + (hash[i] - 1) * stride);
+		if (0 == strcmp(name, (const char *)other)) {
+			return hash[i] - 1;
+		}
+	}
+	return -1;
+}
+
+int spritepack_component(const struct pack_animation *ani, const char *name) {
+	int i;
+	if (ani->hash) {
+		return name_find(ani->hash, ani->component_slot, name, &ani->component[0].name, sizeof(struct pack_component));
+	}
+	for (i = 0; i < ani->component_n; i++) {
+		const char *cname = (const char *)ani->component[i].name;
+		if (cname && 0 == strcmp(name, cname)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int spritepack_action(const struct pack_animation *ani, const char *name) {
+	int i;
+	if (ani->hash) {
+		return name_find(ani->hash + ani->component_slot, ani->action_slot, name, &ani->action[0].name, sizeof(struct pack_action));
+	}
+	for (i = 0; i < ani->action_n; i++) {
+		const char *aname = (const char *)ani->action[i].name;
+		if (aname && 0 == strcmp(name, aname)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
 static void _import_animation(struct spritepack *sp) {
 	int i;
 	int frame = 0;
@@ -150,16 +409,26 @@ static void _import_animation(struct spritepack *sp) {
 	for (i = 0; i < component_n; i++) {
 		int id = stream_r16(&sp->is);
 		pa->component[i].id = id;
-		pa->component[i].name = (const uint8_t *)stream_rstr(&sp->is, 0, plloc, &sp->slloc);
+		pa->component[i].name = _import_name(sp);
 	}
 	pa->action_n = stream_r16(&sp->is);
 	pa->action = (struct pack_action *)plloc(&sp->slloc, pa->action_n*sizeof(struct pack_action));
 	for (i = 0; i < pa->action_n; i++) {
-		pa->action[i].name = (const uint8_t *)stream_rstr(&sp->is, 0, plloc, &sp->slloc);
+		pa->action[i].name = _import_name(sp);
 		pa->action[i].n = stream_r16(&sp->is);
 		pa->action[i].start_frame = frame;
 		frame += pa->action[i].n;
 	}
+	pa->component_slot = pack_name_slot(component_n);
+	pa->action_slot = pack_name_slot(pa->action_n);
+	pa->hash = (uint16_t *)plloc(&sp->slloc, pack_hash_size(component_n, pa->action_n));
+	memset(pa->hash, 0, (pa->component_slot + pa->action_slot) * sizeof(uint16_t));
+	for (i = 0; i < component_n; i++) {
+		name_insert(pa->hash, pa->component_slot, pa->component[i].name, i, &pa->component[0].name, sizeof(struct pack_component));
+	}
+	for (i = 0; i < pa->action_n; i++) {
+		name_insert(pa->hash + pa->component_slot, pa->action_slot, pa->action[i].name, i, &pa->action[0].name, sizeof(struct pack_action));
+	}
 	pa->frame_n = stream_r16(&sp->is);
 	pa->frame = (struct pack_frame *)plloc(&sp->slloc, pa->frame_n*sizeof(struct pack_frame));
 	for (i = 0; i < pa->frame_n; i++) {
@@ -192,6 +461,7 @@ static void _import_polygon(struct spritepack *sp) {
 	int n = stream_r8(&sp->is);
 	struct pack_polygon *pp = (struct pack_polygon *)plloc(&sp->slloc, sizeof(struct pack_polygon) + (n - 1)*sizeof(struct pack_poly));
 	pp->n = n;
+	aabb_init(pp->aabb);
 	for (i = 0; i < n; i++) {
 		struct pack_poly *p = &pp->poly[i];
 		int tid = stream_r8(&sp->is);
@@ -202,12 +472,16 @@ static void _import_polygon(struct spritepack *sp) {
 		for (j = 0; j < p->n * 2; j += 2) {
 			float x = (float)stream_r16(&sp->is);
 			float y = (float)stream_r16(&sp->is);
-			texture_coord(p->texid, x, y, &p->texture_coord[j], &p->texture_coord[j + 1]);
+			_import_coord(sp, tid, x, y, &p->texture_coord[j], &p->texture_coord[j + 1]);
 		}
 		for (j = 0; j < p->n * 2; j++) {
 			p->screen_coord[j] = stream_r32(&sp->is);
 		}
+		for (j = 0; j < p->n * 2; j += 2) {
+			aabb_point(pp->aabb, p->screen_coord[j], p->screen_coord[j + 1]);
+		}
 	}
+	aabb_close(pp->aabb);
 }
 
 void _import_sprite(struct spritepack *sp) {
@@ -243,141 +517,2225 @@ void _import_sprite(struct spritepack *sp) {
 	}
 }
 
-static int _require_tex(const char *file, int i, const char *ext) {
+static const int32_t *_bound_sprite(struct sprite_pack *p, uint8_t *state, int id, int32_t tmp[4]);
+
+// bound every frame of animation id, components are bound at the union of all their frames.
+// the parts after a scissor are clipped, but an anchor among them is updated as the frame is drawn
+static void _bound_animation(struct sprite_pack *p, uint8_t *state, int id) {
+	int i, j, clipped;
+	struct pack_animation *pa = (struct pack_animation *)p->data[id];
+	state[id] = 1;
+	aabb_init(pa->aabb);
+	for (i = 0; i < pa->frame_n; i++) {
+		struct pack_frame *pf = &pa->frame[i];
+		aabb_init(pf->aabb);
+		clipped = 0;
+		for (j = 0; j < pf->n; j++) {
+			int32_t tmp[4];
+			struct pack_part *pp = &pf->part[j];
+			int cid = pa->component[pp->component_id].id;
+			const int32_t *b = _bound_sprite(p, state, cid, tmp);
+			if (!clipped || b[0] == AABB_INFINITE) {
+				aabb_merge(pf->aabb, b, pp->t.mat);
+			}
+			if (cid < p->n && p->type[cid] == TYPE_PANEL && ((struct pack_panel *)p->data[cid])->scissor) {
+				clipped = 1;
+			}
+		}
+		aabb_close(pf->aabb);
+		aabb_merge(pa->aabb, pf->aabb, 0);
+	}
+	aabb_close(pa->aabb);
+	state[id] = 2;
+}
+
+static const int32_t *_bound_sprite(struct sprite_pack *p, uint8_t *state, int id, int32_t tmp[4]) {
+	if (id == ANCHOR_ID || id >= p->n) {
+		return Unbounded;
+	}
+	switch (p->type[id]) {
+	case TYPE_PICTURE:
+		return ((struct pack_picture *)p->data[id])->aabb;
+	case TYPE_POLYGON:
+		return ((struct pack_polygon *)p->data[id])->aabb;
+	case TYPE_LABEL:
+	{
+		struct pack_label *pl = (struct pack_label *)p->data[id];
+		tmp[0] = tmp[1] = 0;
+		tmp[2] = pl->width * SCREEN_SCALE;
+		tmp[3] = pl->height * SCREEN_SCALE;
+		return tmp;
+	}
+	case TYPE_PANEL:
+	{
+		struct pack_panel *pp = (struct pack_panel *)p->data[id];
+		tmp[0] = tmp[1] = 0;
+		tmp[2] = pp->width * SCREEN_SCALE;
+		tmp[3] = pp->height * SCREEN_SCALE;
+		return tmp;
+	}
+	case TYPE_ANIMATION:
+		if (state[id] == 0) {
+			_bound_animation(p, state, id);
+		}
+		if (state[id] == 1) {
+			return Unbounded;
+		}
+		return ((struct pack_animation *)p->data[id])->aabb;
+	default:
+		return Unbounded;
+	}
+}
+
+static void _import_bound(struct sprite_pack *p) {
+	int i;
+	uint8_t *state = (uint8_t *)malloc(p->n);
+	memset(state, 0, p->n);
+	for (i = 0; i < p->n; i++) {
+		if (p->type[i] == TYPE_ANIMATION && state[i] == 0) {
+			_bound_animation(p, state, i);
+		}
+	}
+	free(state);
+}
+
+static void _read_aabb(struct stream *is, int32_t aabb[4]) {
+	int i;
+	for (i = 0; i < 4; i++) {
+		int32_t v = stream_r32(is);
+		if (aabb) {
+			aabb[i] = v;
+		}
+	}
+}
+
+// the bound section of the pack compiler, 0 if it does not cover every animation of p as imported
+static int _import_bound_section(struct sprite_pack *p, char *data, int size, int apply) {
+	int i, j, n, animation_n = 0;
+	struct stream is;
+	for (i = 0; i < p->n; i++) {
+		if (p->type[i] == TYPE_ANIMATION) {
+			animation_n++;
+		}
+	}
+	stream_init(&is, data, size);
+	if (is.size < 2) {
+		return 0;
+	}
+	n = (uint16_t)stream_r16(&is);
+	if (n != animation_n) {
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		int id, frame_n;
+		struct pack_animation *pa;
+		if (is.size < 4) {
+			return 0;
+		}
+		id = (uint16_t)stream_r16(&is);
+		frame_n = (uint16_t)stream_r16(&is);
+		if (id >= p->n || p->type[id] != TYPE_ANIMATION) {
+			return 0;
+		}
+		pa = (struct pack_animation *)p->data[id];
+		if (pa->frame_n != frame_n || is.size < (frame_n + 1) * 16) {
+			return 0;
+		}
+		_read_aabb(&is, apply ? pa->aabb : 0);
+		for (j = 0; j < frame_n; j++) {
+			_read_aabb(&is, apply ? pa->frame[j].aabb : 0);
+		}
+	}
+	return 1;
+}
+
+static void _import_sections(struct spritepack *sp, char *data, int size) {
+	struct stream is;
+	stream_init(&is, data, size);
+	while (is.size >= 5) {
+		int tag = (uint8_t)stream_r8(&is);
+		int len = stream_r32(&is);
+		if (len < 0 || len > is.size) {
+			pixel_log("spritepack_import:broken section %d\n", tag);
+			break;
+		}
+		switch (tag) {
+		case PACK_SECTION_BOUND:
+			sp->bound = is.data;
+			sp->bound_size = len;
+			break;
+		case PACK_SECTION_ATLAS:
+			if (len >= 2) {
+				sp->atlas_n = (uint16_t)(((uint8_t)is.data[0]) | ((uint8_t)is.data[1]) << 8);
+				sp->atlas = is.data + 2;
+				if (sp->atlas_n * 4 > len - 2) {
+					sp->atlas_n = (len - 2) / 4;
+				}
+			}
+			break;
+		}
+		is.data += len;
+		is.size -= len;
+	}
+}
+
+static int _tex_alloc(void) {
+	int tid = S.free_n > 0 ? S.free_tex[--S.free_n] : S.tex++;
+	if (tid >= S.tex_ref_cap) {
+		S.tex_ref_cap = S.tex_ref_cap ? S.tex_ref_cap * 2 : 16;
+		S.tex_ref = (int *)realloc(S.tex_ref, S.tex_ref_cap * sizeof(int));
+	}
+	S.tex_ref[tid] = 1;
+	return tid;
+}
+
+static void _tex_free(int tid) {
+	if (S.free_n >= S.free_cap) {
+		S.free_cap = S.free_cap ? S.free_cap * 2 : 16;
+		S.free_tex = (int *)realloc(S.free_tex, S.free_cap * sizeof(int));
+	}
+	S.free_tex[S.free_n++] = tid;
+}
+
+static void _tex_retain(int tid) {
+	S.tex_ref[tid]++;
+}
+
+// unload tid with its last reference
+static void _tex_release(int tid) {
+	if (--S.tex_ref[tid] == 0) {
+		texture_unload(tid);
+		_tex_free(tid);
+	}
+}
+
+// the i-th texture (from 1) of file into tid, from the bundle of the pack when there is one
+static int _load_tex(struct bundle *b, const char *file, int i, int tid) {
 	char tmp[256];
-	sprintf(tmp, "%s%s.%d.%s", S.path, file, i, ext);
-	if (-1 == texture_loadfile(S.tex, tmp, 0)) {
+	char *data;
+	void *pixels;
+	int size, width, height, rid;
+	enum TEXTURE_FORMAT t;
+	if (!b) {
+		sprintf(tmp, "%s%s.%d.png", S.path, file, i);
+		return texture_loadfile(tid, tmp, 0);
+	}
+	sprintf(tmp, "%d.png", i);
+	data = bundle_load(b, tmp, &size);
+	if (!data) {
+		return -1;
+	}
+	pixels = texture_decode_memory(data, size, &width, &height, &t);
+	free(data);
+	if (!pixels) {
 		return -1;
 	}
-	return S.tex++;
+	rid = texture_load(tid, t, width, height, pixels, 0);
+	texture_release(pixels);
+	return rid;
+}
+
+// texture holds the ids to load into, owned by the caller, or 0 to take ids of the storage.
+// without a file the caller has loaded them already
+static void _load_textures(struct spritepack *sp, struct bundle *b, const char *file, int texture_n, const int *texture) {
+	int i;
+	sp->texture_n = texture_n;
+	sp->texture = (int *)malloc((texture_n + 1) * sizeof(int));
+	if (!file) {
+		memcpy(sp->texture, texture, texture_n * sizeof(int));
+		return;
+	}
+	for (i = 0; i < texture_n; i++) {
+		int tid = texture ? texture[i] : _tex_alloc();
+		if (-1 == _load_tex(b, file, i + 1, tid) && !texture) {
+			_tex_free(tid);
+			tid = -1;
+		}
+		sp->texture[i] = tid;
+	}
+}
+
+static void *alloc(void *ud, int size) {
+	return ud;
+}
+
+int spritepack_size(void) {
+	return sizeof(struct sprite_pack);
+}
+
+static void _import_pack(struct spritepack *sp, int *texture, int maxid, char *packdata, int packsize) {
+	sp->slloc.data = packdata;
+	sp->slloc.size = packsize;
+
+	sp->p = (struct sprite_pack *)plloc(&sp->slloc, sizeof(struct sprite_pack));
+	sp->p->n = maxid + 1;
+	sp->tex = texture;
+	sp->p->data = (void **)plloc(&sp->slloc, sp->p->n*sizeof(void *));
+	memset(sp->p->data, 0, sp->p->n*sizeof(void *));
+	sp->p->type = (int *)plloc(&sp->slloc, sp->p->n*sizeof(int));
+	memset(sp->p->type, 0, sp->p->n*sizeof(int));
+}
+
+// the sprites are the first datasize bytes of metadata, sections of the pack compiler follow them
+static void spritepack_import(struct spritepack *sp, int *texture, int maxid, char *packdata, int packsize, char *metadata, int datasize, int metasize) {
+	if (datasize < 0 || datasize > metasize) {
+		datasize = metasize;
+	}
+	_import_sections(sp, metadata + datasize, metasize - datasize);
+	stream_init(&sp->is, metadata, datasize);
+	_import_pack(sp, texture, maxid, packdata, packsize);
+
+	for (; sp->is.size > 0;) {
+		_import_sprite(sp);
+	}
+	if (sp->bound && _import_bound_section(sp->p, sp->bound, sp->bound_size, 0)) {
+		_import_bound_section(sp->p, sp->bound, sp->bound_size, 1);
+	} else {
+		_import_bound(sp->p);
+	}
+	free(sp->names);
+	sp->names = 0;
+	sp->names_n = sp->names_cap = 0;
+	sp->bound = sp->atlas = 0;
+	sp->bound_size = sp->atlas_n = 0;
+}
+
+static void _skip(struct stream *is, int n) {
+	assert(n >= 0 && is->size >= n);
+	is->data += n;
+	is->size -= n;
+}
+
+// the pack memory stream_rstr takes for the string, before _import_name shares it
+static int _skip_string(struct stream *is) {
+	int n = (uint8_t)stream_r8(is);
+	if (n == 255) {
+		return 0;
+	}
+	_skip(is, n);
+	return (n + 1 + 3) & ~3;
+}
+
+// step over a sprite as _import_sprite reads it, the pack memory its import takes at most, 0 if the type is unknown
+static int _skip_sprite(struct stream *is, int type) {
+	int i, j, n, size;
+	switch (type) {
+	case TYPE_PICTURE:
+		n = stream_r8(is);
+		for (i = 0; i < n; i++) {
+			_skip(is, 1 + 8 * 2 + 8 * 4);
+		}
+		return sizeof(struct pack_picture) + (n - 1) * sizeof(struct pack_quad);
+	case TYPE_POLYGON:
+		n = stream_r8(is);
+		size = sizeof(struct pack_polygon) + (n - 1) * sizeof(struct pack_poly);
+		for (i = 0; i < n; i++) {
+			int pn;
+			stream_r8(is);
+			pn = (uint16_t)stream_r8(is);
+			_skip(is, pn * 2 * 2 + pn * 2 * 4);
+			size += pn * 2 * (sizeof(uint16_t) + sizeof(int32_t));
+		}
+		return size;
+	case TYPE_ANIMATION:
+	{
+		int component_n = stream_r16(is);
+		int action_n;
+		size = sizeof(struct pack_animation) + (component_n - 1) * sizeof(struct pack_component);
+		for (i = 0; i < component_n; i++) {
+			stream_r16(is);
+			size += _skip_string(is);
+		}
+		action_n = (uint16_t)stream_r16(is);
+		size += action_n * sizeof(struct pack_action) + pack_hash_size(component_n, action_n);
+		for (i = 0; i < action_n; i++) {
+			size += _skip_string(is);
+			stream_r16(is);
+		}
+		n = (uint16_t)stream_r16(is);
+		size += n * sizeof(struct pack_frame);
+		for (i = 0; i < n; i++) {
+			int part_n = stream_r16(is);
+			size += part_n * sizeof(struct pack_part);
+			for (j = 0; j < part_n; j++) {
+				int tag = stream_r8(is);
+				_skip(is, (tag & TAG_ID ? 2 : 0) + (tag & TAG_MATRIX ? 24 : (tag & TAG_MATRIXREF ? 4 : 0))
+					+ (tag & TAG_COLOR ? 4 : 0) + (tag & TAG_ADDITIVE ? 4 : 0) + (tag & TAG_TOUCH ? 2 : 0));
+				if (tag & TAG_MATRIX) {
+					size += sizeof(struct matrix);
+				}
+			}
+		}
+		return size;
+	}
+	case TYPE_LABEL:
+		_skip(is, 15);
+		return sizeof(struct pack_label);
+	case TYPE_PANEL:
+		_skip(is, 9);
+		return sizeof(struct pack_panel);
+	default:
+		return 0;
+	}
+}
+
+// the pack memory the sprites of metadata take with the structs of this build. The packsize in the
+// header of a .pi is what its exporter counted, short of it for a .pi exported before the structs grew
+static int _pack_size(int maxid, char *metadata, int datasize, int metasize) {
+	struct stream is;
+	int size = sizeof(struct sprite_pack) + (maxid + 1) * (sizeof(void *) + sizeof(int));
+	if (datasize < 0 || datasize > metasize) {
+		datasize = metasize;
+	}
+	stream_init(&is, metadata, datasize);
+	while (is.size > 0) {
+		int n, type;
+		stream_r16(&is);
+		type = stream_r8(&is);
+		if (type == TYPE_MATRIX) {
+			n = stream_r32(&is);
+			_skip(&is, n * 24);
+			size += n * sizeof(struct matrix);
+		} else if ((n = _skip_sprite(&is, type)) > 0) {
+			size += n;
+		} else {
+			break;
+		}
+	}
+	return size;
+}
+
+// where the bounds of each animation start in the bound section, as _import_bound_section reads it
+static void _index_bound(struct spritepack *sp) {
+	struct pack_lazy *z = sp->lazy;
+	struct stream is;
+	int i, n;
+	stream_init(&is, sp->bound, sp->bound_size);
+	if (is.size < 2) {
+		return;
+	}
+	z->bound = (int *)malloc(z->n * sizeof(int));
+	memset(z->bound, 0, z->n * sizeof(int));
+	n = (uint16_t)stream_r16(&is);
+	for (i = 0; i < n && is.size >= 4; i++) {
+		int off = (int)(is.data - sp->bound);
+		int id = (uint16_t)stream_r16(&is);
+		int frame_n = (uint16_t)stream_r16(&is);
+		if (is.size < (frame_n + 1) * 16) {
+			break;
+		}
+		if (id < z->n) {
+			z->bound[id] = off;
+		}
+		_skip(&is, (frame_n + 1) * 16);
+	}
+}
+
+// spritepack_import that only finds where each sprite is, lazy_import imports them
+static void spritepack_index(struct spritepack *sp, const int *texture, int texture_n, int maxid, char *packdata, int packsize, char *metadata, int datasize, int metasize) {
+	struct pack_lazy *z = (struct pack_lazy *)malloc(sizeof(*z));
+	memset(z, 0, sizeof(*z));
+	if (datasize < 0 || datasize > metasize) {
+		datasize = metasize;
+	}
+	z->meta = (char *)malloc(metasize + 1);
+	memcpy(z->meta, metadata, metasize);
+	z->size = datasize;
+	z->n = maxid + 1;
+	z->offset = (int *)malloc(z->n * sizeof(int));
+	memset(z->offset, -1, z->n * sizeof(int));
+	z->matrix = (struct matrix **)malloc(z->n * sizeof(struct matrix *));
+	memset(z->matrix, 0, z->n * sizeof(struct matrix *));
+	z->state = (uint8_t *)malloc(z->n);
+	memset(z->state, 0, z->n);
+	z->tex = (int *)malloc((texture_n + 1) * sizeof(int));
+	memcpy(z->tex, texture, texture_n * sizeof(int));
+	sp->lazy = z;
+
+	_import_sections(sp, z->meta + datasize, metasize - datasize);
+	_import_pack(sp, z->tex, maxid, packdata, packsize);
+	stream_init(&sp->is, z->meta, datasize);
+	while (sp->is.size > 0) {
+		int off = (int)(sp->is.data - z->meta);
+		int id = stream_r16(&sp->is);
+		int type = stream_r8(&sp->is);
+		if (type == TYPE_MATRIX) {
+			_import_matrix(sp);
+			continue;
+		}
+		if (id < 0 || id >= z->n) {
+			pixel_log("spritepack_index id:%d err\n", id);
+			break;
+		}
+		sp->p->type[id] = type;
+		z->offset[id] = off;
+		z->matrix[id] = sp->matrix;
+		if (!_skip_sprite(&sp->is, type)) {
+			pixel_log("spritepack_index type:%d err\n", type);
+			z->offset[id] = -1;
+			break;
+		}
+	}
+	if (sp->bound) {
+		_index_bound(sp);
+	}
+}
+
+// import sprite id and the sprites it draws
+static void lazy_import(struct spritepack *sp, int id) {
+	int i;
+	struct pack_lazy *z = sp->lazy;
+	struct sprite_pack *p = sp->p;
+	if (id < 0 || id >= z->n || p->data[id] || z->offset[id] < 0) {
+		return;
+	}
+	stream_init(&sp->is, z->meta + z->offset[id], z->size - z->offset[id]);
+	sp->matrix = z->matrix[id];
+	_import_sprite(sp);
+	if (p->type[id] == TYPE_ANIMATION) {
+		struct pack_animation *pa = (struct pack_animation *)p->data[id];
+		if (z->bound && z->bound[id]) {
+			struct stream is;
+			stream_init(&is, sp->bound + z->bound[id], sp->bound_size - z->bound[id]);
+			stream_r16(&is);
+			if ((uint16_t)stream_r16(&is) == pa->frame_n) {
+				_read_aabb(&is, pa->aabb);
+				for (i = 0; i < pa->frame_n; i++) {
+					_read_aabb(&is, pa->frame[i].aabb);
+				}
+				z->state[id] = 2;
+			}
+		}
+		for (i = 0; i < pa->component_n; i++) {
+			lazy_import(sp, pa->component[i].id);
+		}
+	}
+}
+
+static void lazy_free(struct spritepack *sp) {
+	struct pack_lazy *z = sp->lazy;
+	if (!z) {
+		return;
+	}
+	free(z->meta);
+	free(z->offset);
+	free(z->matrix);
+	free(z->state);
+	free(z->bound);
+	free(z->tex);
+	free(z);
+	sp->lazy = 0;
+	free(sp->names);
+	sp->names = 0;
+	sp->names_n = sp->names_cap = 0;
+	sp->bound = sp->atlas = 0;
+	sp->bound_size = sp->atlas_n = 0;
+}
+
+// import what is left of a lazy pack, for what walks every sprite
+static void lazy_finish(struct spritepack *sp) {
+	int i;
+	int32_t tmp[4];
+	struct pack_lazy *z = sp->lazy;
+	if (!z) {
+		return;
+	}
+	for (i = 0; i < z->n; i++) {
+		lazy_import(sp, i);
+	}
+	for (i = 0; i < z->n; i++) {
+		if (sp->p->type[i] == TYPE_ANIMATION && sp->p->data[i]) {
+			_bound_sprite(sp->p, z->state, i, tmp);
+		}
+	}
+	lazy_free(sp);
+}
+
+void spritepack_init(const char *path) {
+	S.path = path;
+	if (S.h) {
+		return;
+	}
+	S.h = hash_new(16);
+	S.owner = hash_new(16);
+}
+
+static struct spritepack *pack_new(const char *name) {
+	struct spritepack *sp = (struct spritepack *)malloc(sizeof(*sp));
+	memset(sp, 0, sizeof(*sp));
+	sp->name = (char *)malloc(strlen(name) + 1);
+	strcpy(sp->name, name);
+	sp->ref = 1;
+	return sp;
+}
+
+// free what sp owns but the pack memory
+static void pack_drop(struct spritepack *sp) {
+	lazy_free(sp);
+	free(sp->texture);
+	sp->texture = 0;
+	free(sp->export_data);
+	sp->export_data = 0;
+	if (sp->h) {
+		hash_free(sp->h);
+		sp->h = 0;
+	}
+	free(sp->export);
+	sp->export = 0;
+}
+
+static void pack_free(struct spritepack *sp) {
+	int i;
+	struct spritepack **pp;
+	for (pp = &S.live; *pp; pp = &(*pp)->next) {
+		if (*pp == sp) {
+			*pp = sp->next;
+			hash_remove(S.owner, (const char *)&sp->p, sizeof(sp->p));
+			break;
+		}
+	}
+	if (sp->p) {
+		sprite_pool_clear(sp->p);
+	}
+	if (sp->image) {
+		spritepack_unmap(sp->image);
+	} else if (sp->p) {
+		free(sp->p);
+	}
+	if (sp->texture && !sp->borrowed) {
+		for (i = 0; i < sp->texture_n; i++) {
+			if (sp->texture[i] >= 0) {
+				_tex_release(sp->texture[i]);
+			}
+		}
+	}
+	pack_drop(sp);
+	free(sp->name);
+	free(sp);
+}
+
+// 0 if a pack of its name is loaded already
+static int pack_add(struct spritepack *sp) {
+	if (!hash_insert(S.h, sp->name, (int)strlen(sp->name), sp)) {
+		return 0;
+	}
+	hash_insert(S.owner, (const char *)&sp->p, sizeof(sp->p), sp);
+	sp->next = S.live;
+	S.live = sp;
+	return 1;
+}
+
+// every sprite made and freed asks for its pack, so it is not searched in the list
+static struct spritepack *pack_find(struct sprite_pack *p) {
+	return (struct spritepack *)hash_find(S.owner, (const char *)&p, sizeof(p));
+}
+
+void spritepack_require(struct sprite_pack *p, int id) {
+	int32_t tmp[4];
+	struct spritepack *sp;
+	if (id < 0 || id >= p->n || p->data[id]) {
+		return;
+	}
+	sp = pack_find(p);
+	if (!sp || !sp->lazy) {
+		return;
+	}
+	lazy_import(sp, id);
+	if (p->type[id] == TYPE_ANIMATION && p->data[id]) {
+		_bound_sprite(p, sp->lazy->state, id, tmp);
+	}
+}
+
+void spritepack_retain(struct sprite_pack *p) {
+	struct spritepack *sp = pack_find(p);
+	if (sp) {
+		sp->ref++;
+	}
+}
+
+int spritepack_release(struct sprite_pack *p) {
+	struct spritepack *sp = pack_find(p);
+	if (!sp) {
+		return -1;
+	}
+	if (--sp->ref > 0) {
+		return sp->ref;
+	}
+	pack_free(sp);
+	return 0;
+}
+
+int spritepack_unload(const char *file) {
+	struct spritepack *sp = (struct spritepack *)hash_remove(S.h, file, (int)strlen(file));
+	if (!sp) {
+		return -1;
+	}
+	return spritepack_release(sp->p);
+}
+
+void spritepack_unit(void) {
+	while (S.live) {
+		pack_free(S.live);
+	}
+	hash_free(S.h);
+	hash_free(S.owner);
+	free(S.free_tex);
+	free(S.tex_ref);
+	memset(&S, 0, sizeof(S));
+}
+
+// the export hash maps a name to its id in sp->export
+static void export_read(struct spritepack *sp, struct stream *is, int export_n) {
+	int i;
+	sp->export_n = export_n;
+	sp->export = malloc((export_n + 1) * sizeof(int));
+	sp->h = hash_new(export_n);
+	for (i = 0; i < export_n; i++) {
+		char buff[1024];
+		int len;
+		const char *name;
+		sp->export[i] = stream_r16(is);
+		name = stream_rstr(is, &len, alloc, buff);
+		if (name) {
+			hash_insert(sp->h, name, len, &sp->export[i]);
+		}
+	}
+}
+
+#define IMAGE_MAGIC 0x4d505850
+// an image relocated in place, its pointers are addresses and it is the memory of a pack
+#define IMAGE_RELOCATED 0x52505850
+#define IMAGE_VERSION 2
+#define IMAGE_ALIGN 16
+
+/*
+ * a pack image is the memory of an imported pack, pointers stored as offsets from
+ * the pack, texture ids as indexes of the pack textures. header, export (as in .pi),
+ * reloc (uint32 offsets of the pointers), texid (uint32 offsets of the texture ids),
+ * then the pack at a 16 byte boundary. source_size and source_hash are those of the
+ * .pi it is written from, 0 when unknown, an image of another .pi is stale.
+ */
+struct image_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t texture_n;
+	uint32_t layout;
+	uint32_t export_n;
+	uint32_t export_off;
+	uint32_t export_size;
+	uint32_t reloc_off;
+	uint32_t reloc_n;
+	uint32_t texid_off;
+	uint32_t texid_n;
+	uint32_t data_off;
+	uint32_t data_size;
+	uint32_t source_size;
+	uint32_t source_hash;
+};
+
+struct pack_image {
+	char *map;
+	int size;
+	// 1 mapped, 0 a malloc block freed with it, -1 memory of the caller
+	int mapped;
+	struct image_header *h;
+};
+
+// an image is only valid for the pointer size and struct layout it was written with
+static uint32_t image_layout(void) {
+	uint32_t h = 2166136261u;
+	uint32_t size[] = {
+		sizeof(void *),
+		sizeof(struct sprite_pack),
+		sizeof(struct pack_picture),
+		sizeof(struct pack_quad),
+		sizeof(struct pack_polygon),
+		sizeof(struct pack_poly),
+		sizeof(struct pack_animation),
+		sizeof(struct pack_frame),
+		sizeof(struct pack_part),
+		sizeof(struct pack_action),
+		sizeof(struct pack_component),
+		sizeof(struct pack_label),
+		sizeof(struct pack_panel),
+		sizeof(struct matrix),
+	};
+	int i;
+	for (i = 0; i < (int)(sizeof(size) / sizeof(size[0])); i++) {
+		h = (h ^ size[i]) * 16777619u;
+	}
+	return h;
+}
+
+// the pointers and texture ids to relocate are in the pack, and the pointers point into it
+static int image_check(const struct image_header *h, int size) {
+	uint32_t i;
+	const char *base;
+	const uint32_t *reloc, *texid;
+	if (size < (int)sizeof(*h) || h->magic != IMAGE_MAGIC || h->version != IMAGE_VERSION || h->layout != image_layout()) {
+		return 0;
+	}
+	if ((uint64_t)h->export_off + h->export_size > (uint32_t)size
+		|| (uint64_t)h->reloc_off + (uint64_t)h->reloc_n * 4 > (uint32_t)size
+		|| (uint64_t)h->texid_off + (uint64_t)h->texid_n * 4 > (uint32_t)size
+		|| (uint64_t)h->data_off + h->data_size > (uint32_t)size
+		|| h->reloc_off % 4 || h->texid_off % 4 || h->data_off % IMAGE_ALIGN) {
+		return 0;
+	}
+	base = (const char *)h + h->data_off;
+	reloc = (const uint32_t *)((const char *)h + h->reloc_off);
+	texid = (const uint32_t *)((const char *)h + h->texid_off);
+	for (i = 0; i < h->reloc_n; i++) {
+		uintptr_t p;
+		if ((uint64_t)reloc[i] + sizeof(p) > h->data_size) {
+			pixel_log("image_check: pointer at %u out of the pack\n", reloc[i]);
+			return 0;
+		}
+		memcpy(&p, base + reloc[i], sizeof(p));
+		if (p > h->data_size) {
+			pixel_log("image_check: pointer at %u points out of the pack\n", reloc[i]);
+			return 0;
+		}
+	}
+	for (i = 0; i < h->texid_n; i++) {
+		if ((uint64_t)texid[i] + sizeof(uint16_t) > h->data_size || texid[i] % sizeof(uint16_t)) {
+			pixel_log("image_check: texture id at %u out of the pack\n", texid[i]);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// the hash of the .pi an image is written from
+static uint32_t pi_hash(const char *data, int size) {
+	return name_hashn(data, size);
+}
+
+// 1 when the file pi is there and is not the .pi of size bytes and hash a pack is imported from
+static int pi_changed(const char *pi, uint32_t size, uint32_t hash) {
+	int n, changed;
+	char *data;
+	if (size == 0 || !readable(pi) || !(data = readfile(pi, &n))) {
+		return 0;
+	}
+	changed = (uint32_t)n != size || pi_hash(data, n) != hash;
+	free(data);
+	return changed;
+}
+
+// the .pi next to the .pm or .pz filename, 0 if filename is neither
+static int pi_sibling(const char *filename, char pi[256]) {
+	int n = (int)strlen(filename);
+	if (n < 3 || n >= 256 || (strcmp(filename + n - 3, ".pm") && strcmp(filename + n - 3, ".pz"))) {
+		return 0;
+	}
+	memcpy(pi, filename, n + 1);
+	pi[n - 1] = 'i';
+	return 1;
+}
+
+// an image over map of size bytes, as pack_image mapped tells
+static struct pack_image *image_new(char *map, int size, int mapped) {
+	struct pack_image *img;
+	if (!image_check((struct image_header *)map, size)) {
+		return 0;
+	}
+	img = (struct pack_image *)malloc(sizeof(*img));
+	img->map = map;
+	img->size = size;
+	img->mapped = mapped;
+	img->h = (struct image_header *)map;
+	return img;
+}
+
+struct pack_image *spritepack_map(const char *filename, int *texture_n) {
+	struct pack_image *img;
+	int size;
+	char pi[256];
+	char *map = mapfile(filename, &size);
+	if (!map) {
+		return 0;
+	}
+	img = image_new(map, size, 1);
+	if (!img) {
+		pixel_log("spritepack_map:%s is not an image of this build\n", filename);
+		unmapfile(map, size);
+		return 0;
+	}
+	if (pi_sibling(filename, pi) && pi_changed(pi, img->h->source_size, img->h->source_hash)) {
+		pixel_log("spritepack_map:%s is older than %s\n", filename, pi);
+		spritepack_unmap(img);
+		return 0;
+	}
+	if (texture_n) {
+		*texture_n = img->h->texture_n;
+	}
+	return img;
+}
+
+struct sprite_pack *spritepack_relocate(struct pack_image *img, const int *texture) {
+	uint32_t i;
+	struct image_header *h = img->h;
+	char *base = img->map + h->data_off;
+	const uint32_t *reloc = (const uint32_t *)(img->map + h->reloc_off);
+	const uint32_t *texid = (const uint32_t *)(img->map + h->texid_off);
+	if (h->magic != IMAGE_MAGIC) {
+		return 0;
+	}
+	h->magic = IMAGE_RELOCATED;
+	for (i = 0; i < h->reloc_n; i++) {
+		uintptr_t p;
+		memcpy(&p, base + reloc[i], sizeof(p));
+		p += (uintptr_t)base;
+		memcpy(base + reloc[i], &p, sizeof(p));
+	}
+	for (i = 0; i < h->texid_n; i++) {
+		uint16_t *id = (uint16_t *)(base + texid[i]);
+		if (*id < h->texture_n) {
+			*id = (uint16_t)texture[*id];
+		}
+	}
+	return (struct sprite_pack *)base;
+}
+
+void spritepack_unmap(struct pack_image *img) {
+	if (img->mapped > 0) {
+		unmapfile(img->map, img->size);
+	} else if (img->mapped == 0) {
+		free(img->map);
+	}
+	free(img);
+}
+
+static void image_load(struct spritepack *sp, struct bundle *b, const char *file, struct pack_image *img, const int *texture) {
+	struct stream is;
+	_load_textures(sp, b, file, img->h->texture_n, texture);
+	sp->image = img;
+	sp->p = spritepack_relocate(img, sp->texture);
+	sp->size = img->h->data_size;
+	sp->source_size = img->h->source_size;
+	sp->source_hash = img->h->source_hash;
+	sp->export_size = img->h->export_size;
+	sp->export_data = (char *)malloc(sp->export_size);
+	memcpy(sp->export_data, img->map + img->h->export_off, sp->export_size);
+	stream_init(&is, sp->export_data, sp->export_size);
+	export_read(sp, &is, img->h->export_n);
+}
+
+struct image_writer {
+	char *base;
+	char *out;
+	int size;
+	const int *texture;
+	int texture_n;
+	int reloc_n;
+	int reloc_cap;
+	uint32_t *reloc;
+	int texid_n;
+	int texid_cap;
+	uint32_t *texid;
+};
+
+static void image_push(uint32_t **a, int *n, int *cap, uint32_t v) {
+	if (*n >= *cap) {
+		*cap = *cap ? *cap * 2 : 256;
+		*a = (uint32_t *)realloc(*a, *cap * sizeof(uint32_t));
+	}
+	(*a)[(*n)++] = v;
+}
+
+// turn the pointer stored at field into an offset from the pack
+static void image_ptr(struct image_writer *w, const void *field) {
+	char *p;
+	uintptr_t v;
+	uint32_t off = (uint32_t)((const char *)field - w->base);
+	memcpy(&p, field, sizeof(p));
+	if (!p) {
+		return;
+	}
+	assert(p >= w->base && p <= w->base + w->size);
+	v = (uintptr_t)(p - w->base);
+	memcpy(w->out + off, &v, sizeof(v));
+	image_push(&w->reloc, &w->reloc_n, &w->reloc_cap, off);
+}
+
+static void image_texid(struct image_writer *w, const uint16_t *field) {
+	int i;
+	uint16_t id = 0xffff;
+	uint32_t off = (uint32_t)((const char *)field - w->base);
+	for (i = 0; i < w->texture_n; i++) {
+		if (w->texture[i] == *field) {
+			id = (uint16_t)i;
+			break;
+		}
+	}
+	memcpy(w->out + off, &id, sizeof(id));
+	image_push(&w->texid, &w->texid_n, &w->texid_cap, off);
+}
+
+static void image_animation(struct image_writer *w, struct pack_animation *pa) {
+	int i, j;
+	image_ptr(w, &pa->frame);
+	image_ptr(w, &pa->action);
+	image_ptr(w, &pa->hash);
+	for (i = 0; i < pa->component_n; i++) {
+		image_ptr(w, &pa->component[i].name);
+	}
+	for (i = 0; i < pa->action_n; i++) {
+		image_ptr(w, &pa->action[i].name);
+	}
+	for (i = 0; i < pa->frame_n; i++) {
+		struct pack_frame *pf = &pa->frame[i];
+		image_ptr(w, &pf->part);
+		for (j = 0; j < pf->n; j++) {
+			image_ptr(w, &pf->part[j].t.mat);
+		}
+	}
+}
+
+static void image_walk(struct image_writer *w, struct sprite_pack *p) {
+	int i, j;
+	image_ptr(w, &p->type);
+	image_ptr(w, &p->data);
+	for (i = 0; i < p->n; i++) {
+		if (!p->data[i]) {
+			continue;
+		}
+		image_ptr(w, &p->data[i]);
+		switch (p->type[i]) {
+		case TYPE_PICTURE:
+		{
+			struct pack_picture *pic = (struct pack_picture *)p->data[i];
+			for (j = 0; j < pic->n; j++) {
+				image_texid(w, &pic->rect[j].texid);
+			}
+			break;
+		}
+		case TYPE_POLYGON:
+		{
+			struct pack_polygon *poly = (struct pack_polygon *)p->data[i];
+			for (j = 0; j < poly->n; j++) {
+				image_texid(w, &poly->poly[j].texid);
+				image_ptr(w, &poly->poly[j].texture_coord);
+				image_ptr(w, &poly->poly[j].screen_coord);
+			}
+			break;
+		}
+		case TYPE_ANIMATION:
+			image_animation(w, (struct pack_animation *)p->data[i]);
+			break;
+		}
+	}
+}
+
+static int image_pad(FILE *f, long pos, int align) {
+	static const char zero[IMAGE_ALIGN] = { 0 };
+	int pad = (int)((align - pos % align) % align);
+	return fwrite(zero, 1, pad, f) == (size_t)pad ? pad : -1;
+}
+
+int spritepack_write(const char *filename, struct sprite_pack *p, int size, const int *texture, int texture_n, const char *export, int export_size, int export_n, uint32_t source_size, uint32_t source_hash) {
+	struct image_writer w;
+	struct image_header h;
+	int ok;
+	FILE *f;
+	memset(&w, 0, sizeof(w));
+	w.base = (char *)p;
+	w.size = size;
+	w.texture = texture;
+	w.texture_n = texture_n;
+	w.out = (char *)malloc(size);
+	memcpy(w.out, p, size);
+	image_walk(&w, p);
+
+	memset(&h, 0, sizeof(h));
+	h.magic = IMAGE_MAGIC;
+	h.version = IMAGE_VERSION;
+	h.texture_n = (uint16_t)texture_n;
+	h.layout = image_layout();
+	h.export_n = export_n;
+	h.export_off = sizeof(h);
+	h.export_size = export_size;
+	h.reloc_off = (h.export_off + export_size + 3) & ~3;
+	h.reloc_n = w.reloc_n;
+	h.texid_off = h.reloc_off + w.reloc_n * 4;
+	h.texid_n = w.texid_n;
+	h.data_off = (h.texid_off + w.texid_n * 4 + IMAGE_ALIGN - 1) & ~(IMAGE_ALIGN - 1);
+	h.data_size = size;
+	h.source_size = source_size;
+	h.source_hash = source_hash;
+
+	ok = 0;
+	f = fopen(filename, "wb");
+	if (f) {
+		ok = fwrite(&h, sizeof(h), 1, f) == 1
+			&& fwrite(export, 1, export_size, f) == (size_t)export_size
+			&& image_pad(f, ftell(f), 4) >= 0
+			&& fwrite(w.reloc, 4, w.reloc_n, f) == (size_t)w.reloc_n
+			&& fwrite(w.texid, 4, w.texid_n, f) == (size_t)w.texid_n
+			&& image_pad(f, ftell(f), IMAGE_ALIGN) >= 0
+			&& fwrite(w.out, 1, size, f) == (size_t)size;
+		ok = fclose(f) == 0 && ok;
+	}
+	free(w.out);
+	free(w.reloc);
+	free(w.texid);
+	if (!ok) {
+		pixel_log("spritepack_write:%s failed\n", filename);
+	}
+	return ok;
+}
+
+int spritepack_save(const char *file) {
+	char tmp[256];
+	struct spritepack *sp = (struct spritepack *)hash_find(S.h, file, (int)strlen(file));
+	if (!sp) {
+		return 0;
+	}
+	if (sp->shared) {
+		pixel_log("spritepack_save:%s draws from shared atlases\n", file);
+		return 0;
+	}
+	lazy_finish(sp);
+	sprintf(tmp, "%s%s.pm", S.path, file);
+	return spritepack_write(tmp, sp->p, sp->size, sp->texture, sp->texture_n, sp->export_data, sp->export_size, sp->export_n, sp->source_size, sp->source_hash);
+}
+
+// index the .pi in data for lazy import, the textures are loaded as by _load_textures
+static void pi_load(struct spritepack *sp, struct bundle *b, const char *file, char *data, int size, const int *texture) {
+	int texture_n, export_n, packsize, datasize, metasize;
+	char *metadata, *packdata;
+	int maxid;
+	struct stream is;
+
+	is.data = data;
+	is.size = size;
+
+	export_n = stream_r16(&is);
+	maxid = stream_r16(&is);
+	texture_n = stream_r16(&is);
+	stream_r32(&is);
+	datasize = stream_r32(&is);
+
+	metadata = is.data;
+	export_read(sp, &is, export_n);
+	sp->export_size = (int)(is.data - metadata);
+	sp->export_data = (char *)malloc(sp->export_size);
+	memcpy(sp->export_data, metadata, sp->export_size);
+	metadata = is.data;
+	metasize = is.size;
+	packsize = _pack_size(maxid, metadata, datasize, metasize);
+	packdata = (char *)malloc(packsize);
+	sp->size = packsize;
+	sp->source_size = (uint32_t)size;
+	sp->source_hash = pi_hash(data, size);
+	_load_textures(sp, b, file, texture_n, texture);
+	spritepack_index(sp, sp->texture, texture_n, maxid, packdata, packsize, metadata, datasize, metasize);
+}
+
+// load the pack of a bundle from its image, or its .pi when there is no image of this build
+static int bundle_import(struct spritepack *sp, struct bundle *b, const char *file, const int *texture) {
+	int size;
+	char *data = bundle_load(b, "pm", &size);
+	if (data) {
+		// decompressed straight into the memory the pack lives in
+		struct pack_image *img = image_new(data, size, 0);
+		if (img && (img->h->source_size == 0 || (int)img->h->source_size == bundle_size(b, "pi"))) {
+			image_load(sp, b, file, img, texture);
+			return 1;
+		}
+		if (img) {
+			spritepack_unmap(img);
+		} else {
+			free(data);
+		}
+	}
+	data = bundle_load(b, "pi", &size);
+	if (!data) {
+		return 0;
+	}
+	pi_load(sp, b, file, data, size, texture);
+	free(data);
+	return 1;
+}
+
+// open the bundle filename, 0 if it fails or the .pi next to it is not the one in it
+static struct bundle *bundle_open_fresh(const char *filename) {
+	int size;
+	char *data;
+	char pi[256];
+	struct bundle *b = bundle_open(filename);
+	if (!b || !pi_sibling(filename, pi) || !readable(pi)) {
+		return b;
+	}
+	data = bundle_load(b, "pi", &size);
+	if (data && pi_changed(pi, (uint32_t)size, pi_hash(data, size))) {
+		pixel_log("bundle_open:%s is older than %s\n", filename, pi);
+		bundle_close(b);
+		b = 0;
+	}
+	free(data);
+	return b;
+}
+
+// the number of textures of a bundle, named 1.png, 2.png ...
+static int bundle_textures(struct bundle *b) {
+	char tmp[32];
+	int n = 0;
+	for (;;) {
+		sprintf(tmp, "%d.png", n + 1);
+		if (bundle_size(b, tmp) < 0) {
+			return n;
+		}
+		n++;
+	}
+}
+
+int spritepack_bundle(const char *filename, const char *prefix) {
+	char tmp[256];
+	char (*file)[256];
+	const char **name, **path;
+	int i, n, size, texture_n, ok;
+	struct stream is;
+	char *data;
+	struct pack_image *img;
+	sprintf(tmp, "%s.pi", prefix);
+	data = readfile(tmp, &size);
+	if (!data || size < 6) {
+		free(data);
+		pixel_log("spritepack_bundle:%s failed\n", tmp);
+		return 0;
+	}
+	stream_init(&is, data, size);
+	stream_r16(&is);
+	stream_r16(&is);
+	texture_n = (uint16_t)stream_r16(&is);
+	free(data);
+	file = (char(*)[256])malloc((texture_n + 2) * sizeof(*file));
+	name = (const char **)malloc((texture_n + 2) * sizeof(char *));
+	path = (const char **)malloc((texture_n + 2) * sizeof(char *));
+	n = 0;
+	sprintf(file[n], "%s.pi", prefix);
+	name[n++] = "pi";
+	sprintf(file[n], "%s.pm", prefix);
+	// an image of another build or of an older .pi is left out
+	if (readable(file[n]) && (img = spritepack_map(file[n], 0))) {
+		spritepack_unmap(img);
+		name[n++] = "pm";
+	}
+	for (i = 0; i < texture_n; i++) {
+		char *entry = file[n] + 128;
+		sprintf(file[n], "%s.%d.png", prefix, i + 1);
+		sprintf(entry, "%d.png", i + 1);
+		name[n++] = entry;
+	}
+	for (i = 0; i < n; i++) {
+		path[i] = file[i];
+	}
+	ok = bundle_write(filename, n, name, path, BUNDLE_BLOCK);
+	if (!ok) {
+		pixel_log("spritepack_bundle:%s failed\n", filename);
+	}
+	free(path);
+	free(name);
+	free(file);
+	return ok;
+}
+
+struct sprite_pack *spritepack_load(const char *file) {
+	int size, ok;
+	char *data;
+	char tmp[256];
+	struct bundle *b;
+	struct pack_image *img;
+	struct spritepack *sp;
+
+	if (hash_find(S.h, file, (int)strlen(file))) {
+		return 0;
+	}
+	sp = pack_new(file);
+
+	sprintf(tmp, "%s%s.pz", S.path, file);
+	if (readable(tmp) && (b = bundle_open_fresh(tmp))) {
+		ok = bundle_import(sp, b, file, 0);
+		bundle_close(b);
+		if (ok) {
+			pack_add(sp);
+			pixel_log("spritepack_load:%s ok\n", file);
+			return sp->p;
+		}
+	}
+
+	sprintf(tmp, "%s%s.pm", S.path, file);
+	if (readable(tmp) && (img = spritepack_map(tmp, 0))) {
+		image_load(sp, 0, file, img, 0);
+		pack_add(sp);
+		pixel_log("spritepack_load:%s ok\n", file);
+		return sp->p;
+	}
+
+	sprintf(tmp, "%s%s.pi", S.path, file);
+	data = readfile(tmp, &size);
+	if (!data) {
+		pixel_log("spritepack_load:%s failed\n", tmp);
+		pack_free(sp);
+		return 0;
+	}
+	pi_load(sp, 0, file, data, size, 0);
+	free(data);
+	pack_add(sp);
+	pixel_log("spritepack_load:%s ok\n", file);
+	return sp->p;
+}
+
+#define MEMORY_COPY 0
+#define MEMORY_ADOPT 1
+#define MEMORY_BORROW 2
+
+// the magic of the image in data, 0 if it is too short to be one
+static uint32_t image_magic(const char *data, int size) {
+	return size >= (int)sizeof(struct image_header) ? ((const struct image_header *)data)->magic : 0;
+}
+
+// the number of textures of a pack in memory, -1 if it is too short to be one or it is the memory
+// of a pack already. bundle is set for a .pz
+static int memory_textures(char *data, int size, int *bundle) {
+	struct bundle *b = bundle_open_memory(data, size, 0);
+	*bundle = b != 0;
+	if (b) {
+		int n = bundle_textures(b);
+		bundle_close(b);
+		return n;
+	}
+	if (image_magic(data, size) == IMAGE_MAGIC) {
+		return ((struct image_header *)data)->texture_n;
+	}
+	if (size < 14 || image_magic(data, size) == IMAGE_RELOCATED) {
+		return -1;
+	}
+	return (uint8_t)data[4] | (uint8_t)data[5] << 8;
+}
+
+/*
+ * import sp from the memory of a .pz, .pm or .pi. a .pz loads its textures into texture, or ids of
+ * the storage when it is 0. the textures of a .pm or .pi are texture, loaded by the caller, or the
+ * files <path><name>.N.png when it is 0. data is copied only for a .pm without MEMORY_BORROW or
+ * MEMORY_ADOPT, and with MEMORY_ADOPT it is freed or kept as the pack memory, whatever happens.
+ * an image relocated in place by a load before is refused and left alone, it is the memory of that pack.
+ */
+static int memory_import(struct spritepack *sp, char *data, int size, const int *texture, int own) {
+	struct bundle *b;
+	struct pack_image *img;
+	const char *file = texture ? 0 : sp->name;
+	if (image_magic(data, size) == IMAGE_RELOCATED) {
+		pixel_log("memory_import:%s is the memory of a loaded pack\n", sp->name);
+		return 0;
+	}
+	if ((b = bundle_open_memory(data, size, own == MEMORY_ADOPT))) {
+		int ok = bundle_import(sp, b, sp->name, texture);
+		bundle_close(b);
+		return ok;
+	}
+	if (image_magic(data, size) == IMAGE_MAGIC) {
+		char *map = data;
+		// the pack lives in the image, at the alignment it was written with
+		if (own == MEMORY_COPY || (uintptr_t)data % IMAGE_ALIGN) {
+			map = (char *)malloc(size);
+			memcpy(map, data, size);
+			if (own == MEMORY_ADOPT) {
+				free(data);
+			}
+			own = MEMORY_ADOPT;
+		}
+		img = image_new(map, size, own == MEMORY_BORROW ? -1 : 0);
+		if (!img) {
+			if (own == MEMORY_ADOPT) {
+				free(map);
+			}
+			return 0;
+		}
+		image_load(sp, 0, file, img, texture);
+		return 1;
+	}
+	if (size >= 14) {
+		pi_load(sp, 0, file, data, size, texture);
+	}
+	if (own == MEMORY_ADOPT) {
+		free(data);
+	}
+	return sp->p != 0;
+}
+
+struct sprite_pack *spritepack_load_memory(const char *name, char *data, int size, const int *texture, int texture_n, int adopt) {
+	int bundle;
+	struct spritepack *sp;
+	if (hash_find(S.h, name, (int)strlen(name)) || (texture && memory_textures(data, size, &bundle) > texture_n)) {
+		if (adopt) {
+			free(data);
+		}
+		return 0;
+	}
+	sp = pack_new(name);
+	if (!memory_import(sp, data, size, texture, adopt ? MEMORY_ADOPT : MEMORY_COPY) || !sp->p) {
+		pixel_log("spritepack_load_memory:%s failed\n", name);
+		pack_free(sp);
+		return 0;
+	}
+	// the textures stay the caller's
+	sp->borrowed = texture != 0;
+	pack_add(sp);
+	pixel_log("spritepack_load_memory:%s ok\n", name);
+	return sp->p;
+}
+
+#define ASYNC_READ 0
+#define ASYNC_UPLOAD 1
+#define ASYNC_FAILED 2
+
+struct async_texture {
+	void *pixels;
+	enum TEXTURE_FORMAT format;
+};
+
+/*
+ * a pack loading in the background. the worker reads the .pi, decodes the textures
+ * and imports with texture indexes of the pack, then the main thread uploads the
+ * textures a few at a time, patches the texture ids and calls finish.
+ */
+struct pack_async {
+	struct pack_async *next;
+	int seq;
+	int state;
+	char *prefix;
+	struct spritepack *sp;
+	struct async_texture *texture;
+	int *texsize;
+	int texture_n;
+	int uploaded;
+	// fill sp->texture with the texture ids, then take sp, whose p is 0 when it failed
+	void (*reserve)(struct pack_async *a);
+	void (*finish)(struct pack_async *a);
+	spritepack_loaded cb;
+	void *ud;
+#ifdef PIXEL_LUA
+	struct lua_State *L;
+#endif
+};
+
+struct async_queue {
+	struct pack_async *head;
+	struct pack_async *tail;
+	int posted;
+	int done;
+	float budget;
+};
+
+static struct async_queue Async = { 0, 0, 0, 0, 0.004f };
+
+// read and import the .pi with the texture coords in pixels, 0 if it failed
+static int async_parse(struct pack_async *a) {
+	struct spritepack *sp = a->sp;
+	int size, export_n, maxid, packsize, datasize, i;
+	char *data, *metadata;
+	char tmp[256];
+	struct stream is;
+	a->state = ASYNC_FAILED;
+	sprintf(tmp, "%s.pi", a->prefix);
+	data = readfile(tmp, &size);
+	if (!data) {
+		pixel_log("spritepack_load_async:%s failed\n", tmp);
+		return 0;
+	}
+	stream_init(&is, data, size);
+	export_n = stream_r16(&is);
+	maxid = stream_r16(&is);
+	sp->texture_n = stream_r16(&is);
+	stream_r32(&is);
+	datasize = stream_r32(&is);
+
+	// the export hash is built on the main thread
+	metadata = is.data;
+	for (i = 0; i < export_n; i++) {
+		char buff[1024];
+		stream_r16(&is);
+		stream_rstr(&is, 0, alloc, buff);
+	}
+	sp->export_n = export_n;
+	sp->export_size = (int)(is.data - metadata);
+	sp->export_data = (char *)malloc(sp->export_size);
+	memcpy(sp->export_data, metadata, sp->export_size);
+
+	a->texture_n = sp->texture_n;
+	a->texture = (struct async_texture *)malloc((sp->texture_n + 1) * sizeof(struct async_texture));
+	memset(a->texture, 0, (sp->texture_n + 1) * sizeof(struct async_texture));
+	// texture_normalize keeps the coords of a texture without size
+	a->texsize = (int *)calloc(sp->texture_n * 2 + 1, sizeof(int));
+	sp->tex = (int *)malloc((sp->texture_n + 1) * sizeof(int));
+	for (i = 0; i < sp->texture_n; i++) {
+		sp->tex[i] = i;
+	}
+	sp->texsize = a->texsize;
+	packsize = _pack_size(maxid, is.data, datasize, is.size);
+	sp->size = packsize;
+	sp->source_size = (uint32_t)size;
+	sp->source_hash = pi_hash(data, size);
+	spritepack_import(sp, sp->tex, maxid, (char *)malloc(packsize), packsize, is.data, datasize, is.size);
+	sp->texsize = 0;
+	free(sp->tex);
+	sp->tex = 0;
+	free(data);
+	return 1;
+}
+
+static void async_decode(struct pack_async *a, int i) {
+	char tmp[256];
+	sprintf(tmp, "%s.%d.png", a->prefix, i + 1);
+	a->texture[i].pixels = texture_decode(tmp, &a->texsize[i * 2], &a->texsize[i * 2 + 1], &a->texture[i].format);
+	if (!a->texture[i].pixels) {
+		a->texsize[i * 2] = a->texsize[i * 2 + 1] = 0;
+	}
+}
+
+static void async_read(void *ud, int idx) {
+	struct pack_async *a = (struct pack_async *)ud;
+	int i;
+	(void)idx;
+	if (!async_parse(a)) {
+		return;
+	}
+	for (i = 0; i < a->texture_n; i++) {
+		async_decode(a, i);
+	}
+	a->state = ASYNC_UPLOAD;
+}
+
+static void async_coord(const int *texsize, int tex, uint16_t *coord, int n) {
+	int i;
+	for (i = 0; i < n * 2; i += 2) {
+		texture_normalize(texsize[tex * 2], texsize[tex * 2 + 1], coord[i], coord[i + 1], &coord[i], &coord[i + 1]);
+	}
+}
+
+// the worker left texture indexes of the pack in the texture ids and the texture coords in pixels
+static void async_texid(struct sprite_pack *p, const int *texture, const int *texsize) {
+	int i, j;
+	for (i = 0; i < p->n; i++) {
+		if (p->type[i] == TYPE_PICTURE && p->data[i]) {
+			struct pack_picture *pic = (struct pack_picture *)p->data[i];
+			for (j = 0; j < pic->n; j++) {
+				struct pack_quad *q = &pic->rect[j];
+				async_coord(texsize, q->texid, q->texture_coord, 4);
+				q->texid = (uint16_t)texture[q->texid];
+			}
+		} else if (p->type[i] == TYPE_POLYGON && p->data[i]) {
+			struct pack_polygon *poly = (struct pack_polygon *)p->data[i];
+			for (j = 0; j < poly->n; j++) {
+				struct pack_poly *pp = &poly->poly[j];
+				async_coord(texsize, pp->texid, pp->texture_coord, pp->n);
+				pp->texid = (uint16_t)texture[pp->texid];
+			}
+		}
+	}
+}
+
+static void async_free(struct pack_async *a) {
+	int i;
+	if (a->texture) {
+		for (i = 0; i < a->texture_n; i++) {
+			if (a->texture[i].pixels) {
+				texture_release(a->texture[i].pixels);
+			}
+		}
+	}
+	free(a->texture);
+	free(a->texsize);
+	free(a->prefix);
+	free(a);
+}
+
+static void async_reserve(struct pack_async *a) {
+	int i;
+	for (i = 0; i < a->sp->texture_n; i++) {
+		a->sp->texture[i] = _tex_alloc();
+	}
+}
+
+// put the pack of a in the storage, 0 if it failed
+static struct sprite_pack *async_take(struct pack_async *a) {
+	struct stream is;
+	struct spritepack *sp = a->sp;
+	if (sp->p) {
+		stream_init(&is, sp->export_data, sp->export_size);
+		export_read(sp, &is, sp->export_n);
+	}
+	if (!sp->p || !pack_add(sp)) {
+		pack_free(sp);
+		return 0;
+	}
+	return sp->p;
+}
+
+static void async_finish(struct pack_async *a) {
+	struct sprite_pack *p = async_take(a);
+	if (p) {
+		pixel_log("spritepack_load_async:%s ok\n", a->sp->name);
+	}
+	a->cb(a->ud, p);
+}
+
+// name is the name of the pack in the storage
+static struct pack_async *async_new(const char *prefix, const char *name) {
+	struct pack_async *a = (struct pack_async *)malloc(sizeof(*a));
+	memset(a, 0, sizeof(*a));
+	a->prefix = (char *)malloc(strlen(prefix) + 1);
+	strcpy(a->prefix, prefix);
+	a->sp = pack_new(name);
+	return a;
+}
+
+// 1 if a load of the pack name is in flight, a second one would fail when it is taken
+static int async_loading(const char *name) {
+	struct pack_async *a;
+	for (a = Async.head; a; a = a->next) {
+		if (strcmp(a->sp->name, name) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void async_post(struct pack_async *a) {
+	a->seq = Async.posted++;
+	if (Async.tail) {
+		Async.tail->next = a;
+	} else {
+		Async.head = a;
+	}
+	Async.tail = a;
+	thread_post(async_read, a);
+}
+
+int spritepack_load_async(const char *file, spritepack_loaded cb, void *ud) {
+	char tmp[256];
+	struct pack_async *a;
+	if (hash_find(S.h, file, (int)strlen(file)) || async_loading(file)) {
+		return 0;
+	}
+	sprintf(tmp, "%s%s", S.path, file);
+	a = async_new(tmp, file);
+	a->reserve = async_reserve;
+	a->finish = async_finish;
+	a->cb = cb;
+	a->ud = ud;
+	async_post(a);
+	return 1;
+}
+
+float spritepack_async_budget(float seconds) {
+	float budget = Async.budget;
+	if (seconds > 0) {
+		Async.budget = seconds;
+	}
+	return budget;
+}
+
+// upload texture i of a into the id reserved for it
+static void async_upload(struct pack_async *a, int i) {
+	struct async_texture *t = &a->texture[i];
+	int *size = &a->texsize[i * 2];
+	if (t->pixels && a->sp->texture[i] >= 0) {
+		texture_load(a->sp->texture[i], t->format, size[0], size[1], t->pixels, 0);
+		texture_release(t->pixels);
+		t->pixels = 0;
+	}
+}
+
+int spritepack_async_update(void) {
+	double start;
+	int pending;
+	if (!Async.head) {
+		return 0;
+	}
+	start = thread_time();
+	pending = thread_pending();
+	// jobs run in order, so the first posted - pending are read
+	while (Async.head && Async.head->seq < Async.posted - pending) {
+		struct pack_async *a = Async.head;
+		struct spritepack *sp = a->sp;
+		if (a->state == ASYNC_UPLOAD) {
+			if (!sp->texture) {
+				sp->texture = (int *)malloc((sp->texture_n + 1) * sizeof(int));
+				a->reserve(a);
+			}
+			while (a->uploaded < sp->texture_n) {
+				if (a->uploaded > 0 && thread_time() - start >= Async.budget) {
+					return Async.posted - Async.done;
+				}
+				async_upload(a, a->uploaded++);
+			}
+			async_texid(sp->p, sp->texture, a->texsize);
+		}
+		Async.head = a->next;
+		if (!Async.head) {
+			Async.tail = 0;
+		}
+		Async.done++;
+		a->finish(a);
+		async_free(a);
+		if (thread_time() - start >= Async.budget) {
+			break;
+		}
+	}
+	return Async.posted - Async.done;
+}
+
+/*
+ * a batch reads and parses its packs, then decodes every texture of all of them, each step spread
+ * over the threads of thread_run, then uploads the textures and finishes the packs in order on the
+ * caller. the loads are async loads finished at once.
+ */
+struct batch {
+	struct pack_async **a;
+	int n;
+	// the pack and the texture of each decode
+	int *job_pack;
+	int *job_tex;
+	int job_n;
+	double *parse;
+	double *decode;
+};
+
+static void batch_parse(void *ud, int idx) {
+	struct batch *b = (struct batch *)ud;
+	double start = thread_time();
+	if (b->a[idx] && async_parse(b->a[idx])) {
+		b->a[idx]->state = ASYNC_UPLOAD;
+	}
+	b->parse[idx] = thread_time() - start;
+}
+
+static void batch_decode(void *ud, int idx) {
+	struct batch *b = (struct batch *)ud;
+	double start = thread_time();
+	async_decode(b->a[b->job_pack[idx]], b->job_tex[idx]);
+	b->decode[idx] = thread_time() - start;
+}
+
+// load the n async loads of a, 0 to skip one, and free them. returns the seconds it took
+static double batch_load(struct pack_async **a, int n, struct spritepack_timing *timing) {
+	int i, j;
+	struct batch b;
+	double start = thread_time();
+	memset(&b, 0, sizeof(b));
+	b.a = a;
+	b.n = n;
+	b.parse = (double *)malloc((n + 1) * sizeof(double));
+	thread_run(batch_parse, &b, n);
+	for (i = 0; i < n; i++) {
+		if (a[i] && a[i]->state == ASYNC_UPLOAD) {
+			b.job_n += a[i]->texture_n;
+		}
+	}
+	b.job_pack = (int *)malloc((b.job_n + 1) * sizeof(int));
+	b.job_tex = (int *)malloc((b.job_n + 1) * sizeof(int));
+	b.decode = (double *)malloc((b.job_n + 1) * sizeof(double));
+	for (i = 0, b.job_n = 0; i < n; i++) {
+		for (j = 0; a[i] && a[i]->state == ASYNC_UPLOAD && j < a[i]->texture_n; j++) {
+			b.job_pack[b.job_n] = i;
+			b.job_tex[b.job_n++] = j;
+		}
+	}
+	thread_run(batch_decode, &b, b.job_n);
+	memset(timing, 0, n * sizeof(struct spritepack_timing));
+	for (i = 0; i < b.job_n; i++) {
+		timing[b.job_pack[i]].decode += b.decode[i];
+	}
+	for (i = 0; i < n; i++) {
+		double upload = thread_time();
+		struct spritepack *sp = a[i] ? a[i]->sp : 0;
+		if (!sp) {
+			continue;
+		}
+		timing[i].parse = b.parse[i];
+		if (a[i]->state == ASYNC_UPLOAD) {
+			sp->texture = (int *)malloc((sp->texture_n + 1) * sizeof(int));
+			a[i]->reserve(a[i]);
+			for (j = 0; j < sp->texture_n; j++) {
+				async_upload(a[i], j);
+			}
+			async_texid(sp->p, sp->texture, a[i]->texsize);
+		}
+		a[i]->finish(a[i]);
+		async_free(a[i]);
+		a[i] = 0;
+		timing[i].upload = thread_time() - upload;
+	}
+	free(b.parse);
+	free(b.decode);
+	free(b.job_pack);
+	free(b.job_tex);
+	return thread_time() - start;
+}
+
+static void batch_finish(struct pack_async *a) {
+	*(struct sprite_pack **)a->ud = async_take(a);
+}
+
+double spritepack_load_batch(const char *file[], int n, struct sprite_pack *p[], struct spritepack_timing *timing) {
+	char tmp[256];
+	int i;
+	double total;
+	struct pack_async **a = (struct pack_async **)malloc((n + 1) * sizeof(struct pack_async *));
+	char *skip = (char *)malloc(n + 1);
+	struct spritepack_timing *t = timing ? timing : (struct spritepack_timing *)malloc((n + 1) * sizeof(*t));
+	for (i = 0; i < n; i++) {
+		p[i] = 0;
+		a[i] = 0;
+		skip[i] = hash_find(S.h, file[i], (int)strlen(file[i])) != 0;
+		if (!skip[i]) {
+			sprintf(tmp, "%s%s", S.path, file[i]);
+			a[i] = async_new(tmp, file[i]);
+			a[i]->reserve = async_reserve;
+			a[i]->finish = batch_finish;
+			a[i]->ud = &p[i];
+		}
+	}
+	total = batch_load(a, n, t);
+	for (i = 0; i < n; i++) {
+		if (skip[i]) {
+			pixel_log("spritepack_load_batch:%s loaded already\n", file[i]);
+		} else {
+			pixel_log("spritepack_load_batch:%s %s parse %.1fms decode %.1fms upload %.1fms\n", file[i], p[i] ? "ok" : "failed",
+				t[i].parse * 1000, t[i].decode * 1000, t[i].upload * 1000);
+		}
+	}
+	pixel_log("spritepack_load_batch:%d packs in %.1fms on %d threads\n", n, total * 1000, thread_count());
+	if (!timing) {
+		free(t);
+	}
+	free(a);
+	free(skip);
+	return total;
+}
+
+/*
+ * packs loaded together into shared atlases. each is read like an async load with its texture
+ * coords left in pixels, then the rects its pictures and polygons cut from its textures are
+ * copied, with a pixel of their edge around them against bleeding, into atlases size pixels
+ * wide, shelf by shelf, tallest first. a texture that is not rgba8 or has a rect larger than
+ * an atlas keeps its own.
+ */
+struct atlas_rect {
+	int pack;
+	int tex;
+	int x, y, w, h;
+	// the atlas and where x, y lands in it
+	int atlas;
+	int ax, ay;
+};
+
+struct atlas_build {
+	int size;
+	int n;
+	struct pack_async **a;
+	// sorted by pack, texture and place, each once
+	struct atlas_rect *rect;
+	int rect_n;
+	int rect_cap;
+	// by pack then texture, where in texture the id of a texture keeping its own is, -1 if it is repacked
+	int **keep;
+	// by atlas, its pixels and the rows it fills
+	uint32_t **pixels;
+	int *height;
+	int atlas_n;
+	// the atlases then the textures kept
+	int *texture;
+	int texture_n;
+	// fill texture with texture_n ids
+	void (*reserve)(struct atlas_build *ab);
+	void *ud;
+};
+
+typedef void(*atlas_visitor)(struct atlas_build *ab, int pack, uint16_t *texid, uint16_t *coord, int n);
+
+static void atlas_walk(struct atlas_build *ab, int pack, atlas_visitor f) {
+	int i, j;
+	struct sprite_pack *p = ab->a[pack]->sp->p;
+	for (i = 0; i < p->n; i++) {
+		if (p->type[i] == TYPE_PICTURE && p->data[i]) {
+			struct pack_picture *pic = (struct pack_picture *)p->data[i];
+			for (j = 0; j < pic->n; j++) {
+				f(ab, pack, &pic->rect[j].texid, pic->rect[j].texture_coord, 4);
+			}
+		} else if (p->type[i] == TYPE_POLYGON && p->data[i]) {
+			struct pack_polygon *poly = (struct pack_polygon *)p->data[i];
+			for (j = 0; j < poly->n; j++) {
+				if (poly->poly[j].n > 0) {
+					f(ab, pack, &poly->poly[j].texid, poly->poly[j].texture_coord, poly->poly[j].n);
+				}
+			}
+		}
+	}
+}
+
+static void atlas_bound(struct atlas_rect *r, int pack, int tex, const uint16_t *coord, int n) {
+	int i, x1 = 0, y1 = 0;
+	r->pack = pack;
+	r->tex = tex;
+	r->x = r->y = 0xffff;
+	for (i = 0; i < n * 2; i += 2) {
+		if (coord[i] < r->x) {
+			r->x = coord[i];
+		}
+		if (coord[i] > x1) {
+			x1 = coord[i];
+		}
+		if (coord[i + 1] < r->y) {
+			r->y = coord[i + 1];
+		}
+		if (coord[i + 1] > y1) {
+			y1 = coord[i + 1];
+		}
+	}
+	r->w = x1 - r->x;
+	r->h = y1 - r->y;
+}
+
+static int atlas_cmp(const void *a, const void *b) {
+	const struct atlas_rect *ra = (const struct atlas_rect *)a;
+	const struct atlas_rect *rb = (const struct atlas_rect *)b;
+	if (ra->pack != rb->pack) {
+		return ra->pack - rb->pack;
+	}
+	if (ra->tex != rb->tex) {
+		return ra->tex - rb->tex;
+	}
+	if (ra->x != rb->x) {
+		return ra->x - rb->x;
+	}
+	if (ra->y != rb->y) {
+		return ra->y - rb->y;
+	}
+	if (ra->w != rb->w) {
+		return ra->w - rb->w;
+	}
+	return ra->h - rb->h;
+}
+
+// tallest first, then widest
+static int atlas_taller(const void *a, const void *b) {
+	const struct atlas_rect *ra = *(const struct atlas_rect **)a;
+	const struct atlas_rect *rb = *(const struct atlas_rect **)b;
+	if (ra->h != rb->h) {
+		return rb->h - ra->h;
+	}
+	return rb->w - ra->w;
+}
+
+static void atlas_collect(struct atlas_build *ab, int pack, uint16_t *texid, uint16_t *coord, int n) {
+	if (*texid >= ab->a[pack]->texture_n) {
+		return;
+	}
+	if (ab->rect_n >= ab->rect_cap) {
+		ab->rect_cap = ab->rect_cap ? ab->rect_cap * 2 : 256;
+		ab->rect = (struct atlas_rect *)realloc(ab->rect, ab->rect_cap * sizeof(struct atlas_rect));
+	}
+	atlas_bound(&ab->rect[ab->rect_n++], pack, *texid, coord, n);
+}
+
+static void atlas_rewrite(struct atlas_build *ab, int pack, uint16_t *texid, uint16_t *coord, int n) {
+	int i, tex = *texid;
+	struct pack_async *a = ab->a[pack];
+	struct atlas_rect key, *r;
+	if (tex >= a->texture_n) {
+		return;
+	}
+	if (ab->keep[pack][tex] >= 0) {
+		*texid = (uint16_t)ab->texture[ab->keep[pack][tex]];
+		for (i = 0; i < n * 2; i += 2) {
+			texture_normalize(a->texsize[tex * 2], a->texsize[tex * 2 + 1], coord[i], coord[i + 1], &coord[i], &coord[i + 1]);
+		}
+		return;
+	}
+	atlas_bound(&key, pack, tex, coord, n);
+	r = (struct atlas_rect *)bsearch(&key, ab->rect, ab->rect_n, sizeof(struct atlas_rect), atlas_cmp);
+	assert(r);
+	*texid = (uint16_t)ab->texture[r->atlas];
+	for (i = 0; i < n * 2; i += 2) {
+		float x = (float)(coord[i] - r->x + r->ax);
+		float y = (float)(coord[i + 1] - r->y + r->ay);
+		texture_normalize(ab->size, ab->height[r->atlas], x, y, &coord[i], &coord[i + 1]);
+	}
+}
+
+// the texture of r keeps its own when it is not rgba8 or r does not fit an atlas
+static int atlas_fit(struct atlas_build *ab, const struct atlas_rect *r) {
+	struct pack_async *a = ab->a[r->pack];
+	struct async_texture *t = &a->texture[r->tex];
+	return t->pixels && t->format == TEXTURE_RGBA8 && r->w + 2 <= ab->size && r->h + 2 <= ab->size;
+}
+
+// shelf the rects of textures that do not keep their own, then copy them
+static void atlas_place(struct atlas_build *ab) {
+	int i, j, n = 0, x = 0, y = 0, shelf = 0;
+	struct atlas_rect **order = (struct atlas_rect **)malloc((ab->rect_n + 1) * sizeof(struct atlas_rect *));
+	for (i = 0; i < ab->rect_n; i++) {
+		struct atlas_rect *r = &ab->rect[i];
+		r->atlas = -1;
+		if (ab->keep[r->pack][r->tex] < 0) {
+			order[n++] = r;
+		}
+	}
+	qsort(order, n, sizeof(struct atlas_rect *), atlas_taller);
+	for (i = 0; i < n; i++) {
+		struct atlas_rect *r = order[i];
+		if (x + r->w + 2 > ab->size) {
+			x = 0;
+			y += shelf;
+			shelf = 0;
+		}
+		if (ab->atlas_n == 0 || y + r->h + 2 > ab->size) {
+			ab->height = (int *)realloc(ab->height, (ab->atlas_n + 1) * sizeof(int));
+			ab->height[ab->atlas_n++] = 0;
+			x = y = shelf = 0;
+		}
+		r->atlas = ab->atlas_n - 1;
+		r->ax = x + 1;
+		r->ay = y + 1;
+		x += r->w + 2;
+		if (r->h + 2 > shelf) {
+			shelf = r->h + 2;
+		}
+		if (y + shelf > ab->height[r->atlas]) {
+			ab->height[r->atlas] = y + shelf;
+		}
+	}
+	free(order);
+	ab->pixels = (uint32_t **)malloc((ab->atlas_n + 1) * sizeof(uint32_t *));
+	for (i = 0; i < ab->atlas_n; i++) {
+		ab->pixels[i] = (uint32_t *)calloc(ab->size * ab->height[i], sizeof(uint32_t));
+	}
+	for (i = 0; i < ab->rect_n; i++) {
+		struct atlas_rect *r = &ab->rect[i];
+		struct pack_async *a = ab->a[r->pack];
+		const uint32_t *src = (const uint32_t *)a->texture[r->tex].pixels;
+		int width = a->texsize[r->tex * 2], height = a->texsize[r->tex * 2 + 1];
+		if (r->atlas < 0) {
+			continue;
+		}
+		for (j = -1; j <= r->h; j++) {
+			int k, sy = r->y + j;
+			uint32_t *dst = ab->pixels[r->atlas] + (r->ay + j) * ab->size + r->ax;
+			sy = sy < 0 ? 0 : (sy >= height ? height - 1 : sy);
+			for (k = -1; k <= r->w; k++) {
+				int sx = r->x + k;
+				sx = sx < 0 ? 0 : (sx >= width ? width - 1 : sx);
+				dst[k] = src[sy * width + sx];
+			}
+		}
+	}
 }
 
-static void *alloc(void *ud, int size) {
-	return ud;
-}
+static void atlas_build(struct atlas_build *ab) {
+	int i, j, k, n;
+	for (i = 0; i < ab->n; i++) {
+		struct pack_async *a = ab->a[i];
+		if (a && a->sp->p) {
+			atlas_walk(ab, i, atlas_collect);
+		}
+	}
+	qsort(ab->rect, ab->rect_n, sizeof(struct atlas_rect), atlas_cmp);
+	for (i = 0, n = 0; i < ab->rect_n; i++) {
+		if (n == 0 || atlas_cmp(&ab->rect[n - 1], &ab->rect[i]) != 0) {
+			ab->rect[n++] = ab->rect[i];
+		}
+	}
+	ab->rect_n = n;
 
-int spritepack_size(void) {
-	return sizeof(struct sprite_pack);
-}
+	// a texture keeps its own when one of its rects does not fit, n counts them
+	ab->keep = (int **)malloc((ab->n + 1) * sizeof(int *));
+	for (i = 0, n = 0; i < ab->n; i++) {
+		struct pack_async *a = ab->a[i];
+		int texture_n = a ? a->texture_n : 0;
+		ab->keep[i] = (int *)malloc((texture_n + 1) * sizeof(int));
+		for (j = 0; j < texture_n; j++) {
+			ab->keep[i][j] = -1;
+		}
+	}
+	for (i = 0; i < ab->rect_n; i++) {
+		struct atlas_rect *r = &ab->rect[i];
+		if (!atlas_fit(ab, r)) {
+			ab->keep[r->pack][r->tex] = 0;
+		}
+	}
+	for (i = 0; i < ab->n; i++) {
+		for (j = 0; ab->a[i] && j < ab->a[i]->texture_n; j++) {
+			if (ab->keep[i][j] >= 0) {
+				n++;
+			}
+		}
+	}
+	atlas_place(ab);
 
-static void spritepack_import(struct spritepack *sp, int *texture, int maxid, char *packdata, int packsize, char *metadata, int metasize) {
-	stream_init(&sp->is, metadata, metasize);
-	sp->slloc.data = packdata;
-	sp->slloc.size = packsize;
+	ab->texture_n = ab->atlas_n + n;
+	ab->texture = (int *)malloc((ab->texture_n + 1) * sizeof(int));
+	ab->reserve(ab);
+	for (i = 0; i < ab->atlas_n; i++) {
+		if (ab->texture[i] >= 0) {
+			texture_load(ab->texture[i], TEXTURE_RGBA8, ab->size, ab->height[i], ab->pixels[i], 0);
+		}
+		free(ab->pixels[i]);
+		ab->pixels[i] = 0;
+	}
+	for (i = 0, n = ab->atlas_n; i < ab->n; i++) {
+		struct pack_async *a = ab->a[i];
+		for (j = 0; a && j < a->texture_n; j++) {
+			struct async_texture *t = &a->texture[j];
+			if (ab->keep[i][j] >= 0) {
+				int tid = ab->texture[n];
+				ab->keep[i][j] = n++;
+				if (t->pixels && tid >= 0) {
+					texture_load(tid, t->format, a->texsize[j * 2], a->texsize[j * 2 + 1], t->pixels, 0);
+				}
+			}
+			if (t->pixels) {
+				texture_release(t->pixels);
+				t->pixels = 0;
+			}
+		}
+	}
 
-	sp->p = (struct sprite_pack *)plloc(&sp->slloc, sizeof(struct sprite_pack));
-	sp->p->n = maxid + 1;
-	sp->tex = texture;
-	sp->p->data = (void **)plloc(&sp->slloc, sp->p->n*sizeof(void *));
-	memset(sp->p->data, 0, sp->p->n*sizeof(void *));
-	sp->p->type = (int *)plloc(&sp->slloc, sp->p->n*sizeof(int));
-	memset(sp->p->type, 0, sp->p->n*sizeof(int));
+	// a pack holds the textures it kept and the atlases its rects went to
+	for (i = 0, k = 0; i < ab->n; i++) {
+		struct pack_async *a = ab->a[i];
+		struct spritepack *sp = a ? a->sp : 0;
+		int last = -1;
+		if (!sp || !sp->p) {
+			continue;
+		}
+		atlas_walk(ab, i, atlas_rewrite);
+		sp->shared = 1;
+		sp->texture = (int *)malloc((a->texture_n + ab->atlas_n + 1) * sizeof(int));
+		sp->texture_n = 0;
+		for (j = 0; j < a->texture_n; j++) {
+			if (ab->keep[i][j] >= 0) {
+				sp->texture[sp->texture_n++] = ab->texture[ab->keep[i][j]];
+			}
+		}
+		for (; k < ab->rect_n && ab->rect[k].pack == i; k++) {
+			int atlas = ab->rect[k].atlas;
+			if (atlas >= 0 && atlas != last) {
+				int m;
+				for (m = 0; m < sp->texture_n && sp->texture[m] != ab->texture[atlas]; m++)
+					;
+				if (m == sp->texture_n) {
+					sp->texture[sp->texture_n++] = ab->texture[atlas];
+				}
+				last = atlas;
+			}
+		}
+	}
+}
 
-	for (; sp->is.size > 0;) {
-		_import_sprite(sp);
+// read a pack of the build, on the threads of thread_run
+static void atlas_read(void *ud, int idx) {
+	struct atlas_build *ab = (struct atlas_build *)ud;
+	if (ab->a[idx]) {
+		async_read(ab->a[idx], 0);
 	}
 }
 
-void spritepack_init(const char *path) {
-	S.path = path;
-	S.n = 16;
-	S.h = hash_new(S.n);
-	S.array = malloc(S.n * sizeof(struct spritepack));
-	memset(S.array, 0, S.n*sizeof(struct spritepack));
+static void atlas_init(struct atlas_build *ab, int n, int size) {
+	memset(ab, 0, sizeof(*ab));
+	ab->n = n;
+	ab->size = size;
+	ab->a = (struct pack_async **)malloc((n + 1) * sizeof(struct pack_async *));
+	memset(ab->a, 0, (n + 1) * sizeof(struct pack_async *));
 }
 
-void spritepack_unit(void) {
+// the packs are taken by the caller before, their sp is freed or in the storage
+static void atlas_free(struct atlas_build *ab) {
 	int i;
-	hash_free(S.h);
-	for (i = 0; i < S.n; i++) {
-		struct spritepack *sp = &S.array[i];
-		if (sp->p) {
-			free(sp->p);
+	for (i = 0; i < ab->n; i++) {
+		if (ab->a[i]) {
+			async_free(ab->a[i]);
 		}
-		if (sp->h) {
-			hash_free(sp->h);
-		}
-		if (sp->export) {
-			free(sp->export);
+		if (ab->keep) {
+			free(ab->keep[i]);
 		}
 	}
-	free(S.array);
-}
-
-struct sprite_pack *spritepack_load(const char *file) {
-	int size, texture_n, export_n, packsize, metasize;
-	char *data, *metadata, *packdata;
-	int i, maxid;
-	char tmp[256];
-	struct stream is;
-	struct spritepack *sp;
-	long pos;
-
-	pos = hash_insert(S.h, file, strlen(file));
-	if (pos == -1) {
-		return 0;
+	for (i = 0; ab->pixels && i < ab->atlas_n; i++) {
+		free(ab->pixels[i]);
 	}
-	sp = &S.array[pos];
+	free(ab->pixels);
+	free(ab->height);
+	free(ab->keep);
+	free(ab->rect);
+	free(ab->texture);
+	free(ab->a);
+}
 
-	sprintf(tmp, "%s%s.pi", S.path, file);
-	data = readfile(tmp, &size);
-	if (!data) {
-		pixel_log("spritepack_load:%s failed\n", tmp);
-		return 0;
+static void atlas_reserve(struct atlas_build *ab) {
+	int i;
+	for (i = 0; i < ab->texture_n; i++) {
+		ab->texture[i] = _tex_alloc();
 	}
-	is.data = data;
-	is.size = size;
-
-	export_n = stream_r16(&is);
-	maxid = stream_r16(&is);
-	texture_n = stream_r16(&is);
-	packsize = stream_r32(&is);
-	stream_r32(&is);
+}
 
-	sp->export = malloc(export_n * sizeof(int));
-	sp->h = hash_new(export_n);
-	for (i = 0; i < export_n; i++) {
-		char buff[1024];
-		int len;
-		int id = stream_r16(&is);
-		const char *name = stream_rstr(&is, &len, alloc, buff);
-		pos = hash_insert(sp->h, name, strlen(name));
-		sp->export[pos] = id;
+int spritepack_load_atlas(const char *file[], int n, int size) {
+	char tmp[256];
+	int i, j, loaded = 0;
+	struct atlas_build ab;
+	atlas_init(&ab, n, size);
+	ab.reserve = atlas_reserve;
+	for (i = 0; i < n; i++) {
+		if (!hash_find(S.h, file[i], (int)strlen(file[i]))) {
+			sprintf(tmp, "%s%s", S.path, file[i]);
+			ab.a[i] = async_new(tmp, file[i]);
+		}
 	}
-	packdata = (char *)malloc(packsize);
-	metadata = is.data;
-	metasize = is.size;
-	if (1) {
-#if defined(_MSC_VER)
-		int *texture = (int *)_alloca(texture_n * sizeof(int));
-#else
-		int texture[texture_n];
-#endif
-		for (i = 0; i < texture_n; i++) {
-			texture[i] = _require_tex(file, i + 1, "png");
+	thread_run(atlas_read, &ab, n);
+	atlas_build(&ab);
+	for (i = 0; i < n; i++) {
+		struct spritepack *sp = ab.a[i] ? ab.a[i]->sp : 0;
+		if (!sp) {
+			continue;
+		}
+		for (j = 0; sp->texture && j < sp->texture_n; j++) {
+			_tex_retain(sp->texture[j]);
+		}
+		if (sp->p) {
+			struct stream is;
+			stream_init(&is, sp->export_data, sp->export_size);
+			export_read(sp, &is, sp->export_n);
 		}
-		spritepack_import(sp, texture, maxid, packdata, packsize, metadata, metasize);
+		if (!sp->p || !pack_add(sp)) {
+			pixel_log("spritepack_load_atlas:%s failed\n", file[i]);
+			pack_free(sp);
+			continue;
+		}
+		loaded++;
 	}
-	free(data);
-	pixel_log("spritepack_load:%s ok\n", file);
-	return (struct sprite_pack *)packdata;
+	pixel_log("spritepack_load_atlas:%d packs in %d atlases\n", loaded, ab.atlas_n);
+	// the packs hold the textures now
+	for (i = 0; i < ab.texture_n; i++) {
+		_tex_release(ab.texture[i]);
+	}
+	atlas_free(&ab);
+	return loaded;
 }
 
 struct sprite_pack *spritepack_query(const char *file) {
-	long pos = hash_exist(S.h, file, strlen(file));
-	if (-1 != pos) {
-		return S.array[pos].p;
-	}
-	return 0;
+	struct spritepack *sp = (struct spritepack *)hash_find(S.h, file, (int)strlen(file));
+	return sp ? sp->p : 0;
 }
 
 int spritepack_id(const char *file, const char *name) {
-	long pos = hash_exist(S.h, file, strlen(file));
-	if (-1 != pos) {
-		struct spritepack *sp = &S.array[pos];
-		pos = hash_exist(sp->h, name, strlen(name));
-		if (-1 != pos) {
-			return sp->export[pos];
+	struct spritepack *sp = (struct spritepack *)hash_find(S.h, file, (int)strlen(file));
+	if (sp && sp->h) {
+		int *id = (int *)hash_find(sp->h, name, (int)strlen(name));
+		if (id) {
+			return *id;
 		}
 	}
 	return -1;
@@ -532,7 +2890,8 @@ static int lanimation_size(lua_State *L) {
 	int size = sizeof(struct pack_animation)
 		+ frame * sizeof(struct pack_frame)
 		+ action * sizeof(struct pack_action)
-		+ (component - 1) * sizeof(struct pack_component);
+		+ (component - 1) * sizeof(struct pack_component)
+		+ pack_hash_size(component, action);
 	lua_pushinteger(L, size);
 	return 1;
 }
@@ -576,7 +2935,7 @@ static int lnew(lua_State *L) {
 	int t;
 	char *packdata;
 	char *metadata;
-	size_t metasize;
+	size_t metasize, sectionsize = 0;
 	int maxid = (int)luaL_checkinteger(L, 2);
 	int packsize = (int)luaL_checkinteger(L, 3);
 	t = lua_type(L, 1);
@@ -595,6 +2954,12 @@ static int lnew(lua_State *L) {
 	} else {
 		metadata = (char *)lua_touserdata(L, 4);
 		metasize = (size_t)luaL_checkinteger(L, 5);
+		// the sections packc appends after the sprites
+		sectionsize = (size_t)luaL_optinteger(L, 6, 0);
+	}
+	if (metadata) {
+		int need = _pack_size(maxid, metadata, (int)metasize, (int)(metasize + sectionsize));
+		packsize = packsize > need ? packsize : need;
 	}
 	packdata = (char *)lua_newuserdata(L, packsize);
 	if (metadata) {
@@ -615,7 +2980,7 @@ static int lnew(lua_State *L) {
 		} else if (t == LUA_TNUMBER) {
 			texture[0] = (int)lua_tointeger(L, 1);
 		}
-		spritepack_import(&sp, texture, maxid, packdata, packsize, metadata, (int)metasize);
+		spritepack_import(&sp, texture, maxid, packdata, packsize, metadata, (int)metasize, (int)(metasize + sectionsize));
 	} else {
 		return luaL_error(L, "need metadata");
 	}
@@ -683,10 +3048,591 @@ static int limport(lua_State *L) {
 	return 2;
 }
 
+static int ltexture(lua_State *L, int idx, int *texture, int texture_n) {
+	int i;
+	luaL_checktype(L, idx, LUA_TTABLE);
+	for (i = 0; i < texture_n; i++) {
+		lua_rawgeti(L, idx, i + 1);
+		texture[i] = (int)luaL_checkinteger(L, -1);
+		lua_pop(L, 1);
+	}
+	return texture_n;
+}
+
+// push the export section of a .pi as a table of name to id
+static void lexport(lua_State *L, char *data, int size, int n) {
+	int i;
+	struct stream is;
+	lua_createtable(L, 0, n);
+	stream_init(&is, data, size);
+	for (i = 0; i < n; i++) {
+		char buff[1024];
+		int len;
+		int id = stream_r16(&is);
+		const char *name = stream_rstr(&is, &len, alloc, buff);
+		lua_pushinteger(L, id);
+		lua_setfield(L, -2, name);
+	}
+}
+
+static int lmap(lua_State *L) {
+	int texture_n;
+	const char *filename = luaL_checkstring(L, 1);
+	struct pack_image *img = spritepack_map(filename, &texture_n);
+	if (!img) {
+		return 0;
+	}
+	lua_pushlightuserdata(L, img);
+	lua_pushinteger(L, texture_n);
+	return 2;
+}
+
+// relocate(img, texture, name), the image stays in the storage as name until unload
+static int lrelocate(lua_State *L) {
+	int *texture;
+	struct spritepack *sp;
+	struct pack_image *img = (struct pack_image *)lua_touserdata(L, 1);
+	const char *name = luaL_checkstring(L, 3);
+	struct image_header *h;
+	if (!img) {
+		return luaL_error(L, "need image");
+	}
+	h = img->h;
+	texture = (int *)lua_newuserdata(L, (h->texture_n + 1) * sizeof(int));
+	ltexture(L, 2, texture, h->texture_n);
+	sp = pack_new(name);
+	sp->image = img;
+	sp->p = spritepack_relocate(img, texture);
+	sp->size = h->data_size;
+	if (!sp->p || !pack_add(sp)) {
+		pack_free(sp);
+		return 0;
+	}
+	lua_pushlightuserdata(L, sp->p);
+	lexport(L, img->map + h->export_off, h->export_size, h->export_n);
+	lua_pushinteger(L, h->data_size);
+	return 3;
+}
+
+// load(pi, texture, name), the .pi in the string pi with its textures loaded in texture already.
+// the pack stays in the storage as name until unload, its sprites are imported as they are made
+static int lload(lua_State *L) {
+	size_t size;
+	int texture_n;
+	int *texture;
+	struct spritepack *sp;
+	const char *data = luaL_checklstring(L, 1, &size);
+	const char *name = luaL_checkstring(L, 3);
+	if (size < 14) {
+		return luaL_error(L, "%s is not a pack", name);
+	}
+	texture_n = (int)lua_rawlen(L, 2);
+	if (((uint8_t)data[4] | (uint8_t)data[5] << 8) > texture_n) {
+		return luaL_error(L, "%s needs more textures", name);
+	}
+	texture = (int *)lua_newuserdata(L, (texture_n + 1) * sizeof(int));
+	ltexture(L, 2, texture, texture_n);
+	sp = pack_new(name);
+	pi_load(sp, 0, 0, (char *)data, (int)size, texture);
+	// the textures belong to lua
+	sp->borrowed = 1;
+	if (!sp->p || !pack_add(sp)) {
+		pack_free(sp);
+		return 0;
+	}
+	lua_pushlightuserdata(L, sp->p);
+	lexport(L, sp->export_data, sp->export_size, sp->export_n);
+	lua_pushinteger(L, sp->size);
+	return 3;
+}
+
+// a string or a userdata as the memory of a pack
+static char *lmemory(lua_State *L, int idx, size_t *size) {
+	if (lua_type(L, idx) == LUA_TUSERDATA) {
+		*size = lua_rawlen(L, idx);
+		return (char *)lua_touserdata(L, idx);
+	}
+	return (char *)luaL_checklstring(L, idx, size);
+}
+
+// memory_textures(data) returns the number of textures of the pack in data and whether it is a bundle
+static int lmemory_textures(lua_State *L) {
+	size_t size;
+	int bundle, n;
+	char *data = lmemory(L, 1, &size);
+	n = memory_textures(data, (int)size, &bundle);
+	if (n < 0) {
+		return 0;
+	}
+	lua_pushinteger(L, n);
+	lua_pushboolean(L, bundle);
+	return 2;
+}
+
+// load_memory(name, data, texture, adopt), texture is loaded from a bundle, loaded by lua for a .pm or .pi.
+// with adopt a userdata holding a .pm is the memory of the pack, lua keeps it as long as the pack
+static int lload_memory(lua_State *L) {
+	size_t size;
+	int bundle, texture_n;
+	int *texture;
+	struct spritepack *sp;
+	char *data = lmemory(L, 2, &size);
+	const char *name = luaL_checkstring(L, 1);
+	int own = lua_type(L, 2) == LUA_TUSERDATA && lua_toboolean(L, 4) ? MEMORY_BORROW : MEMORY_COPY;
+	luaL_checktype(L, 3, LUA_TTABLE);
+	texture_n = (int)lua_rawlen(L, 3);
+	if (memory_textures(data, (int)size, &bundle) > texture_n) {
+		return luaL_error(L, "%s needs more textures", name);
+	}
+	texture = (int *)lua_newuserdata(L, (texture_n + 1) * sizeof(int));
+	ltexture(L, 3, texture, texture_n);
+	sp = pack_new(name);
+	if (!memory_import(sp, data, (int)size, texture, own) || !sp->p) {
+		pack_free(sp);
+		return 0;
+	}
+	// the textures belong to lua
+	sp->borrowed = 1;
+	if (!pack_add(sp)) {
+		pack_free(sp);
+		return 0;
+	}
+	lua_pushlightuserdata(L, sp->p);
+	lexport(L, sp->export_data, sp->export_size, sp->export_n);
+	lua_pushinteger(L, sp->size);
+	return 3;
+}
+
+// open_bundle(filename) returns the bundle and the number of its textures
+static int lopen_bundle(lua_State *L) {
+	struct bundle *b = bundle_open_fresh(luaL_checkstring(L, 1));
+	if (!b) {
+		return 0;
+	}
+	lua_pushlightuserdata(L, b);
+	lua_pushinteger(L, bundle_textures(b));
+	return 2;
+}
+
+// load_bundle(b, texture, name) closes b, the pack stays in the storage as name until unload
+static int lload_bundle(lua_State *L) {
+	int ok, texture_n;
+	int *texture;
+	struct spritepack *sp;
+	struct bundle *b = (struct bundle *)lua_touserdata(L, 1);
+	const char *name = luaL_checkstring(L, 3);
+	if (!b) {
+		return luaL_error(L, "need bundle");
+	}
+	texture_n = (int)lua_rawlen(L, 2);
+	texture = (int *)lua_newuserdata(L, (texture_n + 1) * sizeof(int));
+	ltexture(L, 2, texture, texture_n);
+	sp = pack_new(name);
+	ok = bundle_import(sp, b, name, texture);
+	bundle_close(b);
+	// the textures belong to lua
+	sp->borrowed = 1;
+	if (!ok || !sp->p || !pack_add(sp)) {
+		pack_free(sp);
+		return 0;
+	}
+	lua_pushlightuserdata(L, sp->p);
+	lexport(L, sp->export_data, sp->export_size, sp->export_n);
+	lua_pushinteger(L, sp->size);
+	return 3;
+}
+
+static int lbundle(lua_State *L) {
+	lua_pushboolean(L, spritepack_bundle(luaL_checkstring(L, 1), luaL_checkstring(L, 2)));
+	return 1;
+}
+
+static int lunload(lua_State *L) {
+	lua_pushinteger(L, spritepack_unload(luaL_checkstring(L, 1)));
+	return 1;
+}
+
+static int lsave(lua_State *L) {
+	char *export;
+	int *texture;
+	struct spritepack *sp;
+	int texture_n, export_n = 0, export_size = 0;
+	const char *filename = luaL_checkstring(L, 1);
+	struct sprite_pack *p = (struct sprite_pack *)lua_touserdata(L, 2);
+	int size = (int)luaL_checkinteger(L, 3);
+	luaL_checktype(L, 4, LUA_TTABLE);
+	luaL_checktype(L, 5, LUA_TTABLE);
+	if (!p) {
+		return luaL_error(L, "need pack");
+	}
+	if ((sp = pack_find(p))) {
+		if (sp->shared) {
+			lua_pushboolean(L, 0);
+			return 1;
+		}
+		lazy_finish(sp);
+	}
+	texture_n = (int)lua_rawlen(L, 4);
+	texture = (int *)lua_newuserdata(L, (texture_n + 1) * sizeof(int));
+	ltexture(L, 4, texture, texture_n);
+	lua_pushnil(L);
+	while (lua_next(L, 5) != 0) {
+		size_t sz;
+		luaL_checklstring(L, -2, &sz);
+		luaL_checkinteger(L, -1);
+		if (sz >= 255) {
+			return luaL_error(L, "%s is too long", lua_tostring(L, -2));
+		}
+		export_size += 3 + (int)sz;
+		lua_pop(L, 1);
+	}
+	export = (char *)lua_newuserdata(L, export_size + 1);
+	export_size = 0;
+	lua_pushnil(L);
+	while (lua_next(L, 5) != 0) {
+		size_t sz;
+		const char *name = lua_tolstring(L, -2, &sz);
+		int id = (int)lua_tointeger(L, -1);
+		export[export_size++] = (char)(id & 0xff);
+		export[export_size++] = (char)((id >> 8) & 0xff);
+		export[export_size++] = (char)sz;
+		memcpy(export + export_size, name, sz);
+		export_size += (int)sz;
+		export_n++;
+		lua_pop(L, 1);
+	}
+	lua_pushboolean(L, spritepack_write(filename, p, size, texture, texture_n, export, export_size, export_n, sp ? sp->source_size : 0, sp ? sp->source_hash : 0));
+	return 1;
+}
+
+#define SPRITEPACK_ASYNC "PIXEL_SPRITEPACK_ASYNC"
+
+// push the { reserve, cb } of a lua load
+static void lasync_entry(lua_State *L, struct pack_async *a) {
+	lua_getfield(L, LUA_REGISTRYINDEX, SPRITEPACK_ASYNC);
+	lua_rawgetp(L, -1, a);
+	lua_remove(L, -2);
+}
+
+static void lasync_reserve(struct pack_async *a) {
+	int i;
+	lua_State *L = a->L;
+	int top = lua_gettop(L);
+	lasync_entry(L, a);
+	lua_rawgeti(L, -1, 1);
+	lua_pushinteger(L, a->sp->texture_n);
+	if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+		pixel_log("spritepack.load_async:%s\n", lua_tostring(L, -1));
+	}
+	for (i = 0; i < a->sp->texture_n; i++) {
+		a->sp->texture[i] = -1;
+		if (lua_istable(L, -1)) {
+			lua_rawgeti(L, -1, i + 1);
+			if (lua_isinteger(L, -1)) {
+				a->sp->texture[i] = (int)lua_tointeger(L, -1);
+			}
+			lua_pop(L, 1);
+		}
+	}
+	lua_settop(L, top);
+}
+
+// the pack stays in the storage under its prefix until unload, its textures belong to lua
+// cb(pack, export, size, texture), or cb(nil, nil, nil, texture) when the load failed, with the ids
+// reserved for it, which may hold textures already, for lua to take back
+static void lasync_finish(struct pack_async *a) {
+	int i, ok;
+	lua_State *L = a->L;
+	struct spritepack *sp = a->sp;
+	int top = lua_gettop(L);
+	lasync_entry(L, a);
+	lua_rawgeti(L, -1, 2);
+	sp->borrowed = 1;
+	ok = sp->p && pack_add(sp);
+	if (ok) {
+		lua_pushlightuserdata(L, sp->p);
+		lexport(L, sp->export_data, sp->export_size, sp->export_n);
+		lua_pushinteger(L, sp->size);
+	} else {
+		lua_pushnil(L);
+		lua_pushnil(L);
+		lua_pushnil(L);
+	}
+	lua_createtable(L, sp->texture ? sp->texture_n : 0, 0);
+	for (i = 0; sp->texture && i < sp->texture_n; i++) {
+		lua_pushinteger(L, sp->texture[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	if (!ok) {
+		pack_free(sp);
+	}
+	if (lua_pcall(L, 4, 0, 0) != LUA_OK) {
+		pixel_log("spritepack.load_async:%s\n", lua_tostring(L, -1));
+	}
+	lua_getfield(L, LUA_REGISTRYINDEX, SPRITEPACK_ASYNC);
+	lua_pushnil(L);
+	lua_rawsetp(L, -2, a);
+	lua_settop(L, top);
+}
+
+// load_async(prefix, reserve, cb), reserve(n) returns the ids of the n textures of the pack.
+// returns false when prefix is loaded or loading already
+static int lload_async(lua_State *L) {
+	struct pack_async *a;
+	const char *prefix = luaL_checkstring(L, 1);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	luaL_checktype(L, 3, LUA_TFUNCTION);
+	if (hash_find(S.h, prefix, (int)strlen(prefix)) || async_loading(prefix)) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	a = async_new(prefix, prefix);
+	lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+	a->L = lua_tothread(L, -1);
+	lua_pop(L, 1);
+	a->reserve = lasync_reserve;
+	a->finish = lasync_finish;
+	if (lua_getfield(L, LUA_REGISTRYINDEX, SPRITEPACK_ASYNC) != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, LUA_REGISTRYINDEX, SPRITEPACK_ASYNC);
+	}
+	lua_createtable(L, 2, 0);
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, 1);
+	lua_pushvalue(L, 3);
+	lua_rawseti(L, -2, 2);
+	lua_rawsetp(L, -2, a);
+	async_post(a);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+static void latlas_reserve(struct atlas_build *ab) {
+	int i;
+	lua_State *L = (lua_State *)ab->ud;
+	lua_pushvalue(L, 3);
+	lua_pushinteger(L, ab->texture_n);
+	if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+		pixel_log("spritepack.load_atlas:%s\n", lua_tostring(L, -1));
+	}
+	for (i = 0; i < ab->texture_n; i++) {
+		ab->texture[i] = -1;
+		if (lua_istable(L, -1)) {
+			lua_rawgeti(L, -1, i + 1);
+			if (lua_isinteger(L, -1)) {
+				ab->texture[i] = (int)lua_tointeger(L, -1);
+			}
+			lua_pop(L, 1);
+		}
+	}
+	lua_pop(L, 1);
+}
+
+// load_atlas(prefixes, size, reserve), reserve(n) returns the ids of n textures. returns for each
+// prefix { pack, export, size } or false, the packs stay in the storage under their prefix until
+// unload. the textures, reserved whether a pack loaded or not, belong to lua
+static int lload_atlas(lua_State *L) {
+	int i, n;
+	struct atlas_build ab;
+	int size = (int)luaL_checkinteger(L, 2);
+	luaL_checktype(L, 1, LUA_TTABLE);
+	luaL_checktype(L, 3, LUA_TFUNCTION);
+	if (size <= 2 || size > 0xffff) {
+		return luaL_error(L, "invalid atlas size %d", size);
+	}
+	n = (int)lua_rawlen(L, 1);
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, 1, i + 1);
+		luaL_checkstring(L, -1);
+		lua_pop(L, 1);
+	}
+	atlas_init(&ab, n, size);
+	ab.reserve = latlas_reserve;
+	ab.ud = L;
+	for (i = 0; i < n; i++) {
+		const char *prefix;
+		lua_rawgeti(L, 1, i + 1);
+		prefix = lua_tostring(L, -1);
+		if (!hash_find(S.h, prefix, (int)strlen(prefix))) {
+			ab.a[i] = async_new(prefix, prefix);
+		}
+		lua_pop(L, 1);
+	}
+	thread_run(atlas_read, &ab, n);
+	atlas_build(&ab);
+	lua_createtable(L, n, 0);
+	for (i = 0; i < n; i++) {
+		struct spritepack *sp = ab.a[i] ? ab.a[i]->sp : 0;
+		if (sp && sp->p) {
+			struct stream is;
+			stream_init(&is, sp->export_data, sp->export_size);
+			export_read(sp, &is, sp->export_n);
+		}
+		if (sp) {
+			sp->borrowed = 1;
+		}
+		if (!sp || !sp->p || !pack_add(sp)) {
+			if (sp) {
+				pack_free(sp);
+			}
+			lua_pushboolean(L, 0);
+		} else {
+			lua_createtable(L, 3, 0);
+			lua_pushlightuserdata(L, sp->p);
+			lua_rawseti(L, -2, 1);
+			lexport(L, sp->export_data, sp->export_size, sp->export_n);
+			lua_rawseti(L, -2, 2);
+			lua_pushinteger(L, sp->size);
+			lua_rawseti(L, -2, 3);
+		}
+		lua_rawseti(L, -2, i + 1);
+	}
+	atlas_free(&ab);
+	return 1;
+}
+
+static void lbatch_reserve(struct pack_async *a) {
+	int i;
+	lua_State *L = a->L;
+	lua_pushvalue(L, 2);
+	lua_pushinteger(L, a->sp->texture_n);
+	lua_pushinteger(L, a->seq + 1);
+	if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
+		pixel_log("spritepack.load_batch:%s\n", lua_tostring(L, -1));
+	}
+	for (i = 0; i < a->sp->texture_n; i++) {
+		a->sp->texture[i] = -1;
+		if (lua_istable(L, -1)) {
+			lua_rawgeti(L, -1, i + 1);
+			if (lua_isinteger(L, -1)) {
+				a->sp->texture[i] = (int)lua_tointeger(L, -1);
+			}
+			lua_pop(L, 1);
+		}
+	}
+	lua_pop(L, 1);
+}
+
+// set result seq of the table on the top to { pack, export, size, texture } or false
+static void lbatch_finish(struct pack_async *a) {
+	int i;
+	lua_State *L = a->L;
+	struct spritepack *sp = a->sp;
+	if (sp->p) {
+		lua_createtable(L, 4, 3);
+		lua_pushlightuserdata(L, sp->p);
+		lua_rawseti(L, -2, 1);
+		lexport(L, sp->export_data, sp->export_size, sp->export_n);
+		lua_rawseti(L, -2, 2);
+		lua_pushinteger(L, sp->size);
+		lua_rawseti(L, -2, 3);
+		lua_createtable(L, sp->texture_n, 0);
+		for (i = 0; i < sp->texture_n; i++) {
+			lua_pushinteger(L, sp->texture[i]);
+			lua_rawseti(L, -2, i + 1);
+		}
+		lua_rawseti(L, -2, 4);
+	}
+	sp->borrowed = 1;
+	if (!sp->p || !pack_add(sp)) {
+		pack_free(sp);
+		if (lua_istable(L, -1)) {
+			lua_pop(L, 1);
+		}
+		lua_pushboolean(L, 0);
+	}
+	lua_rawseti(L, -2, a->seq + 1);
+}
+
+// load_batch(prefixes, reserve), reserve(n, i) returns the ids of the n textures of prefix i. returns the
+// seconds it took and for each prefix { pack, export, size, texture, parse = , decode = , upload = }
+// or false. the packs stay in the storage under their prefix until unload, the textures belong to lua
+static int lload_batch(lua_State *L) {
+	int i, n;
+	double total;
+	struct pack_async **a;
+	struct spritepack_timing *timing;
+	luaL_checktype(L, 1, LUA_TTABLE);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	n = (int)lua_rawlen(L, 1);
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, 1, i + 1);
+		luaL_checkstring(L, -1);
+		lua_pop(L, 1);
+	}
+	lua_settop(L, 2);
+	lua_createtable(L, n, 0);
+	a = (struct pack_async **)malloc((n + 1) * sizeof(struct pack_async *));
+	timing = (struct spritepack_timing *)malloc((n + 1) * sizeof(struct spritepack_timing));
+	for (i = 0; i < n; i++) {
+		const char *prefix;
+		lua_rawgeti(L, 1, i + 1);
+		prefix = lua_tostring(L, -1);
+		a[i] = 0;
+		if (!hash_find(S.h, prefix, (int)strlen(prefix))) {
+			a[i] = async_new(prefix, prefix);
+			a[i]->seq = i;
+			a[i]->L = L;
+			a[i]->reserve = lbatch_reserve;
+			a[i]->finish = lbatch_finish;
+		}
+		lua_pop(L, 1);
+	}
+	total = batch_load(a, n, timing);
+	for (i = 0; i < n; i++) {
+		if (lua_rawgeti(L, 3, i + 1) == LUA_TTABLE) {
+			lua_pushnumber(L, timing[i].parse);
+			lua_setfield(L, -2, "parse");
+			lua_pushnumber(L, timing[i].decode);
+			lua_setfield(L, -2, "decode");
+			lua_pushnumber(L, timing[i].upload);
+			lua_setfield(L, -2, "upload");
+		} else {
+			lua_pushboolean(L, 0);
+			lua_rawseti(L, 3, i + 1);
+		}
+		lua_pop(L, 1);
+	}
+	free(timing);
+	free(a);
+	lua_pushnumber(L, total);
+	lua_insert(L, 3);
+	return 2;
+}
+
+// seconds from the clock of the load timings
+static int lclock(lua_State *L) {
+	lua_pushnumber(L, thread_time());
+	return 1;
+}
+
+static int lasync_budget(lua_State *L) {
+	float ms = (float)luaL_optnumber(L, 1, 0);
+	lua_pushnumber(L, spritepack_async_budget(ms / 1000.0f) * 1000.0f);
+	return 1;
+}
+
 int pixel_spritepack(lua_State *L) {
 	luaL_Reg l[] = {
 		{ "new", lnew },
 		{ "import", limport },
+		{ "map", lmap },
+		{ "relocate", lrelocate },
+		{ "save", lsave },
+		{ "load", lload },
+		{ "open_bundle", lopen_bundle },
+		{ "load_bundle", lload_bundle },
+		{ "memory_textures", lmemory_textures },
+		{ "load_memory", lload_memory },
+		{ "bundle", lbundle },
+		{ "load_async", lload_async },
+		{ "load_atlas", lload_atlas },
+		{ "load_batch", lload_batch },
+		{ "clock", lclock },
+		{ "unload", lunload },
+		{ "async_budget", lasync_budget },
 		{ "byte", lpackbyte },
 		{ "word", lpackword },
 		{ "int32", lpackint32 },
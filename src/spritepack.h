@@ -21,6 +21,17 @@
 
 #define ANCHOR_ID 0xffff
 
+// aabb[0] of a bound that can not be precomputed (anchors, cycles)
+#define AABB_INFINITE INT32_MIN
+
+/*
+ * optional sections of a .pi after its sprites, a tag byte, a uint32 size, then the payload.
+ * bound: uint16 n, then n animations as uint16 id, uint16 frame_n, the aabb and the aabb of each frame.
+ * atlas: uint16 n, then the uint16 width and height of each texture the pack was compiled against.
+ */
+#define PACK_SECTION_BOUND 1
+#define PACK_SECTION_ATLAS 2
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -53,6 +64,7 @@ extern "C" {
 
 	struct pack_picture {
 		uint16_t n;
+		int32_t aabb[4];
 		struct pack_quad rect[1];
 	};
 
@@ -65,6 +77,7 @@ extern "C" {
 
 	struct pack_polygon {
 		uint16_t n;
+		int32_t aabb[4];
 		struct pack_poly poly[1];
 	};
 
@@ -84,6 +97,7 @@ extern "C" {
 	struct pack_frame {
 		struct pack_part *part;
 		uint16_t n;
+		int32_t aabb[4];
 	};
 
 	struct pack_action {
@@ -103,6 +117,11 @@ extern "C" {
 		uint16_t frame_n;
 		uint16_t action_n;
 		uint16_t component_n;
+		uint16_t component_slot;
+		uint16_t action_slot;
+		int32_t aabb[4];
+		// component index + 1 by name, then action index + 1 by name
+		uint16_t *hash;
 		struct pack_component component[1];
 	};
 
@@ -112,11 +131,90 @@ extern "C" {
 		int n;
 	};
 
+	// a power of two holding n names at half load
+	static inline int pack_name_slot(int n) {
+		int slot = 0;
+		if (n > 0) {
+			for (slot = 4; slot < n * 2; slot *= 2)
+				;
+		}
+		return slot;
+	}
+
+	// the name hash of an animation, pack memory it takes after its actions
+	static inline int pack_hash_size(int component_n, int action_n) {
+		int size = (pack_name_slot(component_n) + pack_name_slot(action_n)) * sizeof(uint16_t);
+		return (size + 7) & ~7;
+	}
+
 	void spritepack_init(const char *path);
 	void spritepack_unit(void);
 	struct sprite_pack *spritepack_load(const char *file);
+	// spritepack_load from the size bytes of a .pz, .pm or .pi in data, named name in the storage. a .pz has
+	// its textures, texture is 0 or the ids to load them into. the textures of a .pm or .pi are the texture_n
+	// ids in texture the caller has loaded, with texture_load_memory say, or the files <path><name>.N.png when
+	// texture is 0. the ids stay the caller's. data stays the caller's, copied when it is a .pm, unless adopt
+	// hands over a malloc block, freed by the load or kept as the memory of the pack. the memory of a pack
+	// loaded from a .pm already is refused
+	struct sprite_pack *spritepack_load_memory(const char *name, char *data, int size, const int *texture, int texture_n, int adopt);
+	// drop the reference of the storage to file, the pack and its textures are freed with the last one.
+	// returns the references left, -1 if file is not loaded
+	int spritepack_unload(const char *file);
+	// references of sprites to a pack of the storage, no-op for other packs
+	void spritepack_retain(struct sprite_pack *p);
+	int spritepack_release(struct sprite_pack *p);
 	struct sprite_pack *spritepack_query(const char *file);
+	// import sprite id of p and the sprites it draws, before they are used. packs of spritepack_load
+	// import a sprite the first time it is made, other packs are imported whole
+	void spritepack_require(struct sprite_pack *p, int id);
 	int spritepack_id(const char *file, const char *name);
+	//the index of the named component or action of ani, -1 if not found
+	int spritepack_component(const struct pack_animation *ani, const char *name);
+	int spritepack_action(const struct pack_animation *ani, const char *name);
+
+	struct pack_image;
+	// map a pack image (.pm) written by spritepack_write, 0 if it is not an image of this build, its
+	// offsets are out of its pack, or the .pi next to it is not the one it is written from
+	struct pack_image *spritepack_map(const char *filename, int *texture_n);
+	// patch the pointers and texture ids of a mapped image in place, texture[i] is the id of its i-th texture.
+	// 0 if it is patched already
+	struct sprite_pack *spritepack_relocate(struct pack_image *img, const int *texture);
+	void spritepack_unmap(struct pack_image *img);
+	// write an imported pack of size bytes as an image, export is the export section of its .pi.
+	// source_size and source_hash are those of the .pi, 0 when unknown, an image of another .pi is not loaded
+	int spritepack_write(const char *filename, struct sprite_pack *p, int size, const int *texture, int texture_n, const char *export, int export_size, int export_n, uint32_t source_size, uint32_t source_hash);
+	// write the pack loaded by spritepack_load(file) to <path><file>.pm
+	int spritepack_save(const char *file);
+	// pack <prefix>.pi, <prefix>.pm when there is one of it and the textures <prefix>.N.png into the
+	// compressed bundle filename, spritepack_load prefers <path><file>.pz to the loose files unless
+	// <path><file>.pi is not the one in it
+	int spritepack_bundle(const char *filename, const char *prefix);
+
+	// load the files like spritepack_load, the pictures and polygons of all of them copied into shared
+	// atlases size pixels wide, so sprites of these packs draw without switching textures. returns the
+	// packs loaded, files loaded already are skipped. the packs are imported whole and can not be saved
+	int spritepack_load_atlas(const char *file[], int n, int size);
+
+	// p is the loaded pack, 0 if it failed
+	typedef void(*spritepack_loaded)(void *ud, struct sprite_pack *p);
+	// load file like spritepack_load with the reading and decoding on the background thread,
+	// cb is called from spritepack_async_update, 0 if file is already loaded or loading
+	int spritepack_load_async(const char *file, spritepack_loaded cb, void *ud);
+	// seconds of texture upload spritepack_async_update may spend per call, returns the previous budget
+	float spritepack_async_budget(float seconds);
+	// upload the textures of read packs within the budget and finish loads in order, returns the loads in flight
+	int spritepack_async_update(void);
+
+	// seconds spent on each step of loading a pack in a batch
+	struct spritepack_timing {
+		double parse;
+		double decode;
+		double upload;
+	};
+	// load the loose .pi and textures of the files at once, the packs read and parsed then all their
+	// textures decoded on the threads of thread_run, then uploaded in order on the caller. p[i] is
+	// the pack of file[i], 0 if it failed or is loaded already, timing may be 0. returns the seconds taken
+	double spritepack_load_batch(const char *file[], int n, struct sprite_pack *p[], struct spritepack_timing *timing);
 
 #ifdef PIXEL_LUA
 #include "lua.h"
@@ -108,40 +108,78 @@ int texture_load(int tid, enum TEXTURE_FORMAT t, int width, int height, void *pi
 	return tex->id;
 }
 
-int texture_loadfile(int tid, const char *filename, int reduce) {
-	unsigned char *data, *pixels;
-	int size, width, height, channel;
-	int rid;
-	enum TEXTURE_FORMAT t;
-	data = (unsigned char *)readfile(filename, &size);
+void *texture_decode(const char *filename, int *width, int *height, enum TEXTURE_FORMAT *format) {
+	void *pixels;
+	int size;
+	char *data = readfile(filename, &size);
 	if (!data) {
-		return -1;
+		return 0;
 	}
-	pixels = stbi_load_from_memory(data, size, &width, &height, &channel, 0);
+	pixels = texture_decode_memory(data, size, width, height, format);
 	free(data);
 	if (!pixels) {
-		pixel_log("texture_loadfile %s err:%s\n", filename, stbi_failure_reason());
-		return -1;
+		pixel_log("texture_decode %s failed\n", filename);
+	}
+	return pixels;
+}
+
+void *texture_decode_memory(const void *data, int size, int *width, int *height, enum TEXTURE_FORMAT *format) {
+	unsigned char *pixels;
+	int channel;
+	pixels = stbi_load_from_memory((const unsigned char *)data, size, width, height, &channel, 0);
+	if (!pixels) {
+		pixel_log("texture_decode err:%s\n", stbi_failure_reason());
+		return 0;
 	}
 	switch (channel) {
 	case 1:
-		t = TEXTURE_A8;
+		*format = TEXTURE_A8;
 		break;
 	case 2:
-		t = TEXTURE_RGBA4;
+		*format = TEXTURE_RGBA4;
 		break;
 	case 3:
-		t = TEXTURE_RGB;
+		*format = TEXTURE_RGB;
 		break;
 	case 4:
-		t = TEXTURE_RGBA8;
+		*format = TEXTURE_RGBA8;
 		break;
 	default:
-		t = TEXTURE_INVALID;
+		*format = TEXTURE_INVALID;
 		break;
 	}
-	rid = texture_load(tid, t, width, height, pixels, reduce);
+	return pixels;
+}
+
+void texture_release(void *pixels) {
 	stbi_image_free(pixels);
+}
+
+int texture_loadfile(int tid, const char *filename, int reduce) {
+	void *pixels;
+	int width, height;
+	int rid;
+	enum TEXTURE_FORMAT t;
+	pixels = texture_decode(filename, &width, &height, &t);
+	if (!pixels) {
+		return -1;
+	}
+	rid = texture_load(tid, t, width, height, pixels, reduce);
+	texture_release(pixels);
+	return rid;
+}
+
+int texture_load_memory(int tid, const void *data, int size, int reduce) {
+	void *pixels;
+	int width, height;
+	int rid;
+	enum TEXTURE_FORMAT t;
+	pixels = texture_decode_memory(data, size, &width, &height, &t);
+	if (!pixels) {
+		return -1;
+	}
+	rid = texture_load(tid, t, width, height, pixels, reduce);
+	texture_release(pixels);
 	return rid;
 }
 
@@ -197,8 +235,17 @@ int texture_coord(int tid, float x, float y, uint16_t *u, uint16_t *v) {
 		*v = (uint16_t)y;
 		return 1;
 	}
-	x *= tex->invw;
-	y *= tex->invh;
+	return texture_normalize(tex->width, tex->height, x, y, u, v);
+}
+
+int texture_normalize(int width, int height, float x, float y, uint16_t *u, uint16_t *v) {
+	if (width <= 0 || height <= 0) {
+		*u = (uint16_t)x;
+		*v = (uint16_t)y;
+		return 1;
+	}
+	x *= 1.0f / (float)width;
+	y *= 1.0f / (float)height;
 	if (x > 1.0f) {
 		x = 1.0f;
 	}
@@ -257,6 +304,26 @@ static int lload(lua_State *L) {
 	return 1;
 }
 
+// load_memory(tid, data, reduce), data the encoded image in a string or a userdata
+static int lload_memory(lua_State *L) {
+	size_t size;
+	const char *data;
+	int rid, tid = (int)luaL_checkinteger(L, 1);
+	int reduce = (int)luaL_optinteger(L, 3, 0);
+	if (lua_type(L, 2) == LUA_TUSERDATA) {
+		data = (const char *)lua_touserdata(L, 2);
+		size = lua_rawlen(L, 2);
+	} else {
+		data = luaL_checklstring(L, 2, &size);
+	}
+	rid = texture_load_memory(tid, data, (int)size, reduce);
+	if (rid == -1) {
+		return 0;
+	}
+	lua_pushinteger(L, rid);
+	return 1;
+}
+
 static int lunload(lua_State *L) {
 	int tid = (int)luaL_checkinteger(L, 1);
 	texture_unload(tid);
@@ -282,6 +349,7 @@ static int lswap(lua_State *L) {
 int pixel_texture(lua_State *L) {
 	luaL_Reg l[] = {
 		{"load", lload},
+		{"load_memory", lload_memory},
 		{"unload", lunload},
 		{"size", lsize},
 		{"swap", lswap},
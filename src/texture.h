@@ -12,8 +12,16 @@ extern "C" {
 	void texture_unit(void);
 	int texture_load(int tid, enum TEXTURE_FORMAT t, int width, int height, void *pixels, int reduce);
 	int texture_loadfile(int tid, const char *filename, int reduce);
+	//texture_loadfile from the size bytes of an encoded image, data stays the caller's
+	int texture_load_memory(int tid, const void *data, int size, int reduce);
+	//read and decode an image file without touching the renderer, safe off the main thread
+	void *texture_decode(const char *filename, int *width, int *height, enum TEXTURE_FORMAT *format);
+	void *texture_decode_memory(const void *data, int size, int *width, int *height, enum TEXTURE_FORMAT *format);
+	void texture_release(void *pixels);
 	void texture_unload(int tid);
 	int texture_coord(int tid, float x, float y, uint16_t *u, uint16_t *v);
+	//texture_coord for a texture of width * height that is not loaded yet
+	int texture_normalize(int width, int height, float x, float y, uint16_t *u, uint16_t *v);
 	int texture_rid(int tid);
 	void texture_size(int tid, int *width, int *height);
 	int texture_update(int tid, int width, int height, void *pixels);
@@ -0,0 +1,272 @@
+#include "thread.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_WORKER 7
+
+#if defined(_MSC_VER)
+
+int thread_init(int n) {
+	(void)n;
+	return 0;
+}
+
+void thread_unit(void) {
+}
+
+int thread_count(void) {
+	return 1;
+}
+
+void thread_run(thread_job job, void *ud, int n) {
+	int i;
+	for (i = 0; i < n; i++) {
+		job(ud, i);
+	}
+}
+
+void thread_post(thread_job job, void *ud) {
+	job(ud, 0);
+}
+
+int thread_pending(void) {
+	return 0;
+}
+
+double thread_time(void) {
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+#else
+
+#include <pthread.h>
+#include <unistd.h>
+
+struct pool {
+	int n;
+	pthread_t thread[MAX_WORKER];
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	int quit;
+	// the batch of jobs being run, generation tells workers a new one began
+	int generation;
+	thread_job job;
+	void *ud;
+	int next;
+	int total;
+	int busy;
+};
+
+static struct pool P;
+
+struct post {
+	struct post *next;
+	thread_job job;
+	void *ud;
+};
+
+// the background thread, started by the first thread_post
+struct queue {
+	int init;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wait;
+	struct post *head;
+	struct post *tail;
+	int pending;
+	int quit;
+};
+
+static struct queue Q;
+
+// take jobs from the current batch until it is empty, with the lock held
+static void take_jobs(void) {
+	while (P.next < P.total) {
+		int idx = P.next++;
+		P.busy++;
+		pthread_mutex_unlock(&P.lock);
+		P.job(P.ud, idx);
+		pthread_mutex_lock(&P.lock);
+		if (--P.busy == 0 && P.next >= P.total) {
+			pthread_cond_signal(&P.done);
+		}
+	}
+}
+
+static void *worker(void *ud) {
+	int generation = 0;
+	(void)ud;
+	pthread_mutex_lock(&P.lock);
+	for (;;) {
+		while (!P.quit && generation == P.generation) {
+			pthread_cond_wait(&P.start, &P.lock);
+		}
+		if (P.quit) {
+			break;
+		}
+		generation = P.generation;
+		take_jobs();
+	}
+	pthread_mutex_unlock(&P.lock);
+	return 0;
+}
+
+int thread_init(int n) {
+	int i;
+	if (P.n > 0) {
+		return P.n;
+	}
+	if (n < 0) {
+		n = (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	}
+	if (n > MAX_WORKER) {
+		n = MAX_WORKER;
+	}
+	if (n <= 0) {
+		return 0;
+	}
+	pthread_mutex_init(&P.lock, 0);
+	pthread_cond_init(&P.start, 0);
+	pthread_cond_init(&P.done, 0);
+	P.quit = 0;
+	for (i = 0; i < n; i++) {
+		if (pthread_create(&P.thread[i], 0, worker, 0)) {
+			break;
+		}
+	}
+	P.n = i;
+	return P.n;
+}
+
+void thread_unit(void) {
+	int i;
+	if (Q.init) {
+		// posted jobs are finished before the background thread quits
+		pthread_mutex_lock(&Q.lock);
+		Q.quit = 1;
+		pthread_cond_signal(&Q.wait);
+		pthread_mutex_unlock(&Q.lock);
+		pthread_join(Q.thread, 0);
+		pthread_cond_destroy(&Q.wait);
+		pthread_mutex_destroy(&Q.lock);
+		Q.init = 0;
+		Q.quit = 0;
+	}
+	if (P.n == 0) {
+		return;
+	}
+	pthread_mutex_lock(&P.lock);
+	P.quit = 1;
+	pthread_cond_broadcast(&P.start);
+	pthread_mutex_unlock(&P.lock);
+	for (i = 0; i < P.n; i++) {
+		pthread_join(P.thread[i], 0);
+	}
+	pthread_cond_destroy(&P.done);
+	pthread_cond_destroy(&P.start);
+	pthread_mutex_destroy(&P.lock);
+	P.n = 0;
+}
+
+int thread_count(void) {
+	return P.n + 1;
+}
+
+static void *background(void *ud) {
+	(void)ud;
+	pthread_mutex_lock(&Q.lock);
+	for (;;) {
+		struct post *p;
+		while (!Q.quit && !Q.head) {
+			pthread_cond_wait(&Q.wait, &Q.lock);
+		}
+		if (!Q.head) {
+			break;
+		}
+		p = Q.head;
+		Q.head = p->next;
+		if (!Q.head) {
+			Q.tail = 0;
+		}
+		pthread_mutex_unlock(&Q.lock);
+		p->job(p->ud, 0);
+		free(p);
+		pthread_mutex_lock(&Q.lock);
+		Q.pending--;
+	}
+	pthread_mutex_unlock(&Q.lock);
+	return 0;
+}
+
+void thread_post(thread_job job, void *ud) {
+	struct post *p;
+	if (!Q.init) {
+		pthread_mutex_init(&Q.lock, 0);
+		pthread_cond_init(&Q.wait, 0);
+		if (pthread_create(&Q.thread, 0, background, 0)) {
+			pthread_cond_destroy(&Q.wait);
+			pthread_mutex_destroy(&Q.lock);
+			job(ud, 0);
+			return;
+		}
+		Q.init = 1;
+	}
+	p = (struct post *)malloc(sizeof(*p));
+	p->next = 0;
+	p->job = job;
+	p->ud = ud;
+	pthread_mutex_lock(&Q.lock);
+	if (Q.tail) {
+		Q.tail->next = p;
+	} else {
+		Q.head = p;
+	}
+	Q.tail = p;
+	Q.pending++;
+	pthread_cond_signal(&Q.wait);
+	pthread_mutex_unlock(&Q.lock);
+}
+
+int thread_pending(void) {
+	int n;
+	if (!Q.init) {
+		return 0;
+	}
+	pthread_mutex_lock(&Q.lock);
+	n = Q.pending;
+	pthread_mutex_unlock(&Q.lock);
+	return n;
+}
+
+double thread_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+void thread_run(thread_job job, void *ud, int n) {
+	int i;
+	if (P.n == 0 || n < 2) {
+		for (i = 0; i < n; i++) {
+			job(ud, i);
+		}
+		return;
+	}
+	pthread_mutex_lock(&P.lock);
+	P.job = job;
+	P.ud = ud;
+	P.next = 0;
+	P.total = n;
+	P.busy = 0;
+	P.generation++;
+	pthread_cond_broadcast(&P.start);
+	take_jobs();
+	while (P.busy > 0) {
+		pthread_cond_wait(&P.done, &P.lock);
+	}
+	pthread_mutex_unlock(&P.lock);
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	typedef void(*thread_job)(void *ud, int idx);
+
+	//start n worker threads beside the caller, -1 one per spare core, 0 runs jobs on the caller only
+	int thread_init(int n);
+	void thread_unit(void);
+	//the number of threads thread_run spreads jobs over, the caller included
+	int thread_count(void);
+	//call job(ud, i) for every i in [0, n) and return when all are done
+	void thread_run(thread_job job, void *ud, int n);
+	//queue job(ud, 0) on the background thread, posted jobs run one at a time in order
+	void thread_post(thread_job job, void *ud);
+	//the number of posted jobs not finished yet
+	int thread_pending(void);
+	//seconds from a monotonic clock, to budget work on the caller
+	double thread_time(void);
+
+#ifdef __cplusplus
+};
+#endif
+#endif // _THREAD_H_
@@ -0,0 +1,99 @@
+#include "vertex.h"
+#include "matrix.h"
+#include "renderbuffer.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VERTEX_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VERTEX_NEON
+#include <arm_neon.h>
+#endif
+
+#define OUT(out, i, stride) ((struct vertex_pack *)((char *)(out) + (i) * (stride)))
+
+void vertex_matrix(const struct matrix *mat, float sx, float sy, float f[6]) {
+	if (!mat) {
+		f[0] = sx;
+		f[1] = 0;
+		f[2] = 0;
+		f[3] = sy;
+		f[4] = 0;
+		f[5] = 0;
+	} else {
+		const int *m = mat->m;
+		f[0] = m[0] * sx / 1024.0f;
+		f[1] = m[1] * sy / 1024.0f;
+		f[2] = m[2] * sx / 1024.0f;
+		f[3] = m[3] * sy / 1024.0f;
+		f[4] = m[4] * sx;
+		f[5] = m[5] * sy;
+	}
+}
+
+static inline void transform_point(const float f[6], const int32_t *coord, const uint16_t *texcoord, struct vertex_pack *v) {
+	float x = (float)coord[0];
+	float y = (float)coord[1];
+	v->vx = x * f[0] + y * f[2] + f[4];
+	v->vy = x * f[1] + y * f[3] + f[5];
+	v->tx = texcoord[0];
+	v->ty = texcoord[1];
+}
+
+void vertex_transform(const float f[6], int n, const int32_t *coord, const uint16_t *texcoord, struct vertex_pack *out, int stride) {
+	int i = 0;
+#if defined(VERTEX_SSE2)
+	__m128 a = _mm_set1_ps(f[0]);
+	__m128 b = _mm_set1_ps(f[1]);
+	__m128 c = _mm_set1_ps(f[2]);
+	__m128 d = _mm_set1_ps(f[3]);
+	__m128 e = _mm_set1_ps(f[4]);
+	__m128 g = _mm_set1_ps(f[5]);
+	for (; i + 4 <= n; i += 4) {
+		int j;
+		__m128 p0 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(coord + i * 2)));
+		__m128 p1 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(coord + i * 2 + 4)));
+		__m128 x = _mm_shuffle_ps(p0, p1, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 y = _mm_shuffle_ps(p0, p1, _MM_SHUFFLE(3, 1, 3, 1));
+		__m128 vx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, a), _mm_mul_ps(y, c)), e);
+		__m128 vy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, b), _mm_mul_ps(y, d)), g);
+		__m128 lo = _mm_unpacklo_ps(vx, vy);
+		__m128 hi = _mm_unpackhi_ps(vx, vy);
+		_mm_storel_pi((__m64 *)&OUT(out, i, stride)->vx, lo);
+		_mm_storeh_pi((__m64 *)&OUT(out, i + 1, stride)->vx, lo);
+		_mm_storel_pi((__m64 *)&OUT(out, i + 2, stride)->vx, hi);
+		_mm_storeh_pi((__m64 *)&OUT(out, i + 3, stride)->vx, hi);
+		for (j = 0; j < 4; j++) {
+			memcpy(&OUT(out, i + j, stride)->tx, texcoord + (i + j) * 2, 2 * sizeof(uint16_t));
+		}
+	}
+#elif defined(VERTEX_NEON)
+	float32x4_t a = vdupq_n_f32(f[0]);
+	float32x4_t b = vdupq_n_f32(f[1]);
+	float32x4_t c = vdupq_n_f32(f[2]);
+	float32x4_t d = vdupq_n_f32(f[3]);
+	float32x4_t e = vdupq_n_f32(f[4]);
+	float32x4_t g = vdupq_n_f32(f[5]);
+	for (; i + 4 <= n; i += 4) {
+		int j;
+		int32x4x2_t p = vld2q_s32(coord + i * 2);
+		float32x4_t x = vcvtq_f32_s32(p.val[0]);
+		float32x4_t y = vcvtq_f32_s32(p.val[1]);
+		float32x4_t vx = vmlaq_f32(vmlaq_f32(e, x, a), y, c);
+		float32x4_t vy = vmlaq_f32(vmlaq_f32(g, x, b), y, d);
+		float32x4x2_t z = vzipq_f32(vx, vy);
+		vst1_f32(&OUT(out, i, stride)->vx, vget_low_f32(z.val[0]));
+		vst1_f32(&OUT(out, i + 1, stride)->vx, vget_high_f32(z.val[0]));
+		vst1_f32(&OUT(out, i + 2, stride)->vx, vget_low_f32(z.val[1]));
+		vst1_f32(&OUT(out, i + 3, stride)->vx, vget_high_f32(z.val[1]));
+		for (j = 0; j < 4; j++) {
+			memcpy(&OUT(out, i + j, stride)->tx, texcoord + (i + j) * 2, 2 * sizeof(uint16_t));
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		transform_point(f, coord + i * 2, texcoord + i * 2, OUT(out, i, stride));
+	}
+}
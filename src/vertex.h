@@ -0,0 +1,28 @@
+#ifndef _VERTEX_H_
+#define _VERTEX_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	struct matrix;
+	struct vertex_pack;
+
+	/* A float matrix f transforms a point (x, y) to:
+	*
+	* vx = x * f[0] + y * f[2] + f[4]
+	* vy = x * f[1] + y * f[3] + f[5]
+	*
+	*/
+
+	//fold the fixed point matrix mat (0 is identity) and the scale (sx, sy) into f
+	void vertex_matrix(const struct matrix *mat, float sx, float sy, float f[6]);
+	//transform n points of coord by f and copy texcoord, out advances stride bytes per point
+	void vertex_transform(const float f[6], int n, const int32_t *coord, const uint16_t *texcoord, struct vertex_pack *out, int stride);
+
+#ifdef __cplusplus
+};
+#endif
+#endif // _VERTEX_H_
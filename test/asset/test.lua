@@ -0,0 +1,85 @@
+return {
+{
+	type = "picture",
+	id = 0,
+	{ tex = 1 , src = { 0, 0, 0, 32, 32, 32, 32, 0 }, screen = { 0, 0, 0, 512, 512, 512, 512, 0 } },
+},
+{
+	type = "picture",
+	id = 1,
+	{ tex = 2 , src = { 0, 0, 0, 32, 32, 32, 32, 0 }, screen = { 0, 0, 0, 512, 512, 512, 512, 0 } },
+},
+{
+	type = "label",
+	id = 2,
+	font = "", color = 0xffffffff, align = 0, size = 16, width = 100, height = 20, noedge = true
+},
+{
+	type = "animation",
+	export = "a",
+	id = 3,
+	component = {
+		{id = 0 },
+	},
+	{
+		{ 0 },
+	},
+},
+{
+	type = "animation",
+	export = "mixed",
+	id = 4,
+	component = {
+		{id = 0 },
+		{id = 2, name = 'text' },
+	},
+	{
+		{ { index = 0, mat = {1024,0,0,1024,1024,0} }, 1 },
+	},
+},
+{
+	type = "animation",
+	export = "b",
+	id = 5,
+	component = {
+		{id = 1 },
+	},
+	{
+		{ { index = 0, mat = {1024,0,0,1024,2048,0} } },
+	},
+},
+{
+	type = "panel",
+	id = 6,
+	width = 10, height = 10, scissor = true,
+},
+{
+	type = "animation",
+	export = "clip",
+	id = 7,
+	component = {
+		{id = 6 },
+		{name = 'anchor' },
+	},
+	{
+		{ 0, { index = 1, mat = {1024,0,0,1024,320,160} } },
+	},
+},
+{
+	type = "picture",
+	id = 8,
+	{ tex = 1 , src = { 0, 0, 0, 32, 32, 32, 32, 0 }, screen = { 0, 0, 0, 512, 512, 512, 512, 0 } },
+	{ tex = 2 , src = { 0, 0, 0, 32, 32, 32, 32, 0 }, screen = { 512, 0, 512, 512, 1024, 512, 1024, 0 } },
+},
+{
+	type = "animation",
+	export = "ab",
+	id = 9,
+	component = {
+		{id = 8 },
+	},
+	{
+		{ 0 },
+	},
+},
+}
@@ -0,0 +1,209 @@
+/*
+* Call the lua bindings of sprite.c on the sprites of test/asset/test.pi against the stubs of
+* stub.c, and compare what reaches the renderer with the same calls made from C.
+*
+* make test
+*/
+#include "test.h"
+#include "sprite.h"
+#include "screen.h"
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include <string.h>
+
+static struct trace Expect[TRACE_MAX];
+
+static struct srt Srt = { 160, 160, 1024, 1024, 0 };
+
+static const char *Draw_parallel =
+	"local c, pack, id = ...\n"
+	"local s = c.new(pack, id)\n"
+	"c.draw_parallel({ s }, { x = 100, y = 50, scale = 2 })\n"
+	"return s\n";
+
+// the srt table of draw_parallel places the roots
+static void test_draw_parallel(lua_State *L) {
+	int n;
+	struct sprite *s;
+	struct srt srt = { 100 * SCREEN_SCALE, 50 * SCREEN_SCALE, 2048, 2048, 0 };
+	luaL_loadstring(L, Draw_parallel);
+	luaL_requiref(L, "pixel.sprite", pixel_sprite, 0);
+	lua_pushlightuserdata(L, spritepack_query("test"));
+	lua_pushinteger(L, spritepack_id("test", "a"));
+	trace_reset();
+	if (lua_pcall(L, 3, 1, 0) != LUA_OK) {
+		printf("%s\n", lua_tostring(L, -1));
+		Test_fail++;
+		lua_pop(L, 1);
+		return;
+	}
+	s = (struct sprite *)lua_touserdata(L, -1);
+	n = Trace_n;
+	memcpy(Expect, Trace, n * sizeof(struct trace));
+	trace_reset();
+	sprite_draw(s, &srt);
+	if (!trace_equal(Trace, Trace_n, Expect, n)) {
+		trace_dump("sprite_draw", Trace, Trace_n);
+		trace_dump("draw_parallel", Expect, n);
+		Test_fail++;
+	}
+	CHECK(n == 1 && Expect[0].x[0] != 0);
+	lua_pop(L, 1);
+}
+
+static const char *Draw_material =
+	"local c, pack, id = ...\n"
+	"local s = c.new(pack, id)\n"
+	"c.material(s)\n"
+	"c.draw_parallel({ s }, { x = 100, y = 50, scale = 2 })\n"
+	"return s\n";
+
+// the quads of a sprite with a material keep it past a change of texture
+static void test_draw_material(lua_State *L) {
+	int n;
+	struct sprite *s;
+	struct srt srt = { 100 * SCREEN_SCALE, 50 * SCREEN_SCALE, 2048, 2048, 0 };
+	luaL_loadstring(L, Draw_material);
+	luaL_requiref(L, "pixel.sprite", pixel_sprite, 0);
+	lua_pushlightuserdata(L, spritepack_query("test"));
+	lua_pushinteger(L, spritepack_id("test", "ab"));
+	trace_reset();
+	if (lua_pcall(L, 3, 1, 0) != LUA_OK) {
+		printf("%s\n", lua_tostring(L, -1));
+		Test_fail++;
+		lua_pop(L, 1);
+		return;
+	}
+	s = (struct sprite *)lua_touserdata(L, -1);
+	n = Trace_n;
+	memcpy(Expect, Trace, n * sizeof(struct trace));
+	trace_reset();
+	sprite_draw(s, &srt);
+	if (!trace_equal(Trace, Trace_n, Expect, n)) {
+		trace_dump("sprite_draw", Trace, Trace_n);
+		trace_dump("draw_parallel", Expect, n);
+		Test_fail++;
+	}
+	CHECK(n == 2 && Expect[0].tid != Expect[1].tid && Expect[1].material != 0);
+	lua_pop(L, 1);
+}
+
+static const char *Get_matrix =
+	"local c, pack, id = ...\n"
+	"local s = c.new(pack, id)\n"
+	"return s, c.get.matrix(s)\n";
+
+// the matrix read from lua is a copy, the sprite moves when it is set back
+static void test_get_matrix(lua_State *L) {
+	int n;
+	struct sprite *s;
+	struct matrix *mat;
+	luaL_loadstring(L, Get_matrix);
+	luaL_requiref(L, "pixel.sprite", pixel_sprite, 0);
+	lua_pushlightuserdata(L, spritepack_query("test"));
+	lua_pushinteger(L, spritepack_id("test", "a"));
+	if (lua_pcall(L, 3, 2, 0) != LUA_OK) {
+		printf("%s\n", lua_tostring(L, -1));
+		Test_fail++;
+		lua_pop(L, 1);
+		return;
+	}
+	s = (struct sprite *)lua_touserdata(L, -2);
+	mat = (struct matrix *)lua_touserdata(L, -1);
+	CHECK(mat && mat->m[0] == 1024 && mat->m[4] == 0);
+	trace_reset();
+	sprite_draw(s, &Srt);
+	n = Trace_n;
+	memcpy(Expect, Trace, n * sizeof(struct trace));
+	mat->m[4] += 16 * SCREEN_SCALE;
+	trace_reset();
+	sprite_draw(s, &Srt);
+	CHECK(trace_equal(Trace, Trace_n, Expect, n));
+	sprite_matrix(s, mat);
+	CHECK(sprite_world(s)->m[4] == 16 * SCREEN_SCALE);
+	trace_reset();
+	sprite_draw(s, &Srt);
+	CHECK(n == 1 && Trace_n == 1 && Trace[0].x[0] != Expect[0].x[0]);
+	lua_pop(L, 2);
+}
+
+static const char *New_tree =
+	"local c, pack, id = ...\n"
+	"local s = c.new(pack, id)\n"
+	"local t = c.new(pack, id)\n"
+	"local text = c.method.fetch(s, 'text')\n"
+	"assert(text and text ~= c.method.fetch(t, 'text'))\n"
+	"return s, text\n";
+
+// a lua sprite is a copy of the pool template, with a userdata for each node
+static void test_new_tree(lua_State *L) {
+	struct sprite *s, *text;
+	luaL_loadstring(L, New_tree);
+	luaL_requiref(L, "pixel.sprite", pixel_sprite, 0);
+	lua_pushlightuserdata(L, spritepack_query("test"));
+	lua_pushinteger(L, spritepack_id("test", "mixed"));
+	if (lua_pcall(L, 3, 2, 0) != LUA_OK) {
+		printf("%s\n", lua_tostring(L, -1));
+		Test_fail++;
+		lua_pop(L, 1);
+		return;
+	}
+	s = (struct sprite *)lua_touserdata(L, -2);
+	text = (struct sprite *)lua_touserdata(L, -1);
+	CHECK(sprite_child(s, "text") == text);
+	lua_pop(L, 2);
+}
+
+static const char *Play_drop =
+	"local c, pack, id = ...\n"
+	"local s = debug.setmetatable(c.new(pack, id), { __gc = c.gc })\n"
+	"local anim = debug.getregistry().PIXEL_SPRITE_ANIM\n"
+	"assert(c.method.play(s, nil, 30, 'loop'))\n"
+	"assert(next(anim))\n"
+	"s = nil\n"
+	"collectgarbage()\n"
+	"collectgarbage()\n"
+	"return next(anim) == nil\n";
+
+// a looping sprite dropped without stop is collected, and stopped by its __gc
+static void test_play_drop(lua_State *L) {
+	luaL_loadstring(L, Play_drop);
+	luaL_requiref(L, "pixel.sprite", pixel_sprite, 0);
+	lua_pushlightuserdata(L, spritepack_query("test"));
+	lua_pushinteger(L, spritepack_id("test", "a"));
+	if (lua_pcall(L, 3, 1, 0) != LUA_OK) {
+		printf("%s\n", lua_tostring(L, -1));
+		Test_fail++;
+		lua_pop(L, 1);
+		return;
+	}
+	CHECK(lua_toboolean(L, -1));
+	lua_pop(L, 1);
+	sprite_animate(1.0f);
+	CHECK(sprite_finish(L) == 0);
+}
+
+int main(int argc, char *argv[]) {
+	lua_State *L;
+	screen_init(1024, 768, 1);
+	spritepack_init(argc > 1 ? argv[1] : "test/asset/");
+	spritepack_load("test");
+	L = luaL_newstate();
+	luaL_openlibs(L);
+	test_draw_parallel(L);
+	test_draw_material(L);
+	test_get_matrix(L);
+	test_play_drop(L);
+	test_new_tree(L);
+	lua_close(L);
+	spritepack_unit();
+	if (Test_fail) {
+		printf("%d failed\n", Test_fail);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,374 @@
+/*
+* Draw the sprites of test/asset/test.pi against the stubs of stub.c and compare what reaches
+* the renderer with what drawing the same sprites one at a time gives.
+*
+* make test
+*/
+#include "test.h"
+#include "sprite.h"
+#include "screen.h"
+#include "readfile.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct trace Expect[TRACE_MAX];
+static int Expect_n;
+
+static struct srt Srt = { 160, 160, 1024, 1024, 0 };
+
+static void expect(void) {
+	memcpy(Expect, Trace, Trace_n * sizeof(struct trace));
+	Expect_n = Trace_n;
+	trace_reset();
+}
+
+static int same(const char *what) {
+	if (trace_equal(Expect, Expect_n, Trace, Trace_n)) {
+		return 1;
+	}
+	trace_dump("expected", Expect, Expect_n);
+	trace_dump(what, Trace, Trace_n);
+	return 0;
+}
+
+static struct sprite *text_sprite(const char *name, const char *text) {
+	struct sprite *s = sprite_new("test", name);
+	sprite_text(sprite_child(s, "text"), text);
+	return s;
+}
+
+// a root that bails part way to the main thread does not leave its quads in the op before it
+static void test_roots_fallback(void) {
+	int i;
+	struct sprite *list[3];
+	list[0] = sprite_new("test", "a");
+	list[1] = text_sprite("mixed", "hello");
+	list[2] = sprite_new("test", "b");
+	trace_reset();
+	for (i = 0; i < 3; i++) {
+		sprite_draw(list[i], &Srt);
+	}
+	expect();
+	CHECK(Expect_n == 4 && Expect[2].type == TRACE_LABEL && Expect[1].tid == Expect[0].tid && Expect[3].tid != Expect[0].tid);
+	sprite_draw_roots(list, 3, &Srt);
+	CHECK(same("sprite_draw_roots"));
+	for (i = 0; i < 3; i++) {
+		sprite_free(list[i]);
+	}
+}
+
+// a sorted layer batches the quads of the first and last roots, the middle one is drawn after them
+static void test_layer_fallback(void) {
+	int i;
+	struct sprite *list[3];
+	list[0] = sprite_new("test", "a");
+	list[1] = text_sprite("mixed", "hello");
+	list[2] = sprite_new("test", "b");
+	trace_reset();
+	sprite_draw(list[0], &Srt);
+	sprite_draw(list[2], &Srt);
+	sprite_draw(list[1], &Srt);
+	expect();
+	sprite_layer(0, SPRITE_LAYER_SORTED);
+	for (i = 0; i < 3; i++) {
+		sprite_submit(0, list[i], &Srt);
+	}
+	sprite_layer_flush();
+	CHECK(same("sprite_layer_flush"));
+	sprite_layer(0, SPRITE_LAYER_STRICT);
+	for (i = 0; i < 3; i++) {
+		sprite_free(list[i]);
+	}
+}
+
+static int label_drawn(const char *text) {
+	int i;
+	for (i = 0; i < Trace_n; i++) {
+		if (Trace[i].type == TRACE_LABEL && strcmp(Trace[i].text, text) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void draw_frame(struct sprite *s) {
+	sprite_bitmap_frame();
+	trace_reset();
+	sprite_draw(s, &Srt);
+}
+
+// the bitmap of an animation is redrawn when the text of a label below it changes
+static void test_bitmap_label(void) {
+	struct sprite *s = text_sprite("mixed", "hello");
+	struct sprite *label = sprite_child(s, "text");
+	sprite_bitmap(s, 1);
+	draw_frame(s);
+	CHECK(label_drawn("hello") && Trace[0].target != 0);
+	draw_frame(s);
+	CHECK(Trace_n == 1 && Trace[0].tid > 1000 && Trace[0].target == 0);
+	sprite_text(label, "bye");
+	draw_frame(s);
+	CHECK(label_drawn("bye"));
+	draw_frame(s);
+	CHECK(Trace_n == 1 && Trace[0].tid > 1000);
+	sprite_text(label, "");
+	draw_frame(s);
+	CHECK(Trace_n > 1 && !label_drawn("bye"));
+	sprite_free(s);
+}
+
+// an animation draws the same with the geometry cache as a label below it is shown, hidden and shown again
+static void test_geometry_verdict(void) {
+	int i;
+	struct sprite *s = text_sprite("mixed", "hello");
+	struct sprite *label = sprite_child(s, "text");
+	trace_reset();
+	sprite_draw(s, &Srt);
+	expect();
+	CHECK(Expect_n == 2 && Expect[1].type == TRACE_LABEL);
+	sprite_geometry_cache(1);
+	for (i = 0; i < 3; i++) {
+		sprite_visible(label, i != 1);
+		trace_reset();
+		sprite_draw(s, &Srt);
+		trace_reset();
+		sprite_draw(s, &Srt);
+		if (i == 1) {
+			CHECK(trace_equal(Expect, 1, Trace, Trace_n));
+		} else {
+			CHECK(same("geometry cache"));
+		}
+	}
+	sprite_geometry_cache(0);
+	sprite_free(s);
+}
+
+static int write_file(const char *file, const char *data, int size) {
+	FILE *f = fopen(file, "wb");
+	int ok = f && fwrite(data, 1, size, f) == (size_t)size;
+	return f && fclose(f) == 0 && ok;
+}
+
+// offsets in the header of an image
+#define IMAGE_RELOC_OFF 24
+#define IMAGE_SOURCE_HASH 52
+
+static uint32_t *image_field(char *data, int off) {
+	return (uint32_t *)(data + off);
+}
+
+// an image is not mapped next to a .pi it is not written from, nor loaded with a pointer out of its pack
+// or once it is relocated. a pack drawing from the textures of the caller is written with their ids
+static void test_image_check(const char *path) {
+	int size, n = 0;
+	char pm[256];
+	char *data, *adopt;
+	struct pack_image *img;
+	int texture[2] = { 0, 1 };
+	sprintf(pm, "%stest.pi", path);
+	data = readfile(pm, &size);
+	CHECK(data != 0 && spritepack_load_memory("mem", data, size, texture, 2, 0) != 0);
+	free(data);
+	CHECK(spritepack_save("mem"));
+	sprintf(pm, "%smem.pm", path);
+	CHECK((img = spritepack_map(pm, &n)) != 0 && n == 2);
+	if (img) {
+		spritepack_unmap(img);
+	}
+	remove(pm);
+	spritepack_unload("mem");
+
+	sprintf(pm, "%stest.pm", path);
+	CHECK(spritepack_save("test"));
+	data = readfile(pm, &size);
+	CHECK(data != 0 && (img = spritepack_map(pm, 0)) != 0);
+	if (!data || !img) {
+		free(data);
+		remove(pm);
+		return;
+	}
+	spritepack_unmap(img);
+	*image_field(data, IMAGE_SOURCE_HASH) ^= 1;
+	CHECK(write_file(pm, data, size) && spritepack_map(pm, 0) == 0);
+	*image_field(data, IMAGE_SOURCE_HASH) ^= 1;
+	remove(pm);
+
+	CHECK(spritepack_load_memory("image", data, size, texture, 2, 0) != 0);
+	spritepack_unload("image");
+	// an adopted image is relocated in place, it is not loaded again
+	adopt = (char *)malloc(size);
+	memcpy(adopt, data, size);
+	CHECK(spritepack_load_memory("image", adopt, size, texture, 2, 1) != 0);
+	CHECK(spritepack_load_memory("again", adopt, size, texture, 2, 0) == 0);
+	spritepack_unload("image");
+	*image_field(data, *image_field(data, IMAGE_RELOC_OFF)) = (uint32_t)size;
+	CHECK(spritepack_load_memory("image", data, size, texture, 2, 0) == 0);
+	free(data);
+}
+
+// a released tree is reused by the next sprite of its (pack, id), with more of them than the pool table
+// has slots at first, and the pools are dropped with their packs
+static void test_arena_pool(const char *path) {
+	int i, size, reused = 0;
+	char name[32], pi[256];
+	char *data;
+	int texture[2] = { 0, 1 };
+	sprintf(pi, "%stest.pi", path);
+	data = readfile(pi, &size);
+	CHECK(data != 0);
+	if (!data) {
+		return;
+	}
+	for (i = 0; i < 100; i++) {
+		struct sprite *s, *again;
+		sprintf(name, "pool%d", i);
+		spritepack_load_memory(name, data, size, texture, 2, 0);
+		s = sprite_new(name, "a");
+		sprite_free(s);
+		again = sprite_new(name, "a");
+		reused += s && again == s;
+		sprite_free(again);
+	}
+	CHECK(reused == 100);
+	for (i = 0; i < 100; i += 2) {
+		sprintf(name, "pool%d", i);
+		spritepack_unload(name);
+	}
+	for (i = 1; i < 100; i += 2) {
+		struct sprite *s;
+		sprintf(name, "pool%d", i);
+		s = sprite_new(name, "mixed");
+		CHECK(s && sprite_child(s, "text") != 0);
+		sprite_free(s);
+		spritepack_unload(name);
+	}
+	free(data);
+}
+
+// the bound of an animation follows a part moved out of it and back, and is kept as the part is hidden
+static void test_rebound(void) {
+	int i, aabb[4], moved[4], hidden[4], back[4];
+	struct sprite *s = text_sprite("mixed", "hello");
+	struct sprite *label = sprite_child(s, "text");
+	sprite_aabb(s, &Srt, 0, aabb);
+	sprite_ps(label, 300, 200, 1.0f);
+	sprite_aabb(s, &Srt, 0, moved);
+	CHECK(moved[2] == aabb[2] + 300 && moved[3] > aabb[3] + 150);
+	sprite_visible(label, 0);
+	sprite_aabb(s, &Srt, 0, hidden);
+	sprite_visible(label, 1);
+	CHECK(memcmp(hidden, moved, sizeof(moved)) == 0);
+	sprite_ps(label, 0, 0, 1.0f);
+	sprite_aabb(s, &Srt, 0, back);
+	for (i = 0; i < 4; i++) {
+		CHECK(back[i] == aabb[i]);
+	}
+	sprite_free(s);
+}
+
+// an anchor after an off-screen scissor still follows the tree, drawn directly or from a draw list
+static void test_clipped_anchor(void) {
+	int i;
+	struct sprite *s = sprite_new("test", "clip");
+	struct sprite *anchor = sprite_child(s, "anchor");
+	struct srt srt = { -32000, 0, 1024, 1024, 0 };
+	sprite_visible(anchor, 1);
+	for (i = 0; i < 2; i++) {
+		sprite_drawlist(s, i);
+		sprite_culled();
+		trace_reset();
+		sprite_draw(s, &srt);
+		CHECK(sprite_culled() == 1 && Trace_n == 0);
+		CHECK(sprite_worldmatrix(anchor)->m[4] == 320 + srt.offx && sprite_worldmatrix(anchor)->m[5] == 160);
+		srt.offx -= 1600;
+	}
+	sprite_drawlist(s, 0);
+	sprite_free(s);
+}
+
+static void loaded(void *ud, struct sprite_pack *p) {
+	(void)p;
+	(*(int *)ud)++;
+}
+
+// a pack loading in the background is not loaded a second time
+static void test_async_twice(void) {
+	int n = 0;
+	CHECK(spritepack_load_async("none", loaded, &n) == 1);
+	CHECK(spritepack_load_async("none", loaded, &n) == 0);
+	while (spritepack_async_update() > 0)
+		;
+	CHECK(n == 1);
+}
+
+// 1 for the root, 2 for its label, 3 for another part
+static int touched(struct sprite *root, struct sprite *s) {
+	if (!s) {
+		return 0;
+	}
+	return s == root ? 1 : s == sprite_child(root, "text") ? 2 : 3;
+}
+
+// a pixel next to x, y touches what the index found, so they differ by the rounding of an edge
+static int on_edge(struct sprite *s, struct srt *srt, int x, int y, int found) {
+	return touched(s, sprite_test(s, srt, x - 1, y)) == found || touched(s, sprite_test(s, srt, x + 1, y)) == found ||
+		touched(s, sprite_test(s, srt, x, y - 1)) == found || touched(s, sprite_test(s, srt, x, y + 1)) == found;
+}
+
+// the touch index finds what test_child finds under srts and a root matrix it was not built with
+static void test_touch_index(void) {
+	int i, x, y, hit = 0;
+	struct sprite *s = text_sprite("mixed", "hello");
+	struct sprite *t = text_sprite("mixed", "hello");
+	struct srt srt[] = {
+		{ 160, 160, 1024, 1024, 0 },
+		{ 320, 200, 2048, 1024, 0 },
+		{ 400, 300, 768, 768, 64 },
+		{ 200, 400, 1024, 1536, 200 },
+	};
+	sprite_touchindex(t, 1);
+	for (i = 0; i < 8; i++) {
+		struct srt *r = &srt[i % 4];
+		if (i == 4) {
+			sprite_ps(s, 30, -20, 1.5f);
+			sprite_ps(t, 30, -20, 1.5f);
+		}
+		for (y = 0; y < 768; y += 3) {
+			for (x = 0; x < 1024; x += 3) {
+				int a = touched(s, sprite_test(s, r, x, y));
+				int b = touched(t, sprite_test(t, r, x, y));
+				hit += a != 0;
+				CHECK(a == b || on_edge(s, r, x, y, b));
+			}
+		}
+	}
+	CHECK(hit > 0);
+	sprite_free(s);
+	sprite_free(t);
+}
+
+int main(int argc, char *argv[]) {
+	const char *path = argc > 1 ? argv[1] : "test/asset/";
+	screen_init(1024, 768, 1);
+	spritepack_init(path);
+	test_roots_fallback();
+	test_layer_fallback();
+	test_bitmap_label();
+	test_geometry_verdict();
+	test_touch_index();
+	test_rebound();
+	test_clipped_anchor();
+	test_async_twice();
+	test_image_check(path);
+	test_arena_pool(path);
+	spritepack_unit();
+	if (Test_fail) {
+		printf("%d failed\n", Test_fail);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,274 @@
+#include "test.h"
+#include "label.h"
+#include "material.h"
+#include "render.h"
+#include "shader.h"
+#include "scissor.h"
+#include "texture.h"
+#include "vertex.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct trace Trace[TRACE_MAX];
+int Trace_n = 0;
+int Test_fail = 0;
+
+static int Program = 0;
+static const void *Material = 0;
+static int Texture = 0;
+static int Target = 0;
+static int Target_n = 0;
+static int Scissor = 0;
+
+void trace_reset(void) {
+	Trace_n = 0;
+}
+
+static struct trace *trace_add(int type) {
+	struct trace *t = &Trace[Trace_n < TRACE_MAX - 1 ? Trace_n++ : Trace_n];
+	memset(t, 0, sizeof(*t));
+	t->type = type;
+	t->pid = Program;
+	t->material = Material;
+	t->tid = Texture;
+	t->target = Target;
+	return t;
+}
+
+int trace_equal(const struct trace *a, int an, const struct trace *b, int bn) {
+	return an == bn && memcmp(a, b, an * sizeof(struct trace)) == 0;
+}
+
+void trace_dump(const char *what, const struct trace *t, int n) {
+	int i;
+	printf("%s:\n", what);
+	for (i = 0; i < n; i++) {
+		printf("  %s pid %d tid %d target %d (%g,%g) %s\n", t[i].type == TRACE_QUAD ? "quad" : t[i].type == TRACE_LABEL ? "label" : "scissor",
+			t[i].pid, t[i].tid, t[i].target, t[i].x[0], t[i].y[0], t[i].text);
+	}
+}
+
+void pixel_log(const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	if (getenv("TEST_LOG")) {
+		vprintf(fmt, ap);
+	}
+	va_end(ap);
+}
+
+void shader_program(int pid, struct material *m) {
+	Program = pid;
+	Material = m;
+}
+
+void shader_texture(int id, int channel) {
+	(void)channel;
+	Texture = id;
+}
+
+void shader_flush(void) {}
+void shader_clear(unsigned long argb) { (void)argb; }
+void shader_blend(int m1, int m2) { (void)m1; (void)m2; }
+void shader_default_blend(void) {}
+
+void shader_addquad(const float f[6], const int32_t coord[8], const uint16_t texcoord[8], uint32_t color, uint32_t addi) {
+	int i;
+	struct vertex_pack vp[4];
+	struct trace *t = trace_add(TRACE_QUAD);
+	(void)color;
+	(void)addi;
+	vertex_transform(f, 4, coord, texcoord, vp, sizeof(struct vertex_pack));
+	for (i = 0; i < 4; i++) {
+		t->x[i] = vp[i].vx;
+		t->y[i] = vp[i].vy;
+	}
+}
+
+void shader_addquads(const struct quad *q, int n) {
+	int i, j;
+	for (i = 0; i < n; i++) {
+		struct trace *t = trace_add(TRACE_QUAD);
+		for (j = 0; j < 4; j++) {
+			t->x[j] = q[i].p[j].vp.vx;
+			t->y[j] = q[i].p[j].vp.vy;
+		}
+	}
+}
+
+void shader_drawpolygon(int n, const struct vertex_pack *vp, uint32_t color, uint32_t addi) {
+	struct trace *t = trace_add(TRACE_QUAD);
+	(void)color;
+	(void)addi;
+	t->x[0] = vp[0].vx;
+	t->y[0] = vp[0].vy;
+	t->x[1] = (float)n;
+}
+
+void shader_drawbuffer(struct renderbuffer *rb, float x, float y, float scale) {
+	(void)rb;
+	(void)x;
+	(void)y;
+	(void)scale;
+}
+
+void label_flush(void) {}
+
+void label_draw(const struct rich_text *rich, struct pack_label *pl, struct srt *srt, const struct sprite_trans *trans) {
+	struct trace *t = trace_add(TRACE_LABEL);
+	(void)pl;
+	(void)srt;
+	(void)trans;
+	if (rich && rich->text) {
+		strncpy(t->text, rich->text, sizeof(t->text) - 1);
+	}
+}
+
+int label_char_size(struct pack_label *pl, const char *chr, int *width, int *height, int *unicode) {
+	(void)pl;
+	(void)chr;
+	*width = *height = 0;
+	*unicode = 0;
+	return 1;
+}
+
+int material_size(int pid) {
+	(void)pid;
+	return 16;
+}
+
+struct material *material_init(struct material *m, int pid) {
+	(void)pid;
+	return m;
+}
+
+void scissor_push(int x, int y, int w, int h) {
+	struct trace *t = trace_add(TRACE_SCISSOR);
+	t->x[0] = (float)x;
+	t->y[0] = (float)y;
+	t->x[1] = (float)w;
+	t->y[1] = (float)h;
+	Scissor++;
+}
+
+void scissor_pop(void) {
+	Scissor--;
+}
+
+int scissor_active(void) {
+	return Scissor > 0;
+}
+
+void render_set(enum RENDER_OBJ what, int id, int slot) {
+	(void)slot;
+	if (what == TARGET) {
+		Target = id;
+	}
+}
+
+void render_rem(enum RENDER_OBJ what, int id) {
+	(void)what;
+	(void)id;
+}
+
+void render_setviewport(int x, int y, int width, int height) {
+	(void)x;
+	(void)y;
+	(void)width;
+	(void)height;
+}
+
+void render_setscissor(int x, int y, int width, int height) {
+	(void)x;
+	(void)y;
+	(void)width;
+	(void)height;
+}
+
+int render_buffer_create(enum RENDER_OBJ what, const void *data, int n, int stride) {
+	(void)what;
+	(void)data;
+	(void)n;
+	(void)stride;
+	return 1;
+}
+
+void render_buffer_update(int id, const void *data, int n) {
+	(void)id;
+	(void)data;
+	(void)n;
+}
+
+int render_target_create(int width, int height, enum TEXTURE_FORMAT fmt) {
+	(void)width;
+	(void)height;
+	(void)fmt;
+	return ++Target_n;
+}
+
+// the texture of a target is told apart from the textures of packs
+int render_target_texture(int id) {
+	return 1000 + id;
+}
+
+int texture_rid(int tid) {
+	return tid + 1;
+}
+
+int texture_load(int tid, enum TEXTURE_FORMAT t, int width, int height, void *pixels, int reduce) {
+	(void)tid;
+	(void)t;
+	(void)width;
+	(void)height;
+	(void)pixels;
+	(void)reduce;
+	return 1;
+}
+
+int texture_loadfile(int tid, const char *filename, int reduce) {
+	(void)tid;
+	(void)filename;
+	(void)reduce;
+	return 1;
+}
+
+void *texture_decode(const char *filename, int *width, int *height, enum TEXTURE_FORMAT *format) {
+	(void)filename;
+	(void)format;
+	*width = *height = 0;
+	return 0;
+}
+
+void *texture_decode_memory(const void *data, int size, int *width, int *height, enum TEXTURE_FORMAT *format) {
+	(void)data;
+	(void)size;
+	(void)format;
+	*width = *height = 0;
+	return 0;
+}
+
+void texture_release(void *pixels) {
+	(void)pixels;
+}
+
+void texture_unload(int tid) {
+	(void)tid;
+}
+
+// texture coords are kept in pixels
+int texture_coord(int tid, float x, float y, uint16_t *u, uint16_t *v) {
+	(void)tid;
+	*u = (uint16_t)x;
+	*v = (uint16_t)y;
+	return 1;
+}
+
+int texture_normalize(int width, int height, float x, float y, uint16_t *u, uint16_t *v) {
+	(void)width;
+	(void)height;
+	*u = (uint16_t)x;
+	*v = (uint16_t)y;
+	return 1;
+}
@@ -0,0 +1,41 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+
+/*
+ * stub.c stands in for the renderer, the textures and the labels, recording what is drawn:
+ * each quad with the program, material, texture and target it goes to, and each label with its text.
+ */
+#define TRACE_QUAD 0
+#define TRACE_LABEL 1
+#define TRACE_SCISSOR 2
+
+#define TRACE_MAX 4096
+
+struct trace {
+	int type;
+	int pid;
+	int tid;
+	// the render target drawn into, 0 for the screen
+	int target;
+	// the material passed with the program
+	const void *material;
+	float x[4];
+	float y[4];
+	char text[32];
+};
+
+extern struct trace Trace[TRACE_MAX];
+extern int Trace_n;
+
+void trace_reset(void);
+//1 when the n entries of a and b are the same
+int trace_equal(const struct trace *a, int an, const struct trace *b, int bn);
+void trace_dump(const char *what, const struct trace *t, int n);
+
+extern int Test_fail;
+
+#define CHECK(e) do { if (!(e)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #e); Test_fail++; } } while (0)
+
+#endif // _TEST_H_
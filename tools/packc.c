@@ -0,0 +1,1156 @@
+/*
+* packc - compile a pack description into the .pi spritepack_load reads.
+*
+* The description is the table <prefix>.lua returns, as the exporters write it: a data-only
+* table constructor, read here without a Lua state. Descriptions that compute their table
+* still go through spritepack.pack at runtime.
+*
+* Over spritepack.pack it moves every non-identity matrix into one table of unique matrices
+* referenced by index, counts each component and action name once (the importer shares
+* equal names), and writes sprites depth-first from the exported ones so an animation
+* lands next to what it draws. -b appends the bounds the importer would compute, -a the
+* texture sizes read from <prefix>.N.png. Pack sizes follow the struct layout of this build.
+*
+* make packc && ./tools/packc [-b] [-a] [-o out.pi] prefix
+*/
+#include "spritepack.h"
+#include "matrix.h"
+#include "screen.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+enum { V_NIL, V_BOOL, V_NUMBER, V_STRING, V_TABLE };
+
+struct table;
+
+struct value {
+	int type;
+	double n;
+	char *s;
+	struct table *t;
+};
+
+struct field {
+	char *key;
+	struct value v;
+};
+
+struct table {
+	struct value *array;
+	int n;
+	int cap;
+	struct field *field;
+	int field_n;
+	int field_cap;
+};
+
+struct parser {
+	const char *p;
+	const char *end;
+	const char *file;
+	int line;
+};
+
+static void fail(const char *fmt, const char *s) {
+	fprintf(stderr, "packc: ");
+	fprintf(stderr, fmt, s);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+static void syntax(struct parser *ps, const char *what) {
+	fprintf(stderr, "packc: %s:%d: %s\n", ps->file, ps->line, what);
+	exit(1);
+}
+
+static void *grow(void *data, int *cap, int need, int size) {
+	if (need > *cap) {
+		while (need > *cap) {
+			*cap = *cap ? *cap * 2 : 16;
+		}
+		data = realloc(data, *cap * size);
+	}
+	return data;
+}
+
+static void skip(struct parser *ps) {
+	while (ps->p < ps->end) {
+		char c = *ps->p;
+		if (c == '\n') {
+			ps->line++;
+			ps->p++;
+		} else if (isspace((unsigned char)c)) {
+			ps->p++;
+		} else if (c == '-' && ps->p + 1 < ps->end && ps->p[1] == '-') {
+			ps->p += 2;
+			if (ps->p + 1 < ps->end && ps->p[0] == '[' && ps->p[1] == '[') {
+				for (; ps->p + 1 < ps->end && !(ps->p[0] == ']' && ps->p[1] == ']'); ps->p++) {
+					if (*ps->p == '\n') {
+						ps->line++;
+					}
+				}
+				ps->p += 2;
+			} else {
+				while (ps->p < ps->end && *ps->p != '\n') {
+					ps->p++;
+				}
+			}
+		} else {
+			break;
+		}
+	}
+}
+
+static int peek(struct parser *ps) {
+	skip(ps);
+	return ps->p < ps->end ? (unsigned char)*ps->p : -1;
+}
+
+static int word(struct parser *ps, const char *w) {
+	int n = (int)strlen(w);
+	skip(ps);
+	if (ps->end - ps->p >= n && memcmp(ps->p, w, n) == 0 && (ps->p + n == ps->end || !(isalnum((unsigned char)ps->p[n]) || ps->p[n] == '_'))) {
+		ps->p += n;
+		return 1;
+	}
+	return 0;
+}
+
+static char *parse_string(struct parser *ps) {
+	char q = *ps->p++;
+	int n = 0, cap = 0;
+	char *s = 0;
+	if (q == '[') {
+		const char *start;
+		ps->p++;
+		start = ps->p;
+		while (ps->p + 1 < ps->end && !(ps->p[0] == ']' && ps->p[1] == ']')) {
+			if (*ps->p == '\n') {
+				ps->line++;
+			}
+			ps->p++;
+		}
+		if (ps->p + 1 >= ps->end) {
+			syntax(ps, "unfinished long string");
+		}
+		n = (int)(ps->p - start);
+		s = (char *)malloc(n + 1);
+		memcpy(s, start, n);
+		s[n] = 0;
+		ps->p += 2;
+		return s;
+	}
+	for (;;) {
+		char c;
+		if (ps->p >= ps->end || *ps->p == '\n') {
+			syntax(ps, "unfinished string");
+		}
+		c = *ps->p++;
+		if (c == q) {
+			break;
+		}
+		if (c == '\\' && ps->p < ps->end) {
+			c = *ps->p++;
+			switch (c) {
+			case 'n': c = '\n'; break;
+			case 't': c = '\t'; break;
+			case 'r': c = '\r'; break;
+			default:
+				if (isdigit((unsigned char)c)) {
+					int v = c - '0', i;
+					for (i = 0; i < 2 && ps->p < ps->end && isdigit((unsigned char)*ps->p); i++) {
+						v = v * 10 + *ps->p++ - '0';
+					}
+					c = (char)v;
+				}
+				break;
+			}
+		}
+		s = (char *)grow(s, &cap, n + 2, 1);
+		s[n++] = c;
+	}
+	s = (char *)grow(s, &cap, n + 1, 1);
+	s[n] = 0;
+	return s;
+}
+
+static void parse_value(struct parser *ps, struct value *v);
+
+static void table_set(struct table *t, int i, struct value *v) {
+	if (i < 1) {
+		return;
+	}
+	t->array = (struct value *)grow(t->array, &t->cap, i, sizeof(struct value));
+	while (t->n < i) {
+		memset(&t->array[t->n++], 0, sizeof(struct value));
+	}
+	t->array[i - 1] = *v;
+}
+
+static void table_field(struct table *t, char *key, struct value *v) {
+	t->field = (struct field *)grow(t->field, &t->field_cap, t->field_n + 1, sizeof(struct field));
+	t->field[t->field_n].key = key;
+	t->field[t->field_n].v = *v;
+	t->field_n++;
+}
+
+static struct table *parse_table(struct parser *ps) {
+	struct table *t = (struct table *)calloc(1, sizeof(struct table));
+	int idx = 1;
+	ps->p++;
+	for (;;) {
+		struct value v;
+		int c = peek(ps);
+		if (c == '}') {
+			ps->p++;
+			return t;
+		}
+		if (c == '[' && ps->p + 1 < ps->end && ps->p[1] != '[') {
+			struct value key;
+			ps->p++;
+			parse_value(ps, &key);
+			if (peek(ps) != ']') {
+				syntax(ps, "']' expected");
+			}
+			ps->p++;
+			if (peek(ps) != '=') {
+				syntax(ps, "'=' expected");
+			}
+			ps->p++;
+			parse_value(ps, &v);
+			if (key.type == V_STRING) {
+				table_field(t, key.s, &v);
+			} else if (key.type == V_NUMBER) {
+				table_set(t, (int)key.n, &v);
+			} else {
+				syntax(ps, "unsupported key");
+			}
+		} else if (isalpha(c) || c == '_') {
+			const char *start = ps->p, *name_end;
+			while (ps->p < ps->end && (isalnum((unsigned char)*ps->p) || *ps->p == '_')) {
+				ps->p++;
+			}
+			name_end = ps->p;
+			if (peek(ps) == '=' && !(ps->p + 1 < ps->end && ps->p[1] == '=')) {
+				char *key = (char *)malloc(name_end - start + 1);
+				memcpy(key, start, name_end - start);
+				key[name_end - start] = 0;
+				ps->p++;
+				parse_value(ps, &v);
+				table_field(t, key, &v);
+			} else {
+				ps->p = start;
+				parse_value(ps, &v);
+				table_set(t, idx++, &v);
+			}
+		} else {
+			parse_value(ps, &v);
+			table_set(t, idx++, &v);
+		}
+		c = peek(ps);
+		if (c == ',' || c == ';') {
+			ps->p++;
+		} else if (c != '}') {
+			syntax(ps, "'}' expected");
+		}
+	}
+}
+
+static void parse_value(struct parser *ps, struct value *v) {
+	int c = peek(ps);
+	memset(v, 0, sizeof(*v));
+	if (c == '{') {
+		v->type = V_TABLE;
+		v->t = parse_table(ps);
+	} else if (c == '"' || c == '\'' || (c == '[' && ps->p + 1 < ps->end && ps->p[1] == '[')) {
+		v->type = V_STRING;
+		v->s = parse_string(ps);
+	} else if (word(ps, "true")) {
+		v->type = V_BOOL;
+		v->n = 1;
+	} else if (word(ps, "false")) {
+		v->type = V_BOOL;
+	} else if (word(ps, "nil")) {
+		v->type = V_NIL;
+	} else if (c == '-' || c == '+' || c == '.' || isdigit(c)) {
+		char *end;
+		v->type = V_NUMBER;
+		v->n = strtod(ps->p, &end);
+		if (end == ps->p) {
+			syntax(ps, "number expected");
+		}
+		ps->p = end;
+	} else {
+		syntax(ps, "only a data table can be compiled");
+	}
+}
+
+static struct value *get(struct table *t, const char *key) {
+	int i;
+	for (i = t->field_n - 1; i >= 0; i--) {
+		if (strcmp(t->field[i].key, key) == 0) {
+			return t->field[i].v.type == V_NIL ? 0 : &t->field[i].v;
+		}
+	}
+	return 0;
+}
+
+static struct value *at(struct table *t, int i) {
+	if (i < 1 || i > t->n || t->array[i - 1].type == V_NIL) {
+		return 0;
+	}
+	return &t->array[i - 1];
+}
+
+// the length of the sequence 1..n of t
+static int len(struct table *t) {
+	int n = t->n;
+	while (n > 0 && t->array[n - 1].type == V_NIL) {
+		n--;
+	}
+	return n;
+}
+
+// as readinteger of spritepack.c, integers wrap to 32 bits and floats truncate
+static int32_t num(struct value *v, const char *what) {
+	if (!v || v->type != V_NUMBER) {
+		fail("number expected for %s", what);
+	}
+	if (v->n == (double)(int64_t)v->n) {
+		return (int32_t)(uint32_t)(int64_t)v->n;
+	}
+	return (int32_t)v->n;
+}
+
+static int32_t optnum(struct table *t, const char *key, int32_t def) {
+	struct value *v = get(t, key);
+	return v ? num(v, key) : def;
+}
+
+static struct table *tab(struct value *v, const char *what) {
+	if (!v || v->type != V_TABLE) {
+		fail("table expected for %s", what);
+	}
+	return v->t;
+}
+
+static const char *str(struct value *v) {
+	return v && v->type == V_STRING ? v->s : 0;
+}
+
+static int truthy(struct value *v) {
+	return v && !(v->type == V_BOOL && v->n == 0);
+}
+
+struct buffer {
+	char *data;
+	int size;
+	int cap;
+};
+
+static void wbytes(struct buffer *b, const void *data, int n) {
+	b->data = (char *)grow(b->data, &b->cap, b->size + n, 1);
+	memcpy(b->data + b->size, data, n);
+	b->size += n;
+}
+
+static void w8(struct buffer *b, int v) {
+	uint8_t c = (uint8_t)v;
+	wbytes(b, &c, 1);
+}
+
+static void w16(struct buffer *b, int v) {
+	w8(b, v & 0xff);
+	w8(b, (v >> 8) & 0xff);
+}
+
+static void w32(struct buffer *b, int32_t v) {
+	uint32_t n = (uint32_t)v;
+	w16(b, (int)(n & 0xffff));
+	w16(b, (int)(n >> 16));
+}
+
+static void wstr(struct buffer *b, const char *s) {
+	int n;
+	if (!s) {
+		w8(b, 255);
+		return;
+	}
+	n = (int)strlen(s);
+	if (n >= 255) {
+		fail("%s is too long", s);
+	}
+	w8(b, n);
+	wbytes(b, s, n);
+}
+
+struct part {
+	int index;
+	// index of the matrix table, -1 for none
+	int matrix;
+	int tag;
+	uint32_t color;
+	uint32_t add;
+};
+
+struct frame {
+	struct part *part;
+	int n;
+	int32_t aabb[4];
+};
+
+struct sprite {
+	int id;
+	int type;
+	int visited;
+	const char *export;
+	struct table *data;
+	// animation
+	int *component;
+	int component_n;
+	struct frame *frame;
+	int frame_n;
+	// bound
+	int state;
+	int32_t aabb[4];
+};
+
+struct pack {
+	struct sprite *sprite;
+	int sprite_n;
+	int sprite_cap;
+	struct sprite **id;
+	int maxid;
+	int texture;
+	// the matrix table, open addressed by content
+	struct matrix *matrix;
+	int matrix_n;
+	int matrix_cap;
+	int *slot;
+	int slot_n;
+	int inline_n;
+	// names once each, as the importer keeps them
+	char **name;
+	int name_n;
+	int name_slot;
+	int name_total;
+	int size;
+	int *order;
+	int order_n;
+};
+
+static unsigned int hash_bytes(const void *data, int n) {
+	int i;
+	const uint8_t *p = (const uint8_t *)data;
+	unsigned int h = 2166136261u;
+	for (i = 0; i < n; i++) {
+		h = (h ^ p[i]) * 16777619u;
+	}
+	return h;
+}
+
+static int matrix_add(struct pack *k, const int32_t m[6]) {
+	unsigned int i, mask;
+	int j;
+	if (k->matrix_n * 2 >= k->slot_n) {
+		free(k->slot);
+		k->slot_n = k->slot_n ? k->slot_n * 2 : 64;
+		k->slot = (int *)malloc(k->slot_n * sizeof(int));
+		memset(k->slot, -1, k->slot_n * sizeof(int));
+		for (j = 0; j < k->matrix_n; j++) {
+			mask = k->slot_n - 1;
+			for (i = hash_bytes(k->matrix[j].m, sizeof(k->matrix[j].m)) & mask; k->slot[i] >= 0; i = (i + 1) & mask)
+				;
+			k->slot[i] = j;
+		}
+	}
+	mask = k->slot_n - 1;
+	for (i = hash_bytes(m, 6 * sizeof(int32_t)) & mask; k->slot[i] >= 0; i = (i + 1) & mask) {
+		if (memcmp(k->matrix[k->slot[i]].m, m, 6 * sizeof(int32_t)) == 0) {
+			return k->slot[i];
+		}
+	}
+	k->matrix = (struct matrix *)grow(k->matrix, &k->matrix_cap, k->matrix_n + 1, sizeof(struct matrix));
+	memcpy(k->matrix[k->matrix_n].m, m, 6 * sizeof(int32_t));
+	k->slot[i] = k->matrix_n;
+	return k->matrix_n++;
+}
+
+static void name_add(struct pack *k, char *name) {
+	unsigned int i, mask;
+	int j;
+	if (!name) {
+		return;
+	}
+	if (k->name_n * 2 >= k->name_slot) {
+		char **old = k->name;
+		int old_n = k->name_slot;
+		k->name_slot = k->name_slot ? k->name_slot * 2 : 64;
+		k->name = (char **)calloc(k->name_slot, sizeof(char *));
+		mask = k->name_slot - 1;
+		for (j = 0; j < old_n; j++) {
+			if (old[j]) {
+				for (i = hash_bytes(old[j], (int)strlen(old[j])) & mask; k->name[i]; i = (i + 1) & mask)
+					;
+				k->name[i] = old[j];
+			}
+		}
+		free(old);
+	}
+	mask = k->name_slot - 1;
+	for (i = hash_bytes(name, (int)strlen(name)) & mask; k->name[i]; i = (i + 1) & mask) {
+		if (strcmp(k->name[i], name) == 0) {
+			return;
+		}
+	}
+	k->name[i] = name;
+	k->name_n++;
+	// as stream_rstr allocates it
+	k->name_total += ((int)strlen(name) + 1 + 3) & ~3;
+}
+
+static int is_identity(const int32_t m[6]) {
+	return m[0] == 1024 && m[1] == 0 && m[2] == 0 && m[3] == 1024 && m[4] == 0 && m[5] == 0;
+}
+
+// parts as spritepack.pack writes them, with every matrix moved to the table
+static void read_part(struct pack *k, struct value *v, struct part *p, const int *ref, int ref_n) {
+	struct table *t;
+	struct value *mat;
+	memset(p, 0, sizeof(*p));
+	p->matrix = -1;
+	p->tag = TAG_ID;
+	if (v->type == V_NUMBER) {
+		p->index = num(v, "part");
+		return;
+	}
+	t = tab(v, "part");
+	if (!get(t, "index")) {
+		fail("frame need an index%s", "");
+	}
+	p->index = num(get(t, "index"), "index");
+	mat = get(t, "mat");
+	if (mat && mat->type == V_NUMBER) {
+		int r = num(mat, "mat");
+		if (r < 0 || r >= ref_n) {
+			fail("matrix ref out of the matrix table%s", "");
+		}
+		if (!is_identity(k->matrix[ref[r]].m)) {
+			p->matrix = ref[r];
+		}
+	} else if (mat) {
+		int i;
+		int32_t m[6];
+		struct table *mt = tab(mat, "mat");
+		for (i = 0; i < 6; i++) {
+			m[i] = num(at(mt, i + 1), "mat");
+		}
+		if (!is_identity(m)) {
+			p->matrix = matrix_add(k, m);
+			k->inline_n++;
+		}
+	}
+	if (p->matrix >= 0) {
+		p->tag |= TAG_MATRIXREF;
+	}
+	if (get(t, "color") && (uint32_t)num(get(t, "color"), "color") != 0xffffffff) {
+		p->tag |= TAG_COLOR;
+		p->color = (uint32_t)num(get(t, "color"), "color");
+	}
+	if (get(t, "add") && num(get(t, "add"), "add") != 0) {
+		p->tag |= TAG_ADDITIVE;
+		p->add = (uint32_t)num(get(t, "add"), "add");
+	}
+	if (truthy(get(t, "touch"))) {
+		p->tag |= TAG_TOUCH;
+	}
+}
+
+static void read_animation(struct pack *k, struct sprite *s, const int *ref, int ref_n) {
+	struct table *t = s->data;
+	struct table *component = tab(get(t, "component"), "component");
+	int i, j, f = 0;
+	s->component_n = len(component);
+	s->component = (int *)malloc((s->component_n + 1) * sizeof(int));
+	for (i = 0; i < s->component_n; i++) {
+		struct table *c = tab(at(component, i + 1), "component");
+		struct value *id = get(c, "id");
+		if (id) {
+			s->component[i] = num(id, "id");
+		} else if (!str(get(c, "name"))) {
+			fail("Anchor need a name%s", "");
+		} else {
+			s->component[i] = ANCHOR_ID;
+		}
+		name_add(k, (char *)str(get(c, "name")));
+	}
+	s->frame_n = 0;
+	for (i = 1; i <= len(t); i++) {
+		name_add(k, (char *)str(get(tab(at(t, i), "action"), "action")));
+		s->frame_n += len(at(t, i)->t);
+	}
+	s->frame = (struct frame *)calloc(s->frame_n + 1, sizeof(struct frame));
+	for (i = 1; i <= len(t); i++) {
+		struct table *action = at(t, i)->t;
+		for (j = 1; j <= len(action); j++, f++) {
+			struct table *frame = tab(at(action, j), "frame");
+			struct frame *pf = &s->frame[f];
+			int p;
+			pf->n = len(frame);
+			pf->part = (struct part *)malloc((pf->n + 1) * sizeof(struct part));
+			for (p = 0; p < pf->n; p++) {
+				read_part(k, at(frame, p + 1), &pf->part[p], ref, ref_n);
+				if (pf->part[p].index < 0 || pf->part[p].index >= s->component_n) {
+					fail("part index out of the components of %s", s->export ? s->export : "an animation");
+				}
+			}
+		}
+	}
+}
+
+static int read_texid(struct pack *k, struct table *t) {
+	int texid = optnum(t, "tex", 1) - 1;
+	if (texid + 1 > k->texture) {
+		k->texture = texid + 1;
+	}
+	return texid;
+}
+
+static void read_pack(struct pack *k, struct table *root) {
+	int i, j;
+	int *ref = 0, ref_n = 0;
+	k->maxid = 0;
+	k->texture = 1;
+	for (i = 1; i <= len(root); i++) {
+		struct table *t = tab(at(root, i), "sprite");
+		const char *type = str(get(t, "type"));
+		struct sprite *s;
+		if (!type) {
+			fail("sprite %s without a type", "");
+		}
+		if (strcmp(type, "matrix") == 0) {
+			// refs of the parts that follow index this table, as in the importer
+			free(ref);
+			ref_n = len(t);
+			ref = (int *)malloc((ref_n + 1) * sizeof(int));
+			for (j = 0; j < ref_n; j++) {
+				int c;
+				int32_t m[6];
+				struct table *mt = tab(at(t, j + 1), "matrix");
+				for (c = 0; c < 6; c++) {
+					m[c] = num(at(mt, c + 1), "matrix");
+				}
+				ref[j] = matrix_add(k, m);
+			}
+			continue;
+		}
+		if (strcmp(type, "particle") == 0) {
+			continue;
+		}
+		k->sprite = (struct sprite *)grow(k->sprite, &k->sprite_cap, k->sprite_n + 1, sizeof(struct sprite));
+		s = &k->sprite[k->sprite_n++];
+		memset(s, 0, sizeof(*s));
+		s->data = t;
+		s->id = num(get(t, "id"), "id");
+		s->export = str(get(t, "export"));
+		if (s->id < 0 || s->id >= ANCHOR_ID) {
+			fail("invalid id in %s", type);
+		}
+		if (s->id > k->maxid) {
+			k->maxid = s->id;
+		}
+		if (strcmp(type, "picture") == 0) {
+			s->type = TYPE_PICTURE;
+			for (j = 1; j <= len(t); j++) {
+				read_texid(k, tab(at(t, j), "picture"));
+			}
+		} else if (strcmp(type, "polygon") == 0) {
+			s->type = TYPE_POLYGON;
+			for (j = 1; j <= len(t); j++) {
+				read_texid(k, tab(at(t, j), "polygon"));
+			}
+		} else if (strcmp(type, "animation") == 0) {
+			s->type = TYPE_ANIMATION;
+			read_animation(k, s, ref, ref_n);
+		} else if (strcmp(type, "label") == 0) {
+			s->type = TYPE_LABEL;
+		} else if (strcmp(type, "panel") == 0) {
+			s->type = TYPE_PANEL;
+		} else {
+			fail("Unknown type %s", type);
+		}
+	}
+	free(ref);
+	k->id = (struct sprite **)calloc(k->maxid + 1, sizeof(struct sprite *));
+	for (i = 0; i < k->sprite_n; i++) {
+		struct sprite *s = &k->sprite[i];
+		if (k->id[s->id]) {
+			fail("Duplicate id in %s", s->export ? s->export : "the pack");
+		}
+		k->id[s->id] = s;
+		if (s->export) {
+			for (j = 0; j < i; j++) {
+				if (k->sprite[j].export && strcmp(k->sprite[j].export, s->export) == 0) {
+					fail("Duplicate export name %s", s->export);
+				}
+			}
+		}
+		for (j = 0; j < s->component_n; j++) {
+			if (s->component[j] != ANCHOR_ID && s->component[j] > k->maxid) {
+				fail("Invalid id in animation %s", s->export ? s->export : "");
+			}
+		}
+	}
+}
+
+// depth first from the exports, so the sprites an animation draws follow it in memory
+static void visit(struct pack *k, int id) {
+	int i;
+	struct sprite *s;
+	if (id < 0 || id > k->maxid || !(s = k->id[id]) || s->visited) {
+		return;
+	}
+	s->visited = 1;
+	k->order[k->order_n++] = (int)(s - k->sprite);
+	for (i = 0; i < s->component_n; i++) {
+		visit(k, s->component[i]);
+	}
+}
+
+static void sort_pack(struct pack *k) {
+	int i;
+	k->order = (int *)malloc((k->sprite_n + 1) * sizeof(int));
+	for (i = 0; i < k->sprite_n; i++) {
+		if (k->sprite[i].export) {
+			visit(k, k->sprite[i].id);
+		}
+	}
+	for (i = 0; i < k->sprite_n; i++) {
+		visit(k, k->sprite[i].id);
+	}
+}
+
+static const int32_t Unbounded[4] = { AABB_INFINITE, AABB_INFINITE, AABB_INFINITE, AABB_INFINITE };
+
+static void aabb_point(int32_t aabb[4], int32_t x, int32_t y) {
+	if (x < aabb[0]) aabb[0] = x;
+	if (x > aabb[2]) aabb[2] = x;
+	if (y < aabb[1]) aabb[1] = y;
+	if (y > aabb[3]) aabb[3] = y;
+}
+
+static void aabb_init(int32_t aabb[4]) {
+	aabb[0] = aabb[1] = INT32_MAX;
+	aabb[2] = aabb[3] = INT32_MIN;
+}
+
+static void aabb_close(int32_t aabb[4]) {
+	if (aabb[0] == INT32_MAX) {
+		memset(aabb, 0, 4 * sizeof(int32_t));
+	}
+}
+
+static void write_quads(struct pack *k, struct buffer *b, struct sprite *s, int polygon) {
+	struct table *t = s->data;
+	int i, j, n = len(t);
+	aabb_init(s->aabb);
+	w8(b, n);
+	for (i = 1; i <= n; i++) {
+		struct table *q = tab(at(t, i), "quad");
+		struct table *src = tab(get(q, "src"), "src");
+		struct table *screen = tab(get(q, "screen"), "screen");
+		int pn = polygon ? len(src) : 8;
+		w8(b, read_texid(k, q));
+		if (polygon) {
+			if (pn != len(screen)) {
+				fail("polygon src and screen differ%s", "");
+			}
+			w8(b, pn / 2);
+			k->size += 12 * (pn / 2);
+		}
+		for (j = 1; j <= pn; j++) {
+			w16(b, num(at(src, j), "src"));
+		}
+		for (j = 1; j <= pn; j++) {
+			w32(b, num(at(screen, j), "screen"));
+		}
+		for (j = 1; j < pn; j += 2) {
+			aabb_point(s->aabb, num(at(screen, j), "screen"), num(at(screen, j + 1), "screen"));
+		}
+	}
+	aabb_close(s->aabb);
+	if (polygon) {
+		k->size += sizeof(struct pack_polygon) + (n - 1) * sizeof(struct pack_poly);
+	} else {
+		k->size += sizeof(struct pack_picture) + (n - 1) * sizeof(struct pack_quad);
+	}
+}
+
+static void write_animation(struct pack *k, struct buffer *b, struct sprite *s) {
+	struct table *t = s->data;
+	struct table *component = get(t, "component")->t;
+	int i, j, f = 0, action_n = len(t);
+	w16(b, s->component_n);
+	for (i = 0; i < s->component_n; i++) {
+		w16(b, s->component[i]);
+		wstr(b, str(get(at(component, i + 1)->t, "name")));
+	}
+	w16(b, action_n);
+	for (i = 1; i <= action_n; i++) {
+		struct table *action = at(t, i)->t;
+		wstr(b, str(get(action, "action")));
+		w16(b, len(action));
+	}
+	w16(b, s->frame_n);
+	for (i = 0; i < s->frame_n; i++) {
+		struct frame *pf = &s->frame[i];
+		w16(b, pf->n);
+		for (j = 0; j < pf->n; j++) {
+			struct part *p = &pf->part[j];
+			w8(b, p->tag);
+			w16(b, p->index);
+			if (p->tag & TAG_MATRIXREF) {
+				w32(b, p->matrix);
+			}
+			if (p->tag & TAG_COLOR) {
+				w32(b, (int32_t)p->color);
+			}
+			if (p->tag & TAG_ADDITIVE) {
+				w32(b, (int32_t)p->add);
+			}
+			if (p->tag & TAG_TOUCH) {
+				w16(b, 1);
+			}
+			f++;
+		}
+	}
+	k->size += sizeof(struct pack_animation)
+		+ s->frame_n * sizeof(struct pack_frame)
+		+ action_n * sizeof(struct pack_action)
+		+ (s->component_n - 1) * sizeof(struct pack_component)
+		+ pack_hash_size(s->component_n, action_n)
+		+ f * sizeof(struct pack_part);
+}
+
+static void write_sprite(struct pack *k, struct buffer *b, struct sprite *s) {
+	struct table *t = s->data;
+	w16(b, s->id);
+	w8(b, s->type);
+	switch (s->type) {
+	case TYPE_PICTURE:
+		write_quads(k, b, s, 0);
+		break;
+	case TYPE_POLYGON:
+		write_quads(k, b, s, 1);
+		break;
+	case TYPE_ANIMATION:
+		write_animation(k, b, s);
+		break;
+	case TYPE_LABEL:
+		w8(b, optnum(t, "align", 0));
+		w32(b, optnum(t, "color", (int32_t)0xffffffff));
+		w16(b, optnum(t, "size", 0));
+		w16(b, optnum(t, "width", 0));
+		w16(b, optnum(t, "height", 0));
+		w8(b, optnum(t, "edge", 0));
+		w8(b, optnum(t, "space_w", 0));
+		w8(b, optnum(t, "space_h", 0));
+		w8(b, optnum(t, "auto_scale", 0));
+		k->size += sizeof(struct pack_label);
+		break;
+	case TYPE_PANEL:
+		w32(b, optnum(t, "width", 0));
+		w32(b, optnum(t, "height", 0));
+		w8(b, truthy(get(t, "scissor")));
+		k->size += sizeof(struct pack_panel);
+		break;
+	}
+}
+
+// as the importer merges bounds, so the section matches what it would compute
+static void aabb_merge(int32_t aabb[4], const int32_t b[4], const struct matrix *mat) {
+	int i;
+	int32_t pt[8];
+	if (aabb[0] == AABB_INFINITE) {
+		return;
+	}
+	if (b[0] == AABB_INFINITE) {
+		memcpy(aabb, b, 4 * sizeof(int32_t));
+		return;
+	}
+	pt[0] = b[0]; pt[1] = b[1];
+	pt[2] = b[2]; pt[3] = b[1];
+	pt[4] = b[0]; pt[5] = b[3];
+	pt[6] = b[2]; pt[7] = b[3];
+	for (i = 0; i < 8; i += 2) {
+		if (mat) {
+			const int *m = mat->m;
+			aabb_point(aabb, (pt[i] * m[0] + pt[i + 1] * m[2]) / 1024 + m[4], (pt[i] * m[1] + pt[i + 1] * m[3]) / 1024 + m[5]);
+		} else {
+			aabb_point(aabb, pt[i], pt[i + 1]);
+		}
+	}
+}
+
+static const int32_t *bound_sprite(struct pack *k, int id, int32_t tmp[4]);
+
+static void bound_animation(struct pack *k, struct sprite *s) {
+	int i, j, clipped;
+	s->state = 1;
+	aabb_init(s->aabb);
+	for (i = 0; i < s->frame_n; i++) {
+		struct frame *pf = &s->frame[i];
+		aabb_init(pf->aabb);
+		clipped = 0;
+		for (j = 0; j < pf->n; j++) {
+			int32_t tmp[4];
+			struct part *p = &pf->part[j];
+			int cid = s->component[p->index];
+			struct sprite *c = cid <= k->maxid ? k->id[cid] : 0;
+			const int32_t *b = bound_sprite(k, cid, tmp);
+			if (!clipped || b[0] == AABB_INFINITE) {
+				aabb_merge(pf->aabb, b, p->matrix >= 0 ? &k->matrix[p->matrix] : 0);
+			}
+			if (c && c->type == TYPE_PANEL && truthy(get(c->data, "scissor"))) {
+				clipped = 1;
+			}
+		}
+		aabb_close(pf->aabb);
+		aabb_merge(s->aabb, pf->aabb, 0);
+	}
+	aabb_close(s->aabb);
+	s->state = 2;
+}
+
+static const int32_t *bound_sprite(struct pack *k, int id, int32_t tmp[4]) {
+	struct sprite *s;
+	if (id == ANCHOR_ID || id > k->maxid || !(s = k->id[id])) {
+		return Unbounded;
+	}
+	switch (s->type) {
+	case TYPE_PICTURE:
+	case TYPE_POLYGON:
+		return s->aabb;
+	case TYPE_LABEL:
+	case TYPE_PANEL:
+		tmp[0] = tmp[1] = 0;
+		tmp[2] = (uint16_t)optnum(s->data, "width", 0) * SCREEN_SCALE;
+		tmp[3] = (uint16_t)optnum(s->data, "height", 0) * SCREEN_SCALE;
+		return tmp;
+	case TYPE_ANIMATION:
+		if (s->state == 0) {
+			bound_animation(k, s);
+		}
+		if (s->state == 1) {
+			return Unbounded;
+		}
+		return s->aabb;
+	default:
+		return Unbounded;
+	}
+}
+
+static void write_bound(struct pack *k, struct buffer *b) {
+	int i, j, n = 0;
+	struct buffer section;
+	memset(&section, 0, sizeof(section));
+	for (i = 0; i <= k->maxid; i++) {
+		struct sprite *s = k->id[i];
+		if (s && s->type == TYPE_ANIMATION) {
+			if (s->state == 0) {
+				bound_animation(k, s);
+			}
+			n++;
+		}
+	}
+	w16(&section, n);
+	for (i = 0; i <= k->maxid; i++) {
+		struct sprite *s = k->id[i];
+		if (s && s->type == TYPE_ANIMATION) {
+			w16(&section, s->id);
+			w16(&section, s->frame_n);
+			for (j = 0; j < 4; j++) {
+				w32(&section, s->aabb[j]);
+			}
+			for (j = 0; j < s->frame_n * 4; j++) {
+				w32(&section, s->frame[j / 4].aabb[j % 4]);
+			}
+		}
+	}
+	w8(b, PACK_SECTION_BOUND);
+	w32(b, section.size);
+	wbytes(b, section.data, section.size);
+	free(section.data);
+}
+
+// width and height from the IHDR chunk of a png
+static int png_size(const char *filename, int *width, int *height) {
+	uint8_t h[24];
+	FILE *f = fopen(filename, "rb");
+	int ok;
+	if (!f) {
+		return 0;
+	}
+	ok = fread(h, 1, sizeof(h), f) == sizeof(h) && memcmp(h, "\x89PNG", 4) == 0 && memcmp(h + 12, "IHDR", 4) == 0;
+	fclose(f);
+	if (ok) {
+		*width = h[16] << 24 | h[17] << 16 | h[18] << 8 | h[19];
+		*height = h[20] << 24 | h[21] << 16 | h[22] << 8 | h[23];
+	}
+	return ok && *width <= 0xffff && *height <= 0xffff;
+}
+
+static int write_atlas(struct pack *k, struct buffer *b, const char *prefix) {
+	char tmp[1024];
+	int i, width, height;
+	w8(b, PACK_SECTION_ATLAS);
+	w32(b, 2 + 4 * k->texture);
+	w16(b, k->texture);
+	for (i = 0; i < k->texture; i++) {
+		snprintf(tmp, sizeof(tmp), "%s.%d.png", prefix, i + 1);
+		if (!png_size(tmp, &width, &height)) {
+			fprintf(stderr, "packc: %s is not a png, no atlas section\n", tmp);
+			return 0;
+		}
+		w16(b, width);
+		w16(b, height);
+	}
+	return 1;
+}
+
+static char *load(const char *filename, int *size) {
+	char *data;
+	long n;
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		fail("can't open %s", filename);
+	}
+	fseek(f, 0, SEEK_END);
+	n = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data = (char *)malloc(n + 1);
+	if (fread(data, 1, n, f) != (size_t)n) {
+		fail("can't read %s", filename);
+	}
+	fclose(f);
+	data[n] = 0;
+	*size = (int)n;
+	return data;
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: packc [-b] [-a] [-o out.pi] prefix\n"
+		"  reads prefix.lua, writes prefix.pi\n"
+		"  -b  append the bounds of the animations\n"
+		"  -a  append the texture sizes of prefix.N.png\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	const char *prefix = 0, *out = 0;
+	char input[1024], output[1024];
+	int i, size, bound = 0, atlas = 0, export_n = 0;
+	struct parser ps;
+	struct value root;
+	struct pack k;
+	struct buffer data, pi, section;
+	FILE *f;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-b") == 0) {
+			bound = 1;
+		} else if (strcmp(argv[i], "-a") == 0) {
+			atlas = 1;
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			out = argv[++i];
+		} else if (argv[i][0] != '-' && !prefix) {
+			prefix = argv[i];
+		} else {
+			usage();
+		}
+	}
+	if (!prefix) {
+		usage();
+	}
+	snprintf(input, sizeof(input), "%s.lua", prefix);
+	snprintf(output, sizeof(output), "%s.pi", prefix);
+	if (out) {
+		snprintf(output, sizeof(output), "%s", out);
+	}
+
+	ps.file = input;
+	ps.p = load(input, &size);
+	ps.end = ps.p + size;
+	ps.line = 1;
+	word(&ps, "return");
+	parse_value(&ps, &root);
+	if (peek(&ps) == ';') {
+		ps.p++;
+	}
+	if (peek(&ps) != -1) {
+		syntax(&ps, "<eof> expected");
+	}
+
+	memset(&k, 0, sizeof(k));
+	read_pack(&k, tab(&root, "the pack"));
+	sort_pack(&k);
+
+	memset(&data, 0, sizeof(data));
+	if (k.matrix_n > 0) {
+		w16(&data, 0);
+		w8(&data, TYPE_MATRIX);
+		w32(&data, k.matrix_n);
+		for (i = 0; i < k.matrix_n * 6; i++) {
+			w32(&data, k.matrix[i / 6].m[i % 6]);
+		}
+		k.size += k.matrix_n * sizeof(struct matrix);
+	}
+	for (i = 0; i < k.order_n; i++) {
+		write_sprite(&k, &data, &k.sprite[k.order[i]]);
+	}
+	k.size += k.name_total;
+	k.size += sizeof(struct sprite_pack) + (k.maxid + 1) * (sizeof(void *) + sizeof(int)) + k.texture * sizeof(int);
+
+	memset(&section, 0, sizeof(section));
+	if (bound) {
+		write_bound(&k, &section);
+	}
+	if (atlas) {
+		int start = section.size;
+		if (!write_atlas(&k, &section, prefix)) {
+			section.size = start;
+		}
+	}
+
+	memset(&pi, 0, sizeof(pi));
+	for (i = 0; i < k.sprite_n; i++) {
+		export_n += k.sprite[i].export != 0;
+	}
+	w16(&pi, export_n);
+	w16(&pi, k.maxid);
+	w16(&pi, k.texture);
+	w32(&pi, k.size);
+	w32(&pi, data.size);
+	for (i = 0; i < k.sprite_n; i++) {
+		if (k.sprite[i].export) {
+			w16(&pi, k.sprite[i].id);
+			wstr(&pi, k.sprite[i].export);
+		}
+	}
+	wbytes(&pi, data.data, data.size);
+	if (section.size > 0) {
+		wbytes(&pi, section.data, section.size);
+	}
+
+	f = fopen(output, "wb");
+	if (!f || fwrite(pi.data, 1, pi.size, f) != (size_t)pi.size || fclose(f) != 0) {
+		fail("can't write %s", output);
+	}
+	printf("%s: %d sprites, %d matrices (%d inline), %d names, %d bytes, %d bytes of pack memory\n",
+		output, k.sprite_n, k.matrix_n, k.inline_n, k.name_n, pi.size, k.size);
+	return 0;
+}